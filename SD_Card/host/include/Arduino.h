@@ -0,0 +1,113 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core the shared modules use
+// (env:native in platformio.ini): String, Print/Stream, Serial on stdout and
+// the timing functions. Not a general Arduino emulation; main.cpp, which
+// needs WiFi, USB and the display, is not built for the host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+class String {
+ public:
+  String() {}
+  String(const char *s) : _s(s ? s : "") {}
+  String(const std::string &s) : _s(s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(int v) : _s(std::to_string(v)) {}
+  explicit String(unsigned v) : _s(std::to_string(v)) {}
+  explicit String(long v) : _s(std::to_string(v)) {}
+  explicit String(unsigned long v) : _s(std::to_string(v)) {}
+
+  const char *c_str() const { return _s.c_str(); }
+  unsigned int length() const { return (unsigned int)_s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  void reserve(unsigned int n) { _s.reserve(n); }
+
+  bool startsWith(const String &p) const { return _s.compare(0, p._s.size(), p._s) == 0; }
+  bool endsWith(const String &p) const {
+    return _s.size() >= p._s.size() && _s.compare(_s.size() - p._s.size(), p._s.size(), p._s) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const { return pos(_s.find(c, from)); }
+  int indexOf(const String &p, unsigned int from = 0) const { return pos(_s.find(p._s, from)); }
+  int lastIndexOf(char c) const { return pos(_s.rfind(c)); }
+  String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < _s.size() ? String(_s.substr(from, to - from)) : String();
+  }
+  long toInt() const { return strtol(_s.c_str(), nullptr, 10); }
+
+  char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+  String &operator+=(const String &o) { _s += o._s; return *this; }
+  String &operator+=(const char *o) { _s += o ? o : ""; return *this; }
+  String &operator+=(char c) { _s += c; return *this; }
+  bool operator==(const String &o) const { return _s == o._s; }
+  bool operator!=(const String &o) const { return _s != o._s; }
+  bool operator<(const String &o) const { return _s < o._s; }
+
+  friend String operator+(String a, const String &b) { return a += b; }
+  friend String operator+(String a, const char *b) { return a += b; }
+  friend String operator+(String a, char b) { return a += b; }
+
+ private:
+  static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+  std::string _s;
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n);
+
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t println(const char *s = "") { return print(s) + print("\n"); }
+  size_t println(const String &s) { return println(s.c_str()); }
+};
+
+// Stream reads go through read()/available()/peek() as on the device;
+// readBytes() and find() wait up to setTimeout() ms for more input.
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long ms) { _timeout = ms; }
+  size_t readBytes(char *buf, size_t n);
+  size_t readBytes(uint8_t *buf, size_t n) { return readBytes((char *)buf, n); }
+  bool find(const char *target);
+  bool find(char *target) { return find((const char *)target); }
+
+ protected:
+  int timedRead();
+
+  unsigned long _timeout = 1000;
+};
+
+// Serial is stdout; there is no input
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t *buf, size_t n) override { return fwrite(buf, 1, n, stdout); }
+  explicit operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
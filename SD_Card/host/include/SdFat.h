@@ -0,0 +1,161 @@
+#pragma once
+
+// Host stand-in for SdFat (env:native in platformio.ini).
+//
+// The volume is a directory on the workstation: File32 reads and writes real
+// files under it. card() is whatever BlockDevice begin() was given, normally
+// a FileBlockDevice over a disk image, and is what the MSC path and the raw
+// benchmark see. The two are not one file system: writing sectors of the
+// image doesn't change the files, and vice versa.
+//
+// What FAT-specific calls return:
+//  - preAllocate() reserves a run of the image's sectors for the file (bump
+//    allocated, wrapping), so contiguousRange()/isContiguous() behave as for
+//    a file on a fresh card and raw writes to that range stay inside it;
+//  - firstCluster() is a stable per-file number (0 for an empty file) but
+//    not a real cluster, and dbgFat() always fails;
+//  - a directory's raw entries (read() on an open directory) are one 32-byte
+//    record per entry, built from its name, size and inode, so checksums of
+//    them change when FAT's would. Not from the mtime: without a date
+//    callback (the firmware sets none) SdFat never touches an entry's dates.
+// File I/O is charged to the card latency model if one is set.
+
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include "Arduino.h"
+#include "block_device.h"
+#include "latency_block_device.h"
+
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+// SdFat's "seek to the end after opening"; not a host flag, stripped before open()
+#define O_AT_END 0x10000000
+#define FILE_READ O_RDONLY
+#define FILE_WRITE (O_RDWR | O_CREAT | O_AT_END)
+
+typedef int oflag_t;
+
+class SdFat;
+struct HostFile;
+
+class SdCard {
+ public:
+  uint32_t sectorCount() { return _dev ? _dev->sectorCount() : 0; }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) { return check(_dev && _dev->readSectors(sector, dst, count)); }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) {
+    return check(_dev && _dev->writeSectors(sector, src, count));
+  }
+  bool readSector(uint32_t sector, uint8_t *dst) { return readSectors(sector, dst, 1); }
+  bool writeSector(uint32_t sector, const uint8_t *src) { return writeSectors(sector, src, 1); }
+  bool syncBlocks() { return check(_dev && _dev->sync()); }
+  bool syncDevice() { return syncBlocks(); }
+  bool isBusy() { return false; }
+  // Nonzero once a command failed, like SD_CARD_ERROR_*
+  uint8_t errorCode() const { return _error; }
+
+ private:
+  friend class SdFat;
+  bool check(bool ok) {
+    if (!ok) _error = 1;
+    return ok;
+  }
+
+  BlockDevice *_dev = nullptr;
+  uint8_t _error = 0;
+};
+
+class File32 : public Stream {
+ public:
+  File32() {}
+
+  explicit operator bool() const { return isOpen(); }
+  bool isOpen() const;
+  bool isDirectory() const;
+  bool isDir() const { return isDirectory(); }
+  bool isFile() const { return isOpen() && !isDirectory(); }
+  void close();
+
+  // Directories
+  File32 openNextFile(oflag_t oflag = O_RDONLY);
+  void rewindDirectory();
+  size_t getName(char *name, size_t size);
+  uint16_t dirIndex() const;
+
+  uint32_t fileSize() const;
+  uint32_t size() const { return fileSize(); }
+  uint32_t curPosition() const;
+  uint32_t position() const { return curPosition(); }
+  bool seekSet(uint32_t pos);
+  bool seek(uint32_t pos) { return seekSet(pos); }
+  bool seekCur(int32_t offset) { return seekSet(curPosition() + offset); }
+  bool seekEnd(int32_t offset = 0) { return seekSet(fileSize() + offset); }
+
+  int read(void *buf, size_t n);
+  int read() override;
+  int peek() override;
+  int available() override;
+  size_t write(const void *buf, size_t n);
+  size_t write(const uint8_t *buf, size_t n) override { return write((const void *)buf, n); }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  bool truncate(uint32_t length);
+  bool truncate() { return truncate(curPosition()); }
+  bool sync();
+  bool flush() { return sync(); }
+
+  bool preAllocate(uint64_t length);
+  bool contiguousRange(uint32_t *bgnSector, uint32_t *endSector);
+  bool isContiguous() const;
+  uint32_t firstCluster() const;
+  bool getModifyDateTime(uint16_t *pdate, uint16_t *ptime);
+
+ private:
+  friend class SdFat;
+  std::shared_ptr<HostFile> _h;
+};
+
+class SdFat {
+ public:
+  // `root` is the directory that plays the volume, `card` the raw device
+  // (may be null: card() is then null too). `latency`, if set, is charged
+  // for file I/O; wrap `card` in a LatencyBlockDevice on the same model to
+  // delay the raw path as well.
+  bool begin(const char *root, BlockDevice *card, uint32_t bytesPerCluster = 32768, CardLatency *latency = nullptr);
+
+  SdCard *card() { return _card._dev ? &_card : nullptr; }
+  uint8_t sdErrorCode() { return _card._error; }
+  uint8_t fatType() const { return 32; }
+  uint32_t bytesPerCluster() const { return _clusterBytes; }
+  uint8_t sectorsPerCluster() const { return (uint8_t)(_clusterBytes / BLOCK_SIZE); }
+  uint32_t clusterCount() { return _card._dev ? _card._dev->sectorCount() / sectorsPerCluster() : 0; }
+  // No FAT to read: -1, as for a read error
+  int8_t dbgFat(uint32_t, uint32_t *) { return -1; }
+
+  File32 open(const char *path, oflag_t oflag = O_RDONLY);
+  bool exists(const char *path);
+  bool mkdir(const char *path, bool pFlag = true);
+  bool rename(const char *oldPath, const char *newPath);
+  bool remove(const char *path);
+  bool rmdir(const char *path);
+
+ private:
+  friend class File32;
+  struct Region {
+    uint32_t first;
+    uint32_t sectors;
+  };
+
+  std::string hostPath(const char *path) const;
+  bool reserve(const std::string &path, uint64_t bytes);
+  const Region *region(const std::string &path) const;
+  void charge(bool write, size_t bytes);
+
+  std::string _root;
+  SdCard _card;
+  uint32_t _clusterBytes = 32768;
+  CardLatency *_latency = nullptr;
+  // preAllocate()d files: their run of card sectors, by volume path
+  std::map<std::string, Region> _regions;
+  uint32_t _nextSector = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+// Host stand-in for the Arduino-ESP32 WiFiClient, as far as HttpBody uses it
+// (env:native): a connection that delivers the bytes queued with push(). Each
+// push() arrives as one piece and available() only counts the current one,
+// the way a socket reports what has come in so far. serverClose() ends the
+// connection once everything queued has been read.
+
+#include <deque>
+#include <string>
+#include "Arduino.h"
+
+class WiFiClient : public Stream {
+ public:
+  void push(const std::string &bytes) {
+    if (!bytes.empty()) _pieces.push_back(bytes);
+  }
+  void serverClose() { _closing = true; }
+
+  uint8_t connected() { return !(_closing && _pieces.empty()); }
+  void stop() {
+    _pieces.clear();
+    _closing = true;
+  }
+
+  int available() override { return _pieces.empty() ? 0 : (int)(_pieces.front().size() - _at); }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t *buf, size_t len) {
+    size_t n = (size_t)available();
+    if (n == 0) return -1;
+    if (len < n) n = len;
+    memcpy(buf, _pieces.front().data() + _at, n);
+    _at += n;
+    if (_at == _pieces.front().size()) {
+      _pieces.pop_front();
+      _at = 0;
+    }
+    return (int)n;
+  }
+  int peek() override { return available() ? (uint8_t)_pieces.front()[_at] : -1; }
+  size_t write(uint8_t) override { return 0; }
+
+ private:
+  std::deque<std::string> _pieces;
+  size_t _at = 0;
+  bool _closing = false;
+};
@@ -0,0 +1,86 @@
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+static std::chrono::steady_clock::time_point startTime() {
+  static const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  return t0;
+}
+
+unsigned long millis() {
+  using namespace std::chrono;
+  return (unsigned long)duration_cast<milliseconds>(steady_clock::now() - startTime()).count();
+}
+
+unsigned long micros() {
+  using namespace std::chrono;
+  return (unsigned long)duration_cast<microseconds>(steady_clock::now() - startTime()).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+size_t Print::write(const uint8_t *buf, size_t n) {
+  size_t done = 0;
+  while (done < n && write(buf[done])) done++;
+  return done;
+}
+
+size_t Print::printf(const char *fmt, ...) {
+  char small[128];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  if ((size_t)n < sizeof(small)) return write((const uint8_t *)small, n);
+  std::string big(n + 1, '\0');
+  va_start(ap, fmt);
+  vsnprintf(&big[0], big.size(), fmt, ap);
+  va_end(ap);
+  return write((const uint8_t *)big.data(), n);
+}
+
+int Stream::timedRead() {
+  unsigned long t0 = millis();
+  for (;;) {
+    int c = read();
+    if (c >= 0 || millis() - t0 >= _timeout) return c;
+    delay(1);
+  }
+}
+
+size_t Stream::readBytes(char *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    int c = timedRead();
+    if (c < 0) break;
+    buf[done++] = (char)c;
+  }
+  return done;
+}
+
+bool Stream::find(const char *target) {
+  size_t len = strlen(target);
+  if (len == 0) return true;
+  size_t matched = 0;
+  for (;;) {
+    int c = timedRead();
+    if (c < 0) return false;
+    if (c == target[matched]) {
+      if (++matched == len) return true;
+    } else {
+      // Restart, allowing this character to begin a new match
+      matched = c == target[0] ? 1 : 0;
+    }
+  }
+}
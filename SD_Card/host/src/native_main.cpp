@@ -0,0 +1,440 @@
+// Host harness for the card-side modules (env:native in platformio.ini).
+//
+// Runs the MSC data path, archive extraction, the file index walk, sync
+// planning and the SD benchmark on a workstation: a directory stands in for
+// the card's file system and a disk image for the raw card (see the SdFat
+// stand-in in host/include/SdFat.h), optionally slowed down to card speeds.
+//
+//   pio run -e native
+//   .pio/build/native/program [options] <command> [args]
+//
+// Options:
+//   --image <file>        raw card image (default card.img)
+//   --image-mb <n>        size to create it with if missing (default 256)
+//   --root <dir>          directory playing the volume (default card)
+//   --read-us <n>         latency per read command
+//   --write-us <n>        ... per write command
+//   --read-sector-us <n>  ... per sector read
+//   --write-sector-us <n> ... per sector written
+//   --stall-every <n>     every n-th write also stalls for --stall-us <n>
+//
+// Commands:
+//   msc [mb] [kb]         host-sized transfers (default 64 KB) through the
+//                         MSC callbacks and layers: sequential write/read of
+//                         mb MB (default 32) at 4 MB into the image, then
+//                         random 4 KB reads, and the callback stats
+//   walk                  rebuild, save and reload the file index
+//   unzip <archive> [dir] stream-extract a .zip or .sdb on the volume into
+//                         dir (default /)
+//   plan <manifest>       parse a manifest (a host file, read like the HTTP
+//                         body) and plan the sync against the volume
+//   bench [mb]            SD benchmark, scratch file of mb MB (default 4)
+//
+// The msc and bench commands write to the image.
+//
+// Left out of the unit test build (pio test -e native), whose tests in test/
+// bring their own main().
+
+#ifndef PIO_UNIT_TESTING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "Arduino.h"
+#include "SdFat.h"
+#include "cluster_writer.h"
+#include "file_block_device.h"
+#include "file_index.h"
+#include "latency_block_device.h"
+#include "manifest_parser.h"
+#include "msc_io.h"
+#include "read_ahead.h"
+#include "sd_bench.h"
+#include "sd_block_device.h"
+#include "sdb_stream.h"
+#include "sector_cache.h"
+#include "sync_plan.h"
+#include "write_combiner.h"
+#include "zip_stream.h"
+
+// The firmware's MSC layer defaults (main.cpp)
+static const size_t MSC_CACHE_SECTORS = 1024;
+static const size_t MSC_CACHE_MAX_RUN = 8;
+static const size_t MSC_READAHEAD_SECTORS = 512;
+static const size_t MSC_READAHEAD_CHUNK = 64;
+static const size_t MSC_WRITE_COMBINE_SECTORS = 256;
+static const uint32_t MSC_WRITE_IDLE_MS = 250;
+
+static const size_t FEED_BYTES = 32768;
+
+static SdFat sd;
+
+static double nowSec() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double mbps(uint64_t bytes, double sec) {
+  return sec > 0 ? bytes / (1024.0 * 1024.0) / sec : 0.0;
+}
+
+static int usage() {
+  fprintf(stderr,
+          "usage: program [--image f] [--image-mb n] [--root dir] [--read-us n] [--write-us n]\n"
+          "               [--read-sector-us n] [--write-sector-us n] [--stall-every n --stall-us n]\n"
+          "               msc [mb] [kb] | walk | unzip <archive> [dir] | plan <manifest> | bench [mb]\n");
+  return 2;
+}
+
+// --- msc ---
+
+// The callbacks' layer stack, as init_usb() builds it; read-ahead prefetches
+// inline since there is no second core to run the worker on
+struct MscLayers {
+  SectorCache cache;
+  ReadAhead readAhead;
+  WriteCombiner combiner;
+
+  explicit MscLayers(BlockDevice &card) : cache(card), readAhead(cache), combiner(readAhead) {
+    cache.begin(MSC_CACHE_SECTORS, SectorCache::WRITE_THROUGH, MSC_CACHE_MAX_RUN);
+    readAhead.begin(MSC_READAHEAD_SECTORS, MSC_READAHEAD_CHUNK);
+    combiner.begin(MSC_WRITE_COMBINE_SECTORS, MSC_WRITE_IDLE_MS);
+  }
+
+  void printStats() {
+    SectorCache::Stats st = cache.stats();
+    ReadAhead::Stats ra = readAhead.stats();
+    WriteCombiner::Stats wc = combiner.stats();
+    printf("cache: %u hits, %u misses, %u evictions, %u bypassed\n", (unsigned)st.hits, (unsigned)st.misses,
+           (unsigned)st.evictions, (unsigned)st.bypassSectors);
+    printf("read-ahead: %u streams, %u/%u sectors from RAM, %u prefetched, %u wasted\n", (unsigned)ra.streams,
+           (unsigned)ra.hitSectors, (unsigned)ra.readSectors, (unsigned)ra.prefetchedSectors,
+           (unsigned)ra.wastedSectors);
+    printf("writes: %u host writes (%u merged) -> %u card writes, %u RMW sectors\n", (unsigned)wc.hostWrites,
+           (unsigned)wc.mergedWrites, (unsigned)wc.flushes, (unsigned)wc.rmwSectors);
+  }
+};
+
+// What the benchmark's "msc" path runs through (MscCallbackDevice in main.cpp)
+class MscCallbackDevice : public BlockDevice {
+ public:
+  explicit MscCallbackDevice(MscLayers &layers) : _layers(layers) {}
+
+  uint32_t sectorCount() override { return _layers.combiner.sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override {
+    return mscRead(_layers.combiner, sector, 0, dst, count * BLOCK_SIZE) == (int32_t)(count * BLOCK_SIZE);
+  }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    return mscWrite(_layers.combiner, sector, 0, src, count * BLOCK_SIZE) == (int32_t)(count * BLOCK_SIZE);
+  }
+  bool sync() override { return _layers.combiner.sync(); }
+
+ private:
+  MscLayers &_layers;
+};
+
+static int runMsc(BlockDevice &card, uint32_t mb, uint32_t kb) {
+  const uint32_t start = 8192;
+  uint32_t chunk = kb * 1024;
+  uint32_t sectors = mb * 1024 * 1024 / BLOCK_SIZE;
+  if (chunk == 0 || chunk % BLOCK_SIZE || sectors < 8 || start + sectors > card.sectorCount()) {
+    fprintf(stderr, "msc: %u MB at sector %u doesn't fit the image (%u sectors)\n", (unsigned)mb,
+            (unsigned)start, (unsigned)card.sectorCount());
+    return 1;
+  }
+  MscLayers layers(card);
+  MscStats stats;
+  // Big enough for the random 4 KB reads too
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[std::max<uint32_t>(chunk, 4096)]);
+  for (uint32_t i = 0; i < chunk; i++) buf[i] = (uint8_t)(i * 7 + 1);
+  uint32_t per = chunk / BLOCK_SIZE;
+
+  double t0 = nowSec();
+  for (uint32_t s = 0; s + per <= sectors; s += per) {
+    if (mscWrite(layers.combiner, start + s, 0, buf.get(), chunk, &stats) < 0) return 1;
+  }
+  if (!layers.combiner.sync()) return 1;
+  double t1 = nowSec();
+  printf("msc seq write %u KB: %.2f MB/s\n", (unsigned)kb, mbps((uint64_t)sectors * BLOCK_SIZE, t1 - t0));
+
+  for (uint32_t s = 0; s + per <= sectors; s += per) {
+    if (mscRead(layers.combiner, start + s, 0, buf.get(), chunk, &stats) < 0) return 1;
+  }
+  double t2 = nowSec();
+  printf("msc seq read  %u KB: %.2f MB/s\n", (unsigned)kb, mbps((uint64_t)sectors * BLOCK_SIZE, t2 - t1));
+
+  const uint32_t ops = 1000;
+  uint32_t rng = 1;
+  for (uint32_t i = 0; i < ops; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    if (mscRead(layers.combiner, start + (rng % (sectors / 8)) * 8, 0, buf.get(), 4096, &stats) < 0) return 1;
+  }
+  double t3 = nowSec();
+  printf("msc rand read 4 KB: %.0f IOPS\n", (t3 - t2) > 0 ? ops / (t3 - t2) : 0.0);
+  layers.printStats();
+  MscStats::dump(stats.snapshot(), [](const char *line) { printf("%s\n", line); });
+  return 0;
+}
+
+// --- walk ---
+
+static int runWalk() {
+  FileIndex index(sd);
+  double t0 = nowSec();
+  if (!index.rebuild()) {
+    fprintf(stderr, "walk: can't walk the volume\n");
+    return 1;
+  }
+  double t1 = nowSec();
+  bool saved = index.save();
+  double t2 = nowSec();
+  FileIndex again(sd);
+  bool ok = again.begin();
+  double t3 = nowSec();
+  ok = ok && again.check("/");
+  double t4 = nowSec();
+  printf("walk: %u entries, rebuild %.1f ms, save %.1f ms (%s), load %.1f ms + check all %.1f ms (%s)\n",
+         (unsigned)index.entries().size(), (t1 - t0) * 1e3, (t2 - t1) * 1e3, saved ? "ok" : "FAILED",
+         (t3 - t2) * 1e3, (t4 - t3) * 1e3, !ok ? "FAILED" : again.rebuilt() ? "rebuilt" : "valid");
+  return saved && ok ? 0 : 1;
+}
+
+// --- unzip ---
+
+static int runUnzip(const char *archive, const char *dest) {
+  File32 in = sd.open(archive, O_RDONLY);
+  if (!in) {
+    fprintf(stderr, "unzip: can't open %s\n", archive);
+    return 1;
+  }
+  std::unique_ptr<StreamExtractor> ex;
+  if (String(archive).endsWith(".sdb")) ex.reset(new SdbStreamExtractor());
+  else ex.reset(new ZipStreamExtractor());
+
+  std::string root = dest;
+  if (root.empty() || root.back() != '/') root += "/";
+  File32 out;
+  std::unique_ptr<ClusterWriter> writer;
+  std::string outPath;
+  uint32_t preallocated = 0;
+  uint32_t failed = 0;
+
+  StreamExtractor::Target target;
+  target.dir = [&](const std::string &name) {
+    std::string dir = root + name;
+    return sd.exists(dir.c_str()) || sd.mkdir(dir.c_str());
+  };
+  target.open = [&](const std::string &name, uint64_t size) {
+    outPath = root + name;
+    size_t slash = outPath.rfind('/');
+    if (slash > 0) {
+      std::string parent = outPath.substr(0, slash);
+      if (!sd.exists(parent.c_str())) sd.mkdir(parent.c_str());
+    }
+    out = sd.open(outPath.c_str(), O_CREAT | O_WRITE | O_TRUNC);
+    if (!out) return false;
+    writer.reset(new ClusterWriter(sd, out));
+    if (size && writer->preallocate(size)) preallocated++;
+    return true;
+  };
+  target.write = [&](const uint8_t *data, size_t len) { return writer->write(data, len); };
+  target.close = [&](bool ok) {
+    if (!writer->finish()) ok = false;
+    out.close();
+    if (!ok) {
+      failed++;
+      sd.remove(outPath.c_str());
+    }
+  };
+
+  if (!ex->begin(target)) return 1;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[FEED_BYTES]);
+  double t0 = nowSec();
+  bool ok = true;
+  int n;
+  while (ok && !ex->done() && (n = in.read(buf.get(), FEED_BYTES)) > 0) ok = ex->feed(buf.get(), (size_t)n);
+  double t1 = nowSec();
+  StreamExtractor::Stats st = ex->stats();
+  if (!ok || !ex->done()) {
+    fprintf(stderr, "unzip: %s\n", ex->error() ? ex->error() : "archive ends early");
+    ok = false;
+  }
+  printf("unzip: %u files, %u dirs, %u skipped, %u failed, %u preallocated; %.1f MB in, %.1f MB out, %.2f MB/s\n",
+         (unsigned)st.files, (unsigned)st.dirs, (unsigned)st.skipped, (unsigned)failed, (unsigned)preallocated,
+         st.inBytes / 1048576.0, st.outBytes / 1048576.0, mbps(st.outBytes, t1 - t0));
+  ex->end();
+  return ok && failed == 0 ? 0 : 1;
+}
+
+// --- plan ---
+
+// The manifest from memory, as the HTTP body arrives: available() is what
+// is left, so the parser never waits
+class MemoryStream : public Stream {
+ public:
+  explicit MemoryStream(std::string data) : _data(std::move(data)) {}
+
+  int available() override { return (int)(_data.size() - _pos); }
+  int read() override { return _pos < _data.size() ? (uint8_t)_data[_pos++] : -1; }
+  int peek() override { return _pos < _data.size() ? (uint8_t)_data[_pos] : -1; }
+  size_t write(uint8_t) override { return 0; }
+
+ private:
+  std::string _data;
+  size_t _pos = 0;
+};
+
+static int runPlan(const char *manifestPath) {
+  FILE *fp = fopen(manifestPath, "rb");
+  if (!fp) {
+    fprintf(stderr, "plan: can't open %s\n", manifestPath);
+    return 1;
+  }
+  std::string data;
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) data.append(chunk, n);
+  fclose(fp);
+
+  double t0 = nowSec();
+  FileIndex index(sd);
+  if (!index.begin()) {
+    fprintf(stderr, "plan: can't walk the volume\n");
+    return 1;
+  }
+  index.check("/");
+  SyncState state(sd);
+  state.load();
+  double t1 = nowSec();
+
+  MemoryStream body(data);
+  body.setTimeout(0);
+  SyncPlanner planner(sd, state, index, true);
+  if (!planner.begin()) {
+    fprintf(stderr, "plan: can't create the plan spool\n");
+    return 1;
+  }
+  ManifestStats ms;
+  String error;
+  bool parsed = parseManifest(body, [&](const ManifestItem &item) { planner.add(item); }, &ms, &error);
+  SyncPlan plan = planner.finish();
+  double t2 = nowSec();
+  plan.close();
+  sd.remove(plan.spoolPath());
+  if (!parsed) {
+    fprintf(stderr, "plan: manifest: %s\n", error.c_str());
+    return 1;
+  }
+
+  printf("plan: index %u entries (%s), state %u entries, %.1f ms\n", (unsigned)index.entries().size(),
+         index.rebuilt() ? "rebuilt" : "loaded", (unsigned)state.entries().size(), (t1 - t0) * 1e3);
+  printf("plan: %u items, %u skipped, parsed and planned in %.1f ms\n", (unsigned)ms.items,
+         (unsigned)ms.skipped, (t2 - t1) * 1e3);
+  for (int k = 0; k < SyncAction::KIND_COUNT; k++) {
+    printf("  %-7s %u\n", syncActionName((SyncAction::Kind)k), (unsigned)plan.counts[k]);
+  }
+  printf("  download %.1f MB (%u of unknown size)\n", plan.downloadBytes / 1048576.0, (unsigned)plan.unknownSize);
+  if (plan.duplicates) printf("  %u duplicate paths, last one kept\n", (unsigned)plan.duplicates);
+  if (index.dirty()) index.save();
+  return 0;
+}
+
+// --- bench ---
+
+static int runBench(uint32_t mb) {
+  SdBlockDevice raw(sd);
+  MscLayers layers(raw);
+  MscCallbackDevice msc(layers);
+  SdBench::Config cfg;
+  cfg.fileBytes = mb * 1024 * 1024;
+  cfg.raw = &raw;
+  cfg.msc = &msc;
+
+  SdBench bench(sd);
+  bool ok = bench.run("/.sd_bench.tmp", cfg, [](const SdBench::Result &r) {
+    printf("%-4s %-10s %6lu B: %8.2f MB/s %8.1f IOPS, latency p50 %lu p90 %lu p99 %lu max %lu us\n", r.path, r.test,
+           (unsigned long)r.bufBytes, r.mbps(), r.iops(), (unsigned long)r.p50Us, (unsigned long)r.p90Us,
+           (unsigned long)r.p99Us, (unsigned long)r.maxUs);
+  });
+  if (!ok) {
+    fprintf(stderr, "bench: failed (image too small for the scratch file?)\n");
+    return 1;
+  }
+  SdBench::Summary prev;
+  bool had = SdBench::loadSummary(sd, "/.sd_bench", &prev);
+  SdBench::Summary s = bench.summarize(had ? &prev : nullptr);
+  SdBench::saveSummary(sd, "/.sd_bench", s);
+  bench.appendCsv("/.sd_bench.csv", s.run);
+  printf("run %lu: W %.2f R %.2f MB/s, 4K %.0f/%.0f IOPS\n", (unsigned long)s.run, s.seqWrite, s.seqRead,
+         s.randWrite, s.randRead);
+  return 0;
+}
+
+// --- main ---
+
+static bool createImage(const char *path, uint32_t mb) {
+  struct stat st;
+  if (stat(path, &st) == 0) return true;
+  FILE *fp = fopen(path, "wb");
+  if (!fp) return false;
+  bool ok = ftruncate(fileno(fp), (off_t)mb * 1024 * 1024) == 0;
+  return fclose(fp) == 0 && ok;
+}
+
+int main(int argc, char **argv) {
+  const char *image = "card.img";
+  const char *root = "card";
+  uint32_t imageMb = 256;
+  CardLatency latency;
+
+  int i = 1;
+  for (; i < argc && !strncmp(argv[i], "--", 2); i++) {
+    if (i + 1 >= argc) return usage();
+    const char *opt = argv[i];
+    const char *val = argv[++i];
+    uint32_t n = (uint32_t)strtoul(val, nullptr, 0);
+    if (!strcmp(opt, "--image")) image = val;
+    else if (!strcmp(opt, "--image-mb")) imageMb = n;
+    else if (!strcmp(opt, "--root")) root = val;
+    else if (!strcmp(opt, "--read-us")) latency.readUs = n;
+    else if (!strcmp(opt, "--write-us")) latency.writeUs = n;
+    else if (!strcmp(opt, "--read-sector-us")) latency.readSectorUs = n;
+    else if (!strcmp(opt, "--write-sector-us")) latency.writeSectorUs = n;
+    else if (!strcmp(opt, "--stall-every")) latency.stallEvery = n;
+    else if (!strcmp(opt, "--stall-us")) latency.stallUs = n;
+    else return usage();
+  }
+  if (i >= argc) return usage();
+  std::string cmd = argv[i++];
+  const char *arg1 = i < argc ? argv[i] : nullptr;
+  const char *arg2 = i + 1 < argc ? argv[i + 1] : nullptr;
+
+  FileBlockDevice file;
+  if (!createImage(image, imageMb) || !file.open(image)) {
+    fprintf(stderr, "can't open card image %s\n", image);
+    return 1;
+  }
+  LatencyBlockDevice slow(file, latency);
+  BlockDevice &card = latency.enabled() ? (BlockDevice &)slow : (BlockDevice &)file;
+  mkdir(root, 0755);
+  if (!sd.begin(root, &card, 32768, latency.enabled() ? &latency : nullptr)) {
+    fprintf(stderr, "can't use %s as the volume\n", root);
+    return 1;
+  }
+
+  if (cmd == "msc") return runMsc(card, arg1 ? atoi(arg1) : 32, arg2 ? atoi(arg2) : 64);
+  if (cmd == "walk") return runWalk();
+  if (cmd == "unzip" && arg1) return runUnzip(arg1, arg2 ? arg2 : "/");
+  if (cmd == "plan" && arg1) return runPlan(arg1);
+  if (cmd == "bench") return runBench(arg1 ? atoi(arg1) : 4);
+  return usage();
+}
+#endif
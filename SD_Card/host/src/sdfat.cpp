@@ -0,0 +1,360 @@
+#include "SdFat.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+// preAllocate() runs start past the first 4 MB, where a card image keeps
+// its partition table and FAT
+static const uint32_t RESERVE_START = 8192;
+static const size_t DIR_RECORD = 32;
+
+struct HostFile {
+  SdFat *fs = nullptr;
+  std::string path;  // volume path, "/" for the root
+  std::string host;
+  int fd = -1;
+  bool dir = false;
+  uint16_t index = 0;  // position in the parent's listing
+
+  // Directories: the entries as of open(), and their raw records
+  std::vector<std::string> names;
+  size_t next = 0;
+  std::string raw;
+  size_t rawPos = 0;
+
+  ~HostFile() {
+    if (fd >= 0) ::close(fd);
+  }
+};
+
+static std::string volumePath(const char *path) {
+  std::string p = path && path[0] == '/' ? path : std::string("/") + (path ? path : "");
+  while (p.size() > 1 && p.back() == '/') p.pop_back();
+  return p;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+// FNV-1a: stands in for the 8.3/long name bytes of a FAT entry
+static uint32_t nameHash(const std::string &name) {
+  uint32_t h = 2166136261u;
+  for (unsigned char c : name) h = (h ^ c) * 16777619u;
+  return h;
+}
+
+// --- SdFat ---
+
+bool SdFat::begin(const char *root, BlockDevice *card, uint32_t bytesPerCluster, CardLatency *latency) {
+  struct stat st;
+  if (!root || stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+  if (bytesPerCluster < BLOCK_SIZE || bytesPerCluster % BLOCK_SIZE) return false;
+  _root = root;
+  while (_root.size() > 1 && _root.back() == '/') _root.pop_back();
+  _card._dev = card;
+  _card._error = 0;
+  _clusterBytes = bytesPerCluster;
+  _latency = latency;
+  _regions.clear();
+  _nextSector = RESERVE_START;
+  return true;
+}
+
+std::string SdFat::hostPath(const char *path) const {
+  std::string v = volumePath(path);
+  return v == "/" ? _root : _root + v;
+}
+
+void SdFat::charge(bool write, size_t bytes) {
+  if (_latency && bytes) _latency->charge(write, (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+bool SdFat::reserve(const std::string &path, uint64_t bytes) {
+  uint32_t count = card() ? _card._dev->sectorCount() : 0;
+  uint32_t spc = sectorsPerCluster();
+  uint64_t sectors = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  sectors = (sectors + spc - 1) / spc * spc;
+  if (sectors == 0 || RESERVE_START + sectors > count) return false;
+  if (_nextSector + sectors > count) _nextSector = RESERVE_START;
+  _regions[path] = Region{_nextSector, (uint32_t)sectors};
+  _nextSector += (uint32_t)sectors;
+  return true;
+}
+
+const SdFat::Region *SdFat::region(const std::string &path) const {
+  auto it = _regions.find(path);
+  return it == _regions.end() ? nullptr : &it->second;
+}
+
+File32 SdFat::open(const char *path, oflag_t oflag) {
+  File32 f;
+  std::shared_ptr<HostFile> h = std::make_shared<HostFile>();
+  h->fs = this;
+  h->path = volumePath(path);
+  h->host = hostPath(path);
+
+  struct stat st;
+  if (stat(h->host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    if ((oflag & O_ACCMODE) != O_RDONLY) return f;
+    DIR *d = opendir(h->host.c_str());
+    if (!d) return f;
+    while (struct dirent *e = readdir(d)) {
+      if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) h->names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(h->names.begin(), h->names.end());
+    for (const std::string &name : h->names) {
+      struct stat es;
+      if (stat((h->host + "/" + name).c_str(), &es) != 0) continue;
+      uint8_t rec[DIR_RECORD] = {};
+      put32(rec, nameHash(name));
+      put32(rec + 4, (uint32_t)es.st_size);
+      put32(rec + 8, (uint32_t)es.st_ino);
+      rec[16] = S_ISDIR(es.st_mode) ? 1 : 0;
+      h->raw.append((const char *)rec, sizeof(rec));
+    }
+    h->dir = true;
+    f._h = h;
+    return f;
+  }
+
+  h->fd = ::open(h->host.c_str(), oflag & ~O_AT_END, 0644);
+  if (h->fd < 0) return f;
+  if (oflag & O_AT_END) lseek(h->fd, 0, SEEK_END);
+  f._h = h;
+  return f;
+}
+
+bool SdFat::exists(const char *path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool SdFat::mkdir(const char *path, bool pFlag) {
+  std::string v = volumePath(path);
+  if (pFlag) {
+    for (size_t i = v.find('/', 1); i != std::string::npos; i = v.find('/', i + 1)) {
+      std::string parent = _root + v.substr(0, i);
+      if (::mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+  }
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool SdFat::rename(const char *oldPath, const char *newPath) {
+  // SdFat doesn't replace an existing entry
+  if (exists(newPath)) return false;
+  if (::rename(hostPath(oldPath).c_str(), hostPath(newPath).c_str()) != 0) return false;
+  std::string from = volumePath(oldPath);
+  std::string to = volumePath(newPath);
+  std::map<std::string, Region> moved;
+  for (auto it = _regions.begin(); it != _regions.end();) {
+    const std::string &p = it->first;
+    if (p == from || (p.size() > from.size() && p.compare(0, from.size(), from) == 0 && p[from.size()] == '/')) {
+      moved[to + p.substr(from.size())] = it->second;
+      it = _regions.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  _regions.insert(moved.begin(), moved.end());
+  return true;
+}
+
+bool SdFat::remove(const char *path) {
+  struct stat st;
+  std::string host = hostPath(path);
+  if (stat(host.c_str(), &st) != 0 || S_ISDIR(st.st_mode)) return false;
+  if (unlink(host.c_str()) != 0) return false;
+  _regions.erase(volumePath(path));
+  return true;
+}
+
+bool SdFat::rmdir(const char *path) {
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+// --- File32 ---
+
+bool File32::isOpen() const {
+  return _h != nullptr;
+}
+
+bool File32::isDirectory() const {
+  return _h && _h->dir;
+}
+
+void File32::close() {
+  _h.reset();
+}
+
+File32 File32::openNextFile(oflag_t oflag) {
+  while (_h && _h->dir && _h->next < _h->names.size()) {
+    size_t i = _h->next++;
+    std::string child = (_h->path == "/" ? "" : _h->path) + "/" + _h->names[i];
+    File32 f = _h->fs->open(child.c_str(), oflag);
+    if (f) {
+      f._h->index = (uint16_t)i;
+      return f;
+    }
+  }
+  return File32();
+}
+
+void File32::rewindDirectory() {
+  if (!_h || !_h->dir) return;
+  _h->next = 0;
+  _h->rawPos = 0;
+}
+
+size_t File32::getName(char *name, size_t size) {
+  if (!_h || size == 0) return 0;
+  std::string base = _h->path == "/" ? "/" : _h->path.substr(_h->path.rfind('/') + 1);
+  snprintf(name, size, "%s", base.c_str());
+  return std::min(base.size(), size - 1);
+}
+
+uint16_t File32::dirIndex() const {
+  return _h ? _h->index : 0;
+}
+
+uint32_t File32::fileSize() const {
+  struct stat st;
+  if (!_h || _h->dir || fstat(_h->fd, &st) != 0) return 0;
+  return (uint32_t)st.st_size;
+}
+
+uint32_t File32::curPosition() const {
+  if (!_h) return 0;
+  if (_h->dir) return (uint32_t)_h->rawPos;
+  off_t pos = lseek(_h->fd, 0, SEEK_CUR);
+  return pos < 0 ? 0 : (uint32_t)pos;
+}
+
+bool File32::seekSet(uint32_t pos) {
+  if (!_h) return false;
+  if (_h->dir) {
+    if (pos > _h->raw.size()) return false;
+    _h->rawPos = pos;
+    return true;
+  }
+  // SdFat can't seek past the end of a file
+  if (pos > fileSize()) return false;
+  return lseek(_h->fd, pos, SEEK_SET) == (off_t)pos;
+}
+
+int File32::read(void *buf, size_t n) {
+  if (!_h) return -1;
+  if (_h->dir) {
+    size_t take = std::min(n, _h->raw.size() - _h->rawPos);
+    memcpy(buf, _h->raw.data() + _h->rawPos, take);
+    _h->rawPos += take;
+    return (int)take;
+  }
+  size_t done = 0;
+  while (done < n) {
+    ssize_t got = ::read(_h->fd, (uint8_t *)buf + done, n - done);
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) return -1;
+    if (got == 0) break;
+    done += (size_t)got;
+  }
+  _h->fs->charge(false, done);
+  return (int)done;
+}
+
+int File32::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File32::peek() {
+  uint32_t pos = curPosition();
+  int c = read();
+  if (c >= 0) seekSet(pos);
+  return c;
+}
+
+int File32::available() {
+  if (!_h) return 0;
+  uint32_t size = _h->dir ? (uint32_t)_h->raw.size() : fileSize();
+  uint32_t pos = curPosition();
+  return pos < size ? (int)std::min<uint32_t>(size - pos, INT_MAX) : 0;
+}
+
+size_t File32::write(const void *buf, size_t n) {
+  if (!_h || _h->dir) return 0;
+  size_t done = 0;
+  while (done < n) {
+    ssize_t put = ::write(_h->fd, (const uint8_t *)buf + done, n - done);
+    if (put < 0 && errno == EINTR) continue;
+    if (put <= 0) break;
+    done += (size_t)put;
+  }
+  _h->fs->charge(true, done);
+  return done;
+}
+
+bool File32::truncate(uint32_t length) {
+  if (!_h || _h->dir) return false;
+  if (ftruncate(_h->fd, length) != 0) return false;
+  return lseek(_h->fd, length, SEEK_SET) == (off_t)length;
+}
+
+bool File32::sync() {
+  // Page cache only: a host fsync() would time the workstation's disk
+  return _h != nullptr;
+}
+
+bool File32::preAllocate(uint64_t length) {
+  // As on FAT: only for an empty file open for writing
+  if (!_h || _h->dir || length == 0 || fileSize() != 0) return false;
+  if (!_h->fs->reserve(_h->path, length)) return false;
+  if (ftruncate(_h->fd, (off_t)length) != 0) {
+    _h->fs->_regions.erase(_h->path);
+    return false;
+  }
+  return true;
+}
+
+bool File32::contiguousRange(uint32_t *bgnSector, uint32_t *endSector) {
+  const SdFat::Region *r = _h ? _h->fs->region(_h->path) : nullptr;
+  if (!r) return false;
+  if (bgnSector) *bgnSector = r->first;
+  if (endSector) *endSector = r->first + r->sectors - 1;
+  return true;
+}
+
+bool File32::isContiguous() const {
+  return _h && _h->fs->region(_h->path);
+}
+
+uint32_t File32::firstCluster() const {
+  if (!_h) return 0;
+  if (const SdFat::Region *r = _h->fs->region(_h->path)) return 2 + r->first / _h->fs->sectorsPerCluster();
+  struct stat st;
+  if (stat(_h->host.c_str(), &st) != 0) return 0;
+  if (!S_ISDIR(st.st_mode) && st.st_size == 0) return 0;
+  return 2 + (uint32_t)(st.st_ino % 0x0FFFFFF0);
+}
+
+bool File32::getModifyDateTime(uint16_t *pdate, uint16_t *ptime) {
+  struct stat st;
+  struct tm tm;
+  if (!_h || stat(_h->host.c_str(), &st) != 0 || !localtime_r(&st.st_mtime, &tm)) return false;
+  int year = tm.tm_year + 1900;
+  if (year < 1980) year = 1980;
+  *pdate = (uint16_t)(((year - 1980) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+  *ptime = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+  return true;
+}
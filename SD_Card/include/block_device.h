@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint32_t BLOCK_SIZE = 512;
+
+// Sector-addressed storage. The USB MSC data path is built as a stack of these
+// (cache, read-ahead, ...) on top of the SD card, so every layer can also be
+// exercised against a plain file on a Linux host.
+class BlockDevice {
+ public:
+  virtual ~BlockDevice() {}
+
+  virtual uint32_t sectorCount() = 0;
+  virtual bool readSectors(uint32_t sector, uint8_t *dst, size_t count) = 0;
+  virtual bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) = 0;
+  // Push any buffered data down to the medium.
+  virtual bool sync() = 0;
+};
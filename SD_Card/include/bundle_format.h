@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// .sdb bundle layout, shared by the firmware and the host tool
+// (tools/sdbundle.cpp). A bundle is a fixed-size table of contents followed
+// by the payloads, each starting on an `align` boundary (512 at least, the
+// card's cluster size for best results):
+//
+//   [header, 64 bytes][count x 256-byte records][pad]
+//   [payload 0][pad][payload 1][pad]...
+//
+// Records list every file and directory in payload order with its offset,
+// size, CRC32, optional SHA-256 and target path, so the reader knows
+// everything before the first payload byte arrives: no local headers, no
+// central directory, no guessing sizes. All integers are little-endian.
+
+static const char SDB_MAGIC[8] = {'S', 'D', 'B', 'U', 'N', 'D', 'L', '1'};
+static const uint32_t SDB_VERSION = 1;
+static const size_t SDB_HEADER_SIZE = 64;
+static const size_t SDB_RECORD_SIZE = 256;
+static const size_t SDB_PATH_MAX = 200;  // including the NUL
+static const uint32_t SDB_MIN_ALIGN = 512;
+
+static const uint32_t SDB_FLAG_DIR = 1 << 0;
+static const uint32_t SDB_FLAG_SHA256 = 1 << 1;  // sha256 field is set
+
+struct SdbHeader {
+  uint32_t version;
+  uint32_t align;      // payload alignment, a power of two >= SDB_MIN_ALIGN
+  uint32_t count;      // records
+  uint32_t tocCrc;     // CRC32 of the records
+  uint64_t dataStart;  // offset of the first payload
+  uint64_t totalSize;  // bundle size in bytes
+};
+
+struct SdbRecord {
+  uint64_t offset;  // from the start of the bundle, `align`ed
+  uint64_t size;
+  uint32_t crc32;
+  uint32_t flags;
+  uint8_t sha256[32];
+  char path[SDB_PATH_MAX];  // relative, '/' separated, NUL padded
+};
+
+inline uint64_t sdbAlignUp(uint64_t v, uint32_t align) { return (v + align - 1) & ~(uint64_t)(align - 1); }
+
+inline void sdbPut32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+inline void sdbPut64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+inline uint32_t sdbGet32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline uint64_t sdbGet64(const uint8_t *p) { return (uint64_t)sdbGet32(p) | ((uint64_t)sdbGet32(p + 4) << 32); }
+
+inline void sdbEncodeHeader(const SdbHeader &h, uint8_t *out) {
+  memset(out, 0, SDB_HEADER_SIZE);
+  memcpy(out, SDB_MAGIC, 8);
+  sdbPut32(out + 8, h.version);
+  sdbPut32(out + 12, h.align);
+  sdbPut32(out + 16, h.count);
+  sdbPut32(out + 20, h.tocCrc);
+  sdbPut64(out + 24, h.dataStart);
+  sdbPut64(out + 32, h.totalSize);
+}
+
+// False if it isn't a bundle header this version can read
+inline bool sdbDecodeHeader(const uint8_t *in, SdbHeader *h) {
+  if (memcmp(in, SDB_MAGIC, 8) != 0) return false;
+  h->version = sdbGet32(in + 8);
+  h->align = sdbGet32(in + 12);
+  h->count = sdbGet32(in + 16);
+  h->tocCrc = sdbGet32(in + 20);
+  h->dataStart = sdbGet64(in + 24);
+  h->totalSize = sdbGet64(in + 32);
+  if (h->version != SDB_VERSION) return false;
+  if (h->align < SDB_MIN_ALIGN || (h->align & (h->align - 1))) return false;
+  return h->dataStart >= SDB_HEADER_SIZE + (uint64_t)h->count * SDB_RECORD_SIZE && h->dataStart <= h->totalSize;
+}
+
+inline void sdbEncodeRecord(const SdbRecord &r, uint8_t *out) {
+  memset(out, 0, SDB_RECORD_SIZE);
+  sdbPut64(out, r.offset);
+  sdbPut64(out + 8, r.size);
+  sdbPut32(out + 16, r.crc32);
+  sdbPut32(out + 20, r.flags);
+  memcpy(out + 24, r.sha256, 32);
+  memcpy(out + 56, r.path, SDB_PATH_MAX);
+  out[56 + SDB_PATH_MAX - 1] = 0;
+}
+
+inline void sdbDecodeRecord(const uint8_t *in, SdbRecord *r) {
+  r->offset = sdbGet64(in);
+  r->size = sdbGet64(in + 8);
+  r->crc32 = sdbGet32(in + 16);
+  r->flags = sdbGet32(in + 20);
+  memcpy(r->sha256, in + 24, 32);
+  memcpy(r->path, in + 56, SDB_PATH_MAX);
+  r->path[SDB_PATH_MAX - 1] = 0;
+}
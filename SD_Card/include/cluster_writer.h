@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SdFat.h"
+
+// Writes a file in whole clusters, into space allocated up front.
+//
+// Growing a file with small writes makes SdFat extend the FAT chain one
+// cluster at a time, interleaved with whatever else is being written, and
+// the file ends up fragmented: slower to write, and slower for the MSC host
+// to play back later. When the final size is known, preallocate() reserves
+// one contiguous run (SdFat then writes without touching the FAT at all),
+// and write() hands the card only cluster-aligned multi-sector chunks,
+// buffering the unaligned head/tail in one cluster-sized buffer. Writes that
+// are already aligned (the download pipeline's buffers) go straight through.
+class ClusterWriter {
+ public:
+  ClusterWriter(SdFat &fs, File32 &file);
+  ~ClusterWriter();
+
+  // Reserve `size` bytes of contiguous clusters. The file must be empty.
+  // False (and the file unchanged) if the card has no run that long.
+  bool preallocate(uint64_t size);
+  bool preallocated() const { return _prealloc != 0; }
+
+  bool write(const uint8_t *data, size_t len);
+  // Writes of this many bytes (or multiples), starting from an aligned
+  // position, skip the buffer
+  size_t cluster() const { return _cluster; }
+  // Bytes handed to the file so far (excludes the buffered tail)
+  uint64_t onFile() const { return _pos; }
+  // Write the buffered tail and give back preallocated space not used
+  bool finish();
+
+ private:
+  bool writeDirect(const uint8_t *data, size_t len);
+
+  SdFat &_fs;
+  File32 &_file;
+  size_t _cluster;
+  uint8_t *_buf = nullptr;
+  size_t _fill = 0;
+  uint64_t _pos;           // file offset of _buf[0]
+  uint64_t _prealloc = 0;  // bytes reserved by preallocate()
+  bool _ok = true;
+};
+
+// Fragment counts in the download/extraction logs. Off by default: walking
+// the FAT goes through SdFat's dbgFat(), a debug interface.
+#ifndef CLUSTER_FRAGMENT_STATS
+#define CLUSTER_FRAGMENT_STATS 0
+#endif
+
+#if CLUSTER_FRAGMENT_STATS
+// Number of contiguous runs the file's cluster chain is made of (1 for a
+// contiguous file, 0 for an empty one)
+uint32_t countFragments(SdFat &fs, File32 &file);
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Digest a manifest "hash" value promises. Recognised forms:
+//   "sha256:<64 hex>" or 64 bare hex digits   -> SHA-256
+//   "crc32:<8 hex>"   or 8 bare hex digits    -> CRC32 (zip polynomial)
+// Anything else is only compared verbatim to detect changes, not verified.
+struct ExpectedHash {
+  enum Kind : uint8_t { NONE, CRC32, SHA256 };
+  Kind kind;
+  uint32_t crc;
+  uint8_t sha256[32];
+};
+
+ExpectedHash parseExpectedHash(const std::string &value);
+
+// Hashes bytes as they stream past (network -> card), so verifying costs no
+// extra read of the data. CRC32 is always kept; SHA-256 only when asked for,
+// on the ESP32-S3 through mbedtls, which drives the hardware SHA engine.
+class StreamHasher {
+ public:
+  StreamHasher();
+  ~StreamHasher();
+
+  void begin(bool sha256);
+  void update(const uint8_t *data, size_t len);
+  uint64_t bytes() const { return _bytes; }
+  uint32_t crc32() const { return _crc; }
+
+  // Finishes the SHA-256 (if any) and compares; true for Kind NONE
+  bool matches(const ExpectedHash &expected);
+  // Lowercase hex of the finished SHA-256 (after matches()), else ""
+  std::string sha256Hex() const;
+
+ private:
+  StreamHasher(const StreamHasher &) = delete;
+  StreamHasher &operator=(const StreamHasher &) = delete;
+
+  void finishSha();
+
+  uint32_t _crc = 0;
+  uint64_t _bytes = 0;
+  bool _sha = false;
+  bool _shaDone = false;
+  uint8_t _digest[32];
+  void *_ctx = nullptr;  // mbedtls_sha256_context, or the portable state
+};
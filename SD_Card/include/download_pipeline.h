@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+// Producer/consumer pipeline between the network and the card.
+//
+// The caller (network side) fills buffers with acquire()/commit(); a writer
+// task pinned to another core drains full buffers into the sink, so TLS
+// decryption and SD writes overlap instead of taking turns. Buffers are only
+// handed over when full (or on finish()), so the card always sees large
+// writes whatever size the TCP reads come in.
+//
+// Without a writer task (startWorker failed, Linux host) commit() drains
+// inline and the pipeline degrades to the old read-then-write loop.
+class DownloadPipeline {
+ public:
+  using Sink = std::function<bool(const uint8_t *data, size_t len)>;
+
+  struct Stats {
+    uint64_t bytes;
+    uint32_t buffers;     // handed to the writer
+    uint32_t netBusyMs;   // producer filling buffers
+    uint32_t netWaitMs;   // producer waiting for a free buffer (card-bound)
+    uint32_t sdBusyMs;    // writer inside the sink
+    uint32_t sdWaitMs;    // writer waiting for data (network-bound)
+  };
+
+  DownloadPipeline() {}
+  ~DownloadPipeline() { end(); }
+
+  bool begin(size_t bufferBytes, size_t buffers);
+  void end();
+  bool active() const { return _count != 0; }
+  bool startWorker(int core, int priority = 3);
+
+  // Start a transfer into `sink`. Returns false if the pipeline isn't set up.
+  bool start(Sink sink);
+  // Free space in the buffer being filled; blocks while all buffers are
+  // queued. Returns nullptr once the sink has failed.
+  uint8_t *acquire(size_t *room);
+  // `n` bytes were written at the pointer acquire() returned
+  void commit(size_t n);
+  // Queue the partial buffer, wait for the writer to drain everything.
+  // Returns false if any sink call failed.
+  bool finish();
+
+  Stats stats();
+
+  // Writer loop body; public for the task trampoline
+  void drain(bool block);
+
+ private:
+  struct Buffer {
+    uint8_t *data;
+    size_t len;
+  };
+
+  void submitLocked();
+
+  std::mutex _lock;
+  std::condition_variable _cv;
+
+  Buffer *_bufs = nullptr;
+  size_t _count = 0;
+  size_t _bufBytes = 0;
+
+  // Ring of buffers: [_tail, _tail + _full) are queued for the writer,
+  // _head is being filled.
+  size_t _head = 0;
+  size_t _tail = 0;
+  size_t _full = 0;
+  bool _writing = false;
+  bool _failed = false;
+
+  Sink _sink;
+  void *_task = nullptr;  // TaskHandle_t
+  uint32_t _fillStart = 0;
+
+  Stats _stats = {};
+};
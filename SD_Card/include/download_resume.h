@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "SdFat.h"
+
+// Downloads land in "<path>.tmp" and are renamed into place when complete
+static const char *const DOWNLOAD_TMP_SUFFIX = ".tmp";
+// Sidecar of an interrupted .tmp file
+static const char *const RESUME_SUFFIX = ".resume";
+
+// Sidecar next to an interrupted download's .tmp file: how many bytes of it
+// are known to be on the card (synced), and the server's validator (strong
+// ETag or Last-Modified) they belong to. A later attempt asks for the rest
+// with Range + If-Range; if the file changed on the server in between, the
+// server answers 200 with the whole file and the download starts over.
+//
+// Text format: "<offset, 20 digits>\n<validator>\n". The offset is fixed
+// width so checkpoints rewrite the same bytes of an already open file
+// instead of creating directory entries.
+class ResumeSidecar {
+ public:
+  explicit ResumeSidecar(SdFat &fs) : _fs(fs) {}
+  ~ResumeSidecar() { end(); }
+
+  static std::string pathFor(const std::string &tmpPath) { return tmpPath + RESUME_SUFFIX; }
+
+  // Resume point of `tmpPath`; false if there is none usable (no sidecar,
+  // no validator, or the .tmp file is shorter than the recorded offset)
+  bool load(const std::string &tmpPath, uint64_t *offset, std::string *validator);
+
+  // Start recording checkpoints for `tmpPath`, which already holds `offset`
+  // bytes (a resume). That offset is written back at once: the sidecar is
+  // rewritten in place, never truncated, so a power cut before the next
+  // checkpoint still finds it.
+  bool begin(const std::string &tmpPath, const std::string &validator, uint64_t offset = 0);
+  // The first `offset` bytes of the .tmp file are synced to the card
+  bool checkpoint(uint64_t offset);
+  void end();
+  bool active() { return _file.isOpen(); }
+
+  // Drop the sidecar (transfer done, or not worth resuming)
+  void remove(const std::string &tmpPath);
+
+ private:
+  SdFat &_fs;
+  File32 _file;
+  std::string _validator;
+};
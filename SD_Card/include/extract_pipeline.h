@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include "download_pipeline.h"
+#include "miniz.h"
+#include "zip_reader.h"
+
+// Three-stage extraction of deflated zip entries:
+//
+//   read     reader task on its own core: compressed bytes from the archive
+//            into a ring of input buffers, as far ahead as the ring allows
+//   inflate  the calling task: tinfl plus CRC32 over the output
+//   write    the DownloadPipeline writer task: inflated data to the card
+//
+// Every queue is bounded (input ring here, output buffers in the
+// DownloadPipeline), so a slow stage stalls the ones feeding it instead of
+// growing memory. Each stage records busy and idle time; together with the
+// DownloadPipeline stats that shows whether a bundle is card-bound (inflate
+// waits on input or output) or CPU-bound (reader and writer idle).
+//
+// SdFat is not thread-safe and the reader and writer share the card, so the
+// reader takes cardLock() around each read; the write sink must take it too.
+//
+// Without a reader task (startWorker failed, Linux host) input is read
+// inline when the inflater runs dry.
+class ExtractPipeline {
+ public:
+  struct Stats {
+    uint32_t entries;
+    uint64_t inBytes;           // compressed bytes read
+    uint64_t outBytes;          // inflated bytes handed to the writer
+    uint32_t readBusyMs;        // reader inside the card read
+    uint32_t readWaitMs;        // reader waiting for a free input buffer (CPU-bound)
+    uint32_t inflateBusyMs;     // inflate + CRC
+    uint32_t inflateInWaitMs;   // inflater waiting for input (card read-bound)
+  };
+
+  ExtractPipeline() {}
+  ~ExtractPipeline() { end(); }
+
+  bool begin(size_t bufferBytes, size_t buffers);
+  void end();
+  bool active() const { return _count != 0; }
+  bool startWorker(int core, int priority = 3);
+
+  std::mutex &cardLock() { return _cardLock; }
+
+  // Inflate the deflated entry `st` of the archive behind `reader` into
+  // `out`, which must already be start()ed; the caller finish()es it.
+  // False on a read error, a corrupt stream, a size or CRC mismatch, or a
+  // failed write.
+  bool inflateEntry(BufferedZipReader &reader, const mz_zip_archive_file_stat &st, DownloadPipeline &out);
+
+  Stats stats();
+  void resetStats();
+
+  // Reader loop body; public for the task trampoline
+  void fill(bool block);
+
+ private:
+  struct Buffer {
+    uint8_t *data;
+    size_t len;
+    bool last;   // final piece of the entry
+  };
+
+  // Next filled buffer, blocking until the reader has one; nullptr if the
+  // read failed
+  Buffer *take();
+  void release();
+  // Stop reading the current entry and drop whatever was read ahead
+  void stopJob();
+  bool emit(DownloadPipeline &out, const uint8_t *data, size_t len);
+
+  std::mutex _lock;
+  std::condition_variable _cv;
+  std::mutex _cardLock;
+
+  Buffer *_bufs = nullptr;
+  size_t _count = 0;
+  size_t _bufBytes = 0;
+
+  // Ring of input buffers: [_tail, _tail + _full) hold compressed data for
+  // the inflater, _head is the next one the reader fills
+  size_t _head = 0;
+  size_t _tail = 0;
+  size_t _full = 0;
+  bool _reading = false;
+
+  // Current job: archive range still to read
+  BufferedZipReader *_src = nullptr;
+  uint64_t _srcOfs = 0;
+  uint64_t _srcLeft = 0;
+  bool _readFailed = false;
+
+  tinfl_decompressor *_inflator = nullptr;
+  uint8_t *_dict = nullptr;  // TINFL_LZ_DICT_SIZE ring, also the output window
+
+  void *_task = nullptr;  // TaskHandle_t
+  Stats _stats = {};
+};
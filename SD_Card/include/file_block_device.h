@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdio.h>
+#include "block_device.h"
+
+// BlockDevice backed by a disk image file. Used to run the MSC data path
+// (cache, read-ahead, ...) on a workstation against a copy of a real card.
+class FileBlockDevice : public BlockDevice {
+ public:
+  FileBlockDevice() {}
+  ~FileBlockDevice() { close(); }
+
+  // Opens an existing image. The sector count is taken from the file size.
+  bool open(const char *path, bool readOnly = false);
+  void close();
+  bool isOpen() const { return _fp != nullptr; }
+
+  uint32_t sectorCount() override { return _sectors; }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override;
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override;
+  bool sync() override;
+
+ private:
+  bool seekTo(uint32_t sector);
+
+  FILE *_fp = nullptr;
+  uint32_t _sectors = 0;
+  bool _readOnly = false;
+};
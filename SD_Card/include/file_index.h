@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SdFat.h"
+
+// Flat index of every file and directory on the card, persisted as a small
+// binary file in the card root.
+//
+// Playlist selection, .nomsc restore, logical listings and the sync trash
+// pass iterate this array instead of walking the FAT tree with
+// openNextFile(). The firmware keeps it current by going through rename(),
+// remove() and mkdir() here, or by calling update() after creating a file
+// through SdFat directly; save() writes it back.
+//
+// Staleness is detected two ways: the file on the card is unsealed before the
+// first change and only sealed again by save(), and every directory's raw
+// entries are checksummed, so edits made by a PC or over MSC show up without
+// opening every file. Only the root is checked up front; a directory is
+// checked the first time check() is asked for it (or something below it),
+// and if it changed, only that directory's subtree is walked again. Boot
+// cost doesn't grow with the library, and parts of the card nobody looks at
+// are never read.
+class FileIndex {
+ public:
+  // FLAG_CHECKED (directories, not saved): checksum compared this session
+  enum : uint8_t { FLAG_DIR = 1, FLAG_CHECKED = 2 };
+
+  struct Entry {
+    std::string path;       // absolute, no trailing '/'
+    uint32_t size;
+    uint32_t firstCluster;
+    uint32_t dirCrc;        // directories: CRC32 of the raw directory entries
+    uint16_t date;          // FAT modify date/time
+    uint16_t time;
+    uint8_t flags;
+    bool isDir() const { return flags & FLAG_DIR; }
+  };
+
+  // Entries [begin, end) in entries()
+  struct Range {
+    size_t begin;
+    size_t end;
+  };
+
+  explicit FileIndex(SdFat &fs, const char *indexPath = "/.index.bin") : _fs(fs), _indexPath(indexPath) {}
+
+  // Load the index from the card and check its root; rebuild it if it is
+  // missing or the root changed. Returns false only if the card can't be
+  // walked at all.
+  bool begin();
+  // The card may have changed behind our back (e.g. the host wrote over
+  // MSC): every directory needs checking again; the root is, right away
+  bool refresh();
+  // Make entries at and under directory `path` (and its parents) current,
+  // checking each directory not yet checked and re-walking changed ones.
+  // Call before relying on a part of the index; check("/") for all of it.
+  // Invalidates references into entries().
+  bool check(const char *path);
+  bool rebuild();
+  bool save();
+  bool loaded() const { return _loaded; }
+  bool dirty() const { return _dirty; }
+  // True if the card had to be walked, in full or in part, since the last
+  // begin()/refresh()
+  bool rebuilt() const { return _rebuilt; }
+
+  // Sorted by path
+  const std::vector<Entry> &entries() const { return _entries; }
+  const Entry *find(const char *path) const;
+  // Everything whose path starts with `prefix`
+  Range under(const char *prefix) const;
+
+  // Card operations that keep the index in step
+  bool rename(const char *from, const char *to);
+  bool remove(const char *path);
+  bool mkdir(const char *path);
+  // Re-read one path after it was created, rewritten or deleted through
+  // SdFat directly
+  void update(const char *path);
+
+ private:
+  size_t lowerBound(const char *path) const;
+  bool unseal();
+  void touch(const std::string &dir);
+  bool updateTouched();
+  bool checkOne(const std::string &dir);
+  bool isCheckedDir(const std::string &dir) const;
+  bool rescan(const std::string &dir);
+  bool walk(const std::string &path, size_t self);
+  bool dirCrc(const char *path, uint32_t *crc);
+  uint32_t *crcSlot(const std::string &dir);
+  bool load();
+  void sort();
+
+  SdFat &_fs;
+  const char *_indexPath;
+  std::vector<Entry> _entries;
+  uint32_t _rootCrc = 0;
+  bool _rootChecked = false;
+  std::vector<std::string> _touched;  // directories changed since their CRC was taken
+  bool _loaded = false;
+  bool _dirty = false;
+  bool _sealedOnCard = false;
+  bool _rebuilt = false;
+};
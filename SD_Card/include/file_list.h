@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The file browser's current listing, packed: one fixed-size entry per row
+// plus a single arena holding every name. Parent directories are interned,
+// so a folder of 5,000 tracks stores its path once; sizes stay numbers
+// until a row is drawn. Both buffers live in PSRAM when there is some and
+// are kept across listings, so browsing doesn't churn the heap: an entry
+// costs 12 bytes plus its name, against three heap blocks per row before.
+class FileList {
+ public:
+  FileList() {}
+  ~FileList();
+
+  // Forget the entries, keep the memory
+  void clear();
+  // `parent` is the directory the entry lives in, without trailing '/'
+  // ("" for the root). False if out of memory.
+  bool add(const char *parent, const char *name, uint32_t size, bool isDir);
+  // A row that isn't a file, e.g. "(no files found)"
+  bool addPlaceholder(const char *text);
+
+  size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+  bool isDir(size_t i) const { return _entries[i].dir; }
+  bool isPlaceholder(size_t i) const { return _entries[i].placeholder; }
+  uint32_t fileSize(size_t i) const { return _entries[i].size; }
+
+  // Name (or placeholder text); not NUL-terminated
+  const char *name(size_t i, size_t *len) const;
+  // Full path ("<parent>/<name>") into `buf`, truncated to fit; returns
+  // the untruncated length
+  size_t path(size_t i, char *buf, size_t n) const;
+
+  // Bytes held (entries, parents, arena), for the heap report
+  size_t bytes() const { return _entryCap * sizeof(Entry) + _parentCap * sizeof(Parent) + _arenaCap; }
+
+ private:
+  struct Entry {
+    uint32_t name;     // arena offset
+    uint32_t size;
+    uint16_t parent;   // index into the parent table
+    uint16_t nameLen : 14;
+    uint16_t dir : 1;
+    uint16_t placeholder : 1;
+  };
+  struct Parent {
+    uint32_t ofs;      // arena offset
+    uint16_t len;
+  };
+
+  bool reserveEntries(size_t n);
+  bool reserveParents(size_t n);
+  bool reserveArena(size_t n);
+  // Copy into the arena; returns the offset or UINT32_MAX
+  uint32_t store(const char *s, size_t len);
+  // Parent table index for `parent`, adding it if new; UINT16_MAX if full
+  uint16_t intern(const char *parent, size_t len);
+
+  Entry *_entries = nullptr;
+  size_t _count = 0;
+  size_t _entryCap = 0;
+
+  Parent *_parents = nullptr;
+  size_t _parentCount = 0;
+  size_t _parentCap = 0;
+  uint16_t _lastParent = UINT16_MAX;  // consecutive entries share a parent
+
+  char *_arena = nullptr;
+  size_t _arenaUsed = 0;
+  size_t _arenaCap = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+// Stall limit for reads and connects on a session
+const unsigned long HTTP_IO_TIMEOUT_MS = 10000;
+
+// Response body of a keep-alive request. Reads stop exactly at the end of
+// the body (Content-Length, or the last chunk of a chunked reply) so the
+// connection can carry the next request; chunk framing is stripped.
+// available() never blocks: 0 means "nothing yet", check finished().
+class HttpBody : public Stream {
+ public:
+  void begin(WiFiClient *in, int contentLength, bool chunked);
+  void end() {
+    _in = nullptr;
+    _state = CLOSED;
+  }
+  bool finished();
+  // True if the body ended cleanly (not cut off by a dropped connection)
+  bool complete() const { return _state == DONE; }
+  // Read and drop the rest (e.g. a zip's central directory) so the
+  // connection can be reused; false if it stalls for `timeoutMs`
+  bool skip(unsigned long timeoutMs);
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  int read(uint8_t *buf, size_t len);
+  size_t write(uint8_t) override { return 0; }
+
+ private:
+  enum State { DATA, CHUNK_SIZE, CHUNK_END, TRAILER, DONE, CLOSED };
+
+  // Advance through chunk framing with whatever has arrived
+  void pump();
+  size_t dataAvailable();
+  void consumed(size_t n);
+
+  WiFiClient *_in = nullptr;
+  State _state = CLOSED;
+  bool _chunked = false;
+  bool _unbounded = false;  // no length, no chunks: body ends at close
+  uint32_t _left = 0;       // bytes left in the body or current chunk
+  char _line[20];
+  size_t _lineLen = 0;
+};
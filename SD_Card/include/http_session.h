@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <condition_variable>
+#include <mutex>
+#include "http_body.h"
+
+// Connections kept open across requests. Each slot holds one client (plain
+// or TLS) and stays connected to the last host it talked to, so a sync of
+// many files pays for one TLS handshake instead of one per file. A request
+// to another host, or one the server has closed, reconnects the slot.
+//
+// Up to `slots` requests can be in flight at once (one per task); open()
+// blocks while all are busy.
+class HttpSessionPool {
+ public:
+  class Session {
+   public:
+    HttpBody &body() { return _body; }
+    int size() { return _http.getSize(); }  // -1 if unknown / chunked
+    int status() const { return _status; }
+    // Strong ETag, else Last-Modified; empty if the server sent neither
+    String validator();
+    // First byte of a 206 reply (Content-Range), -1 if missing or malformed
+    int64_t rangeStart();
+
+   private:
+    friend class HttpSessionPool;
+    WiFiClient _plain;
+    WiFiClientSecure _secure;
+    HTTPClient _http;
+    HttpBody _body;
+    String _key;  // "https://host:port" the client is connected to
+    bool _https = false;
+    bool _busy = false;
+    int _status = 0;
+  };
+
+  struct Stats {
+    uint32_t requests;
+    uint32_t reused;       // served on an already open connection
+    uint32_t handshakes;   // new connections (TLS handshakes for https)
+    uint32_t handshakeMs;  // time spent connecting
+    uint32_t failures;
+  };
+
+  explicit HttpSessionPool(size_t slots = 1);
+  ~HttpSessionPool();
+
+  // GET `url`. Returns the session with the body ready to read, or nullptr
+  // (the slot already released; `status` set if given).
+  // With `from` > 0 only the rest of the resource starting at that byte is
+  // asked for, and only if it still matches `validator` (If-Range); the
+  // status tells whether that happened (206) or the whole resource follows
+  // (200).
+  Session *open(const String &url, int *status = nullptr, uint64_t from = 0,
+                const String &validator = String());
+  // Release the slot. The connection stays open if the body was read to
+  // the end, otherwise it is closed.
+  void close(Session *s);
+  // Drop every idle connection (e.g. before WiFi goes down)
+  void disconnect();
+
+  Stats stats();
+  void resetStats();
+
+ private:
+  bool connect(Session *s, const String &host, uint16_t port, bool https);
+  int request(Session *s, const String &url, const String &key, const String &host, uint16_t port, bool https,
+              uint64_t from, const String &validator);
+
+  Session *_slots;
+  size_t _count;
+  std::mutex _lock;
+  std::condition_variable _cv;
+  Stats _stats = {};
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include "block_device.h"
+
+// Artificial card latency for host runs: an image file on a workstation SSD
+// answers in microseconds, a real card in hundreds of them, with the odd
+// write stalling for tens of milliseconds while the card erases.
+//
+// Each command costs `readUs`/`writeUs` plus a per-sector cost, and every
+// `stallEvery`-th write (0 = never) another `stallUs`. One model is shared by
+// everything that reaches the same card (the block device below and, on the
+// host, the SdFat stand-in's file I/O), so stalls are counted per card.
+// Delays are slept, so expect the host scheduler's granularity (~50 us).
+struct CardLatency {
+  uint32_t readUs = 0;
+  uint32_t writeUs = 0;
+  uint32_t readSectorUs = 0;
+  uint32_t writeSectorUs = 0;
+  uint32_t stallEvery = 0;
+  uint32_t stallUs = 0;
+
+  bool enabled() const { return readUs || writeUs || readSectorUs || writeSectorUs || stallUs; }
+  // Sleep for one command of `sectors` sectors
+  void charge(bool write, size_t sectors);
+
+ private:
+  std::atomic<uint32_t> _writes{0};
+};
+
+// BlockDevice that delays every command by `latency` and passes it on.
+class LatencyBlockDevice : public BlockDevice {
+ public:
+  LatencyBlockDevice(BlockDevice &lower, CardLatency &latency) : _lower(lower), _latency(latency) {}
+
+  uint32_t sectorCount() override { return _lower.sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override {
+    _latency.charge(false, count);
+    return _lower.readSectors(sector, dst, count);
+  }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    _latency.charge(true, count);
+    return _lower.writeSectors(sector, src, count);
+  }
+  bool sync() override { return _lower.sync(); }
+
+ private:
+  BlockDevice &_lower;
+  CardLatency &_latency;
+};
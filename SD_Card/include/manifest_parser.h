@@ -0,0 +1,25 @@
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+#include "sync_plan.h"
+
+// Parses the worker manifest straight off a stream (HTTP body, file, ...),
+// one array element at a time, so memory use is the same for 100 entries or
+// 50,000: only the current element is ever held as a JSON document.
+//
+// Accepted: a bare array, or an object whose "files" member is the array.
+// Elements are {"path", "size", "hash"[, "bundle"]} objects, or plain names
+// of zip or .sdb bundles (the original format; other plain names are
+// skipped).
+// A "hash" of the form "sha256:<hex>" or "crc32:<hex>" is also verified
+// against the downloaded bytes (see content_hash.h).
+struct ManifestStats {
+  uint32_t items;    // handed to onItem
+  uint32_t skipped;  // elements that weren't usable
+};
+
+// Returns false on malformed or truncated input; `error` says why. Items
+// already delivered before the failure must not be treated as a full list.
+bool parseManifest(Stream &in, const std::function<void(const ManifestItem &)> &onItem,
+                   ManifestStats *stats = nullptr, String *error = nullptr);
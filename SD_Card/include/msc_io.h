@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include "block_device.h"
+#include "msc_stats.h"
+#include "write_combiner.h"
+
+// What the USB MSC callbacks do with a host request, kept out of main.cpp so
+// the host build (env:native) runs the same code against a disk image.
+//
+// Requests are byte-addressed: `bufsize` bytes starting `offset` bytes into
+// sector `lba`. Both return `bufsize`, or -1 if the request runs past the end
+// of the device or a layer below fails. With `stats`, every request is
+// timed and counted there.
+//
+// Reads: whole sectors go down in one readSectors() call; a partial head or
+// tail sector is read whole and the wanted bytes copied out.
+int32_t mscRead(BlockDevice &dev, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize,
+                MscStats *stats = nullptr);
+// Writes: handed to the write combiner, which merges them with neighbouring
+// writes and read-modify-writes partial sectors once per flush.
+int32_t mscWrite(WriteCombiner &dev, uint32_t lba, uint32_t offset, const uint8_t *buffer, uint32_t bufsize,
+                 MscStats *stats = nullptr);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+
+// Always-on counters for the MSC callbacks (msc_io.h), per direction: a
+// latency histogram, a request size histogram, aligned vs partial requests
+// (offset or length not whole sectors, the path that reads a sector to copy
+// part of it) and byte/error totals. record() is a handful of increments
+// under a mutex, next to a card access that takes hundreds of microseconds.
+//
+// The UI works on snapshots: two of them a second apart give the current
+// throughput, one the averages since reset().
+class MscStats {
+ public:
+  enum Dir { READ, WRITE, DIR_COUNT };
+
+  // Latency bucket i counts requests of [2^i, 2^(i+1)) us; bucket 0 also
+  // takes 0 us, the last everything from 2^19 us (~0.5 s) up
+  static const int LATENCY_BUCKETS = 20;
+  // Size bucket i counts requests of up to 512 << i bytes (512 B .. 128 KB);
+  // the last takes everything larger
+  static const int SIZE_BUCKETS = 10;
+
+  struct Counters {
+    uint32_t requests;
+    uint32_t partial;
+    uint32_t errors;
+    uint64_t bytes;
+    uint64_t totalUs;
+    uint32_t maxUs;
+    uint32_t latency[LATENCY_BUCKETS];
+    uint32_t size[SIZE_BUCKETS];
+  };
+
+  struct Snapshot {
+    Counters dir[DIR_COUNT];
+    uint32_t ms;  // since reset()
+  };
+
+  MscStats();
+
+  void record(Dir d, uint32_t bytes, bool partial, uint32_t us, bool ok);
+  Snapshot snapshot();
+  void reset();
+
+  // Upper bound (us) of the bucket holding the pct-th percentile; 0 if empty
+  static uint32_t percentileUs(const Counters &c, uint32_t pct);
+  static uint32_t latencyBucketUs(int i) { return 1u << i; }  // lower bound
+  static uint32_t sizeBucketBytes(int i) { return 512u << i; }  // upper bound
+  // Bytes per second in direction `d` from `earlier` to `later`
+  static float rate(const Snapshot &earlier, const Snapshot &later, Dir d);
+  // Text report, one call of `line` per line (no newline)
+  static void dump(const Snapshot &s, const std::function<void(const char *line)> &line);
+
+ private:
+  std::mutex _lock;
+  Counters _c[DIR_COUNT];
+  uint32_t _t0 = 0;
+};
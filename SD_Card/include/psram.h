@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdlib.h>
+
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+// Large, long-lived buffers (caches, ring buffers) go to PSRAM when the board
+// has it, so they don't eat the internal heap that WiFi/TLS needs.
+static inline void *psramAlloc(size_t bytes) {
+#if defined(ESP32)
+  void *p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) return p;
+#endif
+  return malloc(bytes);
+}
+
+static inline void psramFree(void *p) {
+  free(p);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include "block_device.h"
+
+// Sequential read-ahead for MSC streaming playback.
+//
+// Watches the LBAs the host reads. Once `trigger` reads in a row continue
+// exactly where the previous one ended, the following sectors are fetched
+// into a ring buffer ahead of the host, and later reads are copied out of RAM
+// while the card is already busy with the next chunk.
+//
+// Prefetching runs on a FreeRTOS task (startWorker) pinned to the other core.
+// Without a worker (Linux host) the prefetch is done inline after each read.
+// Every call into the lower device goes through _io, so the worker and the
+// host never drive the card at once even when the layer below has no lock.
+class ReadAhead : public BlockDevice {
+ public:
+  struct Stats {
+    uint32_t readSectors;        // everything the host asked for
+    uint32_t hitSectors;         // ... served from the ring buffer
+    uint32_t prefetchedSectors;  // sectors fetched ahead of the host
+    uint32_t wastedSectors;      // prefetched but dropped unread
+    uint32_t streams;            // sequential streams detected
+  };
+
+  explicit ReadAhead(BlockDevice &lower) : _lower(lower) {}
+  ~ReadAhead() { end(); }
+
+  // `ringSectors` is the read-ahead depth, `chunkSectors` the size of each
+  // card request the prefetcher issues.
+  bool begin(size_t ringSectors, size_t chunkSectors = 64, uint8_t trigger = 2);
+  void end();
+  bool active() const { return _ring != nullptr; }
+
+  // Start the background prefetch task. ESP32 only; returns false elsewhere.
+  bool startWorker(int core, int priority = 2);
+
+  // Fetch one chunk ahead if a stream is active and there is room.
+  // Returns true if something was added to the ring.
+  bool pump();
+
+  uint32_t sectorCount() override;
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override;
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override;
+  bool sync() override;
+
+  // Throw away everything prefetched (e.g. card changed under us).
+  void invalidate();
+
+  Stats stats();
+  void resetStats();
+
+ private:
+  void copyOut(uint8_t *dst, size_t n);
+  void dropFront(size_t n);
+  void resetWindow(uint32_t start);
+  void kick();
+
+  BlockDevice &_lower;
+  std::mutex _lock;
+  std::mutex _io;  // taken after _lock, never the other way round
+  std::condition_variable _fetched;
+
+  uint8_t *_ring = nullptr;  // _cap sectors, PSRAM
+  size_t _cap = 0;
+  size_t _chunk = 64;
+  uint8_t _trigger = 2;
+
+  // Window of prefetched sectors: LBAs [_winStart, _winStart + _winCount),
+  // the first of which sits at ring slot _head.
+  uint32_t _winStart = 0;
+  size_t _winCount = 0;
+  size_t _head = 0;
+  uint32_t _gen = 0;  // bumped whenever the window is thrown away
+
+  uint32_t _nextLba = 0xFFFFFFFF;  // where the host's last read ended
+  uint8_t _streak = 0;
+
+  bool _inflight = false;
+  uint32_t _inflightLba = 0;
+  size_t _inflightCount = 0;
+
+  void *_task = nullptr;  // TaskHandle_t
+
+  Stats _stats = {};
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "SdFat.h"
+
+// Append-only journal of the renames done to disable files for a playlist.
+//
+// Each rename is recorded (and synced) before it happens and marked done
+// after, so the set of files that may carry a .nomsc suffix is always known.
+// Restoring replays just these records instead of searching the card; a
+// rename cut short by power loss is detected by checking whether the new
+// name exists.
+//
+// Text format, one record per line: "R <from>\t<to>" then "D" once done.
+// FAT names can't contain tabs or newlines; a torn last line is ignored.
+class RenameJournal {
+ public:
+  explicit RenameJournal(SdFat &fs, const char *path = "/.nomsc.jnl") : _fs(fs), _path(path) {}
+  ~RenameJournal() { close(); }
+
+  // Open for appending (creates the journal if needed)
+  bool open();
+  void close();
+  bool exists() { return _fs.exists(_path); }
+  const char *path() const { return _path; }
+
+  // Must be durable before the rename is attempted
+  bool record(const char *from, const char *to);
+  // The rename recorded last succeeded
+  bool commit();
+
+  // Call undo(from, to) for every journaled rename whose new name still
+  // exists, newest first. The journal is deleted once every undo succeeded.
+  // Returns the number of renames undone; `interrupted` (optional) counts
+  // records that were never marked done.
+  size_t rollback(const std::function<bool(const char *from, const char *to)> &undo, size_t *interrupted = nullptr);
+
+ private:
+  struct Record {
+    std::string from;
+    std::string to;
+    bool done;
+  };
+
+  bool read(std::vector<Record> *out);
+
+  SdFat &_fs;
+  const char *_path;
+  File32 _file;
+};
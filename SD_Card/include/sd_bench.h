@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "SdFat.h"
+#include "block_device.h"
+
+// SD card benchmark, run on a contiguous scratch file.
+//
+//   file  File32 API: a sequential write/read sweep over transfer sizes
+//         (minBuf..maxBuf, doubling) and random 4 KB writes/reads
+//   raw   the same sectors through a BlockDevice (readSectors/writeSectors)
+//   msc   the same sectors through the MSC callback path, in host-sized
+//         transfers
+//
+// Every transfer is timed, so each result carries latency percentiles as
+// well as throughput. Raw and MSC writes only ever touch the scratch file's
+// own clusters, which is why it is preallocated in one run: the file system
+// around it is never written behind SdFat's back.
+//
+// Results go to a CSV that grows by one block of rows per run (the card's
+// history), and the headline numbers to a small summary file that boot
+// shows instead of measuring again.
+class SdBench {
+ public:
+  struct Config {
+    uint32_t fileBytes = 4 * 1024 * 1024;
+    uint32_t minBuf = 512;
+    uint32_t maxBuf = 256 * 1024;
+    uint32_t sweepOps = 512;     // transfers per sweep size at most
+    uint32_t randomOps = 500;    // random 4 KB transfers per direction
+    uint32_t rawChunk = 32768;
+    uint32_t mscChunk = 4096;    // what the host's requests arrive as
+    BlockDevice *raw = nullptr;  // skipped if null
+    BlockDevice *msc = nullptr;
+    std::mutex *lock = nullptr;  // held around each test, not the whole run
+  };
+
+  struct Result {
+    const char *path;   // "file", "raw", "msc"
+    const char *test;   // "seq_write", "seq_read", "rand_write", "rand_read"
+    uint32_t bufBytes;  // bytes per transfer
+    uint64_t bytes;
+    uint32_t ops;
+    uint32_t us;        // whole test, including the final sync for writes
+    uint32_t p50Us, p90Us, p99Us, maxUs;  // per transfer
+
+    float mbps() const { return us ? (float)(bytes / (1024.0 * 1024.0) / (us / 1e6)) : 0.0f; }
+    float iops() const { return us ? (float)(ops / (us / 1e6)) : 0.0f; }
+  };
+
+  // Headline numbers: 32 KB sequential through File32, 4 KB random.
+  // first* are from the card's first run, to show wear over time.
+  struct Summary {
+    uint32_t run;
+    float seqWrite, seqRead;          // MB/s
+    float randWrite, randRead;        // IOPS
+    float firstSeqWrite, firstSeqRead;
+    float firstRandWrite, firstRandRead;
+  };
+
+  using Report = std::function<void(const Result &)>;
+
+  explicit SdBench(SdFat &fs) : _fs(fs) {}
+
+  // The scratch file is created, benchmarked and removed. False if it
+  // couldn't be set up (no contiguous space, card error); `report` is
+  // called after each test.
+  bool run(const char *scratchPath, const Config &cfg, Report report = nullptr);
+  const std::vector<Result> &results() const { return _results; }
+
+  // Headline numbers of the last run(), numbered after `previous`
+  Summary summarize(const Summary *previous) const;
+  static bool loadSummary(SdFat &fs, const char *path, Summary *s);
+  static bool saveSummary(SdFat &fs, const char *path, const Summary &s);
+  // Append the last run()'s rows (header first if the file is new)
+  bool appendCsv(const char *path, uint32_t run) const;
+
+ private:
+  using Op = std::function<bool(uint32_t index, uint32_t *bytes)>;
+
+  // Time `ops` calls of `op`, then `finish` (sync); false on the first error
+  bool measure(const char *path, const char *test, uint32_t bufBytes, uint32_t ops, const Op &op,
+               const std::function<bool()> &finish);
+  bool fileTests(const Config &cfg);
+  bool blockTests(const char *path, BlockDevice &dev, uint32_t chunk, const Config &cfg);
+  uint32_t nextRandom();
+
+  SdFat &_fs;
+  File32 _file;
+  uint8_t *_buf = nullptr;
+  uint32_t _firstSector = 0;
+  uint32_t _sectors = 0;
+  uint32_t _rng = 1;
+  std::mutex *_lock = nullptr;
+  Report _report;
+  std::vector<uint32_t> _lat;
+  std::vector<Result> _results;
+};
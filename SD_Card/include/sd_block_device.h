@@ -0,0 +1,26 @@
+#pragma once
+
+#include "SdFat.h"
+#include "block_device.h"
+
+// BlockDevice view of the raw SD card behind an SdFat volume.
+class SdBlockDevice : public BlockDevice {
+ public:
+  explicit SdBlockDevice(SdFat &fs) : _fs(fs) {}
+
+  uint32_t sectorCount() override {
+    return _fs.card() ? _fs.card()->sectorCount() : 0;
+  }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override {
+    return _fs.card() && _fs.card()->readSectors(sector, dst, count);
+  }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    return _fs.card() && _fs.card()->writeSectors(sector, src, count);
+  }
+  bool sync() override {
+    return _fs.card() && _fs.card()->syncBlocks();
+  }
+
+ private:
+  SdFat &_fs;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bundle_format.h"
+#include "content_hash.h"
+#include "stream_extractor.h"
+
+// Streaming extraction of an .sdb bundle (bundle_format.h).
+//
+// The header and table of contents are read and checked (TOC CRC, offsets
+// ascending and inside the bundle) before anything is written. After that
+// there is nothing left to parse: padding is skipped by offset and each
+// payload is copied to its file, whose size is known up front, while its
+// CRC32 (and SHA-256 if the record has one) is computed on the way.
+class SdbStreamExtractor : public StreamExtractor {
+ public:
+  SdbStreamExtractor() {}
+  ~SdbStreamExtractor() override { end(); }
+
+  bool begin(const Target &target) override;
+  void end() override;
+
+  bool feed(const uint8_t *data, size_t len) override;
+  bool done() const override { return _state == DONE; }
+  const char *error() const override { return _error; }
+  Stats stats() const override { return _stats; }
+
+  // Header of the bundle once it has been read (count 0 before)
+  const SdbHeader &header() const { return _header; }
+
+ private:
+  enum State { HEADER, TOC, GAP, PAYLOAD, DONE, FAILED };
+
+  struct Entry {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc32;
+    uint32_t flags;
+    uint8_t sha256[32];
+    std::string path;
+  };
+
+  bool gather(const uint8_t *&data, size_t &len, size_t need);
+  bool checkToc();
+  // Move on to entry _next: directories are created on the spot, files
+  // opened, then the gap up to the payload is skipped
+  bool nextEntry();
+  bool finishEntry();
+  bool fail(const char *why);
+
+  Target _target;
+  State _state = HEADER;
+  const char *_error = nullptr;
+
+  std::string _buf;  // header / current record bytes so far
+  SdbHeader _header = {};
+  std::vector<Entry> _entries;
+  uint32_t _tocCrc = 0;
+  uint64_t _pos = 0;  // bundle offset of the next byte fed
+
+  // Current entry
+  size_t _next = 0;
+  uint64_t _left = 0;  // payload bytes still to come
+  bool _skip = false;  // consume but don't write
+  bool _open = false;  // Target::open succeeded
+  bool _writeOk = true;
+  StreamHasher _hasher;
+
+  Stats _stats = {};
+};
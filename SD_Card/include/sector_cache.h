@@ -0,0 +1,98 @@
+#pragma once
+
+#include <mutex>
+#include "block_device.h"
+
+// LRU cache of individual 512-byte sectors in front of another BlockDevice.
+//
+// Meant for the small, hot requests a head unit makes over and over (FAT,
+// directory sectors, the partial sectors of read-modify-write). Requests longer
+// than `maxRun` sectors bypass the cache so streaming reads don't flush the
+// metadata out of it.
+//
+// In WRITE_BACK mode written sectors stay dirty in RAM until flush()/sync(),
+// eviction, or a bypassing write covers them. WRITE_THROUGH always writes the
+// card first and only keeps a clean copy.
+class SectorCache : public BlockDevice {
+ public:
+  enum Mode { WRITE_THROUGH, WRITE_BACK };
+
+  struct Stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;     // dirty sectors written to the lower device
+    uint32_t bypassSectors;  // sectors moved without touching the cache
+  };
+
+  explicit SectorCache(BlockDevice &lower) : _lower(lower) {}
+  ~SectorCache() { end(); }
+
+  // Allocates `slots` sectors (PSRAM when available). Safe to call again to
+  // resize; any dirty data is flushed first.
+  bool begin(size_t slots, Mode mode = WRITE_THROUGH, size_t maxRun = 8);
+  void end();
+  bool active() const { return _data != nullptr; }
+
+  Mode mode() const { return _mode; }
+  size_t slots() const { return _slots; }
+
+  uint32_t sectorCount() override { return _lower.sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override;
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override;
+  bool sync() override;
+
+  // Write all dirty sectors down, keeping them cached.
+  bool flush();
+  // Drop everything (after a flush). Use when the card was changed behind our back.
+  bool invalidate();
+
+  Stats stats();
+  void resetStats();
+  size_t dirtyCount() const { return _dirty; }
+
+ private:
+  static const int32_t NIL = -1;
+
+  struct Slot {
+    uint32_t lba;
+    int32_t hashNext;
+    int32_t prev;  // towards most recently used
+    int32_t next;  // towards least recently used
+    bool valid;
+    bool dirty;
+  };
+
+  uint8_t *slotData(int32_t i) { return _data + (size_t)i * BLOCK_SIZE; }
+  uint32_t bucketOf(uint32_t lba) const { return (lba * 2654435761u) & _bucketMask; }
+
+  int32_t lookup(uint32_t lba);
+  void hashInsert(int32_t i);
+  void hashRemove(int32_t i);
+  void lruUnlink(int32_t i);
+  void lruPushFront(int32_t i);
+  void lruPushBack(int32_t i);
+  // Takes the least recently used slot, writing it back if dirty.
+  bool takeSlot(int32_t *out);
+  bool insert(uint32_t lba, const uint8_t *src, bool dirty);
+  bool flushLocked();
+  bool writeBackRun(int32_t *slotIdx, size_t n);
+
+  BlockDevice &_lower;
+  std::mutex _lock;
+
+  Mode _mode = WRITE_THROUGH;
+  size_t _slots = 0;
+  size_t _maxRun = 8;
+  size_t _dirty = 0;
+
+  uint8_t *_data = nullptr;       // _slots * BLOCK_SIZE, PSRAM
+  Slot *_meta = nullptr;
+  int32_t *_buckets = nullptr;
+  uint32_t _bucketMask = 0;
+  uint8_t *_bounce = nullptr;     // staging for coalesced write-back
+  int32_t _mru = NIL;
+  int32_t _lru = NIL;
+
+  Stats _stats = {};
+};
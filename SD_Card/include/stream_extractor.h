@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+// An archive extracted from a byte stream, front to back, without ever
+// storing the archive: feed() takes it in chunks of any size (e.g. whatever
+// the HTTP client returned) and entries go straight to their destination
+// through `Target`. Implemented for zip (ZipStreamExtractor) and .sdb
+// bundles (SdbStreamExtractor).
+class StreamExtractor {
+ public:
+  struct Target {
+    std::function<bool(const std::string &name)> dir;
+    // `size` is the uncompressed size, 0 if the archive doesn't say.
+    // Returning false (the file couldn't be created) fails the extraction;
+    // without `open` files are skipped.
+    std::function<bool(const std::string &name, uint64_t size)> open;
+    std::function<bool(const uint8_t *data, size_t len)> write;
+    // ok = all bytes written and the checksum matched
+    std::function<void(bool ok)> close;
+  };
+
+  struct Stats {
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t skipped;    // unsafe names (or files, without Target::open)
+    uint64_t inBytes;    // archive bytes consumed
+    uint64_t outBytes;   // bytes written to the target
+  };
+
+  virtual ~StreamExtractor() {}
+
+  virtual bool begin(const Target &target) = 0;
+  virtual void end() = 0;
+
+  // False once the archive can't be extracted; error() says why
+  virtual bool feed(const uint8_t *data, size_t len) = 0;
+  // Every entry has been extracted; the rest of the stream is index/padding
+  virtual bool done() const = 0;
+  virtual const char *error() const = 0;
+  virtual Stats stats() const = 0;
+};
+
+// Same rule the unzip path applies: nothing may land outside the destination
+bool safeEntryName(const std::string &name);
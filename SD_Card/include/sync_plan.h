@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SdFat.h"
+#include "file_index.h"
+
+// One item of the worker's manifest.
+struct ManifestItem {
+  std::string path;  // absolute card path
+  uint32_t size;     // 0 = unknown
+  std::string hash;  // content hash from the manifest, compared verbatim
+  bool bundle;       // zip / .sdb extracted into the card root, not kept
+};
+
+// What previous syncs installed, kept on the card as text lines
+// "<path>\t<size>\t<hash>\t<origin>", sorted by path.
+//
+// `origin` is the manifest item a file came from: itself for single files,
+// the zip for files extracted from a bundle. Bundles get an entry of their
+// own (origin == path) so they are not fetched again after extraction.
+class SyncState {
+ public:
+  struct Entry {
+    std::string path;
+    uint32_t size;
+    std::string hash;
+    std::string origin;
+  };
+
+  explicit SyncState(SdFat &fs, const char *path = "/.sync_state") : _fs(fs), _path(path) {}
+
+  // A missing or unreadable file leaves the state empty and returns false
+  bool load();
+  bool save();
+  const char *path() const { return _path; }
+
+  const std::vector<Entry> &entries() const { return _entries; }
+  const Entry *find(const std::string &path) const;
+  void set(const Entry &e);
+  void erase(const std::string &path);
+  // Paths installed from `origin`, sorted
+  std::vector<std::string> fromOrigin(const std::string &origin) const;
+
+ private:
+  size_t lowerBound(const std::string &path) const;
+
+  SdFat &_fs;
+  const char *_path;
+  std::vector<Entry> _entries;
+};
+
+struct SyncAction {
+  enum Kind : uint8_t { ADD, UPDATE, DELETE, KEEP, ADOPT, KIND_COUNT };
+  Kind kind;
+  ManifestItem item;  // DELETE: only item.path is set
+};
+
+// Everything but KEEP, which is only counted. The actions' hashes and paths
+// are spooled to a card file as the planner finds them; RAM holds a 12-byte
+// record per action, read back one at a time with get().
+class SyncPlan {
+ public:
+  uint32_t counts[SyncAction::KIND_COUNT] = {};
+  uint64_t downloadBytes = 0;
+  uint32_t unknownSize = 0;  // transfers the manifest gives no size for
+  uint32_t duplicates = 0;   // manifest items overridden by a later one for the same path
+
+  // False if the spool couldn't be written: the plan is incomplete
+  bool ok() const { return !_failed; }
+  size_t size() const { return _records.size(); }
+  SyncAction::Kind kind(size_t i) const { return _records[i].kind; }
+  bool get(size_t i, SyncAction *action);
+  // Closes the spool file; the caller removes it (spoolPath())
+  void close();
+  const char *spoolPath() const { return _path; }
+
+ private:
+  friend class SyncPlanner;
+  struct Record {
+    uint32_t offset;  // of its line in the spool
+    uint32_t size;
+    SyncAction::Kind kind;
+    bool dropped;  // superseded by a later item for the same path
+  };
+
+  bool readLine(uint32_t offset, std::string *line);
+
+  File32 _spool;
+  const char *_path = nullptr;
+  uint32_t _end = 0;
+  bool _failed = false;
+  std::vector<Record> _records;
+};
+
+const char *syncActionName(SyncAction::Kind kind);
+
+// Diffs the manifest against the state DB and the card one item at a time,
+// so the manifest never has to be held in memory: add() classifies an item
+// as soon as the parser produces it, finish() adds the deletions, ahead of
+// everything else in the plan. When the manifest lists a path twice the
+// later item wins, as if the earlier one wasn't there.
+//  ADD     not installed yet           UPDATE  hash/size changed or file missing
+//  DELETE  its manifest item is gone   KEEP    up to date
+//  ADOPT   already on the card with the right size but not in the state DB
+// With `trashUntracked`, card files that neither the manifest nor the state
+// knows about are deleted too (internal dot-files at the root, and the partial
+// download of an item still to be fetched, excepted).
+// `state` and `index` must not change until finish().
+class SyncPlanner {
+ public:
+  SyncPlanner(SdFat &fs, const SyncState &state, const FileIndex &index, bool trashUntracked,
+              const char *spoolPath = "/.sync_plan");
+
+  // Creates the spool file; false if it can't
+  bool begin();
+  void add(const ManifestItem &item);
+  SyncPlan finish();
+
+ private:
+  // What a path's earlier manifest item became: nothing yet, KEEP, or
+  // record (claim - 1) of the plan
+  static constexpr uint32_t UNCLAIMED = 0;
+  static constexpr uint32_t CLAIM_KEEP = 0xFFFFFFFF;
+
+  uint32_t push(SyncAction::Kind kind, const ManifestItem &item);
+  uint32_t *claimSlot(const ManifestItem &item, const SyncState::Entry *st, const FileIndex::Entry *f);
+  void drop(uint32_t claim);
+  void markOrigin(const std::string &origin);
+  void markPartial(const std::string &path);
+
+  SdFat &_fs;
+  const SyncState &_state;
+  const FileIndex &_index;
+  bool _trashUntracked;
+  SyncPlan _plan;
+  // One bit per state/index entry: referenced by some manifest item
+  std::vector<bool> _stateSeen;
+  std::vector<bool> _indexSeen;
+  // Per state/index entry, and for new paths (path hash, claim) sorted by
+  // hash: the claim of the manifest item naming it, to find duplicates
+  std::vector<uint32_t> _stateClaim;
+  std::vector<uint32_t> _indexClaim;
+  std::vector<std::pair<uint32_t, uint32_t>> _newClaim;
+  // (origin, state entry) sorted by origin, to find bundle members
+  std::vector<std::pair<std::string, size_t>> _byOrigin;
+};
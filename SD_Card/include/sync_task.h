@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Runs the boot sync (SD benchmark, WiFi, manifest, downloads, extraction,
+// trash) on its own task so loop() keeps serving the buttons and screen.
+//
+// The job never draws: it post()s events, and loop() poll()s them and does
+// the drawing, since only the loop task touches the display. Progress
+// events replace a queued progress event rather than queueing behind it, so
+// a slow UI sees the latest numbers, not a backlog. When the queue is full
+// the oldest event is dropped.
+//
+// SdFat is not thread-safe. The job holds cardLock() while it uses the card
+// (one sync action at a time, so the UI gets a turn between files); the UI
+// takes it with try_lock and leaves the card alone when it is busy.
+//
+// Without FreeRTOS (Linux host), or if the task can't be created, start()
+// runs the job inline.
+class SyncTask {
+ public:
+  struct Event {
+    enum Kind { STATUS, PROGRESS, ITEM_DONE, FINISHED };
+    Kind kind;
+    char text[48];       // status line, or the file being transferred
+    char detail[48];     // STATUS: second line
+    uint64_t done;       // PROGRESS: bytes so far
+    int64_t total;       // PROGRESS: -1 if unknown
+    uint32_t elapsedMs;  // PROGRESS
+    bool ok;             // ITEM_DONE, FINISHED
+  };
+  using Job = std::function<bool(SyncTask &)>;
+
+  struct Stats {
+    uint32_t posted;
+    uint32_t coalesced;  // progress folded into a queued one
+    uint32_t dropped;    // queue full
+  };
+
+  SyncTask() {}
+  ~SyncTask();
+
+  bool begin(size_t queueDepth = 16);
+  // False if a job is already running or begin() wasn't called
+  bool start(Job job, int core, int priority, uint32_t stackBytes);
+  bool running() const { return _running; }
+
+  // Job side: check cancelled() between steps and stop early
+  void cancel() { _cancel = true; }
+  bool cancelled() const { return _cancel; }
+  void setPriority(int priority);
+  int priority() const { return _priority; }
+
+  void post(const Event &e);
+  void status(const char *text, const char *detail = "");
+  void progress(const char *name, uint64_t done, int64_t total, uint32_t elapsedMs);
+  void itemDone(const char *name, bool ok);
+
+  // UI side: next event, false if none
+  bool poll(Event *e);
+
+  std::mutex &cardLock() { return _card; }
+  Stats stats();
+
+  // Task body; public for the task trampoline
+  void run();
+
+ private:
+  std::mutex _lock;
+  Event *_queue = nullptr;
+  size_t _depth = 0;
+  size_t _head = 0;   // oldest
+  size_t _count = 0;
+
+  Job _job;
+  std::mutex _card;
+  std::atomic<bool> _running{false};
+  std::atomic<bool> _cancel{false};
+  int _priority = 0;
+  void *_task = nullptr;  // TaskHandle_t
+
+  Stats _stats = {};
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "block_device.h"
+
+// Read-only virtual FAT volume that exposes a subset of the card's files.
+//
+// The virtual volume keeps the real volume's geometry (partition offset, FAT
+// type, cluster size, cluster count), so data cluster N of the virtual volume
+// *is* data cluster N of the card: file contents are passed straight through
+// to the card, while the boot sector, FSInfo, FATs and directories are
+// synthesised in RAM. Only the chains of the selected files (plus the
+// virtual directories) appear in the FAT; every other cluster reads as free.
+//
+// Switching playlists is a rebuild in RAM; nothing is written to the card.
+class VirtualFat : public BlockDevice {
+ public:
+  struct Entry {
+    std::string path;       // relative to the virtual root, '/' separated
+    uint32_t size;
+    uint32_t firstCluster;  // 0 for empty files
+    uint16_t date;          // FAT date/time; 0 = use a fixed default
+    uint16_t time;
+  };
+
+  struct Info {
+    uint8_t fatType;     // 12, 16 or 32
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t fragments;  // cluster runs across all exposed files
+    uint32_t skipped;    // entries dropped (bad chain, overlap, ...)
+  };
+
+  explicit VirtualFat(BlockDevice &card) : _card(card) {}
+
+  // Parse the card's volume and build a view containing only `files`.
+  // `label` (up to 11 chars) becomes the volume label.
+  bool build(const std::vector<Entry> &files, const char *label);
+  void clear();
+  bool active();
+  Info info();
+
+  uint32_t sectorCount() override { return _card.sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override;
+  bool writeSectors(uint32_t, const uint8_t *, size_t) override { return false; }
+  bool sync() override { return true; }
+
+ private:
+  struct Geometry {
+    uint32_t partStart;
+    uint32_t totalSectors;
+    uint16_t reserved;
+    uint8_t numFats;
+    uint32_t fatSectors;
+    uint16_t rootEntries;   // FAT12/16 fixed root directory
+    uint32_t rootSectors;
+    uint32_t dataStart;     // relative to partStart
+    uint8_t spc;            // sectors per cluster
+    uint32_t clusters;
+    uint8_t fatType;
+    uint16_t fsInfo;        // FAT32 only
+    uint16_t backupBoot;    // FAT32 only, 0 = none
+    uint8_t media;
+  };
+
+  enum RunKind : uint8_t { RUN_FILE, RUN_DIR };
+
+  // A stretch of consecutive clusters in one chain.
+  struct Run {
+    uint32_t first;
+    uint32_t count;
+    uint32_t next;       // cluster after the run's last one, or EOC
+    uint32_t dir;        // RUN_DIR: owning directory
+    uint32_t dirOffset;  // RUN_DIR: cluster index of `first` within that directory
+    RunKind kind;
+  };
+
+  struct Child {
+    std::string name;
+    bool isDir;
+    uint32_t index;  // into _dirs (isDir) or the build's file list
+  };
+
+  struct Dir {
+    uint32_t parent;
+    std::vector<Child> children;
+    std::vector<uint8_t> bytes;
+    uint32_t firstCluster;  // 0 = FAT12/16 fixed root
+  };
+
+  bool readGeometry(Geometry *g);
+  bool readChain(uint32_t first, std::vector<Run> *out);
+  bool readFatEntry(uint32_t cluster, uint32_t *value);
+  uint32_t eoc() const;
+  uint32_t fatEntry(uint32_t cluster) const;
+  const Run *findRun(uint32_t cluster) const;
+  bool allocDirClusters(uint32_t dir, uint32_t count, uint32_t *cursor);
+  void encodeDir(uint32_t dir, const std::vector<Entry> &files);
+
+  void synthBoot(uint8_t *dst);
+  void synthFsInfo(uint8_t *dst);
+  void synthFat(uint32_t fatSector, uint8_t *dst);
+  // Returns false if `sector` has to be read from the card unchanged.
+  bool synthSector(uint32_t sector, uint8_t *dst);
+
+  BlockDevice &_card;
+  std::mutex _lock;
+  bool _active = false;
+  Geometry _g = {};
+  uint8_t _bootSector[BLOCK_SIZE];
+  std::vector<Run> _runs;  // sorted by first cluster
+  std::vector<Dir> _dirs;  // [0] is the root
+  std::vector<Run> _dirRuns;  // directory clusters while building
+  uint32_t _serial = 0;
+  char _label[11];
+  Info _info = {};
+
+  // One-sector cache for reading the card's FAT while building
+  uint32_t _fatCacheSector = 0xFFFFFFFF;
+  uint8_t _fatCache[2 * BLOCK_SIZE];
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <mutex>
+#include "block_device.h"
+
+// Write-combining stage for the MSC write path.
+//
+// Host writes arrive in 4-64 KB pieces, sometimes not sector aligned. Pieces
+// that continue (or overlap) the pending extent are merged in a staging
+// buffer and go to the card as one large writeSectors() call once the buffer
+// is full, the next write lands somewhere else, flush()/sync() is called or
+// the writer has been idle for `idleMs` (see poll()). Unaligned head/tail
+// bytes are only read-modify-written once per flush, not once per piece.
+//
+// Reads are overlaid with pending bytes, so the host always sees its writes.
+class WriteCombiner : public BlockDevice {
+ public:
+  struct Stats {
+    uint32_t hostWrites;     // write() calls
+    uint32_t mergedWrites;   // ... that extended the pending extent
+    uint32_t flushes;        // writeSectors() calls issued
+    uint32_t sectorsWritten;
+    uint32_t rmwSectors;     // partial sectors that had to be read first
+    uint32_t idleFlushes;
+  };
+
+  explicit WriteCombiner(BlockDevice &lower) : _lower(lower) {}
+  ~WriteCombiner() { end(); }
+
+  bool begin(size_t bufferSectors, uint32_t idleMs = 250);
+  void end();
+  bool active() const { return _buf != nullptr; }
+
+  // Byte-granular write starting `offset` bytes into sector `lba`.
+  bool write(uint32_t lba, uint32_t offset, const uint8_t *src, uint32_t len);
+  bool flush();
+  // Flush if nothing was written for idleMs. Call periodically with millis().
+  void poll(uint32_t nowMs);
+  bool pending();
+
+  uint32_t sectorCount() override { return _lower.sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override;
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    return write(sector, 0, src, (uint32_t)(count * BLOCK_SIZE));
+  }
+  bool sync() override;
+
+  Stats stats();
+  void resetStats();
+
+ private:
+  bool flushLocked();
+
+  BlockDevice &_lower;
+  std::mutex _lock;
+
+  uint8_t *_buf = nullptr;  // staging, starts at sector _base
+  size_t _capBytes = 0;
+  uint32_t _idleMs = 250;
+
+  // Pending bytes are [_start, _end) in absolute card byte offsets.
+  bool _pending = false;
+  uint32_t _base = 0;
+  uint64_t _start = 0;
+  uint64_t _end = 0;
+  // poll() notices new writes through _writeSeq and restarts the idle clock
+  uint32_t _writeSeq = 0;
+  uint32_t _seenSeq = 0;
+  uint32_t _idleSince = 0;
+
+  Stats _stats = {};
+};
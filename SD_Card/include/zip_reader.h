@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include "SdFat.h"
+#include "miniz.h"
+
+// Buffered reader under miniz's m_pRead callback.
+//
+// miniz asks for data by (offset, length), often a few dozen bytes at a
+// time: local headers, inflate input in small pieces, the end-of-central-
+// directory search. Served straight from the file, each request is a seek
+// plus a short read on the card. Here requests are served from two windows:
+//  - a read-ahead window, sector aligned, refilled with one large read when
+//    a request falls outside it (sequential inflate input streams through);
+//  - a tail window holding the end of the archive, where the central
+//    directory and its end record live, loaded once, so parsing the
+//    directory doesn't evict the read-ahead window and vice versa.
+// Requests at least as large as the window bypass it.
+//
+// Stored (uncompressed) entries, the usual case for bundles of MP3/M4A, can
+// skip miniz altogether: copyStored() streams the entry's bytes from the
+// archive to a sink in window-sized reads cut to whole clusters of the
+// destination, with the CRC computed on the way.
+class BufferedZipReader {
+ public:
+  struct Stats {
+    uint32_t requests;    // m_pRead calls from miniz
+    uint64_t requested;   // bytes miniz asked for
+    uint32_t sdReads;     // read calls that reached the card
+    uint64_t sdBytes;     // bytes read from the card
+  };
+
+  explicit BufferedZipReader(File32 &file) : _file(file) {}
+  ~BufferedZipReader() { end(); }
+
+  bool begin(size_t windowBytes, size_t tailBytes);
+  void end();
+
+  size_t read(uint64_t ofs, void *buf, size_t n);
+  Stats stats() const { return _stats; }
+
+  // Archive offset of the entry's (compressed) data, checked against the
+  // archive size. False on a read error or a bad local header.
+  bool dataOffset(const mz_zip_archive_file_stat &st, uint64_t *ofs);
+
+  // True if `st` can go through copyStored()
+  static bool isStored(const mz_zip_archive_file_stat &st);
+  // Copy a stored entry to `sink`, in chunks that are multiples of `align`
+  // (the sink's cluster size; 0 for any) but the last. False on a read
+  // error, a bad local header, a sink failure or a CRC mismatch.
+  bool copyStored(const mz_zip_archive_file_stat &st, const std::function<bool(const uint8_t *, size_t)> &sink,
+                  size_t align = 0);
+
+  // m_pRead trampoline; m_pIO_opaque must point at the reader
+  static size_t mzRead(void *opaque, mz_uint64 ofs, void *buf, size_t n);
+
+ private:
+  bool load(uint64_t ofs, uint8_t *dst, size_t n);
+
+  File32 &_file;
+  uint64_t _size = 0;
+
+  uint8_t *_win = nullptr;
+  size_t _winBytes = 0;
+  uint64_t _winStart = 0;
+  size_t _winLen = 0;  // valid bytes
+
+  uint8_t *_tail = nullptr;
+  uint64_t _tailStart = 0;
+  size_t _tailLen = 0;
+  bool _tailLoaded = false;
+
+  Stats _stats = {};
+};
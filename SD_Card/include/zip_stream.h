@@ -0,0 +1,63 @@
+#pragma once
+
+#include "miniz.h"
+#include "stream_extractor.h"
+
+// Streaming extraction of a zip archive: local file headers are parsed as
+// they arrive and each entry is inflated straight into its destination.
+//
+// Extraction is complete once the central directory starts (done()).
+// Entries are CRC-checked; deflate streams with a trailing data descriptor
+// are handled. Encrypted entries, methods other than stored and deflate, and
+// stored entries with a data descriptor (length unknowable without the
+// central directory) make the archive fail, so the caller can fall back to
+// the download-then-unzip path.
+class ZipStreamExtractor : public StreamExtractor {
+ public:
+  ZipStreamExtractor() {}
+  ~ZipStreamExtractor() override { end(); }
+
+  bool begin(const Target &target) override;
+  void end() override;
+
+  bool feed(const uint8_t *data, size_t len) override;
+  bool done() const override { return _state == DONE; }
+  const char *error() const override { return _error; }
+  Stats stats() const override { return _stats; }
+
+ private:
+  enum State { HEADER, META, STORED, DEFLATE, DESCRIPTOR, DONE, FAILED };
+
+  // Copy up to `need` bytes into _buf; true once it holds `need`
+  bool gather(const uint8_t *&data, size_t &len, size_t need);
+  bool startEntry();
+  size_t inflateSome(const uint8_t *data, size_t len);
+  void emit(const uint8_t *data, size_t len);
+  bool finishEntry();
+  bool fail(const char *why);
+
+  Target _target;
+  State _state = HEADER;
+  const char *_error = nullptr;
+
+  std::string _buf;  // header / name / extra / descriptor bytes so far
+
+  // Current entry
+  uint16_t _flags = 0;
+  uint16_t _method = 0;
+  uint32_t _crc = 0;        // expected
+  uint64_t _compLeft = 0;   // compressed bytes still to come (no descriptor)
+  uint64_t _uncompSize = 0;
+  bool _zip64 = false;
+  bool _skip = false;       // consume but don't write
+  bool _open = false;       // Target::open succeeded
+  bool _writeOk = true;
+  uint32_t _outCrc = 0;
+  uint64_t _outBytes = 0;
+
+  tinfl_decompressor *_inflator = nullptr;
+  uint8_t *_dict = nullptr;  // TINFL_LZ_DICT_SIZE ring, also the output window
+  size_t _dictOfs = 0;
+
+  Stats _stats = {};
+};
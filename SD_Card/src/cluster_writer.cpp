@@ -0,0 +1,94 @@
+#include "cluster_writer.h"
+
+#include <string.h>
+#include "psram.h"
+
+ClusterWriter::ClusterWriter(SdFat &fs, File32 &file) : _fs(fs), _file(file) {
+  _cluster = fs.bytesPerCluster();
+  if (_cluster == 0) _cluster = 512;
+  _pos = file.curPosition();
+}
+
+ClusterWriter::~ClusterWriter() {
+  psramFree(_buf);
+}
+
+bool ClusterWriter::preallocate(uint64_t size) {
+  if (size == 0 || size > 0xFFFFFFFF || _file.fileSize() != 0) return false;
+  if (!_file.preAllocate(size)) return false;
+  _prealloc = size;
+  return true;
+}
+
+bool ClusterWriter::writeDirect(const uint8_t *data, size_t len) {
+  if (_file.write(data, len) != len) {
+    _ok = false;
+    return false;
+  }
+  _pos += len;
+  return true;
+}
+
+bool ClusterWriter::write(const uint8_t *data, size_t len) {
+  if (!_ok) return false;
+  while (len > 0) {
+    if (_fill == 0) {
+      // Aligned and at least a cluster: write whole clusters in place
+      size_t head = (size_t)(_pos % _cluster);
+      size_t whole = head == 0 ? (len / _cluster) * _cluster : 0;
+      if (whole) {
+        if (!writeDirect(data, whole)) return false;
+        data += whole;
+        len -= whole;
+        continue;
+      }
+    }
+    if (!_buf) {
+      _buf = (uint8_t *)psramAlloc(_cluster);
+      // No buffer to spare: unaligned writes still work, just not batched
+      if (!_buf) return writeDirect(data, len);
+    }
+    // Fill up to the next cluster boundary
+    size_t room = _cluster - (size_t)((_pos + _fill) % _cluster);
+    size_t n = len < room ? len : room;
+    memcpy(_buf + _fill, data, n);
+    _fill += n;
+    data += n;
+    len -= n;
+    if ((_pos + _fill) % _cluster == 0) {
+      size_t fill = _fill;
+      _fill = 0;
+      if (!writeDirect(_buf, fill)) return false;
+    }
+  }
+  return true;
+}
+
+bool ClusterWriter::finish() {
+  if (_fill) {
+    size_t fill = _fill;
+    _fill = 0;
+    writeDirect(_buf, fill);
+  }
+  // preAllocate() set the file size to the reservation; cut it back to what
+  // was written and free the clusters after it
+  if (_prealloc && _pos < _prealloc && !_file.truncate((uint32_t)_pos)) _ok = false;
+  return _ok;
+}
+
+#if CLUSTER_FRAGMENT_STATS
+uint32_t countFragments(SdFat &fs, File32 &file) {
+  uint32_t c = file.firstCluster();
+  if (c < 2) return 0;
+  if (file.isContiguous()) return 1;
+  uint32_t fragments = 1;
+  uint32_t next;
+  for (uint32_t steps = 0; steps < fs.clusterCount(); steps++) {
+    // 1: next link, 0: end of chain, -1: read error
+    if (fs.dbgFat(c, &next) != 1) break;
+    if (next != c + 1) fragments++;
+    c = next;
+  }
+  return fragments;
+}
+#endif
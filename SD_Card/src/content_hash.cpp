@@ -0,0 +1,213 @@
+#include "content_hash.h"
+
+#include <string.h>
+#include "miniz.h"
+
+#if defined(ESP32)
+#include <mbedtls/sha256.h>
+#endif
+
+// --- expected values ---
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool parseHex(const std::string &s, size_t ofs, uint8_t *out, size_t bytes) {
+  if (s.size() - ofs != bytes * 2) return false;
+  for (size_t i = 0; i < bytes; i++) {
+    int hi = hexValue(s[ofs + 2 * i]);
+    int lo = hexValue(s[ofs + 2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out[i] = (uint8_t)(hi << 4 | lo);
+  }
+  return true;
+}
+
+ExpectedHash parseExpectedHash(const std::string &value) {
+  ExpectedHash e = {};
+  size_t ofs = 0;
+  if (value.compare(0, 7, "sha256:") == 0) ofs = 7;
+  else if (value.compare(0, 6, "crc32:") == 0) ofs = 6;
+
+  if (ofs != 6 && parseHex(value, ofs, e.sha256, 32)) {
+    e.kind = ExpectedHash::SHA256;
+    return e;
+  }
+  uint8_t crc[4];
+  if (ofs != 7 && parseHex(value, ofs, crc, 4)) {
+    e.kind = ExpectedHash::CRC32;
+    e.crc = (uint32_t)crc[0] << 24 | (uint32_t)crc[1] << 16 | (uint32_t)crc[2] << 8 | crc[3];
+    return e;
+  }
+  e.kind = ExpectedHash::NONE;
+  return e;
+}
+
+// --- SHA-256 ---
+
+#if defined(ESP32)
+
+static void *shaNew() {
+  mbedtls_sha256_context *c = new mbedtls_sha256_context;
+  mbedtls_sha256_init(c);
+  mbedtls_sha256_starts(c, 0);
+  return c;
+}
+static void shaUpdate(void *c, const uint8_t *data, size_t len) {
+  mbedtls_sha256_update((mbedtls_sha256_context *)c, data, len);
+}
+static void shaFinish(void *c, uint8_t out[32]) {
+  mbedtls_sha256_finish((mbedtls_sha256_context *)c, out);
+}
+static void shaFree(void *c) {
+  mbedtls_sha256_free((mbedtls_sha256_context *)c);
+  delete (mbedtls_sha256_context *)c;
+}
+
+#else
+
+// Portable FIPS 180-4 SHA-256 for builds without mbedtls (host tools, tests)
+struct Sha256State {
+  uint32_t h[8];
+  uint64_t total;
+  uint8_t block[64];
+  size_t used;
+};
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void shaBlock(Sha256State *s, const uint8_t *p) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4], f = s->h[5], g = s->h[6], h = s->h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+  }
+  s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+  s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void *shaNew() {
+  static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  Sha256State *s = new Sha256State;
+  memcpy(s->h, init, sizeof(init));
+  s->total = 0;
+  s->used = 0;
+  return s;
+}
+
+static void shaUpdate(void *c, const uint8_t *data, size_t len) {
+  Sha256State *s = (Sha256State *)c;
+  s->total += len;
+  while (len > 0) {
+    size_t n = 64 - s->used;
+    if (n > len) n = len;
+    memcpy(s->block + s->used, data, n);
+    s->used += n;
+    data += n;
+    len -= n;
+    if (s->used == 64) {
+      shaBlock(s, s->block);
+      s->used = 0;
+    }
+  }
+}
+
+static void shaFinish(void *c, uint8_t out[32]) {
+  Sha256State *s = (Sha256State *)c;
+  uint64_t bits = s->total * 8;
+  uint8_t pad = 0x80;
+  shaUpdate(s, &pad, 1);
+  pad = 0;
+  while (s->used != 56) shaUpdate(s, &pad, 1);
+  uint8_t len[8];
+  for (int i = 0; i < 8; i++) len[i] = (uint8_t)(bits >> (56 - 8 * i));
+  shaUpdate(s, len, 8);
+  for (int i = 0; i < 8; i++) {
+    out[4 * i] = (uint8_t)(s->h[i] >> 24);
+    out[4 * i + 1] = (uint8_t)(s->h[i] >> 16);
+    out[4 * i + 2] = (uint8_t)(s->h[i] >> 8);
+    out[4 * i + 3] = (uint8_t)s->h[i];
+  }
+}
+
+static void shaFree(void *c) {
+  delete (Sha256State *)c;
+}
+
+#endif
+
+// --- StreamHasher ---
+
+StreamHasher::StreamHasher() {}
+
+StreamHasher::~StreamHasher() {
+  if (_ctx) shaFree(_ctx);
+}
+
+void StreamHasher::begin(bool sha256) {
+  if (_ctx) shaFree(_ctx);
+  _ctx = nullptr;
+  _crc = MZ_CRC32_INIT;
+  _bytes = 0;
+  _sha = sha256;
+  _shaDone = false;
+  if (sha256) _ctx = shaNew();
+}
+
+void StreamHasher::update(const uint8_t *data, size_t len) {
+  _crc = (uint32_t)mz_crc32(_crc, data, len);
+  _bytes += len;
+  if (_ctx && !_shaDone) shaUpdate(_ctx, data, len);
+}
+
+void StreamHasher::finishSha() {
+  if (!_ctx || _shaDone) return;
+  shaFinish(_ctx, _digest);
+  _shaDone = true;
+}
+
+bool StreamHasher::matches(const ExpectedHash &expected) {
+  switch (expected.kind) {
+    case ExpectedHash::CRC32:
+      return _crc == expected.crc;
+    case ExpectedHash::SHA256:
+      finishSha();
+      return _shaDone && memcmp(_digest, expected.sha256, 32) == 0;
+    default:
+      return true;
+  }
+}
+
+std::string StreamHasher::sha256Hex() const {
+  if (!_shaDone) return std::string();
+  static const char *digits = "0123456789abcdef";
+  std::string hex;
+  for (int i = 0; i < 32; i++) {
+    hex += digits[_digest[i] >> 4];
+    hex += digits[_digest[i] & 15];
+  }
+  return hex;
+}
@@ -0,0 +1,164 @@
+#include "download_pipeline.h"
+
+#include <chrono>
+#include "psram.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+static uint32_t nowMs() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool DownloadPipeline::begin(size_t bufferBytes, size_t buffers) {
+  end();
+  if (bufferBytes == 0 || buffers < 2) return false;
+
+  Buffer *bufs = new Buffer[buffers];
+  for (size_t i = 0; i < buffers; i++) {
+    bufs[i].len = 0;
+    bufs[i].data = (uint8_t *)psramAlloc(bufferBytes);
+    if (!bufs[i].data) {
+      for (size_t j = 0; j < i; j++) psramFree(bufs[j].data);
+      delete[] bufs;
+      return false;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _bufs = bufs;
+  _count = buffers;
+  _bufBytes = bufferBytes;
+  _head = _tail = _full = 0;
+  return true;
+}
+
+void DownloadPipeline::end() {
+  std::unique_lock<std::mutex> lk(_lock);
+  // Anything still queued is dropped, but not while the writer is using it
+  _cv.wait(lk, [this] { return !_writing; });
+  for (size_t i = 0; i < _count; i++) psramFree(_bufs[i].data);
+  delete[] _bufs;
+  _bufs = nullptr;
+  _count = 0;
+  _head = _tail = _full = 0;
+  _sink = nullptr;
+}
+
+#if defined(ESP32)
+static void downloadWriterTask(void *arg) {
+  DownloadPipeline *p = (DownloadPipeline *)arg;
+  for (;;) p->drain(true);
+}
+#endif
+
+bool DownloadPipeline::startWorker(int core, int priority) {
+#if defined(ESP32)
+  if (_task) return true;
+  TaskHandle_t h = nullptr;
+  if (xTaskCreatePinnedToCore(downloadWriterTask, "dl_write", 6144, this, priority, &h, core) != pdPASS) return false;
+  _task = h;
+  return true;
+#else
+  (void)core;
+  (void)priority;
+  return false;
+#endif
+}
+
+bool DownloadPipeline::start(Sink sink) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_count || !sink) return false;
+  _sink = std::move(sink);
+  _failed = false;
+  _stats = {};
+  _fillStart = 0;
+  return true;
+}
+
+uint8_t *DownloadPipeline::acquire(size_t *room) {
+  std::unique_lock<std::mutex> lk(_lock);
+  if (!_count) return nullptr;
+  uint32_t t0 = nowMs();
+  // The buffer at _head is free unless every buffer is queued
+  _cv.wait(lk, [this] { return _failed || _full < _count; });
+  _stats.netWaitMs += nowMs() - t0;
+  if (_failed) return nullptr;
+
+  Buffer &b = _bufs[_head];
+  *room = _bufBytes - b.len;
+  _fillStart = nowMs();
+  return b.data + b.len;
+}
+
+void DownloadPipeline::commit(size_t n) {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_count) return;
+    _stats.netBusyMs += nowMs() - _fillStart;
+    _bufs[_head].len += n;
+    _stats.bytes += n;
+    if (_bufs[_head].len >= _bufBytes) submitLocked();
+  }
+  if (!_task) drain(false);
+}
+
+void DownloadPipeline::submitLocked() {
+  _head = (_head + 1) % _count;
+  _full++;
+  _stats.buffers++;
+  _cv.notify_all();
+}
+
+bool DownloadPipeline::finish() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_count) return false;
+    if (_bufs[_head].len) submitLocked();
+  }
+  if (!_task) drain(false);
+
+  std::unique_lock<std::mutex> lk(_lock);
+  _cv.wait(lk, [this] { return _full == 0; });
+  _sink = nullptr;
+  return !_failed;
+}
+
+void DownloadPipeline::drain(bool block) {
+  std::unique_lock<std::mutex> lk(_lock);
+  for (;;) {
+    // One drainer at a time, buffers go to the sink in order
+    if (_full == 0 || _writing) {
+      if (!block) return;
+      uint32_t t0 = nowMs();
+      _cv.wait(lk, [this] { return _full > 0 && !_writing; });
+      // Only count idle time inside a transfer
+      if (_sink) _stats.sdWaitMs += nowMs() - t0;
+    }
+
+    Buffer &b = _bufs[_tail];
+    _writing = true;
+    bool skip = _failed;  // after a failure the rest is just dropped
+    lk.unlock();
+    uint32_t t0 = nowMs();
+    bool ok = skip || _sink(b.data, b.len);
+    uint32_t busy = nowMs() - t0;
+    lk.lock();
+
+    _stats.sdBusyMs += busy;
+    if (!ok) _failed = true;
+    b.len = 0;
+    _tail = (_tail + 1) % _count;
+    _full--;
+    _writing = false;
+    _cv.notify_all();
+  }
+}
+
+DownloadPipeline::Stats DownloadPipeline::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
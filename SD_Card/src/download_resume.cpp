@@ -0,0 +1,71 @@
+#include "download_resume.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t OFFSET_DIGITS = 20;
+
+bool ResumeSidecar::load(const std::string &tmpPath, uint64_t *offset, std::string *validator) {
+  File32 f = _fs.open(pathFor(tmpPath).c_str(), O_RDONLY);
+  if (!f) return false;
+  char buf[320];
+  int n = f.read(buf, sizeof(buf) - 1);
+  f.close();
+  if (n <= (int)OFFSET_DIGITS) return false;
+  buf[n] = 0;
+
+  // "<offset>\n<validator>\n"; a torn write leaves no second newline
+  char *nl = (char *)memchr(buf, '\n', n);
+  if (!nl) return false;
+  *nl = 0;
+  char *v = nl + 1;
+  char *end = (char *)memchr(v, '\n', n - (v - buf));
+  if (!end || end == v) return false;
+  *end = 0;
+  *offset = strtoull(buf, nullptr, 10);
+  *validator = v;
+
+  File32 tmp = _fs.open(tmpPath.c_str(), O_RDONLY);
+  if (!tmp) return false;
+  uint64_t have = tmp.fileSize();
+  tmp.close();
+  return *offset > 0 && have >= *offset;
+}
+
+bool ResumeSidecar::begin(const std::string &tmpPath, const std::string &validator, uint64_t offset) {
+  end();
+  if (validator.empty() || validator.size() > 256) return false;
+  _file = _fs.open(pathFor(tmpPath).c_str(), O_RDWR | O_CREAT);
+  _validator = validator;
+  if (!_file.isOpen()) return false;
+
+  // Whole record over the old one, then cut off whatever a longer old
+  // validator left behind
+  char head[OFFSET_DIGITS + 2];
+  snprintf(head, sizeof(head), "%020llu\n", (unsigned long long)offset);
+  uint32_t len = OFFSET_DIGITS + 1 + _validator.size() + 1;
+  bool ok = _file.seekSet(0) && _file.write(head, OFFSET_DIGITS + 1) == OFFSET_DIGITS + 1 &&
+            _file.write(_validator.data(), _validator.size()) == _validator.size() && _file.write("\n", 1) == 1;
+  ok = ok && (_file.fileSize() == len || _file.truncate(len));
+  return _file.sync() && ok;
+}
+
+bool ResumeSidecar::checkpoint(uint64_t offset) {
+  if (!_file.isOpen()) return false;
+  // The validator is already there (begin()); only the offset changes
+  char head[OFFSET_DIGITS + 2];
+  snprintf(head, sizeof(head), "%020llu\n", (unsigned long long)offset);
+  bool ok = _file.seekSet(0) && _file.write(head, OFFSET_DIGITS + 1) == OFFSET_DIGITS + 1;
+  return _file.sync() && ok;
+}
+
+void ResumeSidecar::end() {
+  if (_file.isOpen()) _file.close();
+}
+
+void ResumeSidecar::remove(const std::string &tmpPath) {
+  end();
+  std::string p = pathFor(tmpPath);
+  if (_fs.exists(p.c_str())) _fs.remove(p.c_str());
+}
@@ -0,0 +1,258 @@
+#include "extract_pipeline.h"
+
+#include <chrono>
+#include <string.h>
+#include "psram.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+static uint32_t nowMs() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool ExtractPipeline::begin(size_t bufferBytes, size_t buffers) {
+  end();
+  if (bufferBytes == 0 || buffers < 2) return false;
+
+  uint8_t *dict = (uint8_t *)psramAlloc(TINFL_LZ_DICT_SIZE);
+  if (!dict) return false;
+  Buffer *bufs = new Buffer[buffers];
+  for (size_t i = 0; i < buffers; i++) {
+    bufs[i].len = 0;
+    bufs[i].last = false;
+    bufs[i].data = (uint8_t *)psramAlloc(bufferBytes);
+    if (!bufs[i].data) {
+      for (size_t j = 0; j < i; j++) psramFree(bufs[j].data);
+      delete[] bufs;
+      psramFree(dict);
+      return false;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _bufs = bufs;
+  _count = buffers;
+  _bufBytes = bufferBytes;
+  _head = _tail = _full = 0;
+  _dict = dict;
+  _inflator = new tinfl_decompressor;
+  return true;
+}
+
+void ExtractPipeline::end() {
+  std::unique_lock<std::mutex> lk(_lock);
+  _srcLeft = 0;
+  _src = nullptr;
+  _cv.wait(lk, [this] { return !_reading; });
+  for (size_t i = 0; i < _count; i++) psramFree(_bufs[i].data);
+  delete[] _bufs;
+  _bufs = nullptr;
+  _count = 0;
+  _head = _tail = _full = 0;
+  delete _inflator;
+  _inflator = nullptr;
+  psramFree(_dict);
+  _dict = nullptr;
+}
+
+#if defined(ESP32)
+static void extractReaderTask(void *arg) {
+  ExtractPipeline *p = (ExtractPipeline *)arg;
+  for (;;) p->fill(true);
+}
+#endif
+
+bool ExtractPipeline::startWorker(int core, int priority) {
+#if defined(ESP32)
+  if (_task) return true;
+  TaskHandle_t h = nullptr;
+  if (xTaskCreatePinnedToCore(extractReaderTask, "unz_read", 6144, this, priority, &h, core) != pdPASS) return false;
+  _task = h;
+  return true;
+#else
+  (void)core;
+  (void)priority;
+  return false;
+#endif
+}
+
+void ExtractPipeline::fill(bool block) {
+  std::unique_lock<std::mutex> lk(_lock);
+  for (;;) {
+    auto canRead = [this] { return _count && _srcLeft > 0 && _full < _count && !_reading; };
+    if (!canRead()) {
+      if (!block) return;
+      // Only a full ring during an entry is time lost to the inflater
+      bool stalled = _srcLeft > 0;
+      uint32_t t0 = nowMs();
+      _cv.wait(lk, canRead);
+      if (stalled) _stats.readWaitMs += nowMs() - t0;
+    }
+
+    Buffer &b = _bufs[_head];
+    BufferedZipReader *src = _src;
+    uint64_t at = _srcOfs;
+    size_t n = _srcLeft < _bufBytes ? (size_t)_srcLeft : _bufBytes;
+    _srcOfs += n;
+    _srcLeft -= n;
+    b.last = _srcLeft == 0;
+    _reading = true;
+    lk.unlock();
+
+    uint32_t t0 = nowMs();
+    size_t got;
+    {
+      std::lock_guard<std::mutex> card(_cardLock);
+      got = src->read(at, b.data, n);
+    }
+    uint32_t busy = nowMs() - t0;
+    lk.lock();
+
+    _stats.readBusyMs += busy;
+    _reading = false;
+    if (got != n) {
+      _readFailed = true;
+      _srcLeft = 0;
+    } else {
+      b.len = n;
+      _head = (_head + 1) % _count;
+      _full++;
+      _stats.inBytes += n;
+    }
+    _cv.notify_all();
+  }
+}
+
+ExtractPipeline::Buffer *ExtractPipeline::take() {
+  if (!_task) fill(false);
+  std::unique_lock<std::mutex> lk(_lock);
+  uint32_t t0 = nowMs();
+  _cv.wait(lk, [this] { return _full > 0 || _readFailed || (_srcLeft == 0 && !_reading); });
+  _stats.inflateInWaitMs += nowMs() - t0;
+  // Whatever was read before a failure is still handed out first
+  return _full ? &_bufs[_tail] : nullptr;
+}
+
+void ExtractPipeline::release() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _bufs[_tail].len = 0;
+  _tail = (_tail + 1) % _count;
+  _full--;
+  _cv.notify_all();
+}
+
+void ExtractPipeline::stopJob() {
+  std::unique_lock<std::mutex> lk(_lock);
+  _srcLeft = 0;
+  _cv.wait(lk, [this] { return !_reading; });
+  for (size_t i = 0; i < _count; i++) _bufs[i].len = 0;
+  _head = _tail = _full = 0;
+  _src = nullptr;
+  _readFailed = false;
+  _cv.notify_all();
+}
+
+bool ExtractPipeline::emit(DownloadPipeline &out, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    size_t room;
+    uint8_t *dst = out.acquire(&room);
+    if (!dst) return false;
+    size_t n = len < room ? len : room;
+    memcpy(dst, data, n);
+    out.commit(n);
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool ExtractPipeline::inflateEntry(BufferedZipReader &reader, const mz_zip_archive_file_stat &st,
+                                   DownloadPipeline &out) {
+  if (!_count) return false;
+  uint64_t data;
+  {
+    std::lock_guard<std::mutex> card(_cardLock);
+    if (!reader.dataOffset(st, &data)) return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _src = &reader;
+    _srcOfs = data;
+    _srcLeft = st.m_comp_size;
+    _readFailed = false;
+    _stats.entries++;
+    _cv.notify_all();
+  }
+
+  tinfl_init(_inflator);
+  size_t dictOfs = 0;
+  uint32_t crc = MZ_CRC32_INIT;
+  uint64_t outBytes = 0;
+  bool done = false;     // end of the deflate stream
+  bool exact = false;    // ... on the last compressed byte
+  bool bad = false;
+
+  while (!done && !bad) {
+    Buffer *b = take();
+    if (!b) break;
+
+    uint32_t t0 = nowMs();
+    DownloadPipeline::Stats before = out.stats();
+    size_t pos = 0;
+    for (;;) {
+      size_t inSize = b->len - pos;
+      size_t outSize = TINFL_LZ_DICT_SIZE - dictOfs;
+      mz_uint32 flags = b->last ? 0 : TINFL_FLAG_HAS_MORE_INPUT;
+      tinfl_status s = tinfl_decompress(_inflator, b->data + pos, &inSize, _dict, _dict + dictOfs, &outSize, flags);
+      pos += inSize;
+      if (outSize) {
+        crc = (uint32_t)mz_crc32(crc, _dict + dictOfs, outSize);
+        outBytes += outSize;
+        if (!emit(out, _dict + dictOfs, outSize)) {
+          bad = true;
+          break;
+        }
+        dictOfs = (dictOfs + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+      }
+      if (s == TINFL_STATUS_DONE) {
+        done = true;
+        exact = b->last && pos == b->len;
+        break;
+      }
+      if (s < 0 || (s == TINFL_STATUS_NEEDS_MORE_INPUT && b->last)) {
+        bad = true;
+        break;
+      }
+      if (s == TINFL_STATUS_NEEDS_MORE_INPUT) break;
+      // HAS_MORE_OUTPUT: the window wrapped, go round again
+    }
+    // Time blocked on a free output buffer is the writer's, not ours
+    uint32_t outWait = out.stats().netWaitMs - before.netWaitMs;
+    uint32_t elapsed = nowMs() - t0;
+    release();
+    std::lock_guard<std::mutex> guard(_lock);
+    _stats.inflateBusyMs += elapsed > outWait ? elapsed - outWait : 0;
+  }
+
+  stopJob();
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _stats.outBytes += outBytes;
+  }
+  return exact && crc == st.m_crc32 && outBytes == st.m_uncomp_size;
+}
+
+ExtractPipeline::Stats ExtractPipeline::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+void ExtractPipeline::resetStats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats = {};
+}
@@ -0,0 +1,41 @@
+#include "file_block_device.h"
+
+#include <sys/types.h>
+
+bool FileBlockDevice::open(const char *path, bool readOnly) {
+  close();
+  _fp = fopen(path, readOnly ? "rb" : "r+b");
+  if (!_fp) return false;
+  if (fseeko(_fp, 0, SEEK_END) != 0) { close(); return false; }
+  off_t bytes = ftello(_fp);
+  if (bytes < 0) { close(); return false; }
+  _sectors = (uint32_t)((uint64_t)bytes / BLOCK_SIZE);
+  _readOnly = readOnly;
+  return true;
+}
+
+void FileBlockDevice::close() {
+  if (_fp) fclose(_fp);
+  _fp = nullptr;
+  _sectors = 0;
+}
+
+bool FileBlockDevice::seekTo(uint32_t sector) {
+  return fseeko(_fp, (off_t)sector * (off_t)BLOCK_SIZE, SEEK_SET) == 0;
+}
+
+bool FileBlockDevice::readSectors(uint32_t sector, uint8_t *dst, size_t count) {
+  if (!_fp || (uint64_t)sector + count > _sectors) return false;
+  if (!seekTo(sector)) return false;
+  return fread(dst, BLOCK_SIZE, count, _fp) == count;
+}
+
+bool FileBlockDevice::writeSectors(uint32_t sector, const uint8_t *src, size_t count) {
+  if (!_fp || _readOnly || (uint64_t)sector + count > _sectors) return false;
+  if (!seekTo(sector)) return false;
+  return fwrite(src, BLOCK_SIZE, count, _fp) == count;
+}
+
+bool FileBlockDevice::sync() {
+  return _fp && fflush(_fp) == 0;
+}
@@ -0,0 +1,571 @@
+#include "file_index.h"
+
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include "miniz.h"
+
+// On-card layout, little endian:
+//   header: "CSIX", u16 version, u8 sealed, u8 0, u32 count, u32 card sectors, u32 root CRC
+//   count records: u32 size, u32 first cluster, u32 dir CRC, u16 date, u16 time,
+//                  u16 path length, u8 flags, u8 0, path
+static const char INDEX_MAGIC[4] = {'C', 'S', 'I', 'X'};
+static const uint16_t INDEX_VERSION = 1;
+static const size_t HEADER_BYTES = 20;
+static const size_t SEALED_OFFSET = 6;
+static const size_t RECORD_BYTES = 20;
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::string parentOf(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  if (slash == std::string::npos || slash == 0) return "/";
+  return path.substr(0, slash);
+}
+
+static std::string normalize(const char *path) {
+  std::string p(path);
+  while (p.size() > 1 && p.back() == '/') p.pop_back();
+  return p;
+}
+
+bool FileIndex::begin() {
+  _rebuilt = false;
+  if (load()) {
+    _loaded = true;
+    _dirty = false;
+    // Everything else is checked when asked for
+    if (checkOne("/")) return true;
+  }
+  if (!rebuild()) return false;
+  save();
+  return true;
+}
+
+bool FileIndex::refresh() {
+  if (!_loaded) return begin();
+  _rebuilt = false;
+  _rootChecked = false;
+  for (Entry &e : _entries) e.flags &= ~FLAG_CHECKED;
+  // Our own changes are already in the array; the directories they touched
+  // are unchecked now, so their checksums are left for check() to compare
+  updateTouched();
+  if (checkOne("/")) return true;
+  if (!rebuild()) return false;
+  save();
+  return true;
+}
+
+bool FileIndex::check(const char *path) {
+  if (!_loaded) return false;
+  std::string p = normalize(path);
+
+  // Parents first, from the root down: a changed parent may have dropped
+  // or replaced `p`
+  std::vector<std::string> chain;
+  for (std::string d = p;; d = parentOf(d)) {
+    chain.push_back(d);
+    if (d == "/") break;
+  }
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    const Entry *e = find(it->c_str());
+    if (*it != "/" && (!e || !e->isDir())) return true;  // nothing below it
+    if (!checkOne(*it)) return false;
+  }
+
+  // Then whatever below it hasn't been checked yet, parents before children
+  std::string prefix = (p == "/") ? p : p + "/";
+  std::vector<std::string> pending;
+  Range r = under(prefix.c_str());
+  for (size_t i = r.begin; i < r.end; i++) {
+    const Entry &e = _entries[i];
+    if (e.isDir() && !(e.flags & FLAG_CHECKED)) pending.push_back(e.path);
+  }
+  for (const std::string &d : pending) {
+    // A re-listed parent may have dropped it
+    const Entry *e = find(d.c_str());
+    if (e && e->isDir() && !checkOne(d)) return false;
+  }
+  return true;
+}
+
+bool FileIndex::load() {
+  _entries.clear();
+  _touched.clear();
+  _sealedOnCard = false;
+  _rootChecked = false;
+  if (!_fs.card()) return false;
+
+  File32 f = _fs.open(_indexPath, O_RDONLY);
+  if (!f) return false;
+
+  uint8_t hdr[HEADER_BYTES];
+  bool ok = f.read(hdr, sizeof(hdr)) == (int)sizeof(hdr) &&
+            memcmp(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+            get16(hdr + 4) == INDEX_VERSION &&
+            hdr[SEALED_OFFSET] == 1 &&
+            get32(hdr + 12) == _fs.card()->sectorCount();
+  uint32_t count = ok ? get32(hdr + 8) : 0;
+  _rootCrc = get32(hdr + 16);
+
+  _entries.reserve(count);
+  char path[256];
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint8_t rec[RECORD_BYTES];
+    if (f.read(rec, sizeof(rec)) != (int)sizeof(rec)) { ok = false; break; }
+    uint16_t len = get16(rec + 16);
+    if (len == 0 || len >= sizeof(path) || f.read(path, len) != (int)len) { ok = false; break; }
+    path[len] = 0;
+    Entry e;
+    e.path = path;
+    e.size = get32(rec);
+    e.firstCluster = get32(rec + 4);
+    e.dirCrc = get32(rec + 8);
+    e.date = get16(rec + 12);
+    e.time = get16(rec + 14);
+    e.flags = rec[18] & FLAG_DIR;
+    _entries.push_back(std::move(e));
+  }
+  f.close();
+
+  if (!ok) {
+    _entries.clear();
+    return false;
+  }
+  sort();
+  _sealedOnCard = true;
+  return true;
+}
+
+bool FileIndex::save() {
+  if (!_loaded || !_fs.card()) return false;
+  updateTouched();
+
+  File32 f = _fs.open(_indexPath, O_RDWR | O_CREAT | O_TRUNC);
+  if (!f) return false;
+  _sealedOnCard = false;
+
+  uint8_t hdr[HEADER_BYTES] = {};
+  memcpy(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  put16(hdr + 4, INDEX_VERSION);
+  put32(hdr + 8, (uint32_t)_entries.size());
+  put32(hdr + 12, _fs.card()->sectorCount());
+  bool ok = f.write(hdr, sizeof(hdr)) == sizeof(hdr);
+
+  // Batch records into sector-sized writes
+  uint8_t buf[512];
+  size_t used = 0;
+  for (size_t i = 0; ok && i < _entries.size(); i++) {
+    const Entry &e = _entries[i];
+    size_t need = RECORD_BYTES + e.path.size();
+    if (used + need > sizeof(buf)) {
+      ok = f.write(buf, used) == used;
+      used = 0;
+    }
+    uint8_t rec[RECORD_BYTES] = {};
+    put32(rec, e.size);
+    put32(rec + 4, e.firstCluster);
+    put32(rec + 8, e.dirCrc);
+    put16(rec + 12, e.date);
+    put16(rec + 14, e.time);
+    put16(rec + 16, (uint16_t)e.path.size());
+    rec[18] = e.flags & FLAG_DIR;
+    if (need > sizeof(buf)) {
+      ok = ok && f.write(rec, sizeof(rec)) == sizeof(rec) &&
+           f.write(e.path.data(), e.path.size()) == e.path.size();
+      continue;
+    }
+    memcpy(buf + used, rec, sizeof(rec));
+    memcpy(buf + used + sizeof(rec), e.path.data(), e.path.size());
+    used += need;
+  }
+  if (ok && used) ok = f.write(buf, used) == used;
+  ok = f.sync() && ok;
+  f.close();
+  if (!ok) return false;
+
+  // Writing the file changed its own directory entry; checksum the directory
+  // now, then seal. Rewriting the header doesn't change the entry again.
+  std::string indexDir = parentOf(_indexPath);
+  uint32_t *slot = crcSlot(indexDir);
+  if (slot && !dirCrc(indexDir.c_str(), slot)) return false;
+
+  put32(hdr + 16, _rootCrc);
+  hdr[SEALED_OFFSET] = 1;
+  f = _fs.open(_indexPath, O_RDWR);
+  if (!f) return false;
+  ok = f.write(hdr, sizeof(hdr)) == sizeof(hdr);
+  ok = f.sync() && ok;
+  f.close();
+  if (!ok) return false;
+
+  _sealedOnCard = true;
+  _dirty = false;
+  return true;
+}
+
+bool FileIndex::rebuild() {
+  _entries.clear();
+  _touched.clear();
+  _loaded = false;
+  if (!_fs.card()) return false;
+
+  if (!walk("/", SIZE_MAX)) return false;
+  sort();
+  _loaded = true;
+  _dirty = true;
+  _rebuilt = true;
+  return true;
+}
+
+// Appends everything under `path` to _entries, unsorted. `self` is the index
+// of the directory's own entry, or SIZE_MAX for root.
+bool FileIndex::walk(const std::string &path, size_t self) {
+  File32 dir = _fs.open(path.c_str());
+  if (!dir) return false;
+  if (!dir.isDirectory()) { dir.close(); return false; }
+
+  // Checksum the raw entries, then list them
+  uint32_t crc = 0;
+  uint8_t buf[512];
+  int n;
+  while ((n = dir.read(buf, sizeof(buf))) > 0) crc = (uint32_t)mz_crc32(crc, buf, (size_t)n);
+  if (self == SIZE_MAX) {
+    _rootCrc = crc;
+    _rootChecked = true;
+  } else {
+    _entries[self].dirCrc = crc;
+    _entries[self].flags |= FLAG_CHECKED;
+  }
+
+  dir.rewindDirectory();
+  File32 entry = dir.openNextFile();
+  char nameBuf[256];
+  while (entry) {
+    entry.getName(nameBuf, sizeof(nameBuf));
+    std::string full = path;
+    if (full.back() != '/') full += "/";
+    full += nameBuf;
+
+    if (full != _indexPath) {
+      Entry e;
+      e.path = full;
+      e.size = entry.isDirectory() ? 0 : entry.fileSize();
+      e.firstCluster = entry.firstCluster();
+      e.dirCrc = 0;
+      e.date = 0;
+      e.time = 0;
+      entry.getModifyDateTime(&e.date, &e.time);
+      e.flags = entry.isDirectory() ? FLAG_DIR : 0;
+      _entries.push_back(std::move(e));
+      if (entry.isDirectory()) {
+        entry.close();
+        walk(full, _entries.size() - 1);
+      }
+    }
+    if (entry.isOpen()) entry.close();
+    entry = dir.openNextFile();
+  }
+  dir.close();
+  return true;
+}
+
+// `dir` changed: list it again. Subdirectories that are still there keep
+// their entries and old checksum, to be checked on their own; new ones are
+// walked, and gone ones dropped with everything below them.
+bool FileIndex::rescan(const std::string &dir) {
+  File32 d = _fs.open(dir.c_str());
+  if (!d) return false;
+  if (!d.isDirectory()) { d.close(); return false; }
+  uint32_t crc = 0;
+  uint8_t buf[512];
+  int n;
+  while ((n = d.read(buf, sizeof(buf))) > 0) crc = (uint32_t)mz_crc32(crc, buf, (size_t)n);
+
+  std::string prefix = (dir == "/") ? dir : dir + "/";
+  std::vector<Entry> children;
+  d.rewindDirectory();
+  File32 entry = d.openNextFile();
+  char nameBuf[256];
+  while (entry) {
+    entry.getName(nameBuf, sizeof(nameBuf));
+    Entry e;
+    e.path = prefix + nameBuf;
+    e.size = entry.isDirectory() ? 0 : entry.fileSize();
+    e.firstCluster = entry.firstCluster();
+    e.dirCrc = 0;
+    e.date = 0;
+    e.time = 0;
+    entry.getModifyDateTime(&e.date, &e.time);
+    e.flags = entry.isDirectory() ? FLAG_DIR : 0;
+    if (e.path != _indexPath) children.push_back(std::move(e));
+    entry.close();
+    entry = d.openNextFile();
+  }
+  d.close();
+  std::sort(children.begin(), children.end(), [](const Entry &a, const Entry &b) { return a.path < b.path; });
+  auto child = [&](const std::string &path) -> Entry * {
+    auto it = std::lower_bound(children.begin(), children.end(), path,
+                               [](const Entry &e, const std::string &p) { return e.path < p; });
+    return (it != children.end() && it->path == path) ? &*it : nullptr;
+  };
+
+  // Old entries below `dir`: direct children are replaced by the new
+  // listing, deeper ones kept if their top directory still is one
+  std::vector<bool> known(children.size(), false);
+  std::vector<Entry> kept;
+  Range r = under(prefix.c_str());
+  for (size_t i = r.begin; i < r.end; i++) {
+    Entry &old = _entries[i];
+    size_t slash = old.path.find('/', prefix.size());
+    Entry *c = child(slash == std::string::npos ? old.path : old.path.substr(0, slash));
+    if (!c || !c->isDir()) continue;
+    if (slash == std::string::npos) {
+      if (!old.isDir()) continue;
+      c->dirCrc = old.dirCrc;
+      known[(size_t)(c - children.data())] = true;
+    } else {
+      kept.push_back(std::move(old));
+    }
+  }
+  _entries.erase(_entries.begin() + r.begin, _entries.begin() + r.end);
+
+  size_t base = _entries.size();
+  for (Entry &e : children) _entries.push_back(std::move(e));
+  for (Entry &e : kept) _entries.push_back(std::move(e));
+  for (size_t i = 0; i < known.size(); i++) {
+    if (!known[i] && _entries[base + i].isDir()) walk(_entries[base + i].path, base + i);
+  }
+  sort();
+
+  if (dir == "/") {
+    _rootCrc = crc;
+    _rootChecked = true;
+  } else {
+    size_t i = lowerBound(dir.c_str());
+    if (i < _entries.size() && _entries[i].path == dir) {
+      _entries[i].dirCrc = crc;
+      _entries[i].flags |= FLAG_CHECKED;
+    }
+  }
+  return true;
+}
+
+// --- lookups ---
+
+void FileIndex::sort() {
+  std::sort(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) { return a.path < b.path; });
+}
+
+size_t FileIndex::lowerBound(const char *path) const {
+  auto it = std::lower_bound(_entries.begin(), _entries.end(), path,
+                             [](const Entry &e, const char *p) { return strcmp(e.path.c_str(), p) < 0; });
+  return (size_t)(it - _entries.begin());
+}
+
+const FileIndex::Entry *FileIndex::find(const char *path) const {
+  std::string p = normalize(path);
+  size_t i = lowerBound(p.c_str());
+  if (i < _entries.size() && _entries[i].path == p) return &_entries[i];
+  return nullptr;
+}
+
+FileIndex::Range FileIndex::under(const char *prefix) const {
+  // Paths sharing a prefix sort next to each other
+  size_t len = strlen(prefix);
+  Range r;
+  r.begin = lowerBound(prefix);
+  r.end = r.begin;
+  while (r.end < _entries.size() && _entries[r.end].path.compare(0, len, prefix) == 0) r.end++;
+  return r;
+}
+
+uint32_t *FileIndex::crcSlot(const std::string &dir) {
+  if (dir == "/") return &_rootCrc;
+  size_t i = lowerBound(dir.c_str());
+  if (i < _entries.size() && _entries[i].path == dir && _entries[i].isDir()) return &_entries[i].dirCrc;
+  return nullptr;
+}
+
+// --- staleness ---
+
+bool FileIndex::dirCrc(const char *path, uint32_t *crc) {
+  File32 dir = _fs.open(path);
+  if (!dir) return false;
+  if (!dir.isDirectory()) { dir.close(); return false; }
+  uint32_t c = 0;
+  uint8_t buf[512];
+  int n;
+  while ((n = dir.read(buf, sizeof(buf))) > 0) c = (uint32_t)mz_crc32(c, buf, (size_t)n);
+  dir.close();
+  *crc = c;
+  return true;
+}
+
+bool FileIndex::isCheckedDir(const std::string &dir) const {
+  if (dir == "/") return _rootChecked;
+  const Entry *e = find(dir.c_str());
+  return e && e->isDir() && (e->flags & FLAG_CHECKED);
+}
+
+// Compare one directory's checksum with the card's, listing it again if it
+// changed. False only if it can't be read.
+bool FileIndex::checkOne(const std::string &dir) {
+  if (isCheckedDir(dir)) return true;
+  uint32_t *slot = crcSlot(dir);
+  if (!slot) return false;
+  uint32_t crc;
+  if (dirCrc(dir.c_str(), &crc) && crc == *slot) {
+    if (dir == "/") _rootChecked = true;
+    else _entries[lowerBound(dir.c_str())].flags |= FLAG_CHECKED;
+    return true;
+  }
+  unseal();
+  _dirty = true;
+  _rebuilt = true;
+  return rescan(dir);
+}
+
+void FileIndex::touch(const std::string &dir) {
+  for (const std::string &t : _touched) if (t == dir) return;
+  _touched.push_back(dir);
+}
+
+bool FileIndex::updateTouched() {
+  bool ok = true;
+  for (const std::string &dir : _touched) {
+    // An unchecked directory may also have changed behind our back: keep
+    // the old checksum so check() finds the difference and lists it
+    if (!isCheckedDir(dir)) continue;
+    uint32_t *slot = crcSlot(dir);
+    if (slot && !dirCrc(dir.c_str(), slot)) ok = false;
+  }
+  _touched.clear();
+  return ok;
+}
+
+// Clear the seal on the card before the first change, so a reset before the
+// next save() forces a rebuild.
+bool FileIndex::unseal() {
+  if (!_sealedOnCard) return true;
+  _sealedOnCard = false;
+  File32 f = _fs.open(_indexPath, O_RDWR);
+  if (!f) return false;
+  uint8_t zero = 0;
+  bool ok = f.seekSet(SEALED_OFFSET) && f.write(&zero, 1) == 1;
+  ok = f.sync() && ok;
+  f.close();
+  return ok;
+}
+
+// --- changes ---
+
+bool FileIndex::rename(const char *from, const char *to) {
+  unseal();
+  if (!_fs.rename(from, to)) return false;
+  _dirty = true;
+
+  std::string src = normalize(from);
+  std::string dst = normalize(to);
+  touch(parentOf(src));
+  touch(parentOf(dst));
+
+  // Pull out the entry and anything below it, then re-insert under the new name
+  std::vector<Entry> moved;
+  size_t i = lowerBound(src.c_str());
+  if (i < _entries.size() && _entries[i].path == src) {
+    moved.push_back(std::move(_entries[i]));
+    _entries.erase(_entries.begin() + i);
+  }
+  Range r = under((src + "/").c_str());
+  for (size_t j = r.begin; j < r.end; j++) moved.push_back(std::move(_entries[j]));
+  _entries.erase(_entries.begin() + r.begin, _entries.begin() + r.end);
+
+  if (moved.empty()) {
+    update(dst.c_str());
+    return true;
+  }
+  // A moved directory's ".." entry changes too
+  if (moved[0].isDir()) touch(dst);
+
+  for (Entry &e : moved) {
+    e.path = dst + e.path.substr(src.size());
+    size_t pos = lowerBound(e.path.c_str());
+    _entries.insert(_entries.begin() + pos, std::move(e));
+  }
+  return true;
+}
+
+bool FileIndex::remove(const char *path) {
+  unseal();
+  const Entry *e = find(path);
+  bool ok = (e && e->isDir()) ? _fs.rmdir(path) : _fs.remove(path);
+  if (!ok) return false;
+  update(path);
+  return true;
+}
+
+bool FileIndex::mkdir(const char *path) {
+  unseal();
+  if (!_fs.exists(path) && !_fs.mkdir(path, true)) return false;
+  update(path);
+  return true;
+}
+
+void FileIndex::update(const char *path) {
+  std::string p = normalize(path);
+  if (p == "/" || p == _indexPath) return;
+  unseal();
+  _dirty = true;
+  touch(parentOf(p));
+
+  File32 f = _fs.open(p.c_str());
+  if (!f) {
+    // Gone: drop it and anything that was below it
+    size_t i = lowerBound(p.c_str());
+    if (i < _entries.size() && _entries[i].path == p) _entries.erase(_entries.begin() + i);
+    Range r = under((p + "/").c_str());
+    _entries.erase(_entries.begin() + r.begin, _entries.begin() + r.end);
+    return;
+  }
+
+  Entry e;
+  e.path = p;
+  e.size = f.isDirectory() ? 0 : f.fileSize();
+  e.firstCluster = f.firstCluster();
+  e.dirCrc = 0;
+  e.date = 0;
+  e.time = 0;
+  f.getModifyDateTime(&e.date, &e.time);
+  e.flags = f.isDirectory() ? FLAG_DIR : 0;
+  f.close();
+  if (e.isDir()) touch(p);
+
+  size_t i = lowerBound(p.c_str());
+  if (i < _entries.size() && _entries[i].path == p) {
+    e.dirCrc = _entries[i].dirCrc;
+    if (e.isDir()) e.flags |= _entries[i].flags & FLAG_CHECKED;
+    _entries[i] = std::move(e);
+  } else {
+    // A directory we just made: its contents are what we put there
+    if (e.isDir()) e.flags |= FLAG_CHECKED;
+    _entries.insert(_entries.begin() + i, std::move(e));
+  }
+
+  // Parents created along the way (mkdir -p, unzip)
+  std::string parent = parentOf(p);
+  if (parent != "/" && !find(parent.c_str())) update(parent.c_str());
+}
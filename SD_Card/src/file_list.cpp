@@ -0,0 +1,120 @@
+#include "file_list.h"
+
+#include <string.h>
+#include "psram.h"
+
+static const size_t MAX_NAME = (1 << 14) - 1;
+
+// Grow a PSRAM buffer to hold at least `need` items of `item` bytes,
+// doubling so a listing reallocates a handful of times, not per entry
+static bool growBuffer(void **buf, size_t *cap, size_t need, size_t item, size_t minCap) {
+  if (need <= *cap) return true;
+  size_t cap2 = *cap ? *cap : minCap;
+  while (cap2 < need) cap2 *= 2;
+  void *p = psramAlloc(cap2 * item);
+  if (!p) return false;
+  if (*buf) {
+    memcpy(p, *buf, *cap * item);
+    psramFree(*buf);
+  }
+  *buf = p;
+  *cap = cap2;
+  return true;
+}
+
+FileList::~FileList() {
+  psramFree(_entries);
+  psramFree(_parents);
+  psramFree(_arena);
+}
+
+void FileList::clear() {
+  _count = 0;
+  _parentCount = 0;
+  _arenaUsed = 0;
+  _lastParent = UINT16_MAX;
+}
+
+bool FileList::reserveEntries(size_t n) {
+  return growBuffer((void **)&_entries, &_entryCap, n, sizeof(Entry), 128);
+}
+
+bool FileList::reserveParents(size_t n) {
+  return growBuffer((void **)&_parents, &_parentCap, n, sizeof(Parent), 8);
+}
+
+bool FileList::reserveArena(size_t n) {
+  return growBuffer((void **)&_arena, &_arenaCap, n, 1, 4096);
+}
+
+uint32_t FileList::store(const char *s, size_t len) {
+  if (!reserveArena(_arenaUsed + len)) return UINT32_MAX;
+  uint32_t ofs = (uint32_t)_arenaUsed;
+  memcpy(_arena + ofs, s, len);
+  _arenaUsed += len;
+  return ofs;
+}
+
+uint16_t FileList::intern(const char *parent, size_t len) {
+  auto same = [&](uint16_t p) {
+    return _parents[p].len == len && memcmp(_arena + _parents[p].ofs, parent, len) == 0;
+  };
+  if (_lastParent != UINT16_MAX && same(_lastParent)) return _lastParent;
+  for (size_t p = 0; p < _parentCount; p++) {
+    if (same((uint16_t)p)) return _lastParent = (uint16_t)p;
+  }
+  if (_parentCount >= UINT16_MAX || len > UINT16_MAX || !reserveParents(_parentCount + 1)) return UINT16_MAX;
+  uint32_t ofs = store(parent, len);
+  if (ofs == UINT32_MAX) return UINT16_MAX;
+  _parents[_parentCount].ofs = ofs;
+  _parents[_parentCount].len = (uint16_t)len;
+  _lastParent = (uint16_t)_parentCount++;
+  return _lastParent;
+}
+
+bool FileList::add(const char *parent, const char *name, uint32_t size, bool isDir) {
+  size_t nameLen = strlen(name);
+  if (nameLen > MAX_NAME || !reserveEntries(_count + 1)) return false;
+  uint16_t p = intern(parent, strlen(parent));
+  if (p == UINT16_MAX) return false;
+  uint32_t ofs = store(name, nameLen);
+  if (ofs == UINT32_MAX) return false;
+
+  Entry &e = _entries[_count++];
+  e.name = ofs;
+  e.size = size;
+  e.parent = p;
+  e.nameLen = (uint16_t)nameLen;
+  e.dir = isDir;
+  e.placeholder = false;
+  return true;
+}
+
+bool FileList::addPlaceholder(const char *text) {
+  if (!add("", text, 0, false)) return false;
+  _entries[_count - 1].placeholder = true;
+  return true;
+}
+
+const char *FileList::name(size_t i, size_t *len) const {
+  *len = _entries[i].nameLen;
+  return _arena + _entries[i].name;
+}
+
+size_t FileList::path(size_t i, char *buf, size_t n) const {
+  const Entry &e = _entries[i];
+  const Parent &p = _parents[e.parent];
+  size_t total = p.len + 1 + e.nameLen;
+  if (n == 0) return total;
+  size_t at = 0;
+  auto put = [&](const char *s, size_t len) {
+    size_t c = (at + len < n) ? len : n - 1 - at;
+    memcpy(buf + at, s, c);
+    at += c;
+  };
+  put(_arena + p.ofs, p.len);
+  put("/", 1);
+  put(_arena + e.name, e.nameLen);
+  buf[at] = 0;
+  return total;
+}
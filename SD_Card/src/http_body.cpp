@@ -0,0 +1,112 @@
+#include "http_body.h"
+
+#include <stdlib.h>
+
+void HttpBody::begin(WiFiClient *in, int contentLength, bool chunked) {
+  _in = in;
+  _chunked = chunked;
+  _unbounded = false;
+  _lineLen = 0;
+  _left = 0;
+  if (chunked) {
+    _state = CHUNK_SIZE;
+  } else if (contentLength >= 0) {
+    _left = (uint32_t)contentLength;
+    _state = _left ? DATA : DONE;
+  } else {
+    _unbounded = true;
+    _state = DATA;
+  }
+  setTimeout(HTTP_IO_TIMEOUT_MS);
+}
+
+void HttpBody::pump() {
+  while (_state == CHUNK_SIZE || _state == CHUNK_END || _state == TRAILER) {
+    if (_in->available() <= 0) {
+      if (!_in->connected()) _state = CLOSED;
+      return;
+    }
+    int c = _in->read();
+    if (c != '\n') {
+      if (c != '\r' && _lineLen < sizeof(_line) - 1) _line[_lineLen++] = (char)c;
+      continue;
+    }
+    _line[_lineLen] = 0;
+    size_t len = _lineLen;
+    _lineLen = 0;
+    if (_state == CHUNK_SIZE) {
+      // "<hex size>[;extensions]"
+      _left = (uint32_t)strtoul(_line, nullptr, 16);
+      _state = _left ? DATA : TRAILER;
+    } else if (_state == CHUNK_END) {
+      _state = CHUNK_SIZE;
+    } else if (len == 0) {
+      _state = DONE;  // blank line after the (usually empty) trailer
+    }
+  }
+}
+
+size_t HttpBody::dataAvailable() {
+  if (!_in) return 0;
+  pump();
+  if (_state != DATA) return 0;
+  int n = _in->available();
+  if (n <= 0) {
+    // Without a length, the server closing the connection ends the body
+    if (!_in->connected()) _state = _unbounded ? DONE : CLOSED;
+    return 0;
+  }
+  if (!_unbounded && (uint32_t)n > _left) n = (int)_left;
+  return (size_t)n;
+}
+
+void HttpBody::consumed(size_t n) {
+  if (_unbounded) return;
+  _left -= n;
+  if (_left == 0) _state = _chunked ? CHUNK_END : DONE;
+}
+
+bool HttpBody::finished() {
+  dataAvailable();
+  return _state == DONE || _state == CLOSED;
+}
+
+int HttpBody::available() {
+  return (int)dataAvailable();
+}
+
+int HttpBody::read() {
+  if (!dataAvailable()) return -1;
+  int c = _in->read();
+  if (c >= 0) consumed(1);
+  return c;
+}
+
+int HttpBody::peek() {
+  if (!dataAvailable()) return -1;
+  return _in->peek();
+}
+
+int HttpBody::read(uint8_t *buf, size_t len) {
+  size_t n = dataAvailable();
+  if (n == 0) return 0;
+  if (len > n) len = n;
+  int r = _in->read(buf, len);
+  if (r <= 0) return 0;
+  consumed((size_t)r);
+  return r;
+}
+
+bool HttpBody::skip(unsigned long timeoutMs) {
+  uint8_t buf[256];
+  unsigned long last = millis();
+  while (!finished()) {
+    if (read(buf, sizeof(buf)) > 0) {
+      last = millis();
+    } else {
+      if (millis() - last > timeoutMs) return false;
+      delay(1);
+    }
+  }
+  return complete();
+}
@@ -0,0 +1,202 @@
+#include "http_session.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- HttpSessionPool ---
+
+// "https://host:port/path" -> parts; false for anything but http(s)
+static bool splitUrl(const String &url, bool *https, String *host, uint16_t *port) {
+  int hostStart;
+  if (url.startsWith("https://")) {
+    *https = true;
+    hostStart = 8;
+  } else if (url.startsWith("http://")) {
+    *https = false;
+    hostStart = 7;
+  } else {
+    return false;
+  }
+  int pathStart = url.indexOf('/', hostStart);
+  String hostPort = pathStart < 0 ? url.substring(hostStart) : url.substring(hostStart, pathStart);
+  int colon = hostPort.indexOf(':');
+  if (colon >= 0) {
+    *host = hostPort.substring(0, colon);
+    *port = (uint16_t)hostPort.substring(colon + 1).toInt();
+  } else {
+    *host = hostPort;
+    *port = *https ? 443 : 80;
+  }
+  return host->length() > 0;
+}
+
+HttpSessionPool::HttpSessionPool(size_t slots) {
+  _count = slots ? slots : 1;
+  _slots = new Session[_count];
+}
+
+HttpSessionPool::~HttpSessionPool() {
+  delete[] _slots;
+}
+
+bool HttpSessionPool::connect(Session *s, const String &host, uint16_t port, bool https) {
+  s->_plain.stop();
+  s->_secure.stop();
+  s->_key = "";
+  s->_https = https;
+  WiFiClient &client = https ? (WiFiClient &)s->_secure : s->_plain;
+  if (https) s->_secure.setInsecure();  // replace with setCACert(...) for production
+  client.setTimeout(HTTP_IO_TIMEOUT_MS);
+
+  unsigned long t0 = millis();
+  bool ok = client.connect(host.c_str(), port);
+  unsigned long ms = millis() - t0;
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats.handshakes++;
+  _stats.handshakeMs += ms;
+  return ok;
+}
+
+int HttpSessionPool::request(Session *s, const String &url, const String &key, const String &host,
+                             uint16_t port, bool https, uint64_t from, const String &validator) {
+  static const char *headers[] = {"Transfer-Encoding", "ETag", "Last-Modified", "Content-Range"};
+  for (int attempt = 0; attempt < 2; attempt++) {
+    WiFiClient &client = https ? (WiFiClient &)s->_secure : s->_plain;
+    bool reuse = s->_key == key && client.connected();
+    if (!reuse) {
+      if (!connect(s, host, port, https)) return -1;
+      s->_key = key;
+    }
+
+    // HTTP/1.1 with reuse: HTTPClient sees the open connection and sends
+    // the request on it, and end() leaves it open for the next one
+    s->_http.useHTTP10(false);
+    s->_http.setReuse(true);
+    if (!s->_http.begin(client, url)) return -1;
+    s->_http.collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+    if (from > 0) {
+      char range[32];
+      snprintf(range, sizeof(range), "bytes=%llu-", (unsigned long long)from);
+      s->_http.addHeader("Range", range);
+      if (validator.length()) s->_http.addHeader("If-Range", validator);
+    }
+    int code = s->_http.GET();
+    if (code > 0) {
+      if (reuse) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stats.reused++;
+      }
+      return code;
+    }
+
+    // The server may have closed an idle connection; that only shows up
+    // when the request fails, so retry once on a fresh one
+    s->_http.end();
+    client.stop();
+    s->_key = "";
+    if (!reuse) return code;
+  }
+  return -1;
+}
+
+String HttpSessionPool::Session::validator() {
+  // A weak ETag (W/"...") can't be used with If-Range
+  String etag = _http.header("ETag");
+  if (etag.length() && !etag.startsWith("W/")) return etag;
+  return _http.header("Last-Modified");
+}
+
+int64_t HttpSessionPool::Session::rangeStart() {
+  // "bytes <first>-<last>/<total>"
+  String range = _http.header("Content-Range");
+  if (!range.startsWith("bytes ")) return -1;
+  const char *p = range.c_str() + 6;
+  char *end = nullptr;
+  unsigned long long first = strtoull(p, &end, 10);
+  if (end == p || *end != '-') return -1;
+  return (int64_t)first;
+}
+
+HttpSessionPool::Session *HttpSessionPool::open(const String &url, int *status, uint64_t from,
+                                                const String &validator) {
+  bool https;
+  String host;
+  uint16_t port;
+  if (!splitUrl(url, &https, &host, &port)) {
+    if (status) *status = -1;
+    return nullptr;
+  }
+  String key = (https ? "https://" : "http://") + host + ":" + String(port);
+
+  Session *s = nullptr;
+  {
+    std::unique_lock<std::mutex> lk(_lock);
+    _cv.wait(lk, [this] {
+      for (size_t i = 0; i < _count; i++)
+        if (!_slots[i]._busy) return true;
+      return false;
+    });
+    // Prefer a slot already talking to this host
+    for (size_t i = 0; i < _count && !s; i++)
+      if (!_slots[i]._busy && _slots[i]._key == key) s = &_slots[i];
+    for (size_t i = 0; i < _count && !s; i++)
+      if (!_slots[i]._busy) s = &_slots[i];
+    s->_busy = true;
+    _stats.requests++;
+  }
+
+  int code = request(s, url, key, host, port, https, from, validator);
+  s->_status = code;
+  if (status) *status = code;
+  if (code != HTTP_CODE_OK && !(from > 0 && code == HTTP_CODE_PARTIAL_CONTENT)) {
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _stats.failures++;
+    }
+    close(s);
+    return nullptr;
+  }
+
+  bool chunked = s->_http.header("Transfer-Encoding").indexOf("chunked") >= 0;
+  WiFiClient &client = https ? (WiFiClient &)s->_secure : s->_plain;
+  s->_body.begin(&client, s->_http.getSize(), chunked);
+  return s;
+}
+
+void HttpSessionPool::close(Session *s) {
+  if (!s) return;
+  if (!s->_body.complete()) {
+    // Unread body (or none at all): the connection can't carry another request
+    s->_plain.stop();
+    s->_secure.stop();
+    s->_key = "";
+  }
+  s->_http.end();
+  s->_body.end();
+
+  std::lock_guard<std::mutex> guard(_lock);
+  s->_busy = false;
+  _cv.notify_all();
+}
+
+void HttpSessionPool::disconnect() {
+  std::lock_guard<std::mutex> guard(_lock);
+  for (size_t i = 0; i < _count; i++) {
+    Session &s = _slots[i];
+    if (s._busy) continue;
+    s._plain.stop();
+    s._secure.stop();
+    s._key = "";
+  }
+}
+
+HttpSessionPool::Stats HttpSessionPool::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+void HttpSessionPool::resetStats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats = {};
+}
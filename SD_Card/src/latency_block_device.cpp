@@ -0,0 +1,10 @@
+#include "latency_block_device.h"
+
+#include <chrono>
+#include <thread>
+
+void CardLatency::charge(bool write, size_t sectors) {
+  uint64_t us = write ? writeUs + (uint64_t)writeSectorUs * sectors : readUs + (uint64_t)readSectorUs * sectors;
+  if (write && stallEvery && ++_writes % stallEvery == 0) us += stallUs;
+  if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
@@ -14,13 +14,42 @@
 
 #include <USB.h>
 #include <USBMSC.h>
+#include "tusb.h"
 #include "SdFat.h" 
 
+#include <algorithm>
 #include <vector>
+#include <memory>
 #include "Arduino_GFX_Library.h"
 
 #include "miniz.h"
 
+#include "block_device.h"
+#include "sd_block_device.h"
+#include "sector_cache.h"
+#include "read_ahead.h"
+#include "write_combiner.h"
+#include "msc_io.h"
+#include "msc_stats.h"
+#include "virtual_fat.h"
+#include "file_index.h"
+#include "rename_journal.h"
+#include "sync_plan.h"
+#include "manifest_parser.h"
+#include "download_pipeline.h"
+#include "zip_stream.h"
+#include "sdb_stream.h"
+#include "http_session.h"
+#include "download_resume.h"
+#include "content_hash.h"
+#include "cluster_writer.h"
+#include "zip_reader.h"
+#include "extract_pipeline.h"
+#include "psram.h"
+#include "file_list.h"
+#include "sync_task.h"
+#include "sd_bench.h"
+
 // --- CONFIGURATION ---
 #define SCROLL_BUTTON_PIN 14
 #define BOOT_BUTTON_PIN 0 
@@ -33,6 +62,161 @@
 #define WIFI_PASS "1976@bond"
 #endif
 
+// Sector cache in front of the MSC callbacks (512 B per slot, lives in PSRAM).
+// Write-back is faster for FAT updates but loses data if power drops before
+// the host ejects, so it is opt-in.
+#ifndef MSC_CACHE_SECTORS
+#define MSC_CACHE_SECTORS 1024
+#endif
+#ifndef MSC_CACHE_WRITE_BACK
+#define MSC_CACHE_WRITE_BACK 0
+#endif
+// Requests longer than this (in sectors) bypass the cache (streaming reads)
+#ifndef MSC_CACHE_MAX_RUN
+#define MSC_CACHE_MAX_RUN 8
+#endif
+
+// Sequential read-ahead for streaming playback: ring depth and card request
+// size in sectors, and the core the prefetch task runs on (loop() is on 1).
+#ifndef MSC_READAHEAD_SECTORS
+#define MSC_READAHEAD_SECTORS 512
+#endif
+#ifndef MSC_READAHEAD_CHUNK
+#define MSC_READAHEAD_CHUNK 64
+#endif
+#ifndef MSC_READAHEAD_CORE
+#define MSC_READAHEAD_CORE 0
+#endif
+
+// Host writes are merged into runs of up to this many sectors before they go
+// to the card, and flushed after MSC_WRITE_IDLE_MS without a new write.
+#ifndef MSC_WRITE_COMBINE_SECTORS
+#define MSC_WRITE_COMBINE_SECTORS 256
+#endif
+#ifndef MSC_WRITE_IDLE_MS
+#define MSC_WRITE_IDLE_MS 250
+#endif
+
+// Expose a playlist as a read-only virtual FAT volume built in RAM instead of
+// renaming every other file to .nomsc. 0 = old rename behaviour.
+#ifndef MSC_VIRTUAL_PLAYLIST
+#define MSC_VIRTUAL_PLAYLIST 1
+#endif
+
+// Callback latency/size counters (msc_stats.h) are appended here from the
+// stats screen and at each playlist switch, while the host can't see the card.
+// A root dot-file, so the sync doesn't trash it as untracked.
+#ifndef MSC_STATS_FILE
+#define MSC_STATS_FILE "/.msc_stats.txt"
+#endif
+
+// Manifest/file server; an http:// URL works for a local stand-in
+#ifndef SYNC_WORKER_URL
+#define SYNC_WORKER_URL "https://music-worker.robidobosan.workers.dev/"
+#endif
+// Sync: print the plan without changing anything, and whether card files the
+// manifest doesn't list (and no earlier sync installed) go to /.trash
+#ifndef SYNC_DRY_RUN
+#define SYNC_DRY_RUN 0
+#endif
+#ifndef SYNC_TRASH_UNTRACKED
+#define SYNC_TRASH_UNTRACKED 1
+#endif
+// Extract zip bundles while they download instead of saving the .zip first
+#ifndef SYNC_STREAM_UNZIP
+#define SYNC_STREAM_UNZIP 1
+#endif
+
+// Downloads: network reads on the sync task (SYNC_TASK_CORE) fill these
+// buffers while a writer task on DOWNLOAD_WRITER_CORE drains them to the card
+#ifndef DOWNLOAD_BUFFERS
+#define DOWNLOAD_BUFFERS 4
+#endif
+#ifndef DOWNLOAD_BUFFER_BYTES
+#define DOWNLOAD_BUFFER_BYTES 32768
+#endif
+#ifndef DOWNLOAD_WRITER_CORE
+#define DOWNLOAD_WRITER_CORE 0
+#endif
+// Kept-alive connections to the worker; each is a TLS session (~40 KB heap)
+#ifndef HTTP_POOL_SLOTS
+#define HTTP_POOL_SLOTS 1
+#endif
+// Interrupted downloads resume from the last checkpoint (a sync of the .tmp
+// file plus its sidecar) instead of byte 0
+#ifndef DOWNLOAD_CHECKPOINT_BYTES
+#define DOWNLOAD_CHECKPOINT_BYTES (1024 * 1024)
+#endif
+#ifndef DOWNLOAD_ATTEMPTS
+#define DOWNLOAD_ATTEMPTS 3
+#endif
+// The state DB is saved this often during a sync, so a restart doesn't
+// download again what an interrupted sync already finished
+#ifndef SYNC_CHECKPOINT_MS
+#define SYNC_CHECKPOINT_MS 30000
+#endif
+// Zip extraction reads the archive through a read-ahead window plus a
+// window over the central directory at its end
+#ifndef UNZIP_READ_WINDOW
+#define UNZIP_READ_WINDOW (64 * 1024)
+#endif
+#ifndef UNZIP_TAIL_WINDOW
+#define UNZIP_TAIL_WINDOW (16 * 1024)
+#endif
+// Deflated entries: a reader task on UNZIP_READER_CORE reads compressed data
+// into these buffers, the sync task (SYNC_TASK_CORE) inflates, and the
+// download writer task writes the output. Buffers at least UNZIP_READ_WINDOW
+// in size are read straight from the card without going through the window.
+#ifndef UNZIP_PIPELINE_BUFFERS
+#define UNZIP_PIPELINE_BUFFERS 3
+#endif
+#ifndef UNZIP_PIPELINE_BUFFER_BYTES
+#define UNZIP_PIPELINE_BUFFER_BYTES UNZIP_READ_WINDOW
+#endif
+#ifndef UNZIP_READER_CORE
+#define UNZIP_READER_CORE 0
+#endif
+// SD benchmark: runs at boot when the card has no stored result, when IO14
+// is held at power-up, or every boot with SD_BENCH_ON_BOOT. Otherwise boot
+// shows the stored result. Each run appends its rows to SD_BENCH_CSV; like
+// the other files here it is a root dot-file, which the sync leaves alone.
+#ifndef SD_BENCH_ON_BOOT
+#define SD_BENCH_ON_BOOT 0
+#endif
+#ifndef SD_BENCH_FILE_MB
+#define SD_BENCH_FILE_MB 4
+#endif
+#ifndef SD_BENCH_CSV
+#define SD_BENCH_CSV "/.sd_bench.csv"
+#endif
+#ifndef SD_BENCH_SUMMARY
+#define SD_BENCH_SUMMARY "/.sd_bench"
+#endif
+#ifndef SD_BENCH_SCRATCH
+#define SD_BENCH_SCRATCH "/.sd_bench.tmp"
+#endif
+// Boot sync (SD benchmark or its stored result, WiFi, manifest, downloads)
+// runs on its own task. At the loop task's priority the two share core 1;
+// holding BOOT during a sync switches it to the boost priority, ahead of the
+// UI.
+#ifndef SYNC_TASK_CORE
+#define SYNC_TASK_CORE 1
+#endif
+#ifndef SYNC_TASK_PRIORITY
+#define SYNC_TASK_PRIORITY 1
+#endif
+#ifndef SYNC_TASK_BOOST_PRIORITY
+#define SYNC_TASK_BOOST_PRIORITY 2
+#endif
+#ifndef SYNC_TASK_STACK
+#define SYNC_TASK_STACK 16384
+#endif
+// File browser: after the first page is drawn, the rest of a directory is
+// counted this many entries per loop() pass
+#ifndef LIST_SCAN_BATCH
+#define LIST_SCAN_BATCH 16
+#endif
+
 // --- DISPLAY SETUP (T-Display S3) ---
 #define GFX_EXTRA_PRE_INIT() \
   { \
@@ -51,126 +235,239 @@ SdFat sd; // THE SINGLE SOURCE OF TRUTH FOR SD CARD
 USBMSC MSC;
 // Using Arduino-ESP32 core USB MSC (global objects `USB` and `MSC`)
 
-
-static std::vector<String> g_fileLines;
-static std::vector<String> g_filePaths;
-static std::vector<bool> g_fileIsDir;
+// MSC data path: callbacks -> g_mscDev -> ... -> raw card
+static SdBlockDevice g_sdDev(sd);
+static SectorCache g_mscCache(g_sdDev);
+static ReadAhead g_readAhead(g_mscCache);
+static WriteCombiner g_writeCombiner(g_readAhead);
+// Playlist view; reads its metadata and file data through the read-ahead/cache
+static VirtualFat g_virtualFat(g_readAhead);
+static BlockDevice *g_mscDev = &g_sdDev;
+static bool g_usbStarted = false;
+// Every onRead/onWrite, timed (reset when USB starts)
+static MscStats g_mscStats;
+// The host ejected the volume: the card's FAT is ours to write again
+static volatile bool g_mscEjected = false;
+// The host wrote to the real card: the file index must be checked again
+static volatile bool g_mscHostWrote = false;
+// The volume was swapped and no TEST UNIT READY has failed since
+static volatile bool g_mscChangeUnseen = false;
+
+// Flat on-card index of every file; replaces walking the FAT tree
+static FileIndex g_fileIndex(sd);
+// Renames done by disableNonPlaylistFiles, so restoring doesn't search the card
+static RenameJournal g_renameJournal(sd);
+// What earlier syncs installed, for diffing against the manifest
+static SyncState g_syncState(sd);
+static DownloadPipeline g_downloadPipe;
+static ExtractPipeline g_extractPipe;
+static HttpSessionPool g_httpPool(HTTP_POOL_SLOTS);
+// Runs the boot sync; loop() draws its events and takes the card from it
+// only with try_lock
+static SyncTask g_sync;
+
+
+// Current listing; row labels are formatted from it when drawn. For an SD
+// directory it holds only the page on screen, entries [g_listBase,
+// g_listBase + size()); logical listings hold everything (g_listBase 0).
+static FileList g_fileList;
+static int g_listBase = 0;
+
+// SD directory behind the browser. It stays open: loop() keeps counting
+// entries and noting where each page starts, so paging is one seek plus a
+// page of reads, and the first page shows up as fast in a folder of 5,000
+// tracks as in one of ten.
+struct DirListing {
+  File32 dir;
+  String parent;                  // listed path without trailing '/'
+  std::vector<uint32_t> pagePos;  // directory position of each page's first entry
+  uint32_t scanPos = 0;           // where counting continues
+  int scanned = 0;                // entries counted so far
+  bool active = false;            // an SD directory is listed
+  bool complete = true;           // counted to the end
+  unsigned long startMs = 0;
+};
+static DirListing g_listing;
 static int g_firstLine = 0;
 static int g_linesPerPage = 0;
 static int g_lineHeight = 10;
 static int g_selectedIndex = 0;
 static String g_currentPath = "/";
 
+// What the browser last put on screen, so a key press repaints only what
+// changed: the two rows whose highlight moved, or the list when the page
+// changes. Anything else that draws over the browser calls invalidateBrowser().
+static const int LIST_TOP = 24;
+static String g_listTitle = "Files:";
+static bool g_browserDirty = true;
+static int g_drawnFirstLine = -1;
+static int g_drawnSelected = -1;
+
+// MSC stats screen (IO14 + hold BOOT): replaces the browser until closed,
+// redrawn once a second. `g_statsPrev` is the snapshot the KB/s is taken from.
+static bool g_statsScreen = false;
+static bool g_statsDirty = true;
+static unsigned long g_statsNextDraw = 0;
+static MscStats::Snapshot g_statsPrev;
+
+// Button edge (before debounce) to browser repainted
+struct UiLatency {
+  uint32_t presses;
+  uint32_t pageRepaints;  // whole list redrawn
+  uint32_t rowRepaints;   // only the highlight moved
+  uint32_t lastMs;
+  uint32_t maxMs;
+  uint64_t totalMs;
+  uint32_t drawUs;        // time inside the last repaint
+};
+static UiLatency g_uiLatency = {};
+
 static const int buttonPin = SCROLL_BUTTON_PIN;
 static int lastButtonState = HIGH;
 static unsigned long lastDebounceTime = 0;
 static const unsigned long debounceDelay = 50;
 
-const uint32_t BLOCK_SIZE = 512;
-
 // Disable files that are NOT under playlistPrefix by renaming them with ".nomsc"
 // Returns number of files renamed
 static size_t disableNonPlaylistFiles(const String &playlistPrefix) {
   if (!sd.card()) return 0;
   size_t disabled = 0;
   int total=0;
-  std::function<void(const String&)> walk = [&](const String &path) {
-    File32 dir = sd.open(path.c_str());
-    if (!dir) return;
-    dir.rewindDirectory();
-    File32 entry = dir.openNextFile();
-    char nameBuf[256];
-    while (entry) {
-      entry.getName(nameBuf, sizeof(nameBuf));
-      String name = String(nameBuf);
-      String full = path;
-      if (!full.endsWith("/")) full += "/";
-      full += name;
-
-      if (entry.isDirectory()) {
-        entry.close();
-        walk(full);
-      } else {
-        total++;
-        String lower = name;
-        lower.toLowerCase();
-        bool isAudio = lower.endsWith(".mp3") || lower.endsWith(".wav") || lower.endsWith(".m4a") || lower.endsWith(".flac");
-        if (isAudio) {
-          // if file is NOT part of the chosen playlist prefix, disable it
-          if (!playlistPrefix.isEmpty() && !full.startsWith(playlistPrefix)) {
-            String newFull = full + ".nomsc";
-            if (sd.rename(full.c_str(), newFull.c_str())) {
-              disabled++;
-              Serial.printf("Disabled %s -> %s\n", full.c_str(), newFull.c_str());
-            }
-          }
-        }
-      }
-      if (entry.isOpen()) entry.close();
-      entry = dir.openNextFile();
-      Serial.printf("Found audio: %d  keep=%u\n", total, (unsigned)(total-disabled));
+  // Every file on the card is considered
+  g_fileIndex.check("/");
+  // Collect first: renaming reorders the index
+  std::vector<String> toDisable;
+  for (const FileIndex::Entry &e : g_fileIndex.entries()) {
+    if (e.isDir()) continue;
+    total++;
+    String full = String(e.path.c_str());
+    String lower = full;
+    lower.toLowerCase();
+    bool isAudio = lower.endsWith(".mp3") || lower.endsWith(".wav") || lower.endsWith(".m4a") || lower.endsWith(".flac");
+    // if file is NOT part of the chosen playlist prefix, disable it
+    if (isAudio && !playlistPrefix.isEmpty() && !full.startsWith(playlistPrefix)) toDisable.push_back(full);
+  }
+
+  for (const String &full : toDisable) {
+    String newFull = full + ".nomsc";
+    // Journal first, so a power cut mid-rename can still be undone on boot
+    if (!g_renameJournal.record(full.c_str(), newFull.c_str())) {
+      Serial.printf("Journal write failed, not disabling %s\n", full.c_str());
+      continue;
     }
-    dir.close();
-  };
-  
-  walk(String("/"));
+    if (g_fileIndex.rename(full.c_str(), newFull.c_str())) {
+      g_renameJournal.commit();
+      disabled++;
+      Serial.printf("Disabled %s -> %s\n", full.c_str(), newFull.c_str());
+    }
+  }
+  g_renameJournal.close();
+  g_fileIndex.update(g_renameJournal.path());
+  Serial.printf("Found audio: %d  keep=%u\n", total, (unsigned)(total-disabled));
+  g_fileIndex.save();
   return disabled;
 }
 
+// Rename a disabled file back, or to <name>_restored if the original name
+// has been taken since
+static bool restoreNomscFile(const String &full, const String &origFull) {
+  if (g_fileIndex.find(origFull.c_str())) {
+    String backup = origFull + String("_restored");
+    Serial.printf("Conflict restoring %s -> %s, using %s\n", full.c_str(), origFull.c_str(), backup.c_str());
+    if (!g_fileIndex.rename(full.c_str(), backup.c_str())) return false;
+    Serial.printf("Restored to %s\n", backup.c_str());
+    return true;
+  }
+  if (!g_fileIndex.rename(full.c_str(), origFull.c_str())) {
+    Serial.printf("Failed to restore %s\n", full.c_str());
+    return false;
+  }
+  Serial.printf("Restored %s -> %s\n", full.c_str(), origFull.c_str());
+  return true;
+}
+
 //restore files ending with .nomsc by removing suffix
 static void restoreNomscOnBoot() {
   if (!sd.card()) return;
 
-  std::function<void(const String&)> walk = [&](const String &path) {
-    File32 dir = sd.open(path.c_str());
-    if (!dir) return;
-    dir.rewindDirectory();
-    File32 entry = dir.openNextFile();
-    char nameBuf[256];
-    while (entry) {
-      entry.getName(nameBuf, sizeof(nameBuf));
-      String name = String(nameBuf);
-      String full = path;
-      if (!full.endsWith("/")) full += "/";
-      full += name;
-
-      if (entry.isDirectory()) {
-        entry.close();
-        walk(full);
-      } else {
-        const String suffix = ".nomsc";
-        if (name.endsWith(suffix)) {
-          String origName = name.substring(0, name.length() - suffix.length());
-          String origFull = path;
-          if (!origFull.endsWith("/")) origFull += "/";
-          origFull += origName;
-          // If original name already exists, choose a fallback (append _restored)
-          if (sd.exists(origFull.c_str())) {
-            String backup = origFull + String("_restored");
-            Serial.printf("Conflict restoring %s -> %s, using %s\n", full.c_str(), origFull.c_str(), backup.c_str());
-            if (sd.rename(full.c_str(), backup.c_str())) {
-              Serial.printf("Restored to %s\n", backup.c_str());
-            }
-          } else {
-            if (sd.rename(full.c_str(), origFull.c_str())) {
-              Serial.printf("Restored %s -> %s\n", full.c_str(), origFull.c_str());
-            } else {
-              Serial.printf("Failed to restore %s\n", full.c_str());
-            }
-          }
-        }
-      }
+  // Undo what the journal says was disabled: cost grows with the number of
+  // renames, not with the size of the library
+  if (g_renameJournal.exists()) {
+    size_t interrupted = 0;
+    size_t undone = g_renameJournal.rollback([](const char *from, const char *to) {
+      return restoreNomscFile(String(to), String(from));
+    }, &interrupted);
+    g_fileIndex.update(g_renameJournal.path());
+    Serial.printf("Rename journal: restored %u files (%u interrupted renames)\n", (unsigned)undone, (unsigned)interrupted);
+  }
 
-      if (entry.isOpen()) entry.close();
-      entry = dir.openNextFile();
+  // .nomsc files the journal doesn't know about (older firmware, card edited
+  // elsewhere) can only have appeared if the index had to be rebuilt
+  if (g_fileIndex.rebuilt()) {
+    const String suffix = ".nomsc";
+    std::vector<String> toRestore;
+    for (const FileIndex::Entry &e : g_fileIndex.entries()) {
+      if (e.isDir()) continue;
+      String full = String(e.path.c_str());
+      if (full.endsWith(suffix)) toRestore.push_back(full);
     }
-    dir.close();
-  };
-
-  walk(String("/"));
+    for (const String &full : toRestore) {
+      restoreNomscFile(full, full.substring(0, full.length() - suffix.length()));
+    }
+  }
 
   // Ensure metadata is flushed
   if (sd.card()) sd.card()->syncBlocks();
+  if (g_fileIndex.dirty()) g_fileIndex.save();
+}
+
+// Build the read-only virtual volume for a playlist: only files under
+// playlistPrefix (a directory ending in '/', or one exact file) are visible,
+// with their paths relative to it. Nothing on the card is changed.
+static bool buildVirtualPlaylist(const String &playlistPrefix) {
+  if (!sd.card()) return false;
+  std::vector<VirtualFat::Entry> files;
+
+  auto addFile = [&](const FileIndex::Entry &e, const String &rel) {
+    VirtualFat::Entry v;
+    v.path = rel.c_str();
+    v.size = e.size;
+    v.firstCluster = e.firstCluster;
+    v.date = e.date;
+    v.time = e.time;
+    files.push_back(v);
+  };
+
+  String label;
+  if (!playlistPrefix.endsWith("/")) {
+    g_fileIndex.check(playlistPrefix.substring(0, playlistPrefix.lastIndexOf('/') + 1).c_str());
+    const FileIndex::Entry *e = g_fileIndex.find(playlistPrefix.c_str());
+    if (!e || e->isDir()) return false;
+    label = playlistPrefix.substring(playlistPrefix.lastIndexOf('/') + 1);
+    addFile(*e, label);
+  } else {
+    g_fileIndex.check(playlistPrefix.c_str());
+    FileIndex::Range r = g_fileIndex.under(playlistPrefix.c_str());
+    for (size_t i = r.begin; i < r.end; ++i) {
+      const FileIndex::Entry &e = g_fileIndex.entries()[i];
+      if (e.isDir()) continue;
+      addFile(e, String(e.path.c_str() + playlistPrefix.length()));
+    }
+    String dirPath = playlistPrefix.length() > 1 ? playlistPrefix.substring(0, playlistPrefix.length() - 1) : playlistPrefix;
+    label = dirPath.substring(dirPath.lastIndexOf('/') + 1);
+  }
+  if (label.isEmpty()) label = "PLAYLIST";
+
+  unsigned long t0 = millis();
+  if (!g_virtualFat.build(files, label.c_str())) {
+    Serial.println("Virtual playlist: could not build volume");
+    return false;
+  }
+  VirtualFat::Info info = g_virtualFat.info();
+  Serial.printf("Virtual playlist: FAT%u, %u files, %u dirs, %u fragments, %u skipped (%lu ms)\n",
+                (unsigned)info.fatType, (unsigned)info.files, (unsigned)info.dirs,
+                (unsigned)info.fragments, (unsigned)info.skipped, millis() - t0);
+  return true;
 }
 
 
@@ -180,88 +477,74 @@ static void restoreNomscOnBoot() {
 static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize) {
   // Write `bufsize` bytes starting at sector `lba` + `offset` into the SD card.
   if (!sd.card()) return -1;
-  uint32_t sectors = sd.card()->sectorCount();
-  if (lba >= sectors) return -1;
-
-  uint32_t remaining = bufsize;
-  uint8_t *src = buffer;
-  uint32_t sector = lba;
-  uint32_t off = offset;
-
-  uint8_t tmp[BLOCK_SIZE];
-
-  while (remaining > 0) {
-    // If we are aligned to sector boundary and have at least one full sector, write directly
-    if (off == 0 && remaining >= BLOCK_SIZE) {
-      uint32_t n = remaining / BLOCK_SIZE;
-      // limit n so we don't go past card
-      if (sector + n > sectors) return -1;
-      if (!sd.card()->writeSectors(sector, src, n)) return -1;
-      sector += n;
-      src += n * BLOCK_SIZE;
-      remaining -= n * BLOCK_SIZE;
-      // off stays zero
-      continue;
-    }
-
-    // Partial sector: read-modify-write
-    if (!sd.card()->readSectors(sector, tmp, 1)) return -1;
-    uint32_t toCopy = BLOCK_SIZE - off;
-    if (toCopy > remaining) toCopy = remaining;
-    memcpy(tmp + off, src, toCopy);
-    if (!sd.card()->writeSectors(sector, tmp, 1)) return -1;
-
-    remaining -= toCopy;
-    src += toCopy;
-    sector++;
-    off = 0;
-  }
-
-  return (int32_t)bufsize;
+  // The playlist view is read-only
+  if (g_mscDev == &g_virtualFat) return -1;
+  g_mscHostWrote = true;
+  // The write combiner merges this with neighbouring writes and handles
+  // unaligned head/tail bytes when it flushes (msc_io.h).
+  return mscWrite(g_writeCombiner, lba, offset, buffer, bufsize, &g_mscStats);
 }
 
 static int32_t onRead(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize) {
   // Read `bufsize` bytes starting at sector `lba` + `offset` from the SD card.
   if (!sd.card()) return -1;
-  uint32_t sectors = sd.card()->sectorCount();
-  if (lba >= sectors) return -1;
-
-  uint32_t remaining = bufsize;
-  uint8_t *dst = (uint8_t*)buffer;
-  uint32_t sector = lba;
-  uint32_t off = offset;
-
-  uint8_t tmp[BLOCK_SIZE];
-
-  while (remaining > 0) {
-    // If we are aligned and need whole sectors, read directly
-    if (off == 0 && remaining >= BLOCK_SIZE) {
-      uint32_t n = remaining / BLOCK_SIZE;
-      if (sector + n > sectors) return -1;
-      if (!sd.card()->readSectors(sector, dst, n)) return -1;
-      sector += n;
-      dst += n * BLOCK_SIZE;
-      remaining -= n * BLOCK_SIZE;
-      continue;
-    }
-
-    // Partial sector: read sector then copy
-    if (!sd.card()->readSectors(sector, tmp, 1)) return -1;
-    uint32_t toCopy = BLOCK_SIZE - off;
-    if (toCopy > remaining) toCopy = remaining;
-    memcpy(dst, tmp + off, toCopy);
+  return mscRead(*g_mscDev, lba, offset, buffer, bufsize, &g_mscStats);
+}
 
-    remaining -= toCopy;
-    dst += toCopy;
-    sector++;
-    off = 0;
+static void printMscStats() {
+  if (g_mscCache.active()) {
+    SectorCache::Stats st = g_mscCache.stats();
+    uint32_t lookups = st.hits + st.misses;
+    float hitPct = lookups ? (100.0f * st.hits / lookups) : 0.0f;
+    Serial.printf("MSC cache: %u hits, %u misses (%.1f%%), %u evictions, %u writebacks, %u bypassed, %u dirty\n",
+                  (unsigned)st.hits, (unsigned)st.misses, hitPct, (unsigned)st.evictions,
+                  (unsigned)st.writebacks, (unsigned)st.bypassSectors, (unsigned)g_mscCache.dirtyCount());
   }
+  if (g_readAhead.active()) {
+    ReadAhead::Stats ra = g_readAhead.stats();
+    float hitPct = ra.readSectors ? (100.0f * ra.hitSectors / ra.readSectors) : 0.0f;
+    Serial.printf("MSC read-ahead: %u streams, %u/%u sectors from RAM (%.1f%%), %u prefetched, %.1f KB wasted\n",
+                  (unsigned)ra.streams, (unsigned)ra.hitSectors, (unsigned)ra.readSectors, hitPct,
+                  (unsigned)ra.prefetchedSectors, ra.wastedSectors * (BLOCK_SIZE / 1024.0f));
+  }
+  if (g_writeCombiner.active()) {
+    WriteCombiner::Stats wc = g_writeCombiner.stats();
+    float perFlush = wc.flushes ? (float)wc.sectorsWritten * BLOCK_SIZE / 1024.0f / wc.flushes : 0.0f;
+    Serial.printf("MSC writes: %u host writes (%u merged) -> %u card writes, %.1f KB avg, %u RMW sectors, %u idle flushes\n",
+                  (unsigned)wc.hostWrites, (unsigned)wc.mergedWrites, (unsigned)wc.flushes, perFlush,
+                  (unsigned)wc.rmwSectors, (unsigned)wc.idleFlushes);
+  }
+  MscStats::dump(g_mscStats.snapshot(), [](const char *line) { Serial.println(line); });
+}
 
-  return (int32_t)bufsize;
+// Push everything buffered in the MSC path down to the card
+static void flushMsc(const char *why) {
+  if (!g_mscDev->sync()) Serial.printf("MSC flush (%s) FAILED\n", why);
+  printMscStats();
+}
+
+// A host only drops what it cached of the volume after a TEST UNIT READY
+// fails, and it polls at its own pace: a media change that toggles
+// mediaPresent() between two polls goes unnoticed. After a swap the next
+// TEST UNIT READY that would pass reports UNIT ATTENTION (medium may have
+// changed) instead. The core defines the TinyUSB callback, hence
+// -Wl,--wrap=tud_msc_test_unit_ready_cb in platformio.ini.
+extern "C" bool __real_tud_msc_test_unit_ready_cb(uint8_t lun);
+extern "C" bool __wrap_tud_msc_test_unit_ready_cb(uint8_t lun) {
+  bool ready = __real_tud_msc_test_unit_ready_cb(lun);
+  if (ready && g_mscChangeUnseen) {
+    tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+    ready = false;
+  }
+  // NOT READY (no media) tells the host as much
+  if (!ready) g_mscChangeUnseen = false;
+  return ready;
 }
 
 static bool onStartStop(uint8_t power_condition, bool start, bool load_eject) {
   Serial.printf("MSC START/STOP: power: %u, start: %u, eject: %u\n", power_condition, start, load_eject);
+  if (load_eject && !start) flushMsc("eject");
+  if (load_eject) g_mscEjected = !start;
   return true;
 }
 
@@ -270,8 +553,8 @@ static void usbEventCallback(void *arg, esp_event_base_t event_base, int32_t eve
     arduino_usb_event_data_t *data = (arduino_usb_event_data_t *)event_data;
     switch (event_id) {
       case ARDUINO_USB_STARTED_EVENT: Serial.println("USB PLUGGED"); break;
-      case ARDUINO_USB_STOPPED_EVENT: Serial.println("USB UNPLUGGED"); break;
-      case ARDUINO_USB_SUSPEND_EVENT: Serial.printf("USB SUSPENDED: remote_wakeup_en: %u\n", data->suspend.remote_wakeup_en); break;
+      case ARDUINO_USB_STOPPED_EVENT: Serial.println("USB UNPLUGGED"); flushMsc("unplug"); break;
+      case ARDUINO_USB_SUSPEND_EVENT: Serial.printf("USB SUSPENDED: remote_wakeup_en: %u\n", data->suspend.remote_wakeup_en); flushMsc("suspend"); break;
       case ARDUINO_USB_RESUME_EVENT:  Serial.println("USB RESUMED"); break;
 
       default: break;
@@ -280,177 +563,206 @@ static void usbEventCallback(void *arg, esp_event_base_t event_base, int32_t eve
 }
 
 // --- HELPERS ---
-static String humanReadableSize(uint64_t bytes) {
-  char buf[32];
+static void formatSize(uint64_t bytes, char *buf, size_t n) {
   if (bytes < 1024) {
-    snprintf(buf, sizeof(buf), "%llu B", (unsigned long long)bytes);
+    snprintf(buf, n, "%llu B", (unsigned long long)bytes);
   } else if (bytes < 1024ULL * 1024ULL) {
-    snprintf(buf, sizeof(buf), "%.1f KB", bytes / 1024.0);
+    snprintf(buf, n, "%.1f KB", bytes / 1024.0);
   } else if (bytes < 1024ULL * 1024ULL * 1024ULL) {
-    snprintf(buf, sizeof(buf), "%.1f MB", bytes / (1024.0 * 1024.0));
+    snprintf(buf, n, "%.1f MB", bytes / (1024.0 * 1024.0));
   } else {
-    snprintf(buf, sizeof(buf), "%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    snprintf(buf, n, "%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0));
   }
-  return String(buf);
 }
 
-static void drawPopUp(unsigned long remaining){
-    int W = gfx->width();
-    int H = gfx->height();
-    int boxW = (W * 2) / 3;
-    int boxH = 40;
-    int boxX = (W - boxW) / 2;
-    int boxY = (H - boxH) / 2;
-    gfx->fillRoundRect(boxX, boxY, boxW, boxH, 6, RED);
-    gfx->drawRoundRect(boxX, boxY, boxW, boxH, 6, WHITE);
-    gfx->setTextColor(WHITE);
-    gfx->setTextSize(2);
-    char buf[32];
-    snprintf(buf, sizeof(buf), "Hold %lu ms more", remaining);
-    gfx->setCursor(boxX + 10, boxY + (boxH / 2) - 8);
-    gfx->println(buf);
-    
+static String humanReadableSize(uint64_t bytes) {
+  char buf[32];
+  formatSize(bytes, buf, sizeof(buf));
+  return String(buf);
 }
 
-// --- FILE LISTING (SdFat Version) ---
-void listFilesAndPrintSamples(const char *path = "/") {
-  // SdFat uses 'File' (which is usually File32 or ExFile)
-  File32 root = sd.open(path);
-  if (!root) {
-    Serial.printf("Failed to open dir: %s\n", path);
+// Row text for listing entry i: "DIR: name", or the path below the listed
+// directory followed by the size
+static void fileLabel(size_t i, char *buf, size_t n) {
+  size_t len;
+  const char *name = g_fileList.name(i, &len);
+  if (g_fileList.isPlaceholder(i)) {
+    snprintf(buf, n, "%.*s", (int)len, name);
     return;
   }
-
-  Serial.print("Opened path: ");
-  Serial.println(path);
-  // SdFat directory check
-  if (!root.isDirectory()) {
-     Serial.println("Not a directory");
-     root.close();
-     return;
+  if (g_fileList.isDir(i)) {
+    snprintf(buf, n, "DIR: %.*s", (int)len, name);
+    return;
   }
-  root.rewindDirectory(); // Rewind directory
-
-  g_fileLines.clear();
-  g_filePaths.clear();
-  g_fileIsDir.clear();
-  // Reserve to reduce reallocations and heap churn during listing
-  g_fileLines.reserve(128);
-  g_filePaths.reserve(128);
-  g_fileIsDir.reserve(128);
-
-  File32 entry = root.openNextFile();
-  char nameBuf[128] = {0}; // zero-init to avoid leftover garbage
+  char path[256];
+  g_fileList.path(i, path, sizeof(path));
+  const char *rel = path;
+  size_t base = g_currentPath.length();
+  if (strncmp(path, g_currentPath.c_str(), base) == 0) rel += base;
+  if (*rel == '/') rel++;
+  char size[16];
+  formatSize(g_fileList.fileSize(i), size, sizeof(size));
+  snprintf(buf, n, "%s  %s", rel, size);
+}
 
+// --- DIRECTORY LISTING (SdFat Version) ---
+// Next entry of an open directory; false at the end
+static bool readDirEntry(File32 &dir, char *name, size_t n, bool *isDir, uint32_t *size) {
+  File32 entry = dir.openNextFile();
   while (entry) {
     // Defensive: ensure the File32 is actually open/valid
-    if (!entry.isOpen()) {
+    if (entry.isOpen()) {
+      // Use getName() into a zeroed buffer to avoid relying on pointer
+      // lifetimes or unexpected return values from entry.name().
+      memset(name, 0, n);
+      entry.getName(name, n);
+      *isDir = entry.isDirectory();
+      *size = *isDir ? 0 : (uint32_t)entry.size();
       entry.close();
-      entry = root.openNextFile();
-      continue;
+      return true;
     }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  return false;
+}
 
-    // Use getName() into a local, zeroed buffer to avoid relying on
-    // pointer lifetimes or unexpected return values from entry.name().
-    memset(nameBuf, 0, sizeof(nameBuf));
-    entry.getName(nameBuf, sizeof(nameBuf));
-    String name = String(nameBuf);
-    
-    // Filter hidden files if needed (optional)
-    // if (name.startsWith(".")) { entry.close(); continue; }
-
-    String fullPath = String(path);
-    if (!fullPath.endsWith("/")) fullPath += "/";
-    fullPath += name;
-
-    if (entry.isDirectory()) {
-      // Serial.print("DIR:  "); Serial.println(name);
-      g_fileLines.push_back(String("DIR: ") + name);
-      g_fileIsDir.push_back(true);
-      g_filePaths.push_back(fullPath);
-    } else {
-      uint64_t sz = entry.size();
-      String sizeStr = humanReadableSize(sz);
-      // Serial.print("FILE: "); Serial.println(name);
-      g_fileLines.push_back(name + String("  ") + sizeStr);
-      g_fileIsDir.push_back(false);
-      g_filePaths.push_back(fullPath);
+// Entries known so far: all of them once the directory has been counted
+static int listTotal() {
+  int loaded = g_listBase + (int)g_fileList.size();
+  if (!g_listing.active) return loaded;
+  return g_listing.scanned > loaded ? g_listing.scanned : loaded;
+}
+
+static int listPages() {
+  return (listTotal() + g_linesPerPage - 1) / g_linesPerPage;
+}
+
+static void closeListing() {
+  if (g_listing.dir) g_listing.dir.close();
+  g_listing.active = false;
+  g_listing.complete = true;
+  g_listing.pagePos.clear();
+}
+
+// Count up to `n` more entries of the listed directory, noting where each
+// page starts. Entries belonging to the page being filled (the first one,
+// right after opening) go into g_fileList on the way.
+static void scanListing(int n) {
+  DirListing &l = g_listing;
+  if (!l.active || l.complete) return;
+  l.dir.seekSet(l.scanPos);
+  char name[128];
+  bool isDir;
+  uint32_t size;
+  for (; n > 0; n--) {
+    uint32_t pos = l.dir.curPosition();
+    if (!readDirEntry(l.dir, name, sizeof(name), &isDir, &size)) {
+      l.complete = true;
+      Serial.printf("List %s/: %d entries counted in %lu ms\n", l.parent.c_str(), l.scanned,
+                    millis() - l.startMs);
+      break;
     }
-    entry.close();
+    if (l.scanned % g_linesPerPage == 0) l.pagePos.push_back(pos);
+    int row = l.scanned - g_listBase;
+    if (row == (int)g_fileList.size() && row < g_linesPerPage &&
+        !g_fileList.add(l.parent.c_str(), name, size, isDir)) {
+      Serial.println("File list: out of memory, page truncated");
+    }
+    l.scanned++;
     // Give background tasks a chance to run (TCP, TinyUSB background work)
     yield();
-    entry = root.openNextFile();
   }
+  l.scanPos = l.dir.curPosition();
+  if (l.complete && l.scanned == 0 && g_fileList.empty()) g_fileList.addPlaceholder("(no files found)");
+}
 
-  if (g_fileLines.empty()) {
-    g_fileLines.push_back(String("(no files found)"));
+// Make g_fileList hold page `page` of the listed directory
+static void loadListingPage(int page) {
+  DirListing &l = g_listing;
+  g_fileList.clear();
+  g_listBase = page * g_linesPerPage;
+  if (page >= (int)l.pagePos.size()) return;
+  l.dir.seekSet(l.pagePos[page]);
+  char name[128];
+  bool isDir;
+  uint32_t size;
+  for (int i = 0; i < g_linesPerPage && readDirEntry(l.dir, name, sizeof(name), &isDir, &size); ++i) {
+    if (!g_fileList.add(l.parent.c_str(), name, size, isDir)) {
+      Serial.println("File list: out of memory, page truncated");
+      break;
+    }
   }
+}
 
-  root.close();
+// Whether entry i exists, counting ahead if the scan hasn't reached it yet
+static bool listingHas(int i) {
+  while (!g_listing.complete && listTotal() <= i) scanListing(LIST_SCAN_BATCH);
+  return i < listTotal();
+}
 
-  // --- UI DRAWING (Same as before) ---
-  const int textSize = 1;
-  gfx->setTextSize(textSize);
-  g_lineHeight = 12 * textSize + 6;
-  int startY = 24;
-  int screenH = gfx->height();
-  g_linesPerPage = (screenH - startY - 8) / g_lineHeight;
-  if (g_linesPerPage < 1) g_linesPerPage = 1;
-  g_firstLine = 0;
-  g_currentPath = String(path);
-  g_selectedIndex = 0;
+// --- FILE BROWSER DRAWING ---
+static void invalidateBrowser() {
+  g_browserDirty = true;
+  g_statsDirty = true;  // or over the stats screen
+}
 
-  gfx->fillScreen(BLACK);
-  gfx->setTextColor(WHITE);
-  gfx->setCursor(10, 6);
-  gfx->println("Files:");
-
-  int y = startY;
-  int end = (int)g_fileLines.size();
-  if (end > g_firstLine + g_linesPerPage) end = g_firstLine + g_linesPerPage;
-  for (int i = g_firstLine; i < end; ++i) {
-    if (i == g_selectedIndex) {
-      gfx->fillRect(4, y - 2, gfx->width() - 8, g_lineHeight, WHITE);
-      gfx->setTextColor(BLACK);
-    } else {
-      gfx->setTextColor(WHITE);
-    }
-    gfx->setCursor(6, y);
-    gfx->print(g_fileLines[i]);
-    y += g_lineHeight;
-  }
+// One list row, highlighted if selected. `clear` paints its background
+// first (not needed right after fillScreen).
+static void drawBrowserRow(int i, bool clear) {
+  int y = LIST_TOP + (i - g_firstLine) * g_lineHeight;
+  bool selected = (i == g_selectedIndex);
+  if (clear) gfx->fillRect(0, y - 2, gfx->width(), g_lineHeight, BLACK);
+  if (selected) gfx->fillRect(4, y - 2, gfx->width() - 8, g_lineHeight, WHITE);
+  gfx->setTextColor(selected ? BLACK : WHITE);
+  char label[160];
+  fileLabel(i - g_listBase, label, sizeof(label));
+  gfx->setCursor(6, y);
+  gfx->print(label);
+}
+
+static void drawBrowserFooter(bool clear) {
+  int y = gfx->height() - 12;
+  if (clear) gfx->fillRect(0, y, gfx->width(), 12, BLACK);
   gfx->setTextColor(WHITE);
-  gfx->setCursor(6, gfx->height() - 12);
+  gfx->setCursor(6, y);
   int page = g_firstLine / g_linesPerPage + 1;
-  int pages = ((int)g_fileLines.size() + g_linesPerPage - 1) / g_linesPerPage;
+  // "+" while the directory is still being counted
   char buf[48];
-  snprintf(buf, sizeof(buf), "Pg %d/%d (IO14=Sel, BOOT=Back/Enter)", page, pages);
-  gfx->println(buf);
+  snprintf(buf, sizeof(buf), "Pg %d/%d%s (IO14=Sel, BOOT=Back/Enter)", page, listPages(),
+           g_listing.complete ? "" : "+");
+  gfx->print(buf);
 }
 
-// Draw current page from `g_fileLines` using `g_selectedIndex` and paging.
+// Draw current page from `g_fileList` using `g_selectedIndex` and paging,
+// reading the page from the listed directory if it isn't the one held.
+// Repaints only what differs from what is on screen: nothing, the old and
+// new highlighted rows, or (new page / invalidated) the whole list.
 static void drawCurrentPage() {
+  // Redrawn in full by closeStatsScreen()
+  if (g_statsScreen) return;
   // Safety: ensure layout metrics are available
   // Use the same text size/layout as the main listing
   const int textSize = 1;
   gfx->setTextSize(textSize);
   g_lineHeight = 12 * textSize + 6;
   if (g_linesPerPage <= 0) {
-    int startY = 24;
     int screenH = gfx->height();
-    g_linesPerPage = (screenH - startY - 8) / g_lineHeight;
+    g_linesPerPage = (screenH - LIST_TOP - 8) / g_lineHeight;
     if (g_linesPerPage < 1) g_linesPerPage = 1;
   }
 
   // Normalize selection
-  int total = (int)g_fileLines.size();
+  int total = listTotal();
   if (total == 0) {
     gfx->fillScreen(BLACK);
     gfx->setTextColor(WHITE);
     gfx->setCursor(10,6);
-    gfx->println("Files:");
+    gfx->println(g_listTitle);
     gfx->setCursor(6, gfx->height() - 12);
     gfx->println("(no files)");
+    g_browserDirty = false;
+    g_drawnFirstLine = g_drawnSelected = -1;
     return;
   }
   if (g_selectedIndex < 0) g_selectedIndex = 0;
@@ -460,112 +772,177 @@ static void drawCurrentPage() {
   g_firstLine = (g_selectedIndex / g_linesPerPage) * g_linesPerPage;
   if (g_firstLine < 0) g_firstLine = 0;
 
-  gfx->fillScreen(BLACK);
-  gfx->setTextColor(WHITE);
-  gfx->setCursor(10,6); gfx->println("Files:");
-
-  int y = 24;
+  unsigned long t0 = micros();
+  if (g_listing.active && g_firstLine != g_listBase) loadListingPage(g_firstLine / g_linesPerPage);
   int end = g_firstLine + g_linesPerPage;
-  if (end > total) end = total;
-  for (int i = g_firstLine; i < end; ++i) {
-    if (i == g_selectedIndex) {
-      gfx->fillRect(4, y - 2, gfx->width() - 8, g_lineHeight, WHITE);
-      gfx->setTextColor(BLACK);
-    } else {
+  if (end > g_listBase + (int)g_fileList.size()) end = g_listBase + (int)g_fileList.size();
+
+  // Long names are cut at the screen edge instead of wrapping into the next row
+  gfx->setTextWrap(false);
+  if (g_browserDirty || g_firstLine != g_drawnFirstLine) {
+    bool cleared = g_browserDirty;
+    if (cleared) {
+      gfx->fillScreen(BLACK);
       gfx->setTextColor(WHITE);
+      gfx->setCursor(10,6);
+      gfx->print(g_listTitle);
+    }
+    for (int i = g_firstLine; i < end; ++i) drawBrowserRow(i, !cleared);
+    // A short last page leaves rows of the previous one below it
+    int usedH = (end - g_firstLine) * g_lineHeight;
+    if (!cleared && end - g_firstLine < g_linesPerPage) {
+      gfx->fillRect(0, LIST_TOP - 2 + usedH, gfx->width(), (g_linesPerPage * g_lineHeight) - usedH, BLACK);
     }
-    gfx->setCursor(6, y);
-    gfx->print(g_fileLines[i]);
-    y += g_lineHeight;
+    drawBrowserFooter(!cleared);
+    g_uiLatency.pageRepaints++;
+  } else if (g_selectedIndex != g_drawnSelected) {
+    if (g_drawnSelected >= g_firstLine && g_drawnSelected < end) drawBrowserRow(g_drawnSelected, true);
+    drawBrowserRow(g_selectedIndex, true);
+    g_uiLatency.rowRepaints++;
   }
-  gfx->setTextColor(WHITE);
-  gfx->setCursor(6, gfx->height() - 12);
-  int page = g_firstLine / g_linesPerPage + 1;
-  int pages = ((int)g_fileLines.size() + g_linesPerPage - 1) / g_linesPerPage;
-  char buf[48];
-  snprintf(buf, sizeof(buf), "Pg %d/%d (IO14=Sel, BOOT=Back/Enter)", page, pages);
-  gfx->println(buf);
+  gfx->setTextWrap(true);
+  g_uiLatency.drawUs = micros() - t0;
+
+  g_browserDirty = false;
+  g_drawnFirstLine = g_firstLine;
+  g_drawnSelected = g_selectedIndex;
+}
+
+// Log how long a button press took to reach the screen. `edgeMs` is when
+// the pin changed, so the debounce delay is included.
+static void noteUiLatency(unsigned long edgeMs, const char *what) {
+  uint32_t ms = millis() - edgeMs;
+  UiLatency &u = g_uiLatency;
+  u.presses++;
+  u.lastMs = ms;
+  if (ms > u.maxMs) u.maxMs = ms;
+  u.totalMs += ms;
+  Serial.printf("UI %s: %lu ms press-to-pixel (%lu us drawing; avg %lu ms, max %lu ms over %lu presses; %lu page / %lu row repaints)\n",
+                what, (unsigned long)ms, (unsigned long)u.drawUs, (unsigned long)(u.totalMs / u.presses),
+                (unsigned long)u.maxMs, (unsigned long)u.presses, (unsigned long)u.pageRepaints,
+                (unsigned long)u.rowRepaints);
+}
+
+static void drawPopUp(unsigned long remaining){
+    int W = gfx->width();
+    int H = gfx->height();
+    int boxW = (W * 2) / 3;
+    int boxH = 40;
+    int boxX = (W - boxW) / 2;
+    int boxY = (H - boxH) / 2;
+    gfx->fillRoundRect(boxX, boxY, boxW, boxH, 6, RED);
+    gfx->drawRoundRect(boxX, boxY, boxW, boxH, 6, WHITE);
+    gfx->setTextColor(WHITE);
+    gfx->setTextSize(2);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "Hold %lu ms more", remaining);
+    gfx->setCursor(boxX + 10, boxY + (boxH / 2) - 8);
+    gfx->println(buf);
+    invalidateBrowser();
+}
+
+// --- FILE LISTING (SdFat Version) ---
+// Draws the first page as soon as it is read; pumpListing() counts the rest
+void listFilesAndPrintSamples(const char *path = "/") {
+  unsigned long t0 = millis();
+  closeListing();
+  // SdFat uses 'File' (which is usually File32 or ExFile)
+  File32 &root = g_listing.dir;
+  root = sd.open(path);
+  if (!root) {
+    Serial.printf("Failed to open dir: %s\n", path);
+    return;
+  }
+
+  Serial.print("Opened path: ");
+  Serial.println(path);
+  // SdFat directory check
+  if (!root.isDirectory()) {
+     Serial.println("Not a directory");
+     root.close();
+     return;
+  }
+  root.rewindDirectory(); // Rewind directory
+
+  // Layout first: it decides how many entries make the first page
+  const int textSize = 1;
+  gfx->setTextSize(textSize);
+  g_lineHeight = 12 * textSize + 6;
+  int screenH = gfx->height();
+  g_linesPerPage = (screenH - LIST_TOP - 8) / g_lineHeight;
+  if (g_linesPerPage < 1) g_linesPerPage = 1;
+
+  // Entries keep their memory from the last listing: no heap churn
+  g_fileList.clear();
+  g_listBase = 0;
+  g_listing.parent = String(path);
+  if (g_listing.parent.endsWith("/")) g_listing.parent.remove(g_listing.parent.length() - 1);
+  g_listing.pagePos.clear();
+  g_listing.scanPos = root.curPosition();
+  g_listing.scanned = 0;
+  g_listing.active = true;
+  g_listing.complete = false;
+  g_listing.startMs = t0;
+  scanListing(g_linesPerPage);
+
+  g_firstLine = 0;
+  g_currentPath = String(path);
+  g_selectedIndex = 0;
+  g_listTitle = "Files:";
+
+  invalidateBrowser();
+  drawCurrentPage();
+  Serial.printf("List %s: first page in %lu ms (%u bytes)\n", path, millis() - t0,
+                (unsigned)g_fileList.bytes());
+}
+
+// Background part of a listing: count a few more entries per loop() pass and
+// keep the page count in the footer current. Paused while the host has the
+// card over USB (paging then counts on demand) or the sync task is using it.
+static void pumpListing() {
+  if (g_listing.complete || g_usbStarted) return;
+  std::unique_lock<std::mutex> card(g_sync.cardLock(), std::try_to_lock);
+  if (!card.owns_lock()) return;
+  int pages = listPages();
+  scanListing(LIST_SCAN_BATCH);
+  if (!g_browserDirty && (listPages() != pages || g_listing.complete)) drawBrowserFooter(true);
 }
 
 // --- LOGICAL PATH LISTING (SdFat Version) ---
 void listFilesForLogicalPath(const String &logicalPrefix) {
-  g_fileLines.clear();
-  g_filePaths.clear();
-  g_fileIsDir.clear();
-
-  // Recursive walker for SdFat
-  // Note: Recursive lambdas with capture are tricky in C++, using std::function
-  std::function<void(const String&)> walk = [&](const String &path) {
-    File32 dir = sd.open(path.c_str());
-    if (!dir) return;
-    if (!dir.isDirectory()) { dir.close(); return; }
-    
-    dir.rewindDirectory();
-    File32 entry = dir.openNextFile();
-    char nameBuf[256];
-
-    while (entry) {
-      entry.getName(nameBuf, sizeof(nameBuf));
-      String name = String(nameBuf);
-      String full = path;
-      if (!full.endsWith("/")) full += "/";
-      full += name;
-
-      if (entry.isDirectory()) {
-        // Recurse
-        // Close entry before recursing to save file handles if deep
-        entry.close(); 
-        walk(full);
-      } else {
-        // Check match
-        if (full.startsWith(logicalPrefix)) {
-           String rel = full.substring(logicalPrefix.length());
-           if (rel.startsWith("/")) rel = rel.substring(1);
-           String sizeStr = humanReadableSize(entry.size());
-           g_fileLines.push_back(rel + String("  ") + sizeStr);
-           g_filePaths.push_back(full);
-           g_fileIsDir.push_back(false);
-        }
-        if (entry.isOpen()) entry.close();
-        entry = dir.openNextFile();
-      }
+  closeListing();
+  g_fileList.clear();
+  g_listBase = 0;
+
+  g_fileIndex.check(logicalPrefix.c_str());
+  FileIndex::Range r = g_fileIndex.under(logicalPrefix.c_str());
+  std::string parent;
+  for (size_t i = r.begin; i < r.end; ++i) {
+    const FileIndex::Entry &e = g_fileIndex.entries()[i];
+    if (e.isDir()) continue;
+    size_t slash = e.path.rfind('/');
+    parent.assign(e.path, 0, slash);
+    if (!g_fileList.add(parent.c_str(), e.path.c_str() + slash + 1, e.size, false)) {
+      Serial.println("File list: out of memory, listing truncated");
+      break;
     }
-    dir.close();
-  };
-
-  walk("/"); // Start from root
+  }
 
-  if (g_fileLines.empty()) g_fileLines.push_back(String("(no files found)"));
+  if (g_fileList.empty()) g_fileList.addPlaceholder("(no files found)");
 
-  // --- UI DRAWING (Simplified reuse) ---
   g_firstLine = 0;
   g_currentPath = logicalPrefix;
   g_selectedIndex = 0;
-  
-  gfx->fillScreen(BLACK);
-  gfx->setTextColor(WHITE);
-  gfx->setCursor(10, 6);
-  gfx->println(String("F:") + logicalPrefix);
+  g_listTitle = String("F:") + logicalPrefix;
 
-  // Draw only first page logic here for brevity (same as above)
-  int y = 24;
-  int end = (int)g_fileLines.size();
-  if (end > g_linesPerPage) end = g_linesPerPage;
-  
-  for (int i = 0; i < end; ++i) {
-     if (i == 0) { gfx->fillRect(4, y-2, gfx->width()-8, g_lineHeight, WHITE); gfx->setTextColor(BLACK); }
-     else gfx->setTextColor(WHITE);
-     gfx->setCursor(6, y);
-     gfx->print(g_fileLines[i]);
-     y += g_lineHeight;
-  }
-  gfx->setTextColor(WHITE);
+  invalidateBrowser();
+  drawCurrentPage();
 }
 
 // --- TRASH HELPERS (SdFat Version) ---
 static bool ensureTrashDir() {
-  if (sd.exists("/.trash")) return true;
-  return sd.mkdir("/.trash");
+  if (g_fileIndex.find("/.trash")) return true;
+  return g_fileIndex.mkdir("/.trash");
 }
 
 static String makeTrashPath(const char *origPath) {
@@ -583,7 +960,7 @@ static bool moveToTrash(const char *path) {
   if (!ensureTrashDir()) return false;
   String dest = makeTrashPath(path);
   
-  if (sd.rename(path, dest.c_str())) {
+  if (g_fileIndex.rename(path, dest.c_str())) {
     Serial.printf("Renamed %s -> %s\n", path, dest.c_str());
     return true;
   }
@@ -594,34 +971,27 @@ static bool moveToTrash(const char *path) {
 }
 
 static size_t moveAllToTrash(const char *path = "/") {
-  File32 root = sd.open(path);
-  if (!root) return 0;
-  
   size_t moved = 0;
-  File32 entry = root.openNextFile();
-  char nameBuf[256];
-  
-  // Note: modifying directory while iterating can be tricky.
-  // Safer to collect list then move.
+
+  // Collect the direct children first; moving them reorders the index
+  String prefix = String(path);
+  if (!prefix.endsWith("/")) prefix += "/";
   std::vector<String> toMove;
-  
-  while (entry) {
-    entry.getName(nameBuf, sizeof(nameBuf));
-    String name = String(nameBuf);
+  g_fileIndex.check(prefix.c_str());
+  FileIndex::Range r = g_fileIndex.under(prefix.c_str());
+  for (size_t i = r.begin; i < r.end; ++i) {
+    String full = String(g_fileIndex.entries()[i].path.c_str());
+    String name = full.substring(prefix.length());
+    if (name.isEmpty() || name.indexOf('/') >= 0) continue;
     if (name != "System Volume Information" && name != ".trash") {
-        String full = String(path);
-        if (!full.endsWith("/")) full += "/";
-        full += name;
         toMove.push_back(full);
     }
-    entry.close();
-    entry = root.openNextFile();
   }
-  root.close();
 
   for (const auto &f : toMove) {
       if (moveToTrash(f.c_str())) moved++;
   }
+  g_fileIndex.save();
   return moved;
 }
 
@@ -629,7 +999,8 @@ static size_t moveAllToTrash(const char *path = "/") {
 
 // Draw download progress on the screen. Shows filename, MB downloaded,
 // percent if content length known, and a simple progress bar.
-static void drawDownloadProgress(size_t bytesWritten, int contentLength, unsigned long elapsedMs, const String &label) {
+static void drawDownloadProgress(uint64_t bytesWritten, int64_t contentLength, unsigned long elapsedMs, const char *label) {
+  invalidateBrowser();  // drawn over the file list
   const int W = gfx->width();
   const int H = gfx->height();
   const int boxW = W - 20;
@@ -643,7 +1014,7 @@ static void drawDownloadProgress(size_t bytesWritten, int contentLength, unsigne
   gfx->setTextSize(1);
 
   // Shorten label if necessary
-  String name = label;
+  String name = String(label);
   if (name.length() > 22) name = name.substring(name.length() - 22);
 
   gfx->setCursor(boxX + 6, boxY + 6);
@@ -668,7 +1039,7 @@ static void drawDownloadProgress(size_t bytesWritten, int contentLength, unsigne
   gfx->drawRect(barX - 1, barY - 1, barW + 2, barH + 2, WHITE);
   int fillW = 0;
   if (contentLength > 0) {
-    fillW = (int)(((long long)bytesWritten * (long long)barW) / (long long)contentLength);
+    fillW = (int)(((long long)bytesWritten * (long long)barW) / contentLength);
     if (fillW > barW) fillW = barW;
   } else {
     // Indeterminate: simple animated dot based on elapsedMs
@@ -678,8 +1049,9 @@ static void drawDownloadProgress(size_t bytesWritten, int contentLength, unsigne
   if (fillW > 0) gfx->fillRect(barX, barY, fillW, barH, GREEN);
 }
 
-// Draw SD speed test results (write/read MB/s)
-static void drawSdSpeedResult(float writeMBps, float readMBps) {
+// Two-line status box (sync events, SD benchmark results)
+static void drawStatusBox(const char *line1, const char *line2) {
+  invalidateBrowser();  // drawn over the file list
   const int W = gfx->width();
   const int H = gfx->height();
   const int boxW = W - 20;
@@ -692,124 +1064,325 @@ static void drawSdSpeedResult(float writeMBps, float readMBps) {
   gfx->setTextColor(WHITE);
   gfx->setTextSize(1);
   gfx->setCursor(boxX + 6, boxY + 6);
-  char buf[64];
-  snprintf(buf, sizeof(buf), "SD Write: %.2f MB/s", writeMBps);
-  gfx->print(buf);
+  gfx->print(line1);
   gfx->setCursor(boxX + 6, boxY + 20);
-  snprintf(buf, sizeof(buf), "SD Read:  %.2f MB/s", readMBps);
-  gfx->print(buf);
+  gfx->print(line2);
 }
 
-// Quick SD speed test: write and then read back a temporary file.
-// Keeps the test size small by default to avoid long blocking time.
-static void testSdSpeed(size_t testMB = 2) {
-  if (!sd.card()) return;
-  const String tmpPath = String("/.sd_speed_test.tmp");
-  const size_t totalBytes = testMB * 1024UL * 1024UL;
-  const size_t bufSize = 32768; // 32KB buffer
-  uint8_t *buf = (uint8_t*)malloc(bufSize);
-  if (!buf) return;
-  // Fill buffer with pattern
-  for (size_t i = 0; i < bufSize; ++i) buf[i] = (uint8_t)(i & 0xFF);
-
-  // Write test
-  File32 f = sd.open(tmpPath.c_str(), O_CREAT | O_WRITE | O_TRUNC);
-  if (!f) { free(buf); return; }
-  size_t written = 0;
-  unsigned long t0 = millis();
-  while (written < totalBytes) {
-    size_t toWrite = bufSize;
-    if (written + toWrite > totalBytes) toWrite = totalBytes - written;
-    size_t w = f.write(buf, toWrite);
-    if (w != toWrite) break;
-    written += w;
-    yield();
+// --- MSC STATS SCREEN ---
+static void fmtUs(uint32_t us, char *out, size_t size) {
+  if (us < 1000) snprintf(out, size, "%luus", (unsigned long)us);
+  else if (us < 1000000) snprintf(out, size, "%lums", (unsigned long)(us / 1000));
+  else snprintf(out, size, "%.1fs", us / 1000000.0f);
+}
+
+// Bar height for `count` out of `max` on a log scale, so a single 200 ms
+// stall stays visible next to thousands of fast requests
+static int statsBarH(uint32_t count, uint32_t max, int h) {
+  if (!count || !max) return 0;
+  int bits = 32 - __builtin_clz(count);
+  int maxBits = 32 - __builtin_clz(max);
+  return h * bits / maxBits;
+}
+
+// One bar, clearing what is above it instead of the whole chart
+static void drawStatsBar(int x, int bottom, int w, int h, int barH, uint16_t color) {
+  if (barH < h) gfx->fillRect(x, bottom - h, w, h - barH, BLACK);
+  if (barH > 0) gfx->fillRect(x, bottom - barH, w, barH, color);
+}
+
+// Totals and percentiles per direction, then the latency and size
+// histograms with read and write side by side. Text is drawn with a
+// background and bars over their own blank, so the once-a-second refresh
+// doesn't flash the screen.
+static void drawStatsScreen() {
+  static const uint16_t colors[MscStats::DIR_COUNT] = {CYAN, ORANGE};
+  static const char *names[MscStats::DIR_COUNT] = {"R", "W"};
+  MscStats::Snapshot s = g_mscStats.snapshot();
+  const int W = gfx->width();
+
+  gfx->setTextSize(1);
+  gfx->setTextWrap(false);
+  if (g_statsDirty) {
+    gfx->fillScreen(BLACK);
+    gfx->setTextColor(DARKGREY);
+    gfx->setCursor(W - 22 * 6 - 4, 4);
+    gfx->print("IO14: dump  BOOT: back");
+    // Axis labels under each histogram
+    static const char *latencyLabels[] = {"1us", "16us", "256us", "4ms", "65ms"};
+    for (int i = 0; i < 5; i++) {
+      gfx->setCursor(i * 4 * 16, 109);
+      gfx->print(latencyLabels[i]);
+    }
+    for (int i = 0; i < MscStats::SIZE_BUCKETS; i++) {
+      char label[8];
+      uint32_t bytes = MscStats::sizeBucketBytes(i + 1 < MscStats::SIZE_BUCKETS ? i : i - 1);
+      if (bytes < 1024) snprintf(label, sizeof(label), "%lu", (unsigned long)bytes);
+      else snprintf(label, sizeof(label), "%s%luK", i + 1 < MscStats::SIZE_BUCKETS ? "" : ">",
+                    (unsigned long)(bytes / 1024));
+      gfx->setCursor(i * 32, 156);
+      gfx->print(label);
+    }
   }
-  f.close();
-  unsigned long writeMs = millis() - t0;
-
-  // Read test
-  File32 fr = sd.open(tmpPath.c_str(), O_READ);
-  size_t readBytes = 0;
-  unsigned long t1 = millis();
-  if (fr) {
-    while (readBytes < written) {
-      int r = fr.read(buf, (readBytes + bufSize > written) ? (written - readBytes) : bufSize);
-      if (r <= 0) break;
-      readBytes += r;
-      yield();
+
+  char line[64];
+  gfx->setTextColor(WHITE, BLACK);
+  gfx->setCursor(4, 4);
+  snprintf(line, sizeof(line), "MSC stats, %lu s  ", (unsigned long)(s.ms / 1000));
+  gfx->print(line);
+
+  uint32_t maxLatency = 0, maxSize = 0;
+  for (int d = 0; d < MscStats::DIR_COUNT; d++) {
+    const MscStats::Counters &c = s.dir[d];
+    for (int i = 0; i < MscStats::LATENCY_BUCKETS; i++) maxLatency = std::max(maxLatency, c.latency[i]);
+    for (int i = 0; i < MscStats::SIZE_BUCKETS; i++) maxSize = std::max(maxSize, c.size[i]);
+
+    char p50[12], p90[12], p99[12], maxUs[12];
+    fmtUs(MscStats::percentileUs(c, 50), p50, sizeof(p50));
+    fmtUs(MscStats::percentileUs(c, 90), p90, sizeof(p90));
+    fmtUs(MscStats::percentileUs(c, 99), p99, sizeof(p99));
+    fmtUs(c.maxUs, maxUs, sizeof(maxUs));
+    gfx->setTextColor(colors[d], BLACK);
+    int y = 18 + d * 22;
+    gfx->setCursor(4, y);
+    snprintf(line, sizeof(line), "%s %lu req %.1f MB %.0f KB/s avg %luus", names[d], (unsigned long)c.requests,
+             c.bytes / (1024.0 * 1024.0), MscStats::rate(g_statsPrev, s, (MscStats::Dir)d) / 1024.0f,
+             (unsigned long)(c.requests ? c.totalUs / c.requests : 0));
+    gfx->printf("%-52s", line);
+    gfx->setCursor(4, y + 10);
+    snprintf(line, sizeof(line), "  p50<%s p90<%s p99<%s max %s part %lu err %lu", p50, p90, p99, maxUs,
+             (unsigned long)c.partial, (unsigned long)c.errors);
+    gfx->printf("%-52s", line);
+  }
+
+  // Latency: 16 px per power of two; size: 32 px per doubling
+  for (int i = 0; i < MscStats::LATENCY_BUCKETS; i++) {
+    for (int d = 0; d < MscStats::DIR_COUNT; d++) {
+      drawStatsBar(i * 16 + 2 + d * 6, 106, 6, 44, statsBarH(s.dir[d].latency[i], maxLatency, 44), colors[d]);
+    }
+  }
+  for (int i = 0; i < MscStats::SIZE_BUCKETS; i++) {
+    for (int d = 0; d < MscStats::DIR_COUNT; d++) {
+      drawStatsBar(i * 32 + 4 + d * 12, 152, 12, 30, statsBarH(s.dir[d].size[i], maxSize, 30), colors[d]);
     }
-    fr.close();
   }
-  unsigned long readMs = millis() - t1;
+  gfx->setTextWrap(true);
 
-  // Cleanup
-  sd.remove(tmpPath.c_str());
-  free(buf);
+  g_statsPrev = s;
+  g_statsDirty = false;
+  g_statsNextDraw = millis() + 1000;
+}
+
+static void pumpStatsScreen() {
+  if (g_statsScreen && (long)(millis() - g_statsNextDraw) >= 0) drawStatsScreen();
+}
 
-  double writeSec = (writeMs > 0) ? (writeMs / 1000.0) : 0.0;
-  double readSec = (readMs > 0) ? (readMs / 1000.0) : 0.0;
-  double writeMB = (double)written / (1024.0 * 1024.0);
-  double readMB = (double)readBytes / (1024.0 * 1024.0);
-  float writeMBps = (writeSec > 0.0) ? (float)(writeMB / writeSec) : 0.0f;
-  float readMBps = (readSec > 0.0) ? (float)(readMB / readSec) : 0.0f;
+static void openStatsScreen() {
+  g_statsScreen = true;
+  g_statsPrev = g_mscStats.snapshot();
+  invalidateBrowser();
+  drawStatsScreen();
+}
 
-  Serial.printf("SD speed test: wrote %.2f MB in %lu ms (%.2f MB/s), read %.2f MB in %lu ms (%.2f MB/s)\n",
-                writeMB, (unsigned long)writeMs, writeMBps, readMB, (unsigned long)readMs, readMBps);
+static void closeStatsScreen() {
+  g_statsScreen = false;
+  invalidateBrowser();
+  drawCurrentPage();
+}
 
-  // Show results on-screen
-  drawSdSpeedResult(writeMBps, readMBps);
-  delay(1200); // leave result visible briefly
+// Appends the counters to MSC_STATS_FILE. Only while the host can't see the
+// card (USB not started, the volume ejected, or the playlist served from
+// the virtual FAT): it caches the real FAT and would overwrite the new entry.
+static bool mscStatsWritable() {
+  return !g_usbStarted || g_mscEjected || g_virtualFat.active();
+}
+
+static bool saveMscStats(const char *why) {
+  std::unique_lock<std::mutex> card(g_sync.cardLock(), std::try_to_lock);
+  if (!card.owns_lock()) return false;
+  // Anything the host left buffered reaches the card before SdFat reads it
+  if (g_usbStarted) g_writeCombiner.sync();
+  File32 f = sd.open(MSC_STATS_FILE, O_WRONLY | O_CREAT | O_APPEND);
+  if (!f) return false;
+  char header[64];
+  snprintf(header, sizeof(header), "--- %s, %lu s after boot\n", why, millis() / 1000);
+  bool ok = f.write(header, strlen(header)) == strlen(header);
+  MscStats::dump(g_mscStats.snapshot(), [&](const char *line) {
+    size_t n = strlen(line);
+    ok = ok && f.write(line, n) == n && f.write("\n", 1) == 1;
+  });
+  ok = f.sync() && ok;
+  f.close();
+  g_fileIndex.update(MSC_STATS_FILE);
+  if (g_usbStarted) {
+    // The append rewrote FAT, directory and FSInfo sectors under the MSC
+    // layers; drop their copies, and have an ejected host re-read the FAT
+    // when it loads the medium again
+    g_readAhead.invalidate();
+    g_mscCache.invalidate();
+    if (g_mscEjected) g_mscChangeUnseen = true;
+  }
+  return ok;
+}
+
+// Stats screen, short IO14: always to serial, to the card when it is safe
+static void dumpMscStats() {
+  printMscStats();
+  const char *result;
+  if (!mscStatsWritable()) result = "SD: eject the drive first";
+  else if (saveMscStats("stats screen")) result = "Saved to " MSC_STATS_FILE;
+  else result = "SD busy or write failed";
+  Serial.printf("MSC stats: %s\n", result);
+  drawStatusBox("MSC stats dumped to serial", result);
+  // Leave the box up a little longer than one refresh
+  g_statsNextDraw = millis() + 3000;
 }
 
 // --- DOWNLOADER (SdFat Version) ---
-static bool downloadToSD(const String &url, const String &sdPath) {
-    WiFiClientSecure client;
-    client.setInsecure(); 
-    client.setTimeout(10000); 
+enum DownloadResult { DL_OK, DL_INTERRUPTED, DL_FAILED };
+
+// Fragments a written file ended up in, for the logs. Only counted with
+// CLUSTER_FRAGMENT_STATS, since that walks the FAT through a debug call.
+static uint32_t fileFragments(File32 &f) {
+#if CLUSTER_FRAGMENT_STATS
+    return countFragments(sd, f);
+#else
+    (void)f;
+    return 0;
+#endif
+}
 
-    HTTPClient http;
-    if (!http.begin(client, url)) return false;
+static String fragmentText(uint32_t fragments) {
+    if (!CLUSTER_FRAGMENT_STATS) return "fragments not counted";
+    return String((unsigned long)fragments) + " fragment(s)";
+}
 
-    int code = http.GET();
-    if (code != HTTP_CODE_OK) {
-        http.end();
-        return false;
+// Feed the first `bytes` of a partial download to `hasher`: a resumed
+// transfer only streams the rest, but the digest covers the whole file
+static bool hashPrefix(const String &path, uint64_t bytes, StreamHasher &hasher) {
+    File32 f = sd.open(path.c_str(), O_RDONLY);
+    if (!f) return false;
+    uint8_t buf[2048];
+    while (bytes > 0) {
+        int n = f.read(buf, bytes < sizeof(buf) ? (size_t)bytes : sizeof(buf));
+        if (n <= 0) break;
+        hasher.update(buf, (size_t)n);
+        bytes -= (uint64_t)n;
     }
+    f.close();
+    return bytes == 0;
+}
 
-    WiFiClient *stream = http.getStreamPtr();
-    String tmp = sdPath + ".tmp";
+// One attempt at url -> sdPath. A transfer cut off by the network leaves
+// "<sdPath>.tmp" plus a resume sidecar (DL_INTERRUPTED); the next attempt,
+// in this sync or after a reboot, asks only for the missing bytes.
+// The file is hashed on its way to the card and only renamed into place if
+// it matches `expected`; a mismatch throws it away and counts as
+// interrupted, so it gets downloaded again.
+static DownloadResult downloadOnce(const String &url, const String &sdPath, const ExpectedHash &expected) {
+    String tmp = sdPath + DOWNLOAD_TMP_SUFFIX;
+    ResumeSidecar resume(sd);
+    uint64_t offset = 0;
+    std::string validator;
+    if (!resume.load(tmp.c_str(), &offset, &validator)) offset = 0;
+
+    int code = 0;
+    HttpSessionPool::Session *http = g_httpPool.open(url, &code, offset, String(validator.c_str()));
+    if (http && code == HTTP_CODE_PARTIAL_CONTENT && http->rangeStart() != (int64_t)offset) {
+        // Not the bytes asked for: appending them would corrupt the file
+        Serial.printf("%s: range reply doesn't start at %llu, downloading it whole\n", sdPath.c_str(),
+                      (unsigned long long)offset);
+        g_httpPool.close(http);
+        offset = 0;
+        http = g_httpPool.open(url, &code);
+    }
+    if (!http) {
+        // The sidecar doesn't match the file anymore (416), or the server
+        // refused it (other 4xx): nothing on the card is worth keeping.
+        // Connection trouble and server errors are worth another try.
+        bool restart = code == HTTP_CODE_RANGE_NOT_SATISFIABLE && offset;
+        bool refused = code > 0 && code < 500;
+        if (refused) {
+            resume.remove(tmp.c_str());
+            if (g_fileIndex.find(tmp.c_str())) g_fileIndex.remove(tmp.c_str());
+            g_fileIndex.update(ResumeSidecar::pathFor(tmp.c_str()).c_str());
+        }
+        return (refused && !restart) ? DL_FAILED : DL_INTERRUPTED;
+    }
+    HttpBody &body = http->body();
+    // 200 to a ranged request: the file changed on the server, start over
+    if (code != HTTP_CODE_PARTIAL_CONTENT) offset = 0;
 
     // Ensure dir (SdFat mkdir is robust)
     int p = sdPath.lastIndexOf('/');
     if (p > 0) {
         String parent = sdPath.substring(0, p);
-        if (!sd.exists(parent.c_str())) sd.mkdir(parent.c_str(), true); // true = p_flag (recursive)
+        if (!g_fileIndex.find(parent.c_str())) g_fileIndex.mkdir(parent.c_str()); // recursive, keeps the index in step
     }
 
-    // Open with O_CREAT | O_WRITE | O_TRUNC
-    File32 f = sd.open(tmp.c_str(), O_CREAT | O_WRITE | O_TRUNC);
+    // Resuming: keep the verified prefix, drop anything written after the
+    // last checkpoint. Otherwise O_CREAT | O_WRITE | O_TRUNC.
+    File32 f = offset ? sd.open(tmp.c_str(), O_RDWR) : sd.open(tmp.c_str(), O_CREAT | O_WRITE | O_TRUNC);
+    if (f && offset && !(f.truncate((uint32_t)offset) && f.seekEnd())) f.close();
     if (!f) {
-        http.end();
-        return false;
+        g_httpPool.close(http);
+        return DL_FAILED;
+    }
+    if (offset) Serial.printf("Resuming %s at %llu bytes\n", sdPath.c_str(), (unsigned long long)offset);
+
+    StreamHasher hasher;
+    hasher.begin(expected.kind == ExpectedHash::SHA256);
+    if (offset && !hashPrefix(tmp, offset, hasher)) {
+        f.close(); g_httpPool.close(http); return DL_FAILED;
     }
 
-    uint8_t *buf = (uint8_t*)malloc(32768);
-    if (!buf) { f.close(); http.end(); return false; }
+    // Without a validator a later attempt couldn't tell whether the bytes
+    // on the card are still the right ones, so such files aren't resumable
+    String serverValidator = http->validator();
+    if (!resume.begin(tmp.c_str(), serverValidator.c_str(), offset)) resume.remove(tmp.c_str());
+
+    // Known size: reserve it in one contiguous run before the first byte
+    ClusterWriter writer(sd, f);
+    if (offset == 0 && http->size() > 0 && !writer.preallocate((uint64_t)http->size()))
+        Serial.printf("No contiguous space for %s, growing it\n", sdPath.c_str());
+
+    // Card writes happen on the writer task while we keep reading; the
+    // checkpoints are taken there too, right after the data they cover
+    uint64_t sinceCheckpoint = 0;
+    auto sink = [&](const uint8_t *data, size_t len) {
+        if (!writer.write(data, len)) return false;
+        hasher.update(data, len);
+        sinceCheckpoint += len;
+        if (resume.active() && sinceCheckpoint >= DOWNLOAD_CHECKPOINT_BYTES) {
+            if (f.sync()) resume.checkpoint(writer.onFile());
+            sinceCheckpoint = 0;
+        }
+        return true;
+    };
+    if (!g_downloadPipe.start(sink)) {
+        f.close(); resume.end(); g_httpPool.close(http); return DL_FAILED;
+    }
 
     size_t bytesWritten = 0;
+    bool writeOk = true;
     unsigned long lastByteTime = millis();
     //timing
     unsigned long t0 = millis(); // start timing
     unsigned long lastUpdate = 0;
+    // Progress covers the whole file, not just this attempt's part
+    int total = http->size() >= 0 ? (int)(http->size() + offset) : -1;
 
-    while (http.connected() || stream->available()) {
-        size_t size = stream->available();
+    // A cancelled sync leaves the partial file to be resumed next time
+    while (!body.finished() && !g_sync.cancelled()) {
+        size_t size = body.available();
         if (size > 0) {
-            size_t readSize = (size > 32768) ? 32768 : size;
-            int c = stream->readBytes(buf, readSize);
+            size_t room = 0;
+            uint8_t *dst = g_downloadPipe.acquire(&room);
+            if (!dst) { writeOk = false; break; } // card write failed
+            size_t readSize = (size > room) ? room : size;
+            int c = body.read(dst, readSize);
+            g_downloadPipe.commit(c > 0 ? (size_t)c : 0);
             if (c > 0) {
-                f.write(buf, c);
                 bytesWritten += c;
                 lastByteTime = millis();
                 yield(); 
@@ -822,47 +1395,97 @@ static bool downloadToSD(const String &url, const String &sdPath) {
       // Update on-screen progress every 200ms
       unsigned long now = millis();
       if (now - lastUpdate >= 200) {
-        // Try to get content length (may be 0 if unknown)
-        int contentLength = http.getSize();
-        drawDownloadProgress(bytesWritten, contentLength, now - t0, sdPath);
+        g_sync.progress(sdPath.c_str(), offset + bytesWritten, total, now - t0);
         lastUpdate = now;
       }
     }
+    if (!g_downloadPipe.finish()) writeOk = false;
+    if (!writer.finish()) writeOk = false;
+    // A body cut short (dropped connection, stall) is not a download
+    bool complete = body.complete();
     unsigned long elapsedMs = millis() - t0; // end timing
-    free(buf);
-    f.close();
-    http.end();
+    g_httpPool.close(http);
 
     //if (sd.exists(sdPath.c_str())) sd.remove(sdPath.c_str());
     //return sd.rename(tmp.c_str(), sdPath.c_str());
-    bool ok = true;
-    if (sd.exists(sdPath.c_str())) sd.remove(sdPath.c_str());
-    if (!sd.rename(tmp.c_str(), sdPath.c_str())) ok = false;
+    DownloadResult result = DL_OK;
+    uint32_t fragments = 0;
+    if (!writeOk) {
+        Serial.printf("SD write failed for %s\n", tmp.c_str());
+        f.close();
+        resume.remove(tmp.c_str());
+        sd.remove(tmp.c_str());
+        result = DL_FAILED;
+    } else if (!complete) {
+        // Keep what arrived for the next attempt
+        bool kept = resume.active() && f.sync() && resume.checkpoint(writer.onFile());
+        f.close();
+        resume.end();
+        if (!kept) {
+            resume.remove(tmp.c_str());
+            sd.remove(tmp.c_str());
+        }
+        result = DL_INTERRUPTED;
+    } else if (!hasher.matches(expected)) {
+        Serial.printf("Hash mismatch for %s (crc32 %08lx%s%s), discarding\n", sdPath.c_str(),
+                      (unsigned long)hasher.crc32(), expected.kind == ExpectedHash::SHA256 ? ", sha256 " : "",
+                      hasher.sha256Hex().c_str());
+        f.close();
+        resume.remove(tmp.c_str());
+        sd.remove(tmp.c_str());
+        result = DL_INTERRUPTED;
+    } else {
+        fragments = fileFragments(f);
+        f.close();
+        resume.remove(tmp.c_str());
+        if (g_fileIndex.find(sdPath.c_str())) g_fileIndex.remove(sdPath.c_str());
+        if (!g_fileIndex.rename(tmp.c_str(), sdPath.c_str())) result = DL_FAILED;
+    }
+    g_fileIndex.update(tmp.c_str());
+    g_fileIndex.update(ResumeSidecar::pathFor(tmp.c_str()).c_str());
+    bool ok = result == DL_OK;
 
     // Print MB/s stats (best-effort). Avoid divide-by-zero.
     double seconds = (elapsedMs > 0) ? (elapsedMs / 1000.0) : 0.0;
     double mb = (double)bytesWritten / (1024.0 * 1024.0);
     double mbps = (seconds > 0.0) ? (mb / seconds) : 0.0;
-    Serial.printf("Download %s -> %s : %lu bytes in %lu ms (%.2f MB, %.2f MB/s) %s\n",
+    Serial.printf("Download %s -> %s : %lu bytes in %lu ms (%.2f MB, %.2f MB/s) %s%s\n",
                   url.c_str(), sdPath.c_str(), (unsigned long)bytesWritten, (unsigned long)elapsedMs, mb, mbps,
-                  ok ? "OK" : "FAILED");
+                  ok ? "OK" : (result == DL_INTERRUPTED ? "INTERRUPTED" : "FAILED"),
+                  ok && expected.kind != ExpectedHash::NONE ? ", verified" : "");
+    if (ok) Serial.printf("  %s%s\n", fragmentText(fragments).c_str(), writer.preallocated() ? ", preallocated" : "");
+    // Per stage: busy rate is what each side could sustain alone; with the
+    // stages overlapped the total should approach the slower of the two
+    DownloadPipeline::Stats ps = g_downloadPipe.stats();
+    double netMBps = ps.netBusyMs ? mb / (ps.netBusyMs / 1000.0) : 0.0;
+    double sdMBps = ps.sdBusyMs ? mb / (ps.sdBusyMs / 1000.0) : 0.0;
+    Serial.printf("  net %.2f MB/s busy (%lu ms waiting for card), sd %.2f MB/s busy (%lu ms waiting for net), %lu buffers\n",
+                  netMBps, (unsigned long)ps.netWaitMs, sdMBps, (unsigned long)ps.sdWaitMs, (unsigned long)ps.buffers);
 
     // Final on-screen update
-    int contentLengthFinal = http.getSize();
-    drawDownloadProgress(bytesWritten, contentLengthFinal, elapsedMs, sdPath);
-
-    // Show completion/failure message briefly
-    gfx->setTextSize(1);
-    gfx->setCursor(6, gfx->height() - 26);
-    if (ok) {
-      gfx->setTextColor(GREEN);
-      gfx->println("Download complete");
-    } else {
-      gfx->setTextColor(RED);
-      gfx->println("Download failed");
-    }
+    g_sync.progress(sdPath.c_str(), offset + bytesWritten, total, elapsedMs);
 
-    return ok;
+    return result;
+}
+
+// Retries interrupted (or corrupted) transfers, resuming where possible;
+// what is still missing after DOWNLOAD_ATTEMPTS stays on the card for the
+// next sync. `hash` is the manifest value, see parseExpectedHash().
+static bool downloadToSD(const String &url, const String &sdPath, const std::string &hash = std::string()) {
+    ExpectedHash expected = parseExpectedHash(hash);
+    for (int attempt = 1; attempt <= DOWNLOAD_ATTEMPTS; attempt++) {
+        DownloadResult r = downloadOnce(url, sdPath, expected);
+        if (r != DL_INTERRUPTED || g_sync.cancelled()) {
+            g_sync.itemDone(sdPath.c_str(), r == DL_OK);
+            return r == DL_OK;
+        }
+        if (attempt < DOWNLOAD_ATTEMPTS) {
+            Serial.printf("Retrying %s (%d/%d)\n", sdPath.c_str(), attempt + 1, DOWNLOAD_ATTEMPTS);
+            delay(1000 * attempt);
+        }
+    }
+    g_sync.itemDone(sdPath.c_str(), false);
+    return false;
 }
 
 
@@ -896,8 +1519,8 @@ static void ensureParentDirs(const String &path) {
   if (p <= 0) return;
   String dir = path.substring(0, p);
   // Create hierarchy; sd.mkdir(..., true) creates recursively in SdFat fork used above
-  if (!sd.exists(dir.c_str())) {
-    sd.mkdir(dir.c_str(), true);
+  if (!g_fileIndex.find(dir.c_str())) {
+    g_fileIndex.mkdir(dir.c_str());
     Serial.printf("mkdir %s\n", dir.c_str());
   }
 }
@@ -918,17 +1541,19 @@ size_t miniz_file_read_func(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_
 }
 // --- WRITER CALLBACK: Writes extracted chunks to the destination file ---
 size_t miniz_file_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n) {
-    File32 *pFile = (File32 *)pOpaque;
+    ClusterWriter *pWriter = (ClusterWriter *)pOpaque;
     
-    // Write the chunk to SD
+    // Write the chunk to SD (batched into whole clusters by the writer)
     // Note: We assume sequential writing, so we rarely need to seek. 
     // However, for safety regarding file_ofs, we usually just trust the stream.
-    return pFile->write((const uint8_t*)pBuf, n);
+    return pWriter->write((const uint8_t*)pBuf, n) ? n : 0;
 }
 
 // Unzip zipPath (SD path) into destRoot (SD path, e.g. "/")
-// Returns true on success (best-effort; some file extracts may fail but function returns)
-static bool unzipZipToSD(const char *zipPath, const char *destRoot) {
+// Extraction is best-effort (the other entries are still written), but the
+// result is false if any entry failed, e.g. its CRC didn't match.
+// Paths of the files written are appended to `extracted` if given.
+static bool unzipZipToSD(const char *zipPath, const char *destRoot, std::vector<String> *extracted = nullptr) {
     Serial.printf("Unzip Streaming: %s -> %s\n", zipPath, destRoot);
 
     // 1. Open Source Zip
@@ -941,8 +1566,15 @@ static bool unzipZipToSD(const char *zipPath, const char *destRoot) {
     // 2. Init Miniz with Custom Reader
     mz_zip_archive zip;
     memset(&zip, 0, sizeof(zip));
-    zip.m_pRead = miniz_file_read_func;   // Assign Reader Callback
-    zip.m_pIO_opaque = &zipFile;          // Pass the zip File object
+    BufferedZipReader reader(zipFile);
+    bool buffered = reader.begin(UNZIP_READ_WINDOW, UNZIP_TAIL_WINDOW);
+    if (buffered) {
+        zip.m_pRead = BufferedZipReader::mzRead;  // Large aligned reads instead of one per request
+        zip.m_pIO_opaque = &reader;
+    } else {
+        zip.m_pRead = miniz_file_read_func;   // Assign Reader Callback
+        zip.m_pIO_opaque = &zipFile;          // Pass the zip File object
+    }
 
     if (!mz_zip_reader_init(&zip, zipFile.size(), 0)) {
         Serial.println("mz_zip_reader_init FAILED.");
@@ -955,6 +1587,16 @@ static bool unzipZipToSD(const char *zipPath, const char *destRoot) {
 
     char destPath[256]; 
     mz_zip_archive_file_stat file_stat;
+    int failed = 0;
+    uint32_t fragments = 0;
+    uint32_t preallocated = 0;
+    uint32_t stored = 0;
+    uint32_t pipelined = 0;
+    uint32_t writeBusyMs = 0, writeWaitMs = 0, outWaitMs = 0;
+    bool pipeline = buffered && g_extractPipe.active() && g_downloadPipe.active();
+    if (pipeline) g_extractPipe.resetStats();
+    unsigned long t0 = millis();
+    uint64_t outBytes = 0;
 
     // 3. Iterate and Stream
     for (int i = 0; i < fileCount; i++) {
@@ -968,7 +1610,7 @@ static bool unzipZipToSD(const char *zipPath, const char *destRoot) {
 
         // Check if it is a directory entry
         if (mz_zip_reader_is_file_a_directory(&zip, i)) {
-            sd.mkdir(destPath);
+            g_fileIndex.mkdir(destPath);
             Serial.printf("DIR: %s\n", destPath);
             continue;
         }
@@ -976,33 +1618,333 @@ static bool unzipZipToSD(const char *zipPath, const char *destRoot) {
         // 4. Handle File Extraction (Streaming)
         
         // Create the destination file on SD
-        File32 destFile = sd.open(destPath, FILE_WRITE);
+        // Truncate: FILE_WRITE would append to an older version of the file
+        File32 destFile = sd.open(destPath, O_CREAT | O_WRITE | O_TRUNC);
         if (!destFile) {
             Serial.printf("ERR: Create failed %s\n", destPath);
+            failed++;
             continue;
         }
 
-        // *** THE MAGIC PART ***
-        // Extract using callback. We pass &destFile as the opaque pointer.
-        // miniz will call miniz_file_write_func repeatedly with chunks of data.
-        if (!mz_zip_reader_extract_to_callback(&zip, i, miniz_file_write_func, &destFile, 0)) {
+        // Size is known from the central directory: reserve it contiguously
+        ClusterWriter writer(sd, destFile);
+        if (writer.preallocate(file_stat.m_uncomp_size)) preallocated++;
+
+        bool extractedOk;
+        if (buffered && BufferedZipReader::isStored(file_stat)) {
+            // Stored (already-compressed audio): straight copy, no inflate
+            extractedOk = reader.copyStored(file_stat, [&writer](const uint8_t *data, size_t len) {
+                return writer.write(data, len);
+            }, writer.cluster());
+            stored++;
+        } else if (pipeline && file_stat.m_method == MZ_DEFLATED && !file_stat.m_is_encrypted) {
+            // Read, inflate and write overlap on three stages. The writer
+            // task shares the card with the reader task, hence the lock.
+            extractedOk = g_downloadPipe.start([&writer](const uint8_t *data, size_t len) {
+                std::lock_guard<std::mutex> card(g_extractPipe.cardLock());
+                return writer.write(data, len);
+            });
+            if (extractedOk) {
+                extractedOk = g_extractPipe.inflateEntry(reader, file_stat, g_downloadPipe);
+                if (!g_downloadPipe.finish()) extractedOk = false;
+                DownloadPipeline::Stats ws = g_downloadPipe.stats();
+                writeBusyMs += ws.sdBusyMs;
+                writeWaitMs += ws.sdWaitMs;
+                outWaitMs += ws.netWaitMs;
+            }
+            pipelined++;
+        } else {
+            // *** THE MAGIC PART ***
+            // Extract using callback. We pass &writer as the opaque pointer.
+            // miniz will call miniz_file_write_func repeatedly with chunks of data.
+            extractedOk = mz_zip_reader_extract_to_callback(&zip, i, miniz_file_write_func, &writer, 0);
+        }
+        if (!writer.finish()) extractedOk = false;
+        if (!extractedOk) {
             Serial.printf("FAILED extraction: %s\n", destPath);
             destFile.close();
             // Optional: delete partial file
             sd.remove(destPath);
+            failed++;
         } else {
             Serial.printf("OK: %s\n", destPath);
+            fragments += fileFragments(destFile);
+            outBytes += file_stat.m_uncomp_size;
             destFile.close();
+            if (extracted) extracted->push_back(String(destPath));
         }
+        g_fileIndex.update(destPath);
     }
 
     mz_zip_reader_end(&zip);
     zipFile.close();
-    return true;
+    unsigned long ms = millis() - t0;
+    Serial.printf("Unzip: %.2f MB in %lu ms (%.2f MB/s), %s, %lu preallocated, %lu stored copied directly\n",
+                  outBytes / (1024.0 * 1024.0), ms, ms ? (outBytes / (1024.0 * 1024.0)) / (ms / 1000.0) : 0.0,
+                  fragmentText(fragments).c_str(), (unsigned long)preallocated, (unsigned long)stored);
+    BufferedZipReader::Stats rs = reader.stats();
+    double outMB = outBytes / (1024.0 * 1024.0);
+    Serial.printf("  %lu miniz reads served by %lu SD reads (%.1f per MB extracted, %.2f MB read)\n",
+                  (unsigned long)rs.requests, (unsigned long)rs.sdReads, outMB > 0 ? rs.sdReads / outMB : 0.0,
+                  rs.sdBytes / (1024.0 * 1024.0));
+    if (pipelined) {
+        // The stage with the most busy time is the one the others wait on
+        ExtractPipeline::Stats ps = g_extractPipe.stats();
+        const char *bound = "inflate (CPU)";
+        if (ps.readBusyMs > ps.inflateBusyMs && ps.readBusyMs >= writeBusyMs) bound = "card reads";
+        else if (writeBusyMs > ps.inflateBusyMs) bound = "card writes";
+        Serial.printf("  %lu deflated via pipeline: read %lu ms busy / %lu ms stalled, inflate %lu ms busy / %lu ms waiting for input / %lu ms for output, write %lu ms busy / %lu ms idle, bound by %s\n",
+                      (unsigned long)pipelined, (unsigned long)ps.readBusyMs, (unsigned long)ps.readWaitMs,
+                      (unsigned long)ps.inflateBusyMs, (unsigned long)ps.inflateInWaitMs, (unsigned long)outWaitMs,
+                      (unsigned long)writeBusyMs, (unsigned long)writeWaitMs, bound);
+    }
+    if (failed) Serial.printf("Unzip: %d of %d entries failed\n", failed, fileCount);
+    return failed == 0;
+}
+
+// Bundles in the .sdb format (tools/sdbundle.cpp) rather than zip
+static bool isSdbBundle(const String &path) {
+    return path.endsWith(".sdb");
+}
+
+// Where a streaming extractor puts entries: files under `root`, written on
+// the download writer task through a ClusterWriter, preallocated when the
+// archive gives the size up front
+struct ExtractSink {
+    String root;
+    std::vector<String> *extracted = nullptr;
+    File32 f;
+    String destPath;
+    std::unique_ptr<ClusterWriter> writer;
+    uint32_t fragments = 0;
+    uint32_t preallocated = 0;
+};
+
+static StreamExtractor::Target extractTarget(ExtractSink &s) {
+    StreamExtractor::Target target;
+    target.dir = [&s](const std::string &name) {
+        String dir = s.root + name.c_str();
+        if (!g_fileIndex.find(dir.c_str())) g_fileIndex.mkdir(dir.c_str());
+        Serial.printf("DIR: %s\n", dir.c_str());
+        return true;
+    };
+    target.open = [&s](const std::string &name, uint64_t size) {
+        s.destPath = s.root + name.c_str();
+        ensureParentDirs(s.destPath);
+        s.f = sd.open(s.destPath.c_str(), O_CREAT | O_WRITE | O_TRUNC);
+        if (!s.f) {
+            Serial.printf("ERR: Create failed %s\n", s.destPath.c_str());
+            return false;
+        }
+        // Zip local headers give the size unless a data descriptor follows;
+        // .sdb bundles always do
+        s.writer.reset(new ClusterWriter(sd, s.f));
+        if (size && s.writer->preallocate(size)) s.preallocated++;
+        // Parsing/inflating stays on this task, card writes go to the writer task
+        ClusterWriter *writer = s.writer.get();
+        if (!g_downloadPipe.start([writer](const uint8_t *data, size_t len) { return writer->write(data, len); })) {
+            s.f.close();
+            sd.remove(s.destPath.c_str());
+            return false;
+        }
+        return true;
+    };
+    target.write = [](const uint8_t *data, size_t len) {
+        while (len > 0) {
+            size_t room = 0;
+            uint8_t *dst = g_downloadPipe.acquire(&room);
+            if (!dst) return false;
+            size_t n = (len > room) ? room : len;
+            memcpy(dst, data, n);
+            g_downloadPipe.commit(n);
+            data += n;
+            len -= n;
+        }
+        return true;
+    };
+    target.close = [&s](bool ok) {
+        if (!g_downloadPipe.finish()) ok = false;
+        if (!s.writer->finish()) ok = false;
+        if (ok) s.fragments += fileFragments(s.f);
+        s.f.close();
+        if (ok) {
+            Serial.printf("OK: %s\n", s.destPath.c_str());
+            if (s.extracted) s.extracted->push_back(s.destPath);
+        } else {
+            Serial.printf("FAILED extraction: %s\n", s.destPath.c_str());
+            sd.remove(s.destPath.c_str());
+        }
+        g_fileIndex.update(s.destPath.c_str());
+    };
+    return target;
+}
+
+// Extract a downloaded .sdb bundle (SD path) into destRoot. The TOC gives
+// every size and offset, so this is one sequential pass over the file in
+// large sector-aligned reads, payloads copied straight to their files.
+static bool unpackSdbToSD(const char *bundlePath, const char *destRoot, std::vector<String> *extracted = nullptr) {
+    Serial.printf("Unpack bundle: %s -> %s\n", bundlePath, destRoot);
+    File32 in = sd.open(bundlePath, FILE_READ);
+    if (!in) {
+        Serial.println("FAILED: Could not open bundle.");
+        return false;
+    }
+    uint8_t *buf = (uint8_t *)psramAlloc(UNZIP_READ_WINDOW);
+    if (!buf) {
+        in.close();
+        return false;
+    }
+
+    ExtractSink sink;
+    sink.root = String(destRoot);
+    if (!sink.root.endsWith("/")) sink.root += "/";
+    sink.extracted = extracted;
+
+    SdbStreamExtractor bundle;
+    bool ok = bundle.begin(extractTarget(sink));
+    unsigned long t0 = millis();
+    while (ok && !bundle.done()) {
+        int n = in.read(buf, UNZIP_READ_WINDOW);
+        if (n <= 0) break;
+        ok = bundle.feed(buf, (size_t)n);
+    }
+    bool done = ok && bundle.done();
+    StreamExtractor::Stats bs = bundle.stats();
+    const char *why = bundle.error() ? bundle.error() : (done ? "" : "bundle truncated");
+    bundle.end();
+    in.close();
+    psramFree(buf);
+
+    unsigned long ms = millis() - t0;
+    double outMB = bs.outBytes / (1024.0 * 1024.0);
+    Serial.printf("Unpack: %.2f MB in %lu ms (%.2f MB/s), %u files, %u dirs, %u skipped, %s %s%s\n",
+                  outMB, ms, ms ? outMB / (ms / 1000.0) : 0.0, (unsigned)bs.files, (unsigned)bs.dirs,
+                  (unsigned)bs.skipped, fragmentText(sink.fragments).c_str(), done ? "OK" : "FAILED: ", why);
+    return done;
+}
+
+// Download a bundle (zip, or .sdb going by `label`) and extract it on the
+// fly: entries go straight from the HTTP stream into their final files, so
+// the bundle is never written and the card sees each byte once. Paths
+// written are appended to `extracted`. Every entry's checksum is checked as
+// it streams past, and the bundle bytes as a whole are hashed against `hash`
+// (manifest value) on the way through. Returns false if the bundle couldn't
+// be streamed (unsupported entry, checksum or hash mismatch, network or card
+// error); the caller falls back to downloadToSD + unzipZipToSD/unpackSdbToSD.
+static bool downloadAndExtract(const String &url, const String &label, const char *destRoot,
+                               const std::string &hash, std::vector<String> *extracted) {
+    HttpSessionPool::Session *http = g_httpPool.open(url);
+    if (!http) return false;
+    HttpBody &body = http->body();
+
+    const size_t CHUNK = 4096;
+    uint8_t *buf = (uint8_t *)malloc(CHUNK);
+    if (!buf) {
+        g_httpPool.close(http);
+        return false;
+    }
+
+    ExtractSink sink;
+    sink.root = String(destRoot);
+    if (!sink.root.endsWith("/")) sink.root += "/";
+    sink.extracted = extracted;
+
+    ExpectedHash expected = parseExpectedHash(hash);
+    StreamHasher hasher;
+    hasher.begin(expected.kind == ExpectedHash::SHA256);
+
+    ZipStreamExtractor zipFormat;
+    SdbStreamExtractor sdbFormat;
+    StreamExtractor &archive = isSdbBundle(label) ? (StreamExtractor &)sdbFormat : (StreamExtractor &)zipFormat;
+    bool ok = archive.begin(extractTarget(sink));
+    size_t received = 0;
+    unsigned long lastByteTime = millis();
+    unsigned long t0 = millis();
+    unsigned long lastUpdate = 0;
+
+    // Read to the end even after the last entry: the zip central directory
+    // or .sdb trailing padding is part of what the hash covers, and a fully
+    // read body keeps the connection reusable
+    while (ok && !body.finished() && !g_sync.cancelled()) {
+        size_t size = body.available();
+        if (size > 0) {
+            int c = body.read(buf, (size > CHUNK) ? CHUNK : size);
+            if (c > 0) {
+                received += c;
+                lastByteTime = millis();
+                hasher.update(buf, (size_t)c);
+                if (!archive.done()) ok = archive.feed(buf, (size_t)c);
+                yield();
+            }
+        } else {
+            if (millis() - lastByteTime > 5000) break;
+            delay(1);
+        }
+
+        unsigned long now = millis();
+        if (now - lastUpdate >= 200) {
+            g_sync.progress(label.c_str(), received, http->size(), now - t0);
+            lastUpdate = now;
+        }
+    }
+    unsigned long elapsedMs = millis() - t0;
+    bool done = ok && archive.done() && body.complete();
+    StreamExtractor::Stats zs = archive.stats();
+    const char *why = archive.error() ? archive.error() : (done ? "" : "stream ended early");
+    if (done && !hasher.matches(expected)) {
+        done = false;
+        why = "archive hash mismatch";
+    }
+    int contentLength = http->size();
+    archive.end();  // closes (and removes) an entry cut off by a dropped connection
+    g_httpPool.close(http);
+    free(buf);
+
+    double seconds = (elapsedMs > 0) ? (elapsedMs / 1000.0) : 0.0;
+    double mb = (double)received / (1024.0 * 1024.0);
+    Serial.printf("Stream extract %s: %lu bytes in %lu ms (%.2f MB/s), %u files, %u dirs, %u skipped, %.2f MB written %s%s\n",
+                  url.c_str(), (unsigned long)received, (unsigned long)elapsedMs,
+                  (seconds > 0.0) ? mb / seconds : 0.0, (unsigned)zs.files, (unsigned)zs.dirs,
+                  (unsigned)zs.skipped, zs.outBytes / (1024.0 * 1024.0), done ? "OK" : "FAILED: ", why);
+    Serial.printf("  %s over %u files, %lu preallocated\n", fragmentText(sink.fragments).c_str(), (unsigned)zs.files,
+                  (unsigned long)sink.preallocated);
+    g_sync.progress(label.c_str(), received, contentLength, elapsedMs);
+    g_sync.itemDone(label.c_str(), done);
+    return done;
+}
+
+// Record what a bundle installed, then drop whatever the previous version of
+// it installed that the new one no longer has
+static void recordBundle(const std::string &bundle, const SyncState::Entry &marker,
+                         const std::vector<String> &extracted) {
+  // Both sorted, so the leftovers fall out of one merge
+  std::vector<std::string> previous = g_syncState.fromOrigin(bundle);
+  std::vector<std::string> now;
+  now.reserve(extracted.size());
+  for (const String &x : extracted) {
+    SyncState::Entry member;
+    member.path = x.c_str();
+    const FileIndex::Entry *f = g_fileIndex.find(x.c_str());
+    member.size = f ? f->size : 0;
+    member.origin = bundle;
+    g_syncState.set(member);
+    now.push_back(member.path);
+  }
+  std::sort(now.begin(), now.end());
+  size_t j = 0;
+  for (const std::string &old : previous) {
+    while (j < now.size() && now[j] < old) j++;
+    if (j < now.size() && now[j] == old) continue;
+    if (g_fileIndex.find(old.c_str())) moveToTrash(old.c_str());
+    g_syncState.erase(old);
+  }
+  g_syncState.set(marker);
 }
 
 // --- SYNC (SdFat Version) ---
-bool syncFromWorkerOnly(const char *workerBaseUrl) {
+// Runs on the sync task: reports through g_sync and holds its card lock
+// while planning and during each action, not in between
+bool syncFromWorkerOnly(const char *workerBaseUrl, bool dryRun = SYNC_DRY_RUN) {
 
   String base = String(workerBaseUrl);
   if (!base.endsWith("/")) base += "/";
@@ -1010,107 +1952,191 @@ bool syncFromWorkerOnly(const char *workerBaseUrl) {
   // manifest is at the worker root
   String listUrl = base; // e.g. "https://music-worker.../"
 
-  WiFiClientSecure client;
-  client.setInsecure(); // replace with setCACert(...) for production
-  HTTPClient http;
-  if (!http.begin(client, listUrl)) {
-    Serial.println("Failed to begin list URL");
+  // Plain http:// lets a local stand-in server serve the manifest and files;
+  // the manifest and every download share the pool's kept-alive connection
+  g_httpPool.resetStats();
+  g_sync.status("Sync: reading manifest");
+  int code = 0;
+  HttpSessionPool::Session *http = g_httpPool.open(listUrl, &code);
+  if (!http) {
+    Serial.printf("List GET failed: %d\n", code);
     return false;
   }
-  int code = http.GET();
-  if (code != HTTP_CODE_OK) {
-    Serial.printf("List GET failed: %d\n", code);
-    http.end();
+
+  std::unique_lock<std::mutex> card(g_sync.cardLock());
+
+  // Each manifest item goes to the planner as soon as it is parsed; neither
+  // the body nor the whole list is ever held in memory
+  g_syncState.load();
+  // The plan diffs against the whole card: bring every directory up to date
+  g_fileIndex.check("/");
+  SyncPlanner planner(sd, g_syncState, g_fileIndex, SYNC_TRASH_UNTRACKED);
+  if (!planner.begin()) {
+    g_httpPool.close(http);
+    Serial.println("Sync: can't create the plan spool");
     return false;
   }
-  String body = http.getString();
-  http.end();
-
-  const size_t JSON_DOC_CAPACITY = 12 * 1024;
-  DynamicJsonDocument doc(JSON_DOC_CAPACITY);
-  DeserializationError err = deserializeJson(doc, body);
-  if (err) {
-    Serial.print("JSON parse failed: ");
-    Serial.println(err.c_str());
+  ManifestStats mstats;
+  String perr;
+  bool parsed = parseManifest(http->body(), [&](const ManifestItem &item) { planner.add(item); },
+                              &mstats, &perr);
+  if (parsed) http->body().skip(2000);
+  g_httpPool.close(http);
+  SyncPlan plan = planner.finish();
+  g_fileIndex.update(plan.spoolPath());
+  // Done with the plan (or giving up on it): drop the spool
+  auto dropPlan = [&]() {
+    plan.close();
+    g_fileIndex.remove(plan.spoolPath());
+  };
+  if (!parsed) {
+    // A partial list would turn everything after the failure into deletions
+    Serial.printf("Manifest parse failed after %u items: %s\n", (unsigned)mstats.items, perr.c_str());
+    dropPlan();
     return false;
   }
-  if (!doc.is<JsonArray>()) {
-    Serial.println("List not an array");
+  if (!plan.ok()) {
+    Serial.println("Sync: could not write the plan spool");
+    dropPlan();
     return false;
   }
-
-  std::vector<String> wanted;
-  for (JsonVariant v : doc.as<JsonArray>()) {
-    if (!v.is<const char*>()) continue;
-    String name = String((const char*)v.as<const char*>());
-    if (name.length() == 0) continue;
-    String sdPath = "/" + name;
-    wanted.push_back(sdPath);
-
-    // only download zip files — skip other entries
-    if (!sdPath.endsWith(".zip")) {
-      Serial.printf("Skipping non-zip listed item: %s\n", sdPath.c_str());
-      continue;
+  if (mstats.skipped) Serial.printf("Manifest: skipped %u unusable items\n", (unsigned)mstats.skipped);
+  if (plan.duplicates) Serial.printf("Manifest: %u paths listed more than once, last one kept\n", (unsigned)plan.duplicates);
+  Serial.printf("Sync plan: %u add, %u update, %u delete, %u keep, %u adopt; %.1f MB to download",
+                (unsigned)plan.counts[SyncAction::ADD], (unsigned)plan.counts[SyncAction::UPDATE],
+                (unsigned)plan.counts[SyncAction::DELETE], (unsigned)plan.counts[SyncAction::KEEP],
+                (unsigned)plan.counts[SyncAction::ADOPT], plan.downloadBytes / (1024.0 * 1024.0));
+  if (plan.unknownSize) Serial.printf(" + %u of unknown size", (unsigned)plan.unknownSize);
+  Serial.println();
+  char line[48];
+  snprintf(line, sizeof(line), "%u to get, %.1f MB",
+           (unsigned)(plan.counts[SyncAction::ADD] + plan.counts[SyncAction::UPDATE]),
+           plan.downloadBytes / (1024.0 * 1024.0));
+  g_sync.status("Sync plan", line);
+
+  if (dryRun) {
+    SyncAction a;
+    for (size_t i = 0; i < plan.size(); i++) {
+      if (!plan.get(i, &a)) break;
+      Serial.printf("  %-6s %s", syncActionName(a.kind), a.item.path.c_str());
+      if (a.item.size) Serial.printf(" (%s)", humanReadableSize(a.item.size).c_str());
+      Serial.println();
     }
+    dropPlan();
+    Serial.println("Sync dry run: nothing changed");
+    return true;
+  }
 
-    // skip if exists
-    File32 f = sd.open(sdPath.c_str());
-    bool needDownload = !f;
-    if (f) f.close();
-    if (!needDownload) continue;
-
-    String encoded = urlEncode(name);
-    String fullUrl = base + encoded; // worker serves file at base/<encoded name>
+  card.unlock();
+  unsigned long lastCheckpoint = millis();
+  for (size_t i = 0; i < plan.size(); i++) {
+    // What is done so far is saved below; the rest waits for the next sync
+    if (g_sync.cancelled()) {
+      Serial.println("Sync cancelled");
+      break;
+    }
+    // The UI gets the card between actions
+    std::lock_guard<std::mutex> actionCard(g_sync.cardLock());
+    SyncAction a;
+    if (!plan.get(i, &a)) {
+      Serial.println("Sync: could not read the plan spool");
+      break;
+    }
 
-    Serial.printf("Downloading: %s -> %s\n", fullUrl.c_str(), sdPath.c_str());
-    if (!downloadToSD(fullUrl, sdPath)) {
-      Serial.printf("Download failed for %s\n", fullUrl.c_str());
-      // optional retry logic
-    } else {
-          Serial.printf("Saved %s\n", sdPath.c_str());
-          // If it's a zip in root, extract into SD root
-          if (sdPath.endsWith(".zip")) {
-            Serial.println("Extracting zip...");
-            if (unzipZipToSD(sdPath.c_str(), "/")) {
-              Serial.println("Unzip OK");
-              // optionally remove the zip to save space:
-              sd.remove(sdPath.c_str());
-            } else {
-              Serial.println("Unzip FAILED");
-            }
-      }
+    // Record progress now and then: after a restart the plan is rebuilt
+    // from the manifest and this state, so finished items stay finished
+    if (millis() - lastCheckpoint > SYNC_CHECKPOINT_MS) {
+      if (g_syncState.save()) g_fileIndex.update(g_syncState.path());
+      g_fileIndex.save();
+      lastCheckpoint = millis();
     }
-  }
 
-  // move local files not in wanted list to .trash
-  std::function<void(const String&)> walk = [&](const String &path) {
-    File32 dir = sd.open(path.c_str());
-    if (!dir) return;
-    File32 entry = dir.openNextFile();
-    while (entry) {
-      String name = String(entry.name());
-      String full = path;
-      if (!full.endsWith("/")) full += "/";
-      full += name;
-      if (entry.isDirectory()) {
-        walk(full);
-      } else {
-        bool keep = false;
-        for (auto &w : wanted) if (w == full) { keep = true; break; }
-        if (!keep) {
-          Serial.printf("Moving to trash: %s\n", full.c_str());
-          moveToTrash(full.c_str());
+    String sdPath = String(a.item.path.c_str());
+    SyncState::Entry st;
+    st.path = a.item.path;
+    st.size = a.item.size;
+    st.hash = a.item.hash;
+    st.origin = a.item.path;
+
+    switch (a.kind) {
+      case SyncAction::KEEP:
+        break;
+
+      case SyncAction::ADOPT:
+        g_syncState.set(st);
+        break;
+
+      case SyncAction::DELETE:
+        Serial.printf("Moving to trash: %s\n", sdPath.c_str());
+        if (g_fileIndex.find(sdPath.c_str())) moveToTrash(sdPath.c_str());
+        g_syncState.erase(a.item.path);
+        break;
+
+      case SyncAction::ADD:
+      case SyncAction::UPDATE: {
+        String encoded = urlEncode(sdPath.substring(1));
+        String fullUrl = base + encoded; // worker serves file at base/<encoded name>
+        std::vector<String> extracted;
+#if SYNC_STREAM_UNZIP
+        if (a.item.bundle) {
+          Serial.printf("Streaming bundle: %s -> /\n", fullUrl.c_str());
+          if (downloadAndExtract(fullUrl, sdPath, "/", a.item.hash, &extracted)) {
+            recordBundle(a.item.path, st, extracted);
+            break;
+          }
+          if (g_sync.cancelled()) break;
+          // Whatever was written is rewritten by the unzip below
+          Serial.println("Streaming unzip failed, falling back to download + unzip");
+          extracted.clear();
+        }
+#endif
+        Serial.printf("Downloading: %s -> %s\n", fullUrl.c_str(), sdPath.c_str());
+        if (!downloadToSD(fullUrl, sdPath, a.item.hash)) {
+          Serial.printf("Download failed for %s\n", fullUrl.c_str());
+          // optional retry logic
+          break;
+        }
+        Serial.printf("Saved %s\n", sdPath.c_str());
+        if (!a.item.bundle) {
+          const FileIndex::Entry *f = g_fileIndex.find(sdPath.c_str());
+          st.size = f ? f->size : st.size;
+          g_syncState.set(st);
+          break;
         }
+
+        // Bundle (fallback path): extract the saved zip / .sdb into SD root
+        Serial.println("Extracting bundle...");
+        if (isSdbBundle(sdPath) ? !unpackSdbToSD(sdPath.c_str(), "/", &extracted)
+                                : !unzipZipToSD(sdPath.c_str(), "/", &extracted)) {
+          Serial.println("Unzip FAILED");
+          break;
+        }
+        Serial.println("Unzip OK");
+        // optionally remove the zip to save space:
+        g_fileIndex.remove(sdPath.c_str());
+        recordBundle(a.item.path, st, extracted);
+        break;
       }
-      entry.close();
-      entry = dir.openNextFile();
+
+      default:
+        break;
     }
-    dir.close();
-  };
-  walk(String("/"));
+  }
 
-  listFilesAndPrintSamples("/");
-  return true;
+  card.lock();
+  dropPlan();
+  if (!g_syncState.save()) Serial.println("Sync: could not save state");
+  g_fileIndex.update(g_syncState.path());
+  g_fileIndex.save();
+  card.unlock();
+
+  HttpSessionPool::Stats hs = g_httpPool.stats();
+  Serial.printf("Sync HTTP: %lu requests, %lu on a reused connection, %lu handshakes (%lu ms), %lu failed\n",
+                (unsigned long)hs.requests, (unsigned long)hs.reused, (unsigned long)hs.handshakes,
+                (unsigned long)hs.handshakeMs, (unsigned long)hs.failures);
+  g_httpPool.disconnect();
+  // loop() lists the card again once the task reports it has finished
+  return !g_sync.cancelled();
 }
 
 
@@ -1122,6 +2148,39 @@ static bool connectWiFi(unsigned long timeoutMs = 15000) {
   return WiFi.status() == WL_CONNECTED;
 }
 
+// Sector cache, read-ahead and write combining between the MSC callbacks
+// and the card; each layer passes straight through if it can't start
+static void beginMscLayers() {
+  // Sector cache between the callbacks and the card (falls back to direct access)
+  SectorCache::Mode mode = MSC_CACHE_WRITE_BACK ? SectorCache::WRITE_BACK : SectorCache::WRITE_THROUGH;
+  if (g_mscCache.begin(MSC_CACHE_SECTORS, mode, MSC_CACHE_MAX_RUN)) {
+    Serial.printf("MSC: sector cache %u sectors (%s)\n", (unsigned)MSC_CACHE_SECTORS,
+                  MSC_CACHE_WRITE_BACK ? "write-back" : "write-through");
+  } else {
+    Serial.println("MSC: sector cache alloc failed, using card directly");
+  }
+  // Read-ahead on top of the cache; both layers pass straight through if inactive
+  if (g_readAhead.begin(MSC_READAHEAD_SECTORS, MSC_READAHEAD_CHUNK) &&
+      g_readAhead.startWorker(MSC_READAHEAD_CORE)) {
+    Serial.printf("MSC: read-ahead %u sectors on core %d\n", (unsigned)MSC_READAHEAD_SECTORS, MSC_READAHEAD_CORE);
+  } else {
+    g_readAhead.end();
+    Serial.println("MSC: read-ahead disabled");
+  }
+  if (g_writeCombiner.begin(MSC_WRITE_COMBINE_SECTORS, MSC_WRITE_IDLE_MS)) {
+    Serial.printf("MSC: write combining up to %u KB\n", (unsigned)(MSC_WRITE_COMBINE_SECTORS * BLOCK_SIZE / 1024));
+  } else {
+    Serial.println("MSC: write combining disabled");
+  }
+}
+
+static void endMscLayers() {
+  g_writeCombiner.end();
+  g_readAhead.end();
+  g_mscCache.end();
+  g_mscDev = &g_sdDev;
+}
+
 bool init_usb(){
     // NO sd.begin() here! We do it once in setup.
     // Use Arduino-ESP32 core USB MSC API (MSC, USB globals)
@@ -1130,8 +2189,26 @@ bool init_usb(){
       return false;
     }
 
+    if (g_usbStarted) {
+      // Already enumerated: the layers below are live, so only drop what was
+      // cached for the previous view and report a media change to the host.
+      g_writeCombiner.flush();
+      g_readAhead.invalidate();
+      g_mscCache.invalidate();
+      g_mscDev = g_virtualFat.active() ? (BlockDevice *)&g_virtualFat : &g_writeCombiner;
+      g_mscEjected = false;
+      MSC.mediaPresent(true);
+      Serial.println("init_usb: media changed");
+      return true;
+    }
+
     uint32_t blockCount = sd.card()->sectorCount();
 
+    beginMscLayers();
+    g_mscDev = g_virtualFat.active() ? (BlockDevice *)&g_virtualFat : &g_writeCombiner;
+    g_mscStats.reset();
+    g_mscEjected = false;
+
     // Configure MSC metadata and callbacks (matches USBMSC example)
     MSC.vendorID("ESP32");
     MSC.productID("USB_MSC");
@@ -1153,10 +2230,139 @@ bool init_usb(){
     USB.onEvent(usbEventCallback);
     USB.begin();
 
+    g_usbStarted = true;
     Serial.println("init_usb: MSC + USB started");
     return true;
 }
 
+// --- SD BENCHMARK ---
+// The MSC callbacks as a BlockDevice: what the benchmark's "msc" path runs
+// through, layers and all
+class MscCallbackDevice : public BlockDevice {
+ public:
+  uint32_t sectorCount() override { return g_mscDev->sectorCount(); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override {
+    return onRead(sector, 0, dst, count * BLOCK_SIZE) == (int32_t)(count * BLOCK_SIZE);
+  }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    return onWrite(sector, 0, (uint8_t *)src, count * BLOCK_SIZE) == (int32_t)(count * BLOCK_SIZE);
+  }
+  bool sync() override { return g_mscDev->sync(); }
+};
+
+// IO14 held at power-up
+static bool g_benchRequested = false;
+
+// Headline numbers, and the change since the card's first run
+static void showSdSummary(SyncTask &task, const SdBench::Summary &s, bool cached) {
+  auto pct = [](float now, float first) { return first > 0 ? (now / first - 1.0f) * 100.0f : 0.0f; };
+  char line1[48], line2[48];
+  snprintf(line1, sizeof(line1), "SD W %.1f R %.1f MB/s, 4K %.0f/%.0f IOPS", s.seqWrite, s.seqRead, s.randWrite,
+           s.randRead);
+  snprintf(line2, sizeof(line2), "%s run %lu: W %+.0f%% R %+.0f%% 4K %+.0f%%", cached ? "Stored," : "Bench",
+           (unsigned long)s.run, pct(s.seqWrite, s.firstSeqWrite), pct(s.seqRead, s.firstSeqRead),
+           pct(s.randWrite, s.firstRandWrite));
+  Serial.printf("%s / %s (vs first run)\n", line1, line2);
+  task.status(line1, line2);
+}
+
+// Full benchmark (sd_bench.h) on the sync task; holds the card per test
+static bool runSdBenchmark(SyncTask &task) {
+  task.status("SD benchmark...", "hold IO14 at boot to rerun");
+  SdBench::Config cfg;
+  cfg.fileBytes = SD_BENCH_FILE_MB * 1024UL * 1024UL;
+  cfg.raw = &g_sdDev;
+  MscCallbackDevice mscPath;
+  cfg.msc = &mscPath;
+  cfg.lock = &task.cardLock();
+  {
+    // The MSC layers only exist while USB runs; bring them up for the test
+    std::lock_guard<std::mutex> card(task.cardLock());
+    beginMscLayers();
+    g_mscDev = &g_writeCombiner;
+  }
+
+  SdBench bench(sd);
+  unsigned long t0 = millis();
+  bool ok = bench.run(SD_BENCH_SCRATCH, cfg, [&](const SdBench::Result &r) {
+    Serial.printf("SD bench %-4s %-10s %6lu B: %7.2f MB/s %7.1f IOPS, latency p50 %lu p90 %lu p99 %lu max %lu us\n",
+                  r.path, r.test, (unsigned long)r.bufBytes, r.mbps(), r.iops(), (unsigned long)r.p50Us,
+                  (unsigned long)r.p90Us, (unsigned long)r.p99Us, (unsigned long)r.maxUs);
+    char line1[48], line2[48];
+    snprintf(line1, sizeof(line1), "Bench %s %s %lu B", r.path, r.test, (unsigned long)r.bufBytes);
+    snprintf(line2, sizeof(line2), "%.2f MB/s, p99 %.1f ms", r.mbps(), r.p99Us / 1000.0f);
+    task.status(line1, line2);
+  });
+
+  std::lock_guard<std::mutex> card(task.cardLock());
+  endMscLayers();
+  g_fileIndex.update(SD_BENCH_SCRATCH);
+  if (!ok) {
+    Serial.println("SD bench: failed (no contiguous space for the scratch file, or a card error)");
+    task.status("SD benchmark failed");
+    return false;
+  }
+  SdBench::Summary prev;
+  bool had = SdBench::loadSummary(sd, SD_BENCH_SUMMARY, &prev);
+  SdBench::Summary s = bench.summarize(had ? &prev : nullptr);
+  if (!bench.appendCsv(SD_BENCH_CSV, s.run)) Serial.println("SD bench: could not write " SD_BENCH_CSV);
+  if (!SdBench::saveSummary(sd, SD_BENCH_SUMMARY, s)) Serial.println("SD bench: could not save summary");
+  g_fileIndex.update(SD_BENCH_CSV);
+  g_fileIndex.update(SD_BENCH_SUMMARY);
+  Serial.printf("SD bench: %u results in %lu ms\n", (unsigned)bench.results().size(), millis() - t0);
+  showSdSummary(task, s, false);
+  return true;
+}
+
+// What setup() used to block on, run on the sync task
+static bool bootSyncJob(SyncTask &task) {
+  if (sd.card()) {
+    // Boot shows the stored result; measuring takes a while and wears the card
+    SdBench::Summary stored;
+    bool cached;
+    {
+      std::lock_guard<std::mutex> card(task.cardLock());
+      cached = SdBench::loadSummary(sd, SD_BENCH_SUMMARY, &stored);
+    }
+    if (cached && !g_benchRequested && !SD_BENCH_ON_BOOT) showSdSummary(task, stored, true);
+    else runSdBenchmark(task);
+  }
+  bool wifi = connectWiFi();
+  task.status(wifi ? "WiFi OK" : "WiFi Fail");
+  if (!wifi || task.cancelled()) return false;
+  return syncFromWorkerOnly(SYNC_WORKER_URL);
+}
+
+// Draw what the sync task reported since the last pass
+static void drainSyncEvents() {
+  SyncTask::Event e;
+  while (g_sync.poll(&e)) {
+    switch (e.kind) {
+      case SyncTask::Event::STATUS:
+        drawStatusBox(e.text, e.detail);
+        break;
+      case SyncTask::Event::PROGRESS:
+        drawDownloadProgress(e.done, e.total, e.elapsedMs, e.text);
+        break;
+      case SyncTask::Event::ITEM_DONE:
+        drawStatusBox(e.ok ? "Download complete" : "Download failed", e.text);
+        break;
+      case SyncTask::Event::FINISHED: {
+        SyncTask::Stats st = g_sync.stats();
+        Serial.printf("%s (%u events, %u coalesced, %u dropped)\n", e.text, (unsigned)st.posted,
+                      (unsigned)st.coalesced, (unsigned)st.dropped);
+        // Any directory may have changed under the browser
+        {
+          std::lock_guard<std::mutex> card(g_sync.cardLock());
+          listFilesAndPrintSamples(g_currentPath.c_str());
+          if (!g_listing.active) listFilesAndPrintSamples("/");
+        }
+        drawStatusBox(e.text, "");
+        break;
+      }
+    }
+  }
+}
 
 void setup() {
   Serial.begin(115200);
@@ -1172,6 +2378,7 @@ void setup() {
 
   pinMode(buttonPin, INPUT_PULLUP);
   pinMode(BOOT_BUTTON_PIN, INPUT_PULLUP);
+  g_benchRequested = digitalRead(buttonPin) == LOW;
 
   // 1. ONE SD INIT TO RULE THEM ALL
   // Try standard init
@@ -1186,26 +2393,34 @@ void setup() {
 
   } else {
     Serial.println("SD Mounted (SdFat)");
+    unsigned long t0 = millis();
+    if (g_fileIndex.begin()) {
+      Serial.printf("File index: %u entries, %s in %lu ms\n", (unsigned)g_fileIndex.entries().size(),
+                    g_fileIndex.rebuilt() ? "rebuilt" : "loaded", millis() - t0);
+    } else {
+      Serial.println("File index: card walk failed");
+    }
     // Restore any leftover .nomsc files from previous unexpected power-offs
     restoreNomscOnBoot();
     gfx->setTextColor(GREEN); gfx->println("SD OK");
-    // Quick SD speed test to give immediate feedback on card performance
-    gfx->setTextColor(WHITE);
-    gfx->println("SD speed test...");
-    testSdSpeed(2); // default 2 MB test
   }
 
-  if(connectWiFi()) {
-     gfx->setTextColor(GREEN); gfx->println("WiFi OK");
+  if (g_downloadPipe.begin(DOWNLOAD_BUFFER_BYTES, DOWNLOAD_BUFFERS) || g_downloadPipe.begin(8192, 2)) {
+    if (!g_downloadPipe.startWorker(DOWNLOAD_WRITER_CORE)) Serial.println("Download writer task failed, writing inline");
+  } else {
+    Serial.println("Download buffers alloc failed");
   }
-  else {
-     gfx->setTextColor(RED); gfx->println("WiFi Fail");
+  if (g_extractPipe.begin(UNZIP_PIPELINE_BUFFER_BYTES, UNZIP_PIPELINE_BUFFERS)) {
+    if (!g_extractPipe.startWorker(UNZIP_READER_CORE)) Serial.println("Unzip reader task failed, reading inline");
+  } else {
+    Serial.println("Unzip pipeline alloc failed, inflating through miniz");
   }
-
-  syncFromWorkerOnly("https://music-worker.robidobosan.workers.dev/"); // Call your sync here if needed
-  delay(3000); // Wait a bit to show status
   gfx->setTextSize(1);
   listFilesAndPrintSamples("/");
+  // The browser is live from here; the rest reports through drainSyncEvents()
+  if (!g_sync.begin() || !g_sync.start(bootSyncJob, SYNC_TASK_CORE, SYNC_TASK_PRIORITY, SYNC_TASK_STACK)) {
+    Serial.println("Sync task failed to start");
+  }
   //init_usb(); // starts core MSC + USB, assumes sd is ready
 }
 
@@ -1214,9 +2429,10 @@ void loop() {
   int boot_button = digitalRead(BOOT_BUTTON_PIN);
   if (reading != lastButtonState) lastDebounceTime = millis();
 
-  static int stableState = HIGH;
+  // A press held since power-up asked for the benchmark; its release is not a click
+  static int stableState = g_benchRequested ? LOW : HIGH;
   static unsigned long pressStart = 0;
-  static bool longHandled = false;
+  static bool longHandled = g_benchRequested;
   const unsigned long holdMs = 5000;
   const unsigned long popupDelay = 1000; // show popup after 1s hold
   static unsigned long lastPrint = 0;
@@ -1234,20 +2450,34 @@ void loop() {
       if (reading == LOW) { // Press
         pressStart = millis();
         longHandled = false;
+      } else if (g_statsScreen) { // Release on the stats screen
+        unsigned long dur = (pressStart == 0) ? 0 : millis() - pressStart;
+        if (!longHandled && dur < 1000) dumpMscStats();
+        else g_statsDirty = true;  // the hold popup was drawn over it
+        pressStart = 0;
       } else { // Release
         unsigned long dur = (pressStart == 0) ? 0 : millis() - pressStart;
+        bool moved = false;
+        // Held through the repaint, which may read the next page
+        std::unique_lock<std::mutex> card(g_sync.cardLock(), std::try_to_lock);
         if (!longHandled && dur < 1000) {
            // NEXT PAGE / ITEM: advance selection and redraw only
-           int total = (int)g_fileLines.size();
-           if (total > 0) {
+           if (listTotal() > 0) {
              g_selectedIndex++;
-             if (g_selectedIndex >= total) g_selectedIndex = 0;
-             // Keep current listing and just redraw the page with new selection
-             drawCurrentPage();
+             if (card.owns_lock()) {
+               if (!listingHas(g_selectedIndex)) g_selectedIndex = 0;
+             } else if (g_selectedIndex >= g_listBase + (int)g_fileList.size()) {
+               // The sync has the card: cycle through the page in memory
+               g_selectedIndex = g_listBase;
+             }
+             moved = true;
            }
         }
         pressStart = 0;
+        // One repaint: the moved highlight, plus the list if the hold popup
+        // was drawn over it
         drawCurrentPage();
+        if (moved) noteUiLatency(lastDebounceTime, "select");
       }
       stableState = reading;
     }
@@ -1256,8 +2486,15 @@ void loop() {
     //IO14 check for long press
   if (stableState == LOW && pressStart != 0 && !longHandled) {
     unsigned long elapsed = millis() - pressStart;
-    if (elapsed >= holdMs) {
+    if (elapsed >= holdMs && g_sync.running()) {
+      // Stops after the current file; partial downloads resume next time
+      longHandled = true;
+      g_sync.cancel();
+      drawStatusBox("Cancelling sync...", "");
+      Serial.println("User requested sync cancel (long-press)");
+    } else if (elapsed >= holdMs) {
       longHandled = true;
+      g_statsScreen = false;
       gfx->fillScreen(BLACK);
       gfx->setTextColor(YELLOW);
       gfx->setCursor(6, 6);
@@ -1271,11 +2508,14 @@ void loop() {
       //listFilesAndPrintSamples("/");
       // Determine playlist prefix from current selection (use exact file path for single-file playlist)
       String playlistPrefix;
-      if (g_selectedIndex >= 0 && g_selectedIndex < (int)g_filePaths.size()) {
-        playlistPrefix = g_filePaths[g_selectedIndex];
+      int row = g_selectedIndex - g_listBase;
+      if (row >= 0 && row < (int)g_fileList.size() && !g_fileList.isPlaceholder(row)) {
+        char selected[256];
+        g_fileList.path(row, selected, sizeof(selected));
+        playlistPrefix = selected;
         // If the selected entry is a file, keep that exact file only.
         // If it's a directory, keep everything under that directory.
-        if (g_fileIsDir[g_selectedIndex]) {
+        if (g_fileList.isDir(row)) {
           // ensure directory path ends with '/'
           if (!playlistPrefix.endsWith("/")) playlistPrefix += "/";
         } else {
@@ -1288,13 +2528,37 @@ void loop() {
       }
 
       Serial.printf("Playlist prefix: %s\n", playlistPrefix.c_str());
-      Serial.println("cleaning up leftover files...");
-      gfx->println("cleaning up leftover files...");
-      restoreNomscOnBoot();//clean up any leftovers first
-      size_t disabled = disableNonPlaylistFiles(playlistPrefix);
-      String msg = "Disabled " + String((unsigned)disabled) + " files";
-      gfx->println(msg);
-      Serial.printf("Disabled %u files\n", (unsigned)disabled);
+      if (g_usbStarted) {
+        // Host must not see the volume while it is being swapped
+        MSC.mediaPresent(false);
+        g_mscChangeUnseen = true;
+        flushMsc("playlist switch");
+        saveMscStats("playlist switch");
+      }
+      // The host may have changed the card during a writable MSC session;
+      // if it wrote nothing, the index is as current as it was
+      if (g_mscHostWrote) {
+        g_mscHostWrote = false;
+        g_fileIndex.refresh();
+      }
+      bool virtualOk = false;
+#if MSC_VIRTUAL_PLAYLIST
+      virtualOk = buildVirtualPlaylist(playlistPrefix);
+      if (virtualOk) {
+        String msg = "Playlist: " + String((unsigned)g_virtualFat.info().files) + " files";
+        gfx->println(msg);
+      }
+#endif
+      if (!virtualOk) {
+        g_virtualFat.clear();
+        Serial.println("cleaning up leftover files...");
+        gfx->println("cleaning up leftover files...");
+        restoreNomscOnBoot();//clean up any leftovers first
+        size_t disabled = disableNonPlaylistFiles(playlistPrefix);
+        String msg = "Disabled " + String((unsigned)disabled) + " files";
+        gfx->println(msg);
+        Serial.printf("Disabled %u files\n", (unsigned)disabled);
+      }
 
       // Redraw listing of current path so user sees changes
       listFilesAndPrintSamples(g_currentPath.c_str());
@@ -1349,30 +2613,22 @@ Reset lastPrint (e.g., to 0) on press start and after the long action so the nex
         bootLongHandled = false;
       } else { // Release
         unsigned long dur = (bootPressStart == 0) ? 0 : millis() - bootPressStart;
-        if (!bootLongHandled && dur < 800) {
+        if (!bootLongHandled && dur < 800 && g_statsScreen) {
+          closeStatsScreen();
+        } else if (!bootLongHandled && dur < 800) {
            // SHORT PRESS: ENTER DIR
-           if (g_selectedIndex >= 0 && g_selectedIndex < (int)g_fileLines.size()) {
-             if (g_fileIsDir[g_selectedIndex]) {
-               // Derive directory name from displayed text instead of relying
-               // on g_filePaths (which may be corrupted). Display format is
-               // either "DIR: name" or "name  <size>", so extract the name.
-               String display = g_fileLines[g_selectedIndex];
-               String name;
-               if (display.startsWith("DIR: ")) {
-                 name = display.substring(5);
-               } else {
-                 int sep = display.indexOf("  ");
-                 if (sep > 0) name = display.substring(0, sep);
-                 else name = display;
-               }
-
-               // Compose full path from current path + name
-               String targetPath = g_currentPath;
-               if (!targetPath.endsWith("/")) targetPath += "/";
-               targetPath += name;
-
-               Serial.printf("Entering dir candidate: %s\n", targetPath.c_str());
-               listFilesAndPrintSamples(targetPath.c_str());
+           int row = g_selectedIndex - g_listBase;
+           if (row >= 0 && row < (int)g_fileList.size()) {
+             std::unique_lock<std::mutex> card(g_sync.cardLock(), std::try_to_lock);
+             if (g_fileList.isDir(row) && !card.owns_lock()) {
+               drawStatusBox("Card busy: syncing", "Try again in a moment");
+             } else if (g_fileList.isDir(row)) {
+               char targetPath[256];
+               g_fileList.path(row, targetPath, sizeof(targetPath));
+
+               Serial.printf("Entering dir candidate: %s\n", targetPath);
+               listFilesAndPrintSamples(targetPath);
+               noteUiLatency(lastBootDebounce, "enter dir");
 
               // reset selection to top
               g_selectedIndex = 0;
@@ -1388,9 +2644,22 @@ Reset lastPrint (e.g., to 0) on press start and after the long action so the nex
 
   // LONG PRESS BOOT: GO UP
   if (stableBootState == LOW && bootPressStart != 0 && !bootLongHandled) {
-    if (millis() - bootPressStart > 1000) {
+    if (millis() - bootPressStart > 1000 && stableState == LOW) {
+      // With IO14 held too: MSC stats screen; IO14's release is not a click
+      bootLongHandled = true;
+      longHandled = true;
+      if (g_statsScreen) closeStatsScreen();
+      else openStatsScreen();
+    } else if (millis() - bootPressStart > 1000 && g_sync.running()) {
+      // Toggle the sync between sharing the core with the UI and running ahead of it
+      bootLongHandled = true;
+      bool boost = g_sync.priority() != SYNC_TASK_BOOST_PRIORITY;
+      g_sync.setPriority(boost ? SYNC_TASK_BOOST_PRIORITY : SYNC_TASK_PRIORITY);
+      drawStatusBox(boost ? "Sync: boosted" : "Sync: in background", "Hold BOOT to switch");
+      Serial.printf("User set sync priority %d (long-press BOOT)\n", g_sync.priority());
+    } else if (millis() - bootPressStart > 1000) {
       bootLongHandled = true;
-      
+      g_statsScreen = false;
       listFilesAndPrintSamples("/");
       Serial.println("User requested go to root (long-press BOOT)");
     }
@@ -1398,5 +2667,13 @@ Reset lastPrint (e.g., to 0) on press start and after the long action so the nex
 
   lastButtonState = reading;
   lastBootState = boot_button;
-  yield();
+  // Flush combined MSC writes once the host goes quiet
+  g_writeCombiner.poll(millis());
+  pumpListing();
+  pumpStatsScreen();
+  drainSyncEvents();
+  // The sync task shares this core at the same priority: sleep between
+  // button polls so it gets the core instead of every other time slice
+  if (g_sync.running()) delay(1);
+  else yield();
 }
@@ -0,0 +1,100 @@
+#include "manifest_parser.h"
+
+#include <ArduinoJson.h>
+
+// Room for one element: path up to 255 chars, a SHA-256 hex hash and keys
+static const size_t ELEMENT_CAPACITY = 1024;
+static const unsigned long STREAM_TIMEOUT_MS = 10000;
+
+// Next non-whitespace character without consuming it, or -1 on timeout/EOF
+static int peekNonSpace(Stream &in) {
+  unsigned long t0 = millis();
+  for (;;) {
+    if (in.available() > 0) {
+      int c = in.peek();
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        in.read();
+        continue;
+      }
+      return c;
+    }
+    if (millis() - t0 > STREAM_TIMEOUT_MS) return -1;
+    delay(1);
+  }
+}
+
+static bool fail(String *error, const char *why) {
+  if (error) *error = why;
+  return false;
+}
+
+static bool toItem(JsonVariant v, ManifestItem *item) {
+  String name;
+  item->size = 0;
+  item->hash.clear();
+  if (v.is<const char*>()) {
+    name = String((const char*)v.as<const char*>());
+    // only zip / .sdb files are downloaded as bundles
+    if (!name.endsWith(".zip") && !name.endsWith(".sdb")) return false;
+    item->bundle = true;
+  } else if (v.is<JsonObject>()) {
+    name = String((const char*)(v["path"] | ""));
+    item->size = v["size"] | (uint32_t)0;
+    item->hash = (const char*)(v["hash"] | "");
+    item->bundle = v["bundle"] | (name.endsWith(".zip") || name.endsWith(".sdb"));
+  } else {
+    return false;
+  }
+  if (name.startsWith("/")) name = name.substring(1);
+  if (name.length() == 0) return false;
+  item->path = (String("/") + name).c_str();
+  return true;
+}
+
+bool parseManifest(Stream &in, const std::function<void(const ManifestItem &)> &onItem,
+                   ManifestStats *stats, String *error) {
+  ManifestStats local = {};
+  if (!stats) stats = &local;
+  *stats = {};
+
+  int c = peekNonSpace(in);
+  if (c == '{') {
+    // {"files": [...]}: skip to the array
+    if (!in.find((char *)"\"files\"")) return fail(error, "no \"files\" member");
+    if (peekNonSpace(in) != ':') return fail(error, "expected ':'");
+    in.read();
+    c = peekNonSpace(in);
+  }
+  if (c != '[') return fail(error, "manifest is not an array");
+  in.read();
+
+  if (peekNonSpace(in) == ']') {
+    in.read();
+    return true;
+  }
+
+  DynamicJsonDocument doc(ELEMENT_CAPACITY);
+  ManifestItem item;
+  for (;;) {
+    // Reads exactly one value and leaves the stream right after it
+    DeserializationError err = deserializeJson(doc, in);
+    if (err) return fail(error, err.c_str());
+    if (toItem(doc.as<JsonVariant>(), &item)) {
+      onItem(item);
+      stats->items++;
+    } else {
+      stats->skipped++;
+    }
+
+    c = peekNonSpace(in);
+    if (c == ',') {
+      in.read();
+      continue;
+    }
+    if (c == ']') {
+      in.read();
+      return true;
+    }
+    return fail(error, c < 0 ? "truncated manifest" : "expected ',' or ']'");
+  }
+}
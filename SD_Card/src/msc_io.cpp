@@ -0,0 +1,81 @@
+#include "msc_io.h"
+
+#include <string.h>
+#include <chrono>
+
+static uint32_t nowUs() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int32_t readRequest(BlockDevice &dev, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize) {
+  uint32_t sectors = dev.sectorCount();
+  if (lba >= sectors) return -1;
+
+  uint32_t remaining = bufsize;
+  uint8_t *dst = (uint8_t *)buffer;
+  uint32_t sector = lba;
+  uint32_t off = offset;
+
+  uint8_t tmp[BLOCK_SIZE];
+
+  while (remaining > 0) {
+    // If we are aligned and need whole sectors, read directly
+    if (off == 0 && remaining >= BLOCK_SIZE) {
+      uint32_t n = remaining / BLOCK_SIZE;
+      if (sector + n > sectors) return -1;
+      if (!dev.readSectors(sector, dst, n)) return -1;
+      sector += n;
+      dst += n * BLOCK_SIZE;
+      remaining -= n * BLOCK_SIZE;
+      continue;
+    }
+
+    // Partial sector: read sector then copy
+    if (!dev.readSectors(sector, tmp, 1)) return -1;
+    uint32_t toCopy = BLOCK_SIZE - off;
+    if (toCopy > remaining) toCopy = remaining;
+    memcpy(dst, tmp + off, toCopy);
+
+    remaining -= toCopy;
+    dst += toCopy;
+    sector++;
+    off = 0;
+  }
+
+  return (int32_t)bufsize;
+}
+
+static int32_t writeRequest(WriteCombiner &dev, uint32_t lba, uint32_t offset, const uint8_t *buffer,
+                            uint32_t bufsize) {
+  uint32_t sectors = dev.sectorCount();
+  if (lba >= sectors) return -1;
+  uint64_t endByte = (uint64_t)lba * BLOCK_SIZE + offset + bufsize;
+  if (endByte > (uint64_t)sectors * BLOCK_SIZE) return -1;
+
+  if (!dev.write(lba, offset, buffer, bufsize)) return -1;
+  return (int32_t)bufsize;
+}
+
+// Not whole sectors: the read side copies out of a sector read into tmp,
+// the write side leaves a read-modify-write to the combiner
+static bool partialRequest(uint32_t offset, uint32_t bufsize) {
+  return offset != 0 || bufsize % BLOCK_SIZE != 0;
+}
+
+int32_t mscRead(BlockDevice &dev, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize, MscStats *stats) {
+  if (!stats) return readRequest(dev, lba, offset, buffer, bufsize);
+  uint32_t t0 = nowUs();
+  int32_t r = readRequest(dev, lba, offset, buffer, bufsize);
+  stats->record(MscStats::READ, bufsize, partialRequest(offset, bufsize), nowUs() - t0, r >= 0);
+  return r;
+}
+
+int32_t mscWrite(WriteCombiner &dev, uint32_t lba, uint32_t offset, const uint8_t *buffer, uint32_t bufsize,
+                 MscStats *stats) {
+  if (!stats) return writeRequest(dev, lba, offset, buffer, bufsize);
+  uint32_t t0 = nowUs();
+  int32_t r = writeRequest(dev, lba, offset, buffer, bufsize);
+  stats->record(MscStats::WRITE, bufsize, partialRequest(offset, bufsize), nowUs() - t0, r >= 0);
+  return r;
+}
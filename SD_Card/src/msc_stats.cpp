@@ -0,0 +1,114 @@
+#include "msc_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+static uint32_t nowMs() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int latencyBucket(uint32_t us) {
+  int i = us ? 31 - __builtin_clz(us) : 0;
+  return i < MscStats::LATENCY_BUCKETS ? i : MscStats::LATENCY_BUCKETS - 1;
+}
+
+static int sizeBucket(uint32_t bytes) {
+  uint32_t sectors = (bytes + 511) / 512;
+  int i = sectors > 1 ? 32 - __builtin_clz(sectors - 1) : 0;
+  return i < MscStats::SIZE_BUCKETS ? i : MscStats::SIZE_BUCKETS - 1;
+}
+
+MscStats::MscStats() {
+  reset();
+}
+
+void MscStats::record(Dir d, uint32_t bytes, bool partial, uint32_t us, bool ok) {
+  std::lock_guard<std::mutex> guard(_lock);
+  Counters &c = _c[d];
+  c.requests++;
+  if (partial) c.partial++;
+  if (!ok) c.errors++;
+  else c.bytes += bytes;
+  c.totalUs += us;
+  if (us > c.maxUs) c.maxUs = us;
+  c.latency[latencyBucket(us)]++;
+  c.size[sizeBucket(bytes)]++;
+}
+
+MscStats::Snapshot MscStats::snapshot() {
+  Snapshot s;
+  std::lock_guard<std::mutex> guard(_lock);
+  memcpy(s.dir, _c, sizeof(_c));
+  s.ms = nowMs() - _t0;
+  return s;
+}
+
+void MscStats::reset() {
+  std::lock_guard<std::mutex> guard(_lock);
+  memset(_c, 0, sizeof(_c));
+  _t0 = nowMs();
+}
+
+uint32_t MscStats::percentileUs(const Counters &c, uint32_t pct) {
+  if (!c.requests) return 0;
+  // Rank of the request at the percentile, 1-based
+  uint64_t rank = ((uint64_t)c.requests * pct + 99) / 100;
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += c.latency[i];
+    if (seen >= rank) return i + 1 < LATENCY_BUCKETS ? latencyBucketUs(i + 1) : c.maxUs;
+  }
+  return c.maxUs;
+}
+
+float MscStats::rate(const Snapshot &earlier, const Snapshot &later, Dir d) {
+  uint32_t ms = later.ms - earlier.ms;
+  if (ms == 0 || later.dir[d].bytes < earlier.dir[d].bytes) return 0.0f;
+  return (float)(later.dir[d].bytes - earlier.dir[d].bytes) * 1000.0f / ms;
+}
+
+void MscStats::dump(const Snapshot &s, const std::function<void(const char *line)> &line) {
+  static const char *names[DIR_COUNT] = {"read", "write"};
+  char buf[200];
+  snprintf(buf, sizeof(buf), "MSC stats over %.1f s", s.ms / 1000.0f);
+  line(buf);
+  for (int d = 0; d < DIR_COUNT; d++) {
+    const Counters &c = s.dir[d];
+    float secs = s.ms ? s.ms / 1000.0f : 1.0f;
+    snprintf(buf, sizeof(buf),
+             "%s: %lu requests (%lu aligned, %lu partial, %lu errors), %.1f MB, %.1f KB/s; "
+             "latency avg %lu p50 <%lu p90 <%lu p99 <%lu max %lu us",
+             names[d], (unsigned long)c.requests, (unsigned long)(c.requests - c.partial),
+             (unsigned long)c.partial, (unsigned long)c.errors, c.bytes / (1024.0 * 1024.0),
+             c.bytes / 1024.0 / secs, (unsigned long)(c.requests ? c.totalUs / c.requests : 0),
+             (unsigned long)percentileUs(c, 50), (unsigned long)percentileUs(c, 90),
+             (unsigned long)percentileUs(c, 99), (unsigned long)c.maxUs);
+    line(buf);
+
+    // Non-empty buckets only, as "<upper bound>:count"
+    int n = snprintf(buf, sizeof(buf), "%s latency us:", names[d]);
+    for (int i = 0; i < LATENCY_BUCKETS && n < (int)sizeof(buf); i++) {
+      if (!c.latency[i]) continue;
+      if (i + 1 < LATENCY_BUCKETS) {
+        n += snprintf(buf + n, sizeof(buf) - n, " <%lu:%lu", (unsigned long)latencyBucketUs(i + 1),
+                      (unsigned long)c.latency[i]);
+      } else {
+        n += snprintf(buf + n, sizeof(buf) - n, " >=%lu:%lu", (unsigned long)latencyBucketUs(i),
+                      (unsigned long)c.latency[i]);
+      }
+    }
+    line(buf);
+
+    n = snprintf(buf, sizeof(buf), "%s size KB:", names[d]);
+    for (int i = 0; i < SIZE_BUCKETS && n < (int)sizeof(buf); i++) {
+      if (!c.size[i]) continue;
+      n += snprintf(buf + n, sizeof(buf) - n, " %s%g:%lu", i + 1 < SIZE_BUCKETS ? "<=" : ">",
+                    (i + 1 < SIZE_BUCKETS ? sizeBucketBytes(i) : sizeBucketBytes(i - 1)) / 1024.0,
+                    (unsigned long)c.size[i]);
+    }
+    line(buf);
+  }
+}
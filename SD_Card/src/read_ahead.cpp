@@ -0,0 +1,247 @@
+#include "read_ahead.h"
+
+#include <string.h>
+#include "psram.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+bool ReadAhead::begin(size_t ringSectors, size_t chunkSectors, uint8_t trigger) {
+  end();
+  if (ringSectors == 0 || chunkSectors == 0) return false;
+  if (chunkSectors > ringSectors) chunkSectors = ringSectors;
+
+  uint8_t *ring = (uint8_t *)psramAlloc(ringSectors * BLOCK_SIZE);
+  if (!ring) return false;
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _ring = ring;
+  _cap = ringSectors;
+  _chunk = chunkSectors;
+  _trigger = trigger ? trigger : 1;
+  _nextLba = 0xFFFFFFFF;
+  _streak = 0;
+  resetWindow(0);
+  _stats = {};
+  return true;
+}
+
+void ReadAhead::end() {
+  std::unique_lock<std::mutex> lk(_lock);
+  // Let a running prefetch land before the ring goes away
+  _fetched.wait(lk, [this] { return !_inflight; });
+  psramFree(_ring);
+  _ring = nullptr;
+  _cap = 0;
+  _winCount = 0;
+}
+
+#if defined(ESP32)
+static void readAheadTask(void *arg) {
+  ReadAhead *ra = (ReadAhead *)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (ra->pump()) {}
+  }
+}
+#endif
+
+bool ReadAhead::startWorker(int core, int priority) {
+#if defined(ESP32)
+  if (_task) return true;
+  TaskHandle_t h = nullptr;
+  if (xTaskCreatePinnedToCore(readAheadTask, "msc_ra", 4096, this, priority, &h, core) != pdPASS) return false;
+  _task = h;
+  return true;
+#else
+  (void)core;
+  (void)priority;
+  return false;
+#endif
+}
+
+void ReadAhead::kick() {
+#if defined(ESP32)
+  if (_task) {
+    xTaskNotifyGive((TaskHandle_t)_task);
+    return;
+  }
+#endif
+  while (pump()) {}
+}
+
+// --- ring helpers (lock held) ---
+
+void ReadAhead::copyOut(uint8_t *dst, size_t n) {
+  size_t first = _cap - _head;
+  if (first > n) first = n;
+  memcpy(dst, _ring + _head * BLOCK_SIZE, first * BLOCK_SIZE);
+  if (n > first) memcpy(dst + first * BLOCK_SIZE, _ring, (n - first) * BLOCK_SIZE);
+}
+
+void ReadAhead::dropFront(size_t n) {
+  _head = (_head + n) % _cap;
+  _winStart += n;
+  _winCount -= n;
+}
+
+void ReadAhead::resetWindow(uint32_t start) {
+  _stats.wastedSectors += _winCount;
+  _winStart = start;
+  _winCount = 0;
+  _head = 0;
+  _gen++;
+}
+
+// --- BlockDevice ---
+
+uint32_t ReadAhead::sectorCount() {
+  std::lock_guard<std::mutex> io(_io);
+  return _lower.sectorCount();
+}
+
+bool ReadAhead::sync() {
+  std::lock_guard<std::mutex> io(_io);
+  return _lower.sync();
+}
+
+bool ReadAhead::readSectors(uint32_t sector, uint8_t *dst, size_t count) {
+  if (!_ring) {
+    std::lock_guard<std::mutex> io(_io);
+    return _lower.readSectors(sector, dst, count);
+  }
+
+  std::unique_lock<std::mutex> lk(_lock);
+  bool sequential = (sector == _nextLba);
+  _nextLba = sector + count;
+  _stats.readSectors += count;
+
+  bool ok = true;
+  while (count > 0) {
+    if (_winCount && sector >= _winStart && sector < _winStart + _winCount) {
+      // Host skipped part of the window; those sectors are lost
+      size_t skip = sector - _winStart;
+      _stats.wastedSectors += skip;
+      dropFront(skip);
+
+      size_t n = (count < _winCount) ? count : _winCount;
+      copyOut(dst, n);
+      dropFront(n);
+      _stats.hitSectors += n;
+      sector += n;
+      dst += n * BLOCK_SIZE;
+      count -= n;
+      continue;
+    }
+
+    // The prefetcher is already reading what we need: wait for it
+    if (_inflight && sector >= _inflightLba && sector < _inflightLba + _inflightCount) {
+      _fetched.wait(lk);
+      continue;
+    }
+
+    // Miss: read directly and restart the window right after this request
+    resetWindow(sector + count);
+    lk.unlock();
+    {
+      std::lock_guard<std::mutex> io(_io);
+      ok = _lower.readSectors(sector, dst, count);
+    }
+    lk.lock();
+    count = 0;
+  }
+
+  if (sequential) {
+    if (_streak < 255) _streak++;
+    if (_streak == _trigger) _stats.streams++;
+  } else {
+    _streak = 0;
+  }
+  bool wantMore = ok && _streak >= _trigger && _cap - _winCount >= _chunk;
+  lk.unlock();
+
+  if (wantMore) kick();
+  return ok;
+}
+
+bool ReadAhead::writeSectors(uint32_t sector, const uint8_t *src, size_t count) {
+  if (!_ring) {
+    std::lock_guard<std::mutex> io(_io);
+    return _lower.writeSectors(sector, src, count);
+  }
+
+  // Hold the lock across the write so a prefetch can't start reading the old
+  // contents of this range and land it after we dropped the window.
+  std::lock_guard<std::mutex> guard(_lock);
+  uint32_t end = sector + count;
+  bool hitsWindow = _winCount && sector < _winStart + _winCount && end > _winStart;
+  bool hitsFetch = _inflight && sector < _inflightLba + _inflightCount && end > _inflightLba;
+  if (hitsWindow || hitsFetch) resetWindow(_nextLba);
+  std::lock_guard<std::mutex> io(_io);
+  return _lower.writeSectors(sector, src, count);
+}
+
+bool ReadAhead::pump() {
+  std::unique_lock<std::mutex> lk(_lock);
+  if (!_ring || _inflight || _streak < _trigger) return false;
+
+  size_t space = _cap - _winCount;
+  if (space < _chunk) return false;
+  uint32_t total;
+  {
+    std::lock_guard<std::mutex> io(_io);
+    total = _lower.sectorCount();
+  }
+  uint32_t lba = _winStart + _winCount;
+  if (lba >= total) return false;
+
+  size_t pos = (_head + _winCount) % _cap;
+  size_t n = _chunk;
+  if (n > _cap - pos) n = _cap - pos;  // keep each fetch contiguous in the ring
+  if (n > total - lba) n = total - lba;
+
+  _inflight = true;
+  _inflightLba = lba;
+  _inflightCount = n;
+  uint32_t gen = _gen;
+  lk.unlock();
+
+  // Only the tail of the ring beyond the window is touched here, which
+  // readers never look at until the window grows over it below.
+  bool ok;
+  {
+    std::lock_guard<std::mutex> io(_io);
+    ok = _lower.readSectors(lba, _ring + pos * BLOCK_SIZE, n);
+  }
+
+  lk.lock();
+  _inflight = false;
+  bool kept = ok && gen == _gen;
+  if (kept) {
+    _winCount += n;
+    _stats.prefetchedSectors += n;
+  } else if (ok) {
+    _stats.prefetchedSectors += n;
+    _stats.wastedSectors += n;
+  }
+  _fetched.notify_all();
+  return kept;
+}
+
+void ReadAhead::invalidate() {
+  std::lock_guard<std::mutex> guard(_lock);
+  resetWindow(_nextLba);
+  _streak = 0;
+}
+
+ReadAhead::Stats ReadAhead::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+void ReadAhead::resetStats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats = {};
+}
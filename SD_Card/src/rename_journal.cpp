@@ -0,0 +1,89 @@
+#include "rename_journal.h"
+
+#include <string.h>
+
+bool RenameJournal::open() {
+  if (_file.isOpen()) return true;
+  _file = _fs.open(_path, O_WRONLY | O_CREAT | O_APPEND);
+  return _file.isOpen();
+}
+
+void RenameJournal::close() {
+  if (_file.isOpen()) _file.close();
+}
+
+bool RenameJournal::record(const char *from, const char *to) {
+  if (!open()) return false;
+  std::string line = "R ";
+  line += from;
+  line += '\t';
+  line += to;
+  line += '\n';
+  // Synced here: the directory change of the rename itself is written
+  // immediately by SdFat, so the record has to reach the card first.
+  return _file.write(line.data(), line.size()) == line.size() && _file.sync();
+}
+
+bool RenameJournal::commit() {
+  if (!_file.isOpen()) return false;
+  // Not synced: a lost "D" only makes replay check the record's names
+  return _file.write("D\n", 2) == 2;
+}
+
+bool RenameJournal::read(std::vector<Record> *out) {
+  File32 f = _fs.open(_path, O_RDONLY);
+  if (!f) return false;
+
+  std::string line;
+  char buf[256];
+  int n;
+  while ((n = f.read(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < n; i++) {
+      if (buf[i] != '\n') {
+        line += buf[i];
+        continue;
+      }
+      if (line == "D") {
+        if (!out->empty()) out->back().done = true;
+      } else if (line.size() > 2 && line[0] == 'R' && line[1] == ' ') {
+        size_t tab = line.find('\t', 2);
+        if (tab != std::string::npos && tab > 2 && tab + 1 < line.size()) {
+          Record r;
+          r.from = line.substr(2, tab - 2);
+          r.to = line.substr(tab + 1);
+          r.done = false;
+          out->push_back(std::move(r));
+        }
+      }
+      line.clear();
+    }
+  }
+  f.close();
+  return true;
+}
+
+size_t RenameJournal::rollback(const std::function<bool(const char *from, const char *to)> &undo, size_t *interrupted) {
+  close();
+  if (interrupted) *interrupted = 0;
+
+  std::vector<Record> records;
+  if (!read(&records)) return 0;
+
+  size_t undone = 0;
+  bool allOk = true;
+  for (size_t i = records.size(); i-- > 0;) {
+    const Record &r = records[i];
+    if (!r.done && interrupted) (*interrupted)++;
+    // Never happened (interrupted before the rename) or already undone
+    if (!_fs.exists(r.to.c_str())) continue;
+    if (undo(r.from.c_str(), r.to.c_str())) {
+      undone++;
+    } else {
+      allOk = false;
+    }
+  }
+
+  // Keep the journal if something is still disabled, so the next boot retries
+  if (allOk) _fs.remove(_path);
+  return undone;
+}
@@ -0,0 +1,249 @@
+#include "sd_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "psram.h"
+
+static uint32_t nowUs() {
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static const uint32_t RAND_BYTES = 4096;
+
+uint32_t SdBench::nextRandom() {
+  // xorshift32: the same offsets every run, so runs compare
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+bool SdBench::measure(const char *path, const char *test, uint32_t bufBytes, uint32_t ops, const Op &op,
+                      const std::function<bool()> &finish) {
+  std::unique_lock<std::mutex> lk;
+  if (_lock) lk = std::unique_lock<std::mutex>(*_lock);
+
+  _lat.clear();
+  _lat.reserve(ops);
+  uint64_t bytes = 0;
+  bool ok = true;
+  uint32_t t0 = nowUs();
+  for (uint32_t i = 0; i < ops && ok; i++) {
+    uint32_t n = 0;
+    uint32_t t = nowUs();
+    ok = op(i, &n);
+    _lat.push_back(nowUs() - t);
+    bytes += n;
+  }
+  if (ok && finish) ok = finish();
+  uint32_t us = nowUs() - t0;
+  if (!ok || _lat.empty()) return false;
+
+  std::sort(_lat.begin(), _lat.end());
+  auto pct = [&](size_t p) { return _lat[std::min(_lat.size() - 1, _lat.size() * p / 100)]; };
+  Result r;
+  r.path = path;
+  r.test = test;
+  r.bufBytes = bufBytes;
+  r.bytes = bytes;
+  r.ops = (uint32_t)_lat.size();
+  r.us = us ? us : 1;
+  r.p50Us = pct(50);
+  r.p90Us = pct(90);
+  r.p99Us = pct(99);
+  r.maxUs = _lat.back();
+  _results.push_back(r);
+  if (_report) _report(r);
+  return true;
+}
+
+bool SdBench::fileTests(const Config &cfg) {
+  File32 &f = _file;
+  auto sync = [&] { return f.sync(); };
+
+  for (uint32_t buf = cfg.minBuf; buf <= cfg.maxBuf; buf *= 2) {
+    uint32_t ops = cfg.fileBytes / buf;
+    if (ops > cfg.sweepOps) ops = cfg.sweepOps;
+    if (ops == 0) break;
+    auto write = [&](uint32_t, uint32_t *n) {
+      *n = buf;
+      return f.write(_buf, buf) == buf;
+    };
+    auto read = [&](uint32_t, uint32_t *n) {
+      *n = buf;
+      return f.read(_buf, buf) == (int)buf;
+    };
+    if (!f.seekSet(0) || !measure("file", "seq_write", buf, ops, write, sync)) return false;
+    if (!f.seekSet(0) || !measure("file", "seq_read", buf, ops, read, nullptr)) return false;
+  }
+
+  uint32_t slots = cfg.fileBytes / RAND_BYTES;
+  auto randWrite = [&](uint32_t, uint32_t *n) {
+    *n = RAND_BYTES;
+    return f.seekSet((nextRandom() % slots) * RAND_BYTES) && f.write(_buf, RAND_BYTES) == RAND_BYTES;
+  };
+  auto randRead = [&](uint32_t, uint32_t *n) {
+    *n = RAND_BYTES;
+    return f.seekSet((nextRandom() % slots) * RAND_BYTES) && f.read(_buf, RAND_BYTES) == (int)RAND_BYTES;
+  };
+  _rng = 1;
+  if (!measure("file", "rand_write", RAND_BYTES, cfg.randomOps, randWrite, sync)) return false;
+  _rng = 1;
+  return measure("file", "rand_read", RAND_BYTES, cfg.randomOps, randRead, nullptr);
+}
+
+bool SdBench::blockTests(const char *path, BlockDevice &dev, uint32_t chunk, const Config &cfg) {
+  uint32_t per = chunk / BLOCK_SIZE;
+  uint32_t ops = _sectors / per;
+  if (per == 0 || ops == 0) return false;
+  auto sync = [&] { return dev.sync(); };
+  auto seqWrite = [&](uint32_t i, uint32_t *n) {
+    *n = chunk;
+    return dev.writeSectors(_firstSector + i * per, _buf, per);
+  };
+  auto seqRead = [&](uint32_t i, uint32_t *n) {
+    *n = chunk;
+    return dev.readSectors(_firstSector + i * per, _buf, per);
+  };
+  if (!measure(path, "seq_write", chunk, ops, seqWrite, sync)) return false;
+  if (!measure(path, "seq_read", chunk, ops, seqRead, nullptr)) return false;
+
+  const uint32_t randPer = RAND_BYTES / BLOCK_SIZE;
+  uint32_t slots = _sectors / randPer;
+  auto randWrite = [&](uint32_t, uint32_t *n) {
+    *n = RAND_BYTES;
+    return dev.writeSectors(_firstSector + (nextRandom() % slots) * randPer, _buf, randPer);
+  };
+  auto randRead = [&](uint32_t, uint32_t *n) {
+    *n = RAND_BYTES;
+    return dev.readSectors(_firstSector + (nextRandom() % slots) * randPer, _buf, randPer);
+  };
+  _rng = 1;
+  if (!measure(path, "rand_write", RAND_BYTES, cfg.randomOps, randWrite, sync)) return false;
+  _rng = 1;
+  return measure(path, "rand_read", RAND_BYTES, cfg.randomOps, randRead, nullptr);
+}
+
+bool SdBench::run(const char *scratchPath, const Config &cfg, Report report) {
+  _results.clear();
+  _lock = cfg.lock;
+  _report = report;
+  uint32_t bufBytes = std::max(std::max(cfg.maxBuf, cfg.rawChunk), std::max(cfg.mscChunk, RAND_BYTES));
+  if (cfg.fileBytes < bufBytes || cfg.minBuf == 0) return false;
+
+  bool ok = false;
+  {
+    std::unique_lock<std::mutex> lk;
+    if (_lock) lk = std::unique_lock<std::mutex>(*_lock);
+    _fs.remove(scratchPath);
+    _file = _fs.open(scratchPath, O_RDWR | O_CREAT | O_TRUNC);
+    uint32_t last = 0;
+    // One run of clusters: the raw and MSC tests write to it directly
+    ok = _file && _file.preAllocate(cfg.fileBytes) && _file.contiguousRange(&_firstSector, &last);
+    _sectors = cfg.fileBytes / BLOCK_SIZE;
+    if (ok && last - _firstSector + 1 < _sectors) ok = false;
+    _buf = ok ? (uint8_t *)psramAlloc(bufBytes) : nullptr;
+    if (_buf) for (uint32_t i = 0; i < bufBytes; i++) _buf[i] = (uint8_t)(i * 7 + 1);
+  }
+
+  ok = _buf && fileTests(cfg);
+  if (ok && cfg.raw) ok = blockTests("raw", *cfg.raw, cfg.rawChunk, cfg);
+  if (ok && cfg.msc) ok = blockTests("msc", *cfg.msc, cfg.mscChunk, cfg);
+
+  {
+    std::unique_lock<std::mutex> lk;
+    if (_lock) lk = std::unique_lock<std::mutex>(*_lock);
+    if (_file) _file.close();
+    _fs.remove(scratchPath);
+  }
+  psramFree(_buf);
+  _buf = nullptr;
+  _report = nullptr;
+  _lock = nullptr;
+  return ok;
+}
+
+SdBench::Summary SdBench::summarize(const Summary *previous) const {
+  Summary s = {};
+  for (const Result &r : _results) {
+    if (strcmp(r.path, "file") != 0) continue;
+    bool seq = r.bufBytes == 32768;
+    if (seq && !strcmp(r.test, "seq_write")) s.seqWrite = r.mbps();
+    if (seq && !strcmp(r.test, "seq_read")) s.seqRead = r.mbps();
+    if (!strcmp(r.test, "rand_write")) s.randWrite = r.iops();
+    if (!strcmp(r.test, "rand_read")) s.randRead = r.iops();
+  }
+  if (previous && previous->run) {
+    s.run = previous->run + 1;
+    s.firstSeqWrite = previous->firstSeqWrite;
+    s.firstSeqRead = previous->firstSeqRead;
+    s.firstRandWrite = previous->firstRandWrite;
+    s.firstRandRead = previous->firstRandRead;
+  } else {
+    s.run = 1;
+    s.firstSeqWrite = s.seqWrite;
+    s.firstSeqRead = s.seqRead;
+    s.firstRandWrite = s.randWrite;
+    s.firstRandRead = s.randRead;
+  }
+  return s;
+}
+
+// run \t seqWrite \t seqRead \t randWrite \t randRead \t (the same, first run)
+bool SdBench::loadSummary(SdFat &fs, const char *path, Summary *s) {
+  File32 f = fs.open(path, O_RDONLY);
+  if (!f) return false;
+  char line[160];
+  int n = f.read(line, sizeof(line) - 1);
+  f.close();
+  if (n <= 0) return false;
+  line[n] = 0;
+  Summary t = {};
+  unsigned long run = 0;
+  int got = sscanf(line, "%lu\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f", &run, &t.seqWrite, &t.seqRead, &t.randWrite,
+                   &t.randRead, &t.firstSeqWrite, &t.firstSeqRead, &t.firstRandWrite, &t.firstRandRead);
+  if (got != 9 || run == 0) return false;
+  t.run = (uint32_t)run;
+  *s = t;
+  return true;
+}
+
+bool SdBench::saveSummary(SdFat &fs, const char *path, const Summary &s) {
+  File32 f = fs.open(path, O_RDWR | O_CREAT | O_TRUNC);
+  if (!f) return false;
+  char line[160];
+  int n = snprintf(line, sizeof(line), "%lu\t%.2f\t%.2f\t%.1f\t%.1f\t%.2f\t%.2f\t%.1f\t%.1f\n",
+                   (unsigned long)s.run, s.seqWrite, s.seqRead, s.randWrite, s.randRead, s.firstSeqWrite,
+                   s.firstSeqRead, s.firstRandWrite, s.firstRandRead);
+  bool ok = f.write(line, n) == (size_t)n;
+  ok = f.sync() && ok;
+  f.close();
+  return ok;
+}
+
+bool SdBench::appendCsv(const char *path, uint32_t run) const {
+  File32 f = _fs.open(path, O_WRONLY | O_CREAT | O_APPEND);
+  if (!f) return false;
+  bool ok = true;
+  char line[160];
+  if (f.fileSize() == 0) {
+    const char *header = "run,path,test,buf_bytes,bytes,ops,ms,mb_s,iops,p50_us,p90_us,p99_us,max_us\n";
+    ok = f.write(header, strlen(header)) == strlen(header);
+  }
+  for (const Result &r : _results) {
+    if (!ok) break;
+    int n = snprintf(line, sizeof(line), "%lu,%s,%s,%lu,%llu,%lu,%lu,%.2f,%.1f,%lu,%lu,%lu,%lu\n",
+                     (unsigned long)run, r.path, r.test, (unsigned long)r.bufBytes, (unsigned long long)r.bytes,
+                     (unsigned long)r.ops, (unsigned long)(r.us / 1000), r.mbps(), r.iops(),
+                     (unsigned long)r.p50Us, (unsigned long)r.p90Us, (unsigned long)r.p99Us,
+                     (unsigned long)r.maxUs);
+    ok = f.write(line, n) == (size_t)n;
+  }
+  ok = f.sync() && ok;
+  f.close();
+  return ok;
+}
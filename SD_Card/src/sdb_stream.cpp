@@ -0,0 +1,204 @@
+#include "sdb_stream.h"
+
+#include "miniz.h"
+
+// Bounds the TOC kept in RAM (~64 bytes + path per entry)
+static const uint32_t MAX_ENTRIES = 16384;
+
+bool SdbStreamExtractor::begin(const Target &target) {
+  end();
+  _target = target;
+  _state = HEADER;
+  _error = nullptr;
+  _buf.clear();
+  _header = {};
+  _tocCrc = MZ_CRC32_INIT;
+  _pos = 0;
+  _next = 0;
+  _stats = {};
+  return true;
+}
+
+void SdbStreamExtractor::end() {
+  // A payload cut off mid-way (aborted download) still gets closed
+  if (_open && _target.close) _target.close(false);
+  _open = false;
+  _entries.clear();
+  _entries.shrink_to_fit();
+}
+
+bool SdbStreamExtractor::fail(const char *why) {
+  if (_open && _target.close) _target.close(false);
+  _open = false;
+  _state = FAILED;
+  _error = why;
+  return false;
+}
+
+bool SdbStreamExtractor::gather(const uint8_t *&data, size_t &len, size_t need) {
+  if (_buf.size() < need) {
+    size_t n = need - _buf.size();
+    if (n > len) n = len;
+    _buf.append((const char *)data, n);
+    data += n;
+    len -= n;
+    _pos += n;
+    _stats.inBytes += n;
+  }
+  return _buf.size() >= need;
+}
+
+bool SdbStreamExtractor::feed(const uint8_t *data, size_t len) {
+  if (_state == FAILED) return false;
+
+  // Each state returns once it runs out of input
+  for (;;) {
+    switch (_state) {
+      case HEADER: {
+        if (!gather(data, len, SDB_HEADER_SIZE)) return true;
+        if (!sdbDecodeHeader((const uint8_t *)_buf.data(), &_header)) return fail("not an .sdb bundle");
+        if (_header.count > MAX_ENTRIES) return fail("too many entries");
+        _buf.clear();
+        _entries.reserve(_header.count);
+        _state = TOC;
+        if (_header.count == 0 && !checkToc()) return false;
+        break;
+      }
+
+      case TOC: {
+        if (!gather(data, len, SDB_RECORD_SIZE)) return true;
+        const uint8_t *rec = (const uint8_t *)_buf.data();
+        _tocCrc = (uint32_t)mz_crc32(_tocCrc, rec, SDB_RECORD_SIZE);
+        SdbRecord r;
+        sdbDecodeRecord(rec, &r);
+        Entry e;
+        e.offset = r.offset;
+        e.size = r.size;
+        e.crc32 = r.crc32;
+        e.flags = r.flags;
+        memcpy(e.sha256, r.sha256, sizeof(e.sha256));
+        e.path = r.path;
+        _entries.push_back(std::move(e));
+        _buf.clear();
+        if (_entries.size() == _header.count && !checkToc()) return false;
+        break;
+      }
+
+      case GAP: {
+        // Padding up to the payload's aligned offset
+        uint64_t gap = _entries[_next].offset - _pos;
+        if (gap == 0) {
+          _state = PAYLOAD;
+          break;
+        }
+        if (!len) return true;
+        size_t n = len < gap ? len : (size_t)gap;
+        data += n;
+        len -= n;
+        _pos += n;
+        _stats.inBytes += n;
+        break;
+      }
+
+      case PAYLOAD: {
+        if (_left == 0) {
+          if (!finishEntry()) return false;
+          break;
+        }
+        if (!len) return true;
+        size_t n = len < _left ? len : (size_t)_left;
+        _hasher.update(data, n);
+        if (!_skip && _writeOk) {
+          if (_target.write(data, n)) _stats.outBytes += n;
+          else _writeOk = false;
+        }
+        data += n;
+        len -= n;
+        _left -= n;
+        _pos += n;
+        _stats.inBytes += n;
+        break;
+      }
+
+      case DONE:
+        // Trailing padding is of no interest
+        return true;
+
+      default:
+        return fail("bad state");
+    }
+  }
+}
+
+bool SdbStreamExtractor::checkToc() {
+  if (_tocCrc != _header.tocCrc) return fail("TOC CRC mismatch");
+  uint64_t end = _header.dataStart;
+  for (const Entry &e : _entries) {
+    if (e.flags & SDB_FLAG_DIR) {
+      if (e.size) return fail("directory with data");
+      continue;
+    }
+    // In order, not overlapping, inside the bundle
+    if (e.offset < end || e.offset % _header.align) return fail("bad payload offset");
+    if (e.offset > _header.totalSize || e.size > _header.totalSize - e.offset) {
+      return fail("payload past end of bundle");
+    }
+    end = e.offset + e.size;
+  }
+  _next = 0;
+  return nextEntry();
+}
+
+bool SdbStreamExtractor::nextEntry() {
+  for (; _next < _entries.size(); _next++) {
+    const Entry &e = _entries[_next];
+    if (!(e.flags & SDB_FLAG_DIR)) break;
+    std::string name = e.path;
+    while (!name.empty() && name.back() == '/') name.pop_back();
+    if (!safeEntryName(name)) _stats.skipped++;
+    else if (!_target.dir || _target.dir(name)) _stats.dirs++;
+  }
+  if (_next == _entries.size()) {
+    _state = DONE;
+    return true;
+  }
+
+  const Entry &e = _entries[_next];
+  _skip = true;
+  _open = false;
+  _writeOk = true;
+  _left = e.size;
+  _hasher.begin((e.flags & SDB_FLAG_SHA256) != 0);
+  if (!safeEntryName(e.path) || !_target.open) {
+    _stats.skipped++;
+  } else if (_target.open(e.path, e.size)) {
+    _open = true;
+    _skip = false;
+  } else {
+    // A bundle missing a file must not count as installed
+    return fail("can't create entry");
+  }
+  _state = GAP;
+  return true;
+}
+
+bool SdbStreamExtractor::finishEntry() {
+  const Entry &e = _entries[_next];
+  bool sumOk = _hasher.crc32() == e.crc32;
+  if (sumOk && (e.flags & SDB_FLAG_SHA256)) {
+    ExpectedHash expected = {};
+    expected.kind = ExpectedHash::SHA256;
+    memcpy(expected.sha256, e.sha256, sizeof(expected.sha256));
+    sumOk = _hasher.matches(expected);
+  }
+  bool ok = _writeOk && sumOk;
+  if (_open) {
+    _open = false;
+    if (_target.close) _target.close(ok);
+    if (ok) _stats.files++;
+  }
+  if (!sumOk) return fail("checksum mismatch");
+  if (!_writeOk) return fail("write failed");
+  _next++;
+  return nextEntry();
+}
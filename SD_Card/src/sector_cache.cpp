@@ -0,0 +1,323 @@
+#include "sector_cache.h"
+
+#include <string.h>
+#include <algorithm>
+#include "psram.h"
+
+// Dirty sectors are written back in runs of up to this many sectors.
+static const size_t BOUNCE_SECTORS = 16;
+
+bool SectorCache::begin(size_t slots, Mode mode, size_t maxRun) {
+  end();
+  if (slots == 0) return false;
+
+  size_t buckets = 1;
+  while (buckets < slots) buckets <<= 1;
+
+  _data = (uint8_t *)psramAlloc(slots * BLOCK_SIZE);
+  _meta = (Slot *)malloc(slots * sizeof(Slot));
+  _buckets = (int32_t *)malloc(buckets * sizeof(int32_t));
+  _bounce = (uint8_t *)malloc(BOUNCE_SECTORS * BLOCK_SIZE);
+  if (!_data || !_meta || !_buckets || !_bounce) {
+    end();
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _slots = slots;
+  _mode = mode;
+  _maxRun = maxRun;
+  _bucketMask = (uint32_t)(buckets - 1);
+  for (size_t b = 0; b < buckets; ++b) _buckets[b] = NIL;
+
+  // All slots start on the LRU list as invalid, so the tail is always the
+  // next slot to hand out.
+  _mru = _lru = NIL;
+  for (size_t i = 0; i < slots; ++i) {
+    Slot &s = _meta[i];
+    s.lba = 0;
+    s.hashNext = NIL;
+    s.valid = false;
+    s.dirty = false;
+    lruPushFront((int32_t)i);
+  }
+  _dirty = 0;
+  _stats = {};
+  return true;
+}
+
+void SectorCache::end() {
+  if (_data) flush();
+  std::lock_guard<std::mutex> guard(_lock);
+  psramFree(_data);
+  free(_meta);
+  free(_buckets);
+  free(_bounce);
+  _data = nullptr;
+  _meta = nullptr;
+  _buckets = nullptr;
+  _bounce = nullptr;
+  _slots = 0;
+  _dirty = 0;
+  _mru = _lru = NIL;
+}
+
+// --- index structures ---
+
+int32_t SectorCache::lookup(uint32_t lba) {
+  int32_t i = _buckets[bucketOf(lba)];
+  while (i != NIL) {
+    if (_meta[i].lba == lba) return i;
+    i = _meta[i].hashNext;
+  }
+  return NIL;
+}
+
+void SectorCache::hashInsert(int32_t i) {
+  uint32_t b = bucketOf(_meta[i].lba);
+  _meta[i].hashNext = _buckets[b];
+  _buckets[b] = i;
+}
+
+void SectorCache::hashRemove(int32_t i) {
+  int32_t *link = &_buckets[bucketOf(_meta[i].lba)];
+  while (*link != NIL) {
+    if (*link == i) {
+      *link = _meta[i].hashNext;
+      break;
+    }
+    link = &_meta[*link].hashNext;
+  }
+  _meta[i].hashNext = NIL;
+}
+
+void SectorCache::lruUnlink(int32_t i) {
+  Slot &s = _meta[i];
+  if (s.prev != NIL) _meta[s.prev].next = s.next; else _mru = s.next;
+  if (s.next != NIL) _meta[s.next].prev = s.prev; else _lru = s.prev;
+  s.prev = s.next = NIL;
+}
+
+void SectorCache::lruPushFront(int32_t i) {
+  Slot &s = _meta[i];
+  s.prev = NIL;
+  s.next = _mru;
+  if (_mru != NIL) _meta[_mru].prev = i;
+  _mru = i;
+  if (_lru == NIL) _lru = i;
+}
+
+void SectorCache::lruPushBack(int32_t i) {
+  Slot &s = _meta[i];
+  s.next = NIL;
+  s.prev = _lru;
+  if (_lru != NIL) _meta[_lru].next = i;
+  _lru = i;
+  if (_mru == NIL) _mru = i;
+}
+
+bool SectorCache::takeSlot(int32_t *out) {
+  int32_t i = _lru;
+  Slot &s = _meta[i];
+  if (s.valid) {
+    if (s.dirty) {
+      if (!_lower.writeSectors(s.lba, slotData(i), 1)) return false;
+      s.dirty = false;
+      _dirty--;
+      _stats.writebacks++;
+    }
+    hashRemove(i);
+    s.valid = false;
+    _stats.evictions++;
+  }
+  lruUnlink(i);
+  *out = i;
+  return true;
+}
+
+bool SectorCache::insert(uint32_t lba, const uint8_t *src, bool dirty) {
+  int32_t i;
+  if (!takeSlot(&i)) return false;
+  Slot &s = _meta[i];
+  s.lba = lba;
+  s.valid = true;
+  s.dirty = dirty;
+  if (dirty) _dirty++;
+  memcpy(slotData(i), src, BLOCK_SIZE);
+  hashInsert(i);
+  lruPushFront(i);
+  return true;
+}
+
+// --- BlockDevice ---
+
+bool SectorCache::readSectors(uint32_t sector, uint8_t *dst, size_t count) {
+  if (!_data) return _lower.readSectors(sector, dst, count);
+  std::lock_guard<std::mutex> guard(_lock);
+
+  if (count > _maxRun) {
+    if (!_lower.readSectors(sector, dst, count)) return false;
+    _stats.bypassSectors += count;
+    // The card is stale wherever we still hold a dirty copy.
+    if (_dirty) {
+      for (size_t k = 0; k < count; ++k) {
+        int32_t i = lookup(sector + k);
+        if (i != NIL && _meta[i].dirty) memcpy(dst + k * BLOCK_SIZE, slotData(i), BLOCK_SIZE);
+      }
+    }
+    return true;
+  }
+
+  size_t k = 0;
+  while (k < count) {
+    int32_t i = lookup(sector + k);
+    if (i != NIL) {
+      memcpy(dst + k * BLOCK_SIZE, slotData(i), BLOCK_SIZE);
+      lruUnlink(i);
+      lruPushFront(i);
+      _stats.hits++;
+      k++;
+      continue;
+    }
+
+    // Read the whole run of missing sectors with a single card request
+    size_t run = 1;
+    while (k + run < count && lookup(sector + k + run) == NIL) run++;
+    uint8_t *p = dst + k * BLOCK_SIZE;
+    if (!_lower.readSectors(sector + k, p, run)) return false;
+    _stats.misses += run;
+    for (size_t r = 0; r < run; ++r) {
+      if (!insert(sector + k + r, p + r * BLOCK_SIZE, false)) return false;
+    }
+    k += run;
+  }
+  return true;
+}
+
+bool SectorCache::writeSectors(uint32_t sector, const uint8_t *src, size_t count) {
+  if (!_data) return _lower.writeSectors(sector, src, count);
+  std::lock_guard<std::mutex> guard(_lock);
+
+  bool through = (_mode == WRITE_THROUGH) || count > _maxRun;
+  if (through && !_lower.writeSectors(sector, src, count)) {
+    // Card contents are now unknown for this range; forget our copies.
+    for (size_t k = 0; k < count; ++k) {
+      int32_t i = lookup(sector + k);
+      if (i == NIL) continue;
+      if (_meta[i].dirty) _dirty--;
+      hashRemove(i);
+      _meta[i].valid = false;
+      _meta[i].dirty = false;
+      // Invalid slots go to the tail so they're reused first
+      lruUnlink(i);
+      lruPushBack(i);
+    }
+    return false;
+  }
+
+  if (count > _maxRun) {
+    // Keep any cached copies coherent; they are clean now.
+    _stats.bypassSectors += count;
+    for (size_t k = 0; k < count; ++k) {
+      int32_t i = lookup(sector + k);
+      if (i == NIL) continue;
+      memcpy(slotData(i), src + k * BLOCK_SIZE, BLOCK_SIZE);
+      if (_meta[i].dirty) {
+        _meta[i].dirty = false;
+        _dirty--;
+      }
+    }
+    return true;
+  }
+
+  bool dirty = (_mode == WRITE_BACK);
+  for (size_t k = 0; k < count; ++k) {
+    const uint8_t *p = src + k * BLOCK_SIZE;
+    int32_t i = lookup(sector + k);
+    if (i == NIL) {
+      if (!insert(sector + k, p, dirty)) return false;
+      continue;
+    }
+    memcpy(slotData(i), p, BLOCK_SIZE);
+    if (dirty && !_meta[i].dirty) {
+      _meta[i].dirty = true;
+      _dirty++;
+    }
+    lruUnlink(i);
+    lruPushFront(i);
+  }
+  return true;
+}
+
+bool SectorCache::sync() {
+  if (!flush()) return false;
+  return _lower.sync();
+}
+
+// --- maintenance ---
+
+bool SectorCache::writeBackRun(int32_t *slotIdx, size_t n) {
+  for (size_t k = 0; k < n; ++k) memcpy(_bounce + k * BLOCK_SIZE, slotData(slotIdx[k]), BLOCK_SIZE);
+  if (!_lower.writeSectors(_meta[slotIdx[0]].lba, _bounce, n)) return false;
+  for (size_t k = 0; k < n; ++k) _meta[slotIdx[k]].dirty = false;
+  _dirty -= n;
+  _stats.writebacks += n;
+  return true;
+}
+
+bool SectorCache::flushLocked() {
+  if (!_data || _dirty == 0) return true;
+
+  // Collect dirty slots in LBA order so neighbours go out as one request.
+  int32_t *order = (int32_t *)malloc(_dirty * sizeof(int32_t));
+  if (!order) return false;
+  size_t n = 0;
+  for (size_t i = 0; i < _slots; ++i) {
+    if (_meta[i].valid && _meta[i].dirty) order[n++] = (int32_t)i;
+  }
+  std::sort(order, order + n, [this](int32_t a, int32_t b) { return _meta[a].lba < _meta[b].lba; });
+
+  bool ok = true;
+  size_t start = 0;
+  while (start < n) {
+    size_t len = 1;
+    while (start + len < n && len < BOUNCE_SECTORS &&
+           _meta[order[start + len]].lba == _meta[order[start]].lba + len) {
+      len++;
+    }
+    if (!writeBackRun(order + start, len)) ok = false;
+    start += len;
+  }
+  free(order);
+  return ok;
+}
+
+bool SectorCache::flush() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return flushLocked();
+}
+
+bool SectorCache::invalidate() {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_data) return true;
+  if (!flushLocked()) return false;
+  for (uint32_t b = 0; b <= _bucketMask; ++b) _buckets[b] = NIL;
+  _mru = _lru = NIL;
+  for (size_t i = 0; i < _slots; ++i) {
+    _meta[i].valid = false;
+    _meta[i].dirty = false;
+    _meta[i].hashNext = NIL;
+    lruPushFront((int32_t)i);
+  }
+  return true;
+}
+
+SectorCache::Stats SectorCache::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+void SectorCache::resetStats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats = {};
+}
@@ -0,0 +1,322 @@
+#include "sync_plan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "download_resume.h"
+
+// --- SyncState ---
+
+bool SyncState::load() {
+  _entries.clear();
+  File32 f = _fs.open(_path, O_RDONLY);
+  if (!f) return false;
+
+  std::string line;
+  char buf[256];
+  int n;
+  while ((n = f.read(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < n; i++) {
+      if (buf[i] != '\n') {
+        line += buf[i];
+        continue;
+      }
+      // path \t size \t hash \t origin
+      size_t t1 = line.find('\t');
+      size_t t2 = (t1 == std::string::npos) ? t1 : line.find('\t', t1 + 1);
+      size_t t3 = (t2 == std::string::npos) ? t2 : line.find('\t', t2 + 1);
+      if (t3 != std::string::npos && t1 > 0) {
+        Entry e;
+        e.path = line.substr(0, t1);
+        e.size = (uint32_t)strtoul(line.c_str() + t1 + 1, nullptr, 10);
+        e.hash = line.substr(t2 + 1, t3 - t2 - 1);
+        e.origin = line.substr(t3 + 1);
+        _entries.push_back(std::move(e));
+      }
+      line.clear();
+    }
+  }
+  f.close();
+
+  std::sort(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) { return a.path < b.path; });
+  return true;
+}
+
+bool SyncState::save() {
+  File32 f = _fs.open(_path, O_RDWR | O_CREAT | O_TRUNC);
+  if (!f) return false;
+  bool ok = true;
+  char num[16];
+  for (const Entry &e : _entries) {
+    snprintf(num, sizeof(num), "%lu", (unsigned long)e.size);
+    std::string line = e.path + '\t' + num + '\t' + e.hash + '\t' + e.origin + '\n';
+    if (f.write(line.data(), line.size()) != line.size()) { ok = false; break; }
+  }
+  ok = f.sync() && ok;
+  f.close();
+  return ok;
+}
+
+size_t SyncState::lowerBound(const std::string &path) const {
+  auto it = std::lower_bound(_entries.begin(), _entries.end(), path,
+                             [](const Entry &e, const std::string &p) { return e.path < p; });
+  return (size_t)(it - _entries.begin());
+}
+
+const SyncState::Entry *SyncState::find(const std::string &path) const {
+  size_t i = lowerBound(path);
+  if (i < _entries.size() && _entries[i].path == path) return &_entries[i];
+  return nullptr;
+}
+
+void SyncState::set(const Entry &e) {
+  size_t i = lowerBound(e.path);
+  if (i < _entries.size() && _entries[i].path == e.path) _entries[i] = e;
+  else _entries.insert(_entries.begin() + i, e);
+}
+
+void SyncState::erase(const std::string &path) {
+  size_t i = lowerBound(path);
+  if (i < _entries.size() && _entries[i].path == path) _entries.erase(_entries.begin() + i);
+}
+
+std::vector<std::string> SyncState::fromOrigin(const std::string &origin) const {
+  std::vector<std::string> out;
+  for (const Entry &e : _entries) {
+    if (e.origin == origin && e.path != origin) out.push_back(e.path);
+  }
+  return out;
+}
+
+// --- plan spool ---
+
+// Reads the line at `offset`, without its newline
+bool SyncPlan::readLine(uint32_t offset, std::string *line) {
+  line->clear();
+  if (!_spool.seekSet(offset)) return false;
+  char buf[64];
+  int n;
+  while ((n = _spool.read(buf, sizeof(buf))) > 0) {
+    const char *nl = (const char *)memchr(buf, '\n', n);
+    if (nl) {
+      line->append(buf, nl - buf);
+      return true;
+    }
+    line->append(buf, n);
+  }
+  return false;
+}
+
+// Spool lines are "<bundle 0/1>\t<hash>\t<path>"
+bool SyncPlan::get(size_t i, SyncAction *action) {
+  const Record &r = _records[i];
+  std::string line;
+  if (!readLine(r.offset, &line)) return false;
+  size_t t1 = line.find('\t', 2);
+  if (line.size() < 2 || t1 == std::string::npos) return false;
+  action->kind = r.kind;
+  action->item.bundle = line[0] == '1';
+  action->item.size = r.size;
+  action->item.hash = line.substr(2, t1 - 2);
+  action->item.path = line.substr(t1 + 1);
+  return true;
+}
+
+void SyncPlan::close() {
+  if (_spool) _spool.close();
+}
+
+// --- planner ---
+
+const char *syncActionName(SyncAction::Kind kind) {
+  switch (kind) {
+    case SyncAction::ADD: return "add";
+    case SyncAction::UPDATE: return "update";
+    case SyncAction::DELETE: return "delete";
+    case SyncAction::KEEP: return "keep";
+    case SyncAction::ADOPT: return "adopt";
+    default: return "?";
+  }
+}
+
+// Root-level dot-files/dirs (index, journal, state, .trash) and the Windows
+// system folder belong to the device, not to the library
+static bool isInternal(const std::string &path) {
+  if (path.size() > 1 && path[1] == '.') return true;
+  return path.compare(0, 26, "/System Volume Information") == 0;
+}
+
+static uint32_t pathHash(const std::string &path) {
+  uint32_t h = 2166136261u;
+  for (char c : path) h = (h ^ (uint8_t)c) * 16777619u;
+  return h;
+}
+
+SyncPlanner::SyncPlanner(SdFat &fs, const SyncState &state, const FileIndex &index, bool trashUntracked,
+                         const char *spoolPath)
+    : _fs(fs), _state(state), _index(index), _trashUntracked(trashUntracked) {
+  _plan._path = spoolPath;
+  _stateSeen.assign(state.entries().size(), false);
+  _indexSeen.assign(index.entries().size(), false);
+  _stateClaim.assign(state.entries().size(), UNCLAIMED);
+  _indexClaim.assign(index.entries().size(), UNCLAIMED);
+  _byOrigin.reserve(state.entries().size());
+  for (size_t i = 0; i < state.entries().size(); i++) _byOrigin.emplace_back(state.entries()[i].origin, i);
+  std::sort(_byOrigin.begin(), _byOrigin.end());
+}
+
+bool SyncPlanner::begin() {
+  _plan._spool = _fs.open(_plan._path, O_RDWR | O_CREAT | O_TRUNC);
+  _plan._failed = !_plan._spool;
+  return !_plan._failed;
+}
+
+// Returns the claim for the item's path
+uint32_t SyncPlanner::push(SyncAction::Kind kind, const ManifestItem &item) {
+  _plan.counts[kind]++;
+  if (kind == SyncAction::KEEP) return CLAIM_KEEP;
+  if (kind == SyncAction::ADD || kind == SyncAction::UPDATE) {
+    _plan.downloadBytes += item.size;
+    if (item.size == 0) _plan.unknownSize++;
+    markPartial(item.path);
+  }
+
+  SyncPlan::Record r = {_plan._end, item.size, kind, false};
+  std::string line;
+  line.reserve(item.hash.size() + item.path.size() + 4);
+  line += item.bundle ? '1' : '0';
+  line += '\t';
+  line += item.hash;
+  line += '\t';
+  line += item.path;
+  line += '\n';
+  if (_plan._spool && _plan._spool.seekSet(_plan._end) &&
+      _plan._spool.write(line.data(), line.size()) == line.size()) {
+    _plan._end += line.size();
+  } else {
+    _plan._failed = true;
+  }
+  _plan._records.push_back(r);
+  return (uint32_t)_plan._records.size();
+}
+
+// Where the claim on the item's path is kept: with its state or index
+// entry, or for a path the card doesn't know, in _newClaim (inserted empty)
+uint32_t *SyncPlanner::claimSlot(const ManifestItem &item, const SyncState::Entry *st, const FileIndex::Entry *f) {
+  if (st) return &_stateClaim[(size_t)(st - _state.entries().data())];
+  if (f) return &_indexClaim[(size_t)(f - _index.entries().data())];
+
+  uint32_t h = pathHash(item.path);
+  auto it = std::lower_bound(_newClaim.begin(), _newClaim.end(), std::make_pair(h, (uint32_t)0));
+  for (; it != _newClaim.end() && it->first == h; ++it) {
+    // A new path is always an ADD, so its claim names a record; check it
+    // is the same path and not a hash collision
+    SyncAction earlier;
+    if (_plan.get(it->second - 1, &earlier) && earlier.item.path == item.path) return &it->second;
+  }
+  it = _newClaim.insert(it, std::make_pair(h, UNCLAIMED));
+  return &it->second;
+}
+
+// Undoes what an earlier item for a path added to the plan
+void SyncPlanner::drop(uint32_t claim) {
+  _plan.duplicates++;
+  if (claim == CLAIM_KEEP) {
+    _plan.counts[SyncAction::KEEP]--;
+    return;
+  }
+  SyncPlan::Record &r = _plan._records[claim - 1];
+  r.dropped = true;
+  _plan.counts[r.kind]--;
+  if (r.kind == SyncAction::ADD || r.kind == SyncAction::UPDATE) {
+    _plan.downloadBytes -= r.size;
+    if (r.size == 0) _plan.unknownSize--;
+  }
+}
+
+void SyncPlanner::markOrigin(const std::string &origin) {
+  auto it = std::lower_bound(_byOrigin.begin(), _byOrigin.end(), origin,
+                             [](const std::pair<std::string, size_t> &p, const std::string &o) { return p.first < o; });
+  for (; it != _byOrigin.end() && it->first == origin; ++it) _stateSeen[it->second] = true;
+}
+
+// An interrupted download of `path` is kept for resuming, not trashed as
+// untracked
+void SyncPlanner::markPartial(const std::string &path) {
+  std::string tmp = path + DOWNLOAD_TMP_SUFFIX;
+  for (const std::string &p : {tmp, ResumeSidecar::pathFor(tmp)}) {
+    const FileIndex::Entry *f = _index.find(p.c_str());
+    if (f) _indexSeen[(size_t)(f - _index.entries().data())] = true;
+  }
+}
+
+void SyncPlanner::add(const ManifestItem &m) {
+  const SyncState::Entry *st = _state.find(m.path);
+  if (st) _stateSeen[(size_t)(st - _state.entries().data())] = true;
+  markOrigin(m.path);
+  // The zip itself is gone after extraction; only the state knows it
+  const FileIndex::Entry *f = m.bundle ? nullptr : _index.find(m.path.c_str());
+  if (f) _indexSeen[(size_t)(f - _index.entries().data())] = true;
+
+  // Later entries win: forget what an earlier item for this path planned
+  uint32_t *claim = claimSlot(m, st, f);
+  if (*claim != UNCLAIMED) drop(*claim);
+
+  SyncAction::Kind kind;
+
+  if (m.bundle) {
+    if (!st) kind = SyncAction::ADD;
+    else if (!m.hash.empty() && st->hash != m.hash) kind = SyncAction::UPDATE;
+    else kind = SyncAction::KEEP;
+  } else {
+    bool sizeOk = f && !f->isDir() && (m.size == 0 || f->size == m.size);
+    if (!f || !sizeOk) {
+      kind = st ? SyncAction::UPDATE : SyncAction::ADD;
+    } else if (!st) {
+      // Downloaded before the state DB existed (or it was lost)
+      kind = m.size != 0 ? SyncAction::ADOPT : SyncAction::UPDATE;
+    } else if (st->hash != m.hash || (m.size != 0 && st->size != m.size)) {
+      kind = SyncAction::UPDATE;
+    } else {
+      kind = SyncAction::KEEP;
+    }
+  }
+  *claim = push(kind, m);
+}
+
+SyncPlan SyncPlanner::finish() {
+  ManifestItem gone = {};
+
+  // Installed files whose manifest item went away
+  const std::vector<SyncState::Entry> &entries = _state.entries();
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (_stateSeen[i]) continue;
+    gone.path = entries[i].path;
+    push(SyncAction::DELETE, gone);
+  }
+
+  if (_trashUntracked) {
+    const std::vector<FileIndex::Entry> &files = _index.entries();
+    for (size_t i = 0; i < files.size(); i++) {
+      const FileIndex::Entry &f = files[i];
+      if (_indexSeen[i] || f.isDir() || isInternal(f.path) || _state.find(f.path)) continue;
+      gone.path = f.path;
+      push(SyncAction::DELETE, gone);
+    }
+  }
+
+  // Deletions run first: an untracked path may be one a bundle is about to
+  // extract, and trashing it afterwards would lose the file for good (the
+  // bundle is recorded as installed and never fetched again)
+  std::vector<SyncPlan::Record> &records = _plan._records;
+  records.erase(std::remove_if(records.begin(), records.end(), [](const SyncPlan::Record &r) { return r.dropped; }),
+                records.end());
+  std::stable_partition(records.begin(), records.end(),
+                        [](const SyncPlan::Record &r) { return r.kind == SyncAction::DELETE; });
+  if (_plan._spool && !_plan._spool.sync()) _plan._failed = true;
+
+  SyncPlan plan = std::move(_plan);
+  _plan = SyncPlan();
+  return plan;
+}
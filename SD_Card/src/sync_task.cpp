@@ -0,0 +1,146 @@
+#include "sync_task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+static void copyText(char *dst, size_t n, const char *src) {
+  snprintf(dst, n, "%s", src ? src : "");
+}
+
+// File names keep their end, which is what the progress box shows
+static void copyTail(char *dst, size_t n, const char *src) {
+  size_t len = strlen(src);
+  copyText(dst, n, len >= n ? src + len - (n - 1) : src);
+}
+
+SyncTask::~SyncTask() {
+  delete[] _queue;
+}
+
+bool SyncTask::begin(size_t queueDepth) {
+  if (_running || queueDepth == 0) return false;
+  std::lock_guard<std::mutex> guard(_lock);
+  delete[] _queue;
+  _queue = new Event[queueDepth];
+  _depth = queueDepth;
+  _head = _count = 0;
+  return true;
+}
+
+#if defined(ESP32)
+static void syncTaskMain(void *arg) {
+  ((SyncTask *)arg)->run();
+  vTaskDelete(nullptr);
+}
+#endif
+
+bool SyncTask::start(Job job, int core, int priority, uint32_t stackBytes) {
+  if (!_depth || _running || !job) return false;
+  _job = std::move(job);
+  _cancel = false;
+  _priority = priority;
+  _running = true;
+#if defined(ESP32)
+  {
+    // Held until _task is set, so run() can't clear it first
+    std::lock_guard<std::mutex> guard(_lock);
+    TaskHandle_t h = nullptr;
+    if (xTaskCreatePinnedToCore(syncTaskMain, "sync", stackBytes, this, priority, &h, core) == pdPASS) {
+      _task = h;
+      return true;
+    }
+  }
+#else
+  (void)core;
+  (void)stackBytes;
+#endif
+  run();
+  return true;
+}
+
+void SyncTask::run() {
+  bool ok = _job(*this);
+  Event e = {};
+  e.kind = Event::FINISHED;
+  e.ok = ok;
+  copyText(e.text, sizeof(e.text), _cancel ? "Sync cancelled" : (ok ? "Sync done" : "Sync failed"));
+  post(e);
+  _job = nullptr;
+  std::lock_guard<std::mutex> guard(_lock);
+  _task = nullptr;
+  _running = false;
+}
+
+void SyncTask::setPriority(int priority) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _priority = priority;
+#if defined(ESP32)
+  if (_task) vTaskPrioritySet((TaskHandle_t)_task, priority);
+#endif
+}
+
+void SyncTask::post(const Event &e) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_depth) return;
+  _stats.posted++;
+  if (e.kind == Event::PROGRESS && _count) {
+    Event &last = _queue[(_head + _count - 1) % _depth];
+    if (last.kind == Event::PROGRESS) {
+      last = e;
+      _stats.coalesced++;
+      return;
+    }
+  }
+  if (_count == _depth) {
+    _head = (_head + 1) % _depth;
+    _count--;
+    _stats.dropped++;
+  }
+  _queue[(_head + _count) % _depth] = e;
+  _count++;
+}
+
+void SyncTask::status(const char *text, const char *detail) {
+  Event e = {};
+  e.kind = Event::STATUS;
+  copyText(e.text, sizeof(e.text), text);
+  copyText(e.detail, sizeof(e.detail), detail);
+  post(e);
+}
+
+void SyncTask::progress(const char *name, uint64_t done, int64_t total, uint32_t elapsedMs) {
+  Event e = {};
+  e.kind = Event::PROGRESS;
+  copyTail(e.text, sizeof(e.text), name);
+  e.done = done;
+  e.total = total;
+  e.elapsedMs = elapsedMs;
+  post(e);
+}
+
+void SyncTask::itemDone(const char *name, bool ok) {
+  Event e = {};
+  e.kind = Event::ITEM_DONE;
+  copyTail(e.text, sizeof(e.text), name);
+  e.ok = ok;
+  post(e);
+}
+
+bool SyncTask::poll(Event *e) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_count) return false;
+  *e = _queue[_head];
+  _head = (_head + 1) % _depth;
+  _count--;
+  return true;
+}
+
+SyncTask::Stats SyncTask::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
@@ -0,0 +1,563 @@
+#include "virtual_fat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+static uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t rd32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static void wr16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void wr32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+
+static const uint16_t DEFAULT_DATE = ((2024 - 1980) << 9) | (1 << 5) | 1;  // 2024-01-01
+static const uint8_t ATTR_READ_ONLY = 0x01;
+static const uint8_t ATTR_VOLUME_ID = 0x08;
+static const uint8_t ATTR_DIRECTORY = 0x10;
+static const uint8_t ATTR_ARCHIVE = 0x20;
+static const uint8_t ATTR_LFN = 0x0F;
+
+// --- names ---
+
+static bool isShortNameChar(char c) {
+  if (c >= 'A' && c <= 'Z') return true;
+  if (c >= '0' && c <= '9') return true;
+  return strchr("$%'-_@~`!(){}^#&", c) != nullptr && c != 0;
+}
+
+// True if `name` can be stored as a plain 8.3 entry without an LFN.
+static bool isPlain83(const std::string &name) {
+  size_t dot = name.find('.');
+  std::string base = name.substr(0, dot);
+  std::string ext = (dot == std::string::npos) ? "" : name.substr(dot + 1);
+  if (base.empty() || base.size() > 8 || ext.size() > 3) return false;
+  if (ext.find('.') != std::string::npos) return false;
+  for (char c : base) if (!isShortNameChar(c)) return false;
+  for (char c : ext) if (!isShortNameChar(c)) return false;
+  return true;
+}
+
+static std::vector<uint16_t> utf8ToUcs2(const std::string &s) {
+  std::vector<uint16_t> out;
+  for (size_t i = 0; i < s.size();) {
+    uint8_t c = (uint8_t)s[i];
+    uint32_t cp;
+    size_t len;
+    if (c < 0x80) { cp = c; len = 1; }
+    else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; len = 2; }
+    else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; len = 3; }
+    else { cp = c & 0x07; len = 4; }
+    if (i + len > s.size()) break;
+    for (size_t k = 1; k < len; ++k) cp = (cp << 6) | ((uint8_t)s[i + k] & 0x3F);
+    out.push_back(cp > 0xFFFF ? '_' : (uint16_t)cp);
+    i += len;
+  }
+  if (out.size() > 255) out.resize(255);
+  return out;
+}
+
+static size_t entriesFor(const std::string &name) {
+  if (isPlain83(name)) return 1;
+  return 1 + (utf8ToUcs2(name).size() + 12) / 13;
+}
+
+// Numeric-tail short name ("BASIS~N.EXT"); `tail` is unique per directory.
+static void makeShortName(const std::string &name, uint32_t tail, uint8_t out[11]) {
+  memset(out, ' ', 11);
+  size_t dot = name.rfind('.');
+  if (dot == 0) dot = std::string::npos;
+  std::string base, ext;
+  for (size_t i = 0; i < name.size() && i != dot; ++i) {
+    char c = name[i];
+    if (c == ' ' || c == '.') continue;
+    if (c >= 'a' && c <= 'z') c -= 32;
+    base += isShortNameChar(c) ? c : '_';
+  }
+  if (dot != std::string::npos) {
+    for (size_t i = dot + 1; i < name.size() && ext.size() < 3; ++i) {
+      char c = name[i];
+      if (c == ' ' || c == '.') continue;
+      if (c >= 'a' && c <= 'z') c -= 32;
+      ext += isShortNameChar(c) ? c : '_';
+    }
+  }
+  char tailBuf[12];
+  snprintf(tailBuf, sizeof(tailBuf), "~%lu", (unsigned long)tail);
+  size_t keep = 8 - strlen(tailBuf);
+  if (base.empty()) base = "_";
+  if (base.size() > keep) base.resize(keep);
+  base += tailBuf;
+  memcpy(out, base.data(), base.size());
+  memcpy(out + 8, ext.data(), ext.size());
+}
+
+static uint8_t shortNameChecksum(const uint8_t name[11]) {
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; ++i) sum = (uint8_t)(((sum & 1) ? 0x80 : 0) + (sum >> 1) + name[i]);
+  return sum;
+}
+
+static void putDirEntry(uint8_t *ent, const uint8_t name[11], uint8_t attr, uint32_t cluster,
+                        uint32_t size, uint16_t date, uint16_t time) {
+  memset(ent, 0, 32);
+  memcpy(ent, name, 11);
+  ent[11] = attr;
+  wr16(ent + 14, time);   // create time
+  wr16(ent + 16, date);   // create date
+  wr16(ent + 18, date);   // access date
+  wr16(ent + 20, (uint16_t)(cluster >> 16));
+  wr16(ent + 22, time);
+  wr16(ent + 24, date);
+  wr16(ent + 26, (uint16_t)(cluster & 0xFFFF));
+  wr32(ent + 28, size);
+}
+
+// --- card geometry ---
+
+bool VirtualFat::readGeometry(Geometry *g) {
+  uint8_t buf[BLOCK_SIZE];
+  if (!_card.readSectors(0, buf, 1)) return false;
+  if (buf[510] != 0x55 || buf[511] != 0xAA) return false;
+
+  uint32_t part = 0;
+  bool isBoot = (buf[0] == 0xEB || buf[0] == 0xE9) && rd16(buf + 11) == BLOCK_SIZE && buf[13] != 0;
+  if (!isBoot) {
+    // MBR: use the first FAT partition
+    for (int i = 0; i < 4 && !part; ++i) {
+      const uint8_t *pe = buf + 446 + 16 * i;
+      uint8_t type = pe[4];
+      if (type == 0x01 || type == 0x04 || type == 0x06 || type == 0x0B || type == 0x0C || type == 0x0E) {
+        part = rd32(pe + 8);
+      }
+    }
+    if (!part || !_card.readSectors(part, buf, 1)) return false;
+  }
+
+  memset(g, 0, sizeof(*g));
+  g->partStart = part;
+  if (rd16(buf + 11) != BLOCK_SIZE) return false;
+  g->spc = buf[13];
+  g->reserved = rd16(buf + 14);
+  g->numFats = buf[16];
+  g->rootEntries = rd16(buf + 17);
+  g->totalSectors = rd16(buf + 19) ? rd16(buf + 19) : rd32(buf + 32);
+  g->media = buf[21];
+  g->fatSectors = rd16(buf + 22) ? rd16(buf + 22) : rd32(buf + 36);
+  if (g->spc == 0 || (g->spc & (g->spc - 1)) || g->numFats == 0 || g->fatSectors == 0) return false;
+
+  g->rootSectors = ((uint32_t)g->rootEntries * 32 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  g->dataStart = g->reserved + g->numFats * g->fatSectors + g->rootSectors;
+  if (g->totalSectors <= g->dataStart) return false;
+  g->clusters = (g->totalSectors - g->dataStart) / g->spc;
+  g->fatType = g->clusters < 4085 ? 12 : (g->clusters < 65525 ? 16 : 32);
+  if (g->fatType == 32) {
+    g->fsInfo = rd16(buf + 48);
+    g->backupBoot = rd16(buf + 50);
+    if (g->backupBoot >= g->reserved) g->backupBoot = 0;
+  }
+  memcpy(_bootSector, buf, BLOCK_SIZE);
+  return true;
+}
+
+uint32_t VirtualFat::eoc() const {
+  return _g.fatType == 32 ? 0x0FFFFFFF : (_g.fatType == 16 ? 0xFFFF : 0xFFF);
+}
+
+bool VirtualFat::readFatEntry(uint32_t cluster, uint32_t *value) {
+  uint32_t byteOff = (_g.fatType == 32) ? cluster * 4 : (_g.fatType == 16 ? cluster * 2 : cluster + cluster / 2);
+  uint32_t sector = _g.partStart + _g.reserved + byteOff / BLOCK_SIZE;
+  if (sector != _fatCacheSector) {
+    // Two sectors, so a FAT12 entry straddling the boundary is readable
+    if (!_card.readSectors(sector, _fatCache, 2)) return false;
+    _fatCacheSector = sector;
+  }
+  const uint8_t *p = _fatCache + byteOff % BLOCK_SIZE;
+  if (_g.fatType == 32) *value = rd32(p) & 0x0FFFFFFF;
+  else if (_g.fatType == 16) *value = rd16(p);
+  else *value = (cluster & 1) ? (rd16(p) >> 4) : (rd16(p) & 0xFFF);
+  return true;
+}
+
+bool VirtualFat::readChain(uint32_t first, std::vector<Run> *out) {
+  uint32_t maxCluster = _g.clusters + 1;
+  if (first < 2 || first > maxCluster) return false;
+  uint32_t eocMin = eoc() & ~7u;
+
+  std::vector<Run> chain;
+  Run cur = {first, 1, 0, 0, 0, RUN_FILE};
+  uint32_t c = first;
+  for (uint32_t steps = 0;; ++steps) {
+    if (steps > _g.clusters) return false;  // loop in the chain
+    uint32_t v;
+    if (!readFatEntry(c, &v)) return false;
+    if (v >= eocMin) break;
+    if (v < 2 || v > maxCluster) return false;
+    if (v == c + 1) {
+      cur.count++;
+    } else {
+      cur.next = v;
+      chain.push_back(cur);
+      cur.first = v;
+      cur.count = 1;
+    }
+    c = v;
+  }
+  cur.next = eoc();
+  chain.push_back(cur);
+  out->insert(out->end(), chain.begin(), chain.end());
+  return true;
+}
+
+// --- build ---
+
+const VirtualFat::Run *VirtualFat::findRun(uint32_t cluster) const {
+  auto it = std::upper_bound(_runs.begin(), _runs.end(), cluster,
+                             [](uint32_t c, const Run &r) { return c < r.first; });
+  if (it == _runs.begin()) return nullptr;
+  --it;
+  return (cluster < it->first + it->count) ? &*it : nullptr;
+}
+
+bool VirtualFat::allocDirClusters(uint32_t dir, uint32_t count, uint32_t *cursor) {
+  // Take free clusters from the top of the volume down, skipping file chains.
+  // _runs only holds (sorted) file runs at this point.
+  std::vector<uint32_t> got;
+  while (got.size() < count) {
+    if (*cursor < 2) return false;
+    const Run *r = findRun(*cursor);
+    if (r) {
+      *cursor = r->first - 1;
+      continue;
+    }
+    got.push_back((*cursor)--);
+  }
+  std::reverse(got.begin(), got.end());
+
+  _dirs[dir].firstCluster = got[0];
+  size_t i = 0;
+  while (i < got.size()) {
+    size_t n = 1;
+    while (i + n < got.size() && got[i + n] == got[i] + n) n++;
+    Run r = {got[i], (uint32_t)n, (i + n < got.size()) ? got[i + n] : eoc(), dir, (uint32_t)i, RUN_DIR};
+    _dirRuns.push_back(r);
+    i += n;
+  }
+  return true;
+}
+
+void VirtualFat::encodeDir(uint32_t d, const std::vector<Entry> &files) {
+  Dir &dir = _dirs[d];
+  uint8_t *p = dir.bytes.data();
+  uint8_t name[11];
+
+  if (d == 0) {
+    memcpy(name, _label, 11);
+    putDirEntry(p, name, ATTR_VOLUME_ID, 0, 0, DEFAULT_DATE, 0);
+    p += 32;
+  } else {
+    memset(name, ' ', 11);
+    name[0] = '.';
+    putDirEntry(p, name, ATTR_DIRECTORY, dir.firstCluster, 0, DEFAULT_DATE, 0);
+    p += 32;
+    name[1] = '.';
+    uint32_t parentCluster = (dir.parent == 0) ? 0 : _dirs[dir.parent].firstCluster;
+    putDirEntry(p, name, ATTR_DIRECTORY, parentCluster, 0, DEFAULT_DATE, 0);
+    p += 32;
+  }
+
+  uint32_t tail = 1;
+  for (const Child &child : dir.children) {
+    if (isPlain83(child.name)) {
+      memset(name, ' ', 11);
+      size_t dot = child.name.find('.');
+      memcpy(name, child.name.data(), std::min(dot, child.name.size()));
+      if (dot != std::string::npos) memcpy(name + 8, child.name.data() + dot + 1, child.name.size() - dot - 1);
+    } else {
+      makeShortName(child.name, tail++, name);
+      std::vector<uint16_t> u = utf8ToUcs2(child.name);
+      uint8_t sum = shortNameChecksum(name);
+      size_t count = (u.size() + 12) / 13;
+      static const uint8_t charPos[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+      for (size_t ord = count; ord >= 1; --ord) {
+        memset(p, 0, 32);
+        p[0] = (uint8_t)(ord | (ord == count ? 0x40 : 0));
+        p[11] = ATTR_LFN;
+        p[13] = sum;
+        for (size_t j = 0; j < 13; ++j) {
+          size_t idx = (ord - 1) * 13 + j;
+          uint16_t ch = (idx < u.size()) ? u[idx] : (idx == u.size() ? 0x0000 : 0xFFFF);
+          wr16(p + charPos[j], ch);
+        }
+        p += 32;
+      }
+    }
+
+    if (child.isDir) {
+      putDirEntry(p, name, ATTR_DIRECTORY, _dirs[child.index].firstCluster, 0, DEFAULT_DATE, 0);
+    } else {
+      const Entry &e = files[child.index];
+      putDirEntry(p, name, ATTR_ARCHIVE | ATTR_READ_ONLY, e.firstCluster, e.size,
+                  e.date ? e.date : DEFAULT_DATE, e.date ? e.time : 0);
+    }
+    p += 32;
+  }
+}
+
+bool VirtualFat::build(const std::vector<Entry> &files, const char *label) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _active = false;
+  _runs.clear();
+  _dirRuns.clear();
+  _dirs.clear();
+  _info = {};
+  _fatCacheSector = 0xFFFFFFFF;
+
+  if (!readGeometry(&_g)) return false;
+  _info.fatType = _g.fatType;
+
+  // Directory tree from the relative paths
+  _dirs.push_back(Dir{0, {}, {}, 0});
+  std::map<std::string, uint32_t> dirIndex;
+  for (uint32_t i = 0; i < files.size(); ++i) {
+    const std::string &path = files[i].path;
+    uint32_t parent = 0;
+    size_t start = 0;
+    while (start < path.size() && path[start] == '/') start++;
+    size_t slash;
+    while ((slash = path.find('/', start)) != std::string::npos) {
+      if (slash > start) {
+        std::string key = path.substr(0, slash);
+        auto it = dirIndex.find(key);
+        if (it == dirIndex.end()) {
+          uint32_t idx = (uint32_t)_dirs.size();
+          _dirs.push_back(Dir{parent, {}, {}, 0});
+          _dirs[parent].children.push_back(Child{path.substr(start, slash - start), true, idx});
+          it = dirIndex.emplace(key, idx).first;
+        }
+        parent = it->second;
+      }
+      start = slash + 1;
+    }
+    if (start >= path.size()) continue;
+
+    if (files[i].firstCluster) {
+      if (!readChain(files[i].firstCluster, &_runs)) {
+        _info.skipped++;
+        continue;
+      }
+    } else if (files[i].size) {
+      _info.skipped++;
+      continue;
+    }
+    _dirs[parent].children.push_back(Child{path.substr(start), false, i});
+    _info.files++;
+  }
+
+  std::sort(_runs.begin(), _runs.end(), [](const Run &a, const Run &b) { return a.first < b.first; });
+  for (size_t i = 1; i < _runs.size(); ++i) {
+    // Two files claiming the same cluster: the FS is damaged, don't expose it
+    if (_runs[i].first < _runs[i - 1].first + _runs[i - 1].count) return false;
+  }
+  _info.fragments = (uint32_t)_runs.size();
+
+  // Volume label
+  memset(_label, ' ', sizeof(_label));
+  for (size_t i = 0; label && label[i] && i < sizeof(_label); ++i) {
+    char c = label[i];
+    if (c >= 'a' && c <= 'z') c -= 32;
+    _label[i] = (isShortNameChar(c) || c == ' ') ? c : '_';
+  }
+
+  // Size the directories and place them in free clusters
+  uint32_t clusterBytes = (uint32_t)_g.spc * BLOCK_SIZE;
+  uint32_t cursor = _g.clusters + 1;
+  for (uint32_t d = 0; d < _dirs.size(); ++d) {
+    size_t entries = (d == 0) ? 1 : 2;
+    for (const Child &c : _dirs[d].children) entries += entriesFor(c.name);
+    size_t bytes = entries * 32;
+
+    if (d == 0 && _g.fatType != 32) {
+      if (entries > _g.rootEntries) return false;
+      _dirs[0].bytes.assign(_g.rootSectors * BLOCK_SIZE, 0);
+      continue;
+    }
+    uint32_t n = (uint32_t)((bytes + clusterBytes - 1) / clusterBytes);
+    if (n == 0) n = 1;
+    _dirs[d].bytes.assign((size_t)n * clusterBytes, 0);
+    if (!allocDirClusters(d, n, &cursor)) return false;
+  }
+  _runs.insert(_runs.end(), _dirRuns.begin(), _dirRuns.end());
+  _dirRuns.clear();
+  std::sort(_runs.begin(), _runs.end(), [](const Run &a, const Run &b) { return a.first < b.first; });
+
+  for (uint32_t d = 0; d < _dirs.size(); ++d) encodeDir(d, files);
+  for (Dir &d : _dirs) {
+    d.children.clear();
+    d.children.shrink_to_fit();
+  }
+
+  static uint32_t generation = 0;
+  _serial = 0x56464154u ^ (++generation * 2654435761u) ^ (uint32_t)files.size();
+  _info.dirs = (uint32_t)_dirs.size();
+  _active = true;
+  return true;
+}
+
+void VirtualFat::clear() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _active = false;
+  _runs.clear();
+  _runs.shrink_to_fit();
+  _dirs.clear();
+  _dirs.shrink_to_fit();
+}
+
+bool VirtualFat::active() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _active;
+}
+
+VirtualFat::Info VirtualFat::info() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _info;
+}
+
+// --- sector synthesis ---
+
+uint32_t VirtualFat::fatEntry(uint32_t cluster) const {
+  if (cluster == 0) return (eoc() & ~0xFFu) | _g.media;
+  if (cluster == 1) return eoc();
+  const Run *r = findRun(cluster);
+  if (!r) return 0;
+  return (cluster < r->first + r->count - 1) ? cluster + 1 : r->next;
+}
+
+void VirtualFat::synthBoot(uint8_t *dst) {
+  memcpy(dst, _bootSector, BLOCK_SIZE);
+  // New serial/label so hosts don't reuse what they cached for the last view
+  uint32_t ext = (_g.fatType == 32) ? 64 : 36;
+  if (_g.fatType == 32) wr32(dst + 44, _dirs[0].firstCluster);
+  if (dst[ext + 2] == 0x29) {
+    wr32(dst + ext + 3, _serial);
+    memcpy(dst + ext + 7, _label, 11);
+  }
+}
+
+void VirtualFat::synthFsInfo(uint8_t *dst) {
+  memset(dst, 0, BLOCK_SIZE);
+  wr32(dst, 0x41615252);
+  wr32(dst + 484, 0x61417272);
+  wr32(dst + 488, 0xFFFFFFFF);  // free count unknown
+  wr32(dst + 492, 0xFFFFFFFF);  // no next-free hint
+  wr32(dst + 508, 0xAA550000);
+}
+
+void VirtualFat::synthFat(uint32_t fatSector, uint8_t *dst) {
+  memset(dst, 0, BLOCK_SIZE);
+  uint32_t limit = _g.clusters + 2;
+
+  if (_g.fatType == 32) {
+    uint32_t c0 = fatSector * (BLOCK_SIZE / 4);
+    for (uint32_t i = 0; i < BLOCK_SIZE / 4 && c0 + i < limit; ++i) wr32(dst + i * 4, fatEntry(c0 + i));
+    return;
+  }
+  if (_g.fatType == 16) {
+    uint32_t c0 = fatSector * (BLOCK_SIZE / 2);
+    for (uint32_t i = 0; i < BLOCK_SIZE / 2 && c0 + i < limit; ++i) wr16(dst + i * 2, (uint16_t)fatEntry(c0 + i));
+    return;
+  }
+
+  // FAT12: 1.5 bytes per entry, entries may straddle sector boundaries
+  int32_t b0 = (int32_t)(fatSector * BLOCK_SIZE);
+  auto get = [&](int32_t b) -> uint8_t { return (b >= b0 && b < b0 + (int32_t)BLOCK_SIZE) ? dst[b - b0] : 0; };
+  auto put = [&](int32_t b, uint8_t v) { if (b >= b0 && b < b0 + (int32_t)BLOCK_SIZE) dst[b - b0] = v; };
+  uint32_t n0 = (uint32_t)(b0 * 2) / 3;
+  uint32_t n1 = (uint32_t)((b0 + BLOCK_SIZE) * 2 + 2) / 3;
+  for (uint32_t n = n0; n <= n1 && n < limit; ++n) {
+    uint32_t v = fatEntry(n);
+    int32_t off = (int32_t)(n + n / 2);
+    if (n & 1) {
+      put(off, (uint8_t)((get(off) & 0x0F) | ((v << 4) & 0xF0)));
+      put(off + 1, (uint8_t)(v >> 4));
+    } else {
+      put(off, (uint8_t)(v & 0xFF));
+      put(off + 1, (uint8_t)((get(off + 1) & 0xF0) | ((v >> 8) & 0x0F)));
+    }
+  }
+}
+
+bool VirtualFat::synthSector(uint32_t sector, uint8_t *dst) {
+  if (sector < _g.partStart || sector - _g.partStart >= _g.totalSectors) return false;
+  uint32_t rel = sector - _g.partStart;
+
+  if (rel < _g.reserved) {
+    if (rel == 0 || (_g.backupBoot && rel == _g.backupBoot)) {
+      synthBoot(dst);
+      return true;
+    }
+    if (_g.fatType == 32 && _g.fsInfo &&
+        (rel == _g.fsInfo || (_g.backupBoot && rel == (uint32_t)_g.backupBoot + _g.fsInfo))) {
+      synthFsInfo(dst);
+      return true;
+    }
+    return false;
+  }
+  rel -= _g.reserved;
+
+  if (rel < _g.numFats * _g.fatSectors) {
+    synthFat(rel % _g.fatSectors, dst);
+    return true;
+  }
+  rel -= _g.numFats * _g.fatSectors;
+
+  if (rel < _g.rootSectors) {
+    memcpy(dst, _dirs[0].bytes.data() + (size_t)rel * BLOCK_SIZE, BLOCK_SIZE);
+    return true;
+  }
+  rel -= _g.rootSectors;
+
+  uint32_t cluster = rel / _g.spc + 2;
+  uint32_t within = rel % _g.spc;
+  const Run *r = (cluster <= _g.clusters + 1) ? findRun(cluster) : nullptr;
+  if (!r) {
+    memset(dst, 0, BLOCK_SIZE);
+    return true;
+  }
+  if (r->kind == RUN_FILE) return false;
+
+  const Dir &d = _dirs[r->dir];
+  size_t idx = (size_t)(cluster - r->first + r->dirOffset) * _g.spc + within;
+  memcpy(dst, d.bytes.data() + idx * BLOCK_SIZE, BLOCK_SIZE);
+  return true;
+}
+
+bool VirtualFat::readSectors(uint32_t sector, uint8_t *dst, size_t count) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_active) return _card.readSectors(sector, dst, count);
+
+  size_t k = 0;
+  while (k < count) {
+    if (synthSector(sector + k, dst + k * BLOCK_SIZE)) {
+      k++;
+      continue;
+    }
+    // Pass-through run: file data (and anything outside the volume) is read
+    // from the card in one request.
+    size_t run = 1;
+    bool synthesizedNext = false;
+    while (k + run < count) {
+      if (synthSector(sector + k + run, dst + (k + run) * BLOCK_SIZE)) {
+        synthesizedNext = true;
+        break;
+      }
+      run++;
+    }
+    if (!_card.readSectors(sector + k, dst + k * BLOCK_SIZE, run)) return false;
+    k += run + (synthesizedNext ? 1 : 0);
+  }
+  return true;
+}
@@ -0,0 +1,180 @@
+#include "write_combiner.h"
+
+#include <string.h>
+#include "psram.h"
+
+bool WriteCombiner::begin(size_t bufferSectors, uint32_t idleMs) {
+  end();
+  if (bufferSectors == 0) return false;
+  uint8_t *buf = (uint8_t *)psramAlloc(bufferSectors * BLOCK_SIZE);
+  if (!buf) return false;
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _buf = buf;
+  _capBytes = bufferSectors * BLOCK_SIZE;
+  _idleMs = idleMs;
+  _pending = false;
+  _stats = {};
+  return true;
+}
+
+void WriteCombiner::end() {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (_buf) flushLocked();
+  psramFree(_buf);
+  _buf = nullptr;
+  _capBytes = 0;
+}
+
+bool WriteCombiner::write(uint32_t lba, uint32_t offset, const uint8_t *src, uint32_t len) {
+  if (!_buf) {
+    // Pass-through still has to handle unaligned pieces
+    uint64_t pos = (uint64_t)lba * BLOCK_SIZE + offset;
+    uint8_t tmp[BLOCK_SIZE];
+    while (len > 0) {
+      uint32_t sector = (uint32_t)(pos / BLOCK_SIZE);
+      uint32_t off = (uint32_t)(pos % BLOCK_SIZE);
+      if (off == 0 && len >= BLOCK_SIZE) {
+        uint32_t n = len / BLOCK_SIZE;
+        if (!_lower.writeSectors(sector, src, n)) return false;
+        pos += (uint64_t)n * BLOCK_SIZE;
+        src += n * BLOCK_SIZE;
+        len -= n * BLOCK_SIZE;
+        continue;
+      }
+      uint32_t toCopy = BLOCK_SIZE - off;
+      if (toCopy > len) toCopy = len;
+      if (!_lower.readSectors(sector, tmp, 1)) return false;
+      memcpy(tmp + off, src, toCopy);
+      if (!_lower.writeSectors(sector, tmp, 1)) return false;
+      pos += toCopy;
+      src += toCopy;
+      len -= toCopy;
+    }
+    return true;
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats.hostWrites++;
+  _writeSeq++;
+
+  uint64_t pos = (uint64_t)lba * BLOCK_SIZE + offset;
+  bool merged = false;
+  while (len > 0) {
+    uint64_t baseByte = (uint64_t)_base * BLOCK_SIZE;
+    // Joins the pending extent if it touches it and starts inside the
+    // staging buffer's first sector or later.
+    bool joins = _pending && pos <= _end && pos + len >= _start && pos >= baseByte &&
+                 pos - baseByte < _capBytes;
+    if (!joins) {
+      if (_pending && !flushLocked()) return false;
+      _pending = true;
+      _base = (uint32_t)(pos / BLOCK_SIZE);
+      _start = _end = pos;
+      baseByte = (uint64_t)_base * BLOCK_SIZE;
+    } else if (!merged) {
+      _stats.mergedWrites++;
+      merged = true;
+    }
+
+    uint64_t room = baseByte + _capBytes - pos;
+    uint32_t n = (len < room) ? len : (uint32_t)room;
+    memcpy(_buf + (pos - baseByte), src, n);
+    if (pos < _start) _start = pos;
+    if (pos + n > _end) _end = pos + n;
+    pos += n;
+    src += n;
+    len -= n;
+
+    // Buffer is full: send it and keep going with the rest
+    if (_end == baseByte + _capBytes && !flushLocked()) return false;
+  }
+  return true;
+}
+
+bool WriteCombiner::flushLocked() {
+  if (!_pending) return true;
+
+  uint64_t baseByte = (uint64_t)_base * BLOCK_SIZE;
+  uint32_t headOff = (uint32_t)(_start - baseByte);
+  uint32_t sectors = (uint32_t)((_end - baseByte + BLOCK_SIZE - 1) / BLOCK_SIZE);
+  uint32_t tailUsed = (uint32_t)((_end - baseByte) % BLOCK_SIZE);
+
+  // Fill in the bytes of the first/last sector the host didn't write
+  uint8_t tmp[BLOCK_SIZE];
+  if (headOff != 0) {
+    if (!_lower.readSectors(_base, tmp, 1)) return false;
+    memcpy(_buf, tmp, headOff);
+    _stats.rmwSectors++;
+    if (sectors == 1 && tailUsed != 0) {
+      memcpy(_buf + tailUsed, tmp + tailUsed, BLOCK_SIZE - tailUsed);
+      tailUsed = 0;
+    }
+  }
+  if (tailUsed != 0) {
+    uint32_t last = sectors - 1;
+    if (!_lower.readSectors(_base + last, tmp, 1)) return false;
+    memcpy(_buf + last * BLOCK_SIZE + tailUsed, tmp + tailUsed, BLOCK_SIZE - tailUsed);
+    _stats.rmwSectors++;
+  }
+
+  if (!_lower.writeSectors(_base, _buf, sectors)) return false;
+  _stats.flushes++;
+  _stats.sectorsWritten += sectors;
+  _pending = false;
+  return true;
+}
+
+bool WriteCombiner::flush() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return flushLocked();
+}
+
+void WriteCombiner::poll(uint32_t nowMs) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (_writeSeq != _seenSeq) {
+    _seenSeq = _writeSeq;
+    _idleSince = nowMs;
+    return;
+  }
+  if (_pending && nowMs - _idleSince >= _idleMs) {
+    if (flushLocked()) _stats.idleFlushes++;
+  }
+}
+
+bool WriteCombiner::pending() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _pending;
+}
+
+bool WriteCombiner::readSectors(uint32_t sector, uint8_t *dst, size_t count) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_lower.readSectors(sector, dst, count)) return false;
+  if (!_pending) return true;
+
+  // Overlay whatever part of the pending extent this read covers
+  uint64_t rs = (uint64_t)sector * BLOCK_SIZE;
+  uint64_t re = rs + (uint64_t)count * BLOCK_SIZE;
+  uint64_t a = (rs > _start) ? rs : _start;
+  uint64_t b = (re < _end) ? re : _end;
+  if (a < b) {
+    uint64_t baseByte = (uint64_t)_base * BLOCK_SIZE;
+    memcpy(dst + (a - rs), _buf + (a - baseByte), (size_t)(b - a));
+  }
+  return true;
+}
+
+bool WriteCombiner::sync() {
+  if (!flush()) return false;
+  return _lower.sync();
+}
+
+WriteCombiner::Stats WriteCombiner::stats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+void WriteCombiner::resetStats() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stats = {};
+}
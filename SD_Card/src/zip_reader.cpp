@@ -0,0 +1,145 @@
+#include "zip_reader.h"
+
+#include <string.h>
+#include "psram.h"
+
+static const uint64_t SECTOR = 512;
+static const uint32_t SIG_LOCAL = 0x04034b50;
+static const size_t LOCAL_HEADER_SIZE = 30;
+
+static uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t rd32(const uint8_t *p) { return (uint32_t)rd16(p) | ((uint32_t)rd16(p + 2) << 16); }
+
+bool BufferedZipReader::begin(size_t windowBytes, size_t tailBytes) {
+  end();
+  _size = _file.fileSize();
+  _winBytes = windowBytes;
+  _win = (uint8_t *)psramAlloc(windowBytes);
+  if (!_win) return false;
+  _winLen = 0;
+
+  // The tail is only worth it if the archive is bigger than it
+  if (tailBytes && _size > tailBytes) {
+    _tail = (uint8_t *)psramAlloc(tailBytes);
+    _tailStart = (_size - tailBytes) & ~(SECTOR - 1);
+    _tailLen = (size_t)(_size - _tailStart);
+    if (_tailLen > tailBytes) {
+      _tailStart += SECTOR;
+      _tailLen -= SECTOR;
+    }
+  }
+  _tailLoaded = false;
+  _stats = {};
+  return true;
+}
+
+void BufferedZipReader::end() {
+  psramFree(_win);
+  psramFree(_tail);
+  _win = nullptr;
+  _tail = nullptr;
+  _winLen = 0;
+  _tailLen = 0;
+  _tailLoaded = false;
+}
+
+bool BufferedZipReader::load(uint64_t ofs, uint8_t *dst, size_t n) {
+  _stats.sdReads++;
+  if (_file.curPosition() != ofs && !_file.seekSet((uint32_t)ofs)) return false;
+  int got = _file.read(dst, n);
+  if (got > 0) _stats.sdBytes += (uint64_t)got;
+  return got == (int)n;
+}
+
+size_t BufferedZipReader::read(uint64_t ofs, void *buf, size_t n) {
+  _stats.requests++;
+  _stats.requested += n;
+  if (ofs >= _size) return 0;
+  if (n > _size - ofs) n = (size_t)(_size - ofs);
+  uint8_t *out = (uint8_t *)buf;
+
+  // Entirely in the tail: the central directory and end records
+  if (_tail && ofs >= _tailStart) {
+    if (!_tailLoaded) {
+      if (!load(_tailStart, _tail, _tailLen)) return 0;
+      _tailLoaded = true;
+    }
+    memcpy(out, _tail + (ofs - _tailStart), n);
+    return n;
+  }
+
+  size_t done = 0;
+  while (done < n) {
+    uint64_t at = ofs + done;
+    size_t want = n - done;
+    if (_winLen && at >= _winStart && at < _winStart + _winLen) {
+      size_t avail = (size_t)(_winStart + _winLen - at);
+      size_t c = want < avail ? want : avail;
+      memcpy(out + done, _win + (at - _winStart), c);
+      done += c;
+      continue;
+    }
+    if (want >= _winBytes) {
+      // Big request (e.g. the whole central directory): no copy
+      if (!load(at, out + done, want)) return done;
+      done += want;
+      continue;
+    }
+    // Refill from the sector holding `at`
+    _winStart = at & ~(SECTOR - 1);
+    uint64_t left = _size - _winStart;
+    _winLen = left < _winBytes ? (size_t)left : _winBytes;
+    if (!load(_winStart, _win, _winLen)) {
+      _winLen = 0;
+      return done;
+    }
+  }
+  return done;
+}
+
+size_t BufferedZipReader::mzRead(void *opaque, mz_uint64 ofs, void *buf, size_t n) {
+  return ((BufferedZipReader *)opaque)->read(ofs, buf, n);
+}
+
+bool BufferedZipReader::isStored(const mz_zip_archive_file_stat &st) {
+  return st.m_method == 0 && !st.m_is_encrypted && st.m_comp_size == st.m_uncomp_size;
+}
+
+bool BufferedZipReader::dataOffset(const mz_zip_archive_file_stat &st, uint64_t *ofs) {
+  // The data follows the local header, whose name/extra lengths can differ
+  // from the central directory's copy
+  uint8_t h[LOCAL_HEADER_SIZE];
+  if (read(st.m_local_header_ofs, h, sizeof(h)) != sizeof(h) || rd32(h) != SIG_LOCAL) return false;
+  uint64_t data = st.m_local_header_ofs + LOCAL_HEADER_SIZE + rd16(h + 26) + rd16(h + 28);
+  if (data > _size || st.m_comp_size > _size - data) return false;
+  *ofs = data;
+  return true;
+}
+
+bool BufferedZipReader::copyStored(const mz_zip_archive_file_stat &st,
+                                   const std::function<bool(const uint8_t *, size_t)> &sink, size_t align) {
+  uint64_t data;
+  if (!dataOffset(st, &data)) return false;
+  uint64_t left = st.m_comp_size;
+
+  // The window becomes the copy buffer. Every chunk but the last is a whole
+  // number of `align` bytes, so a sink that starts on a cluster boundary
+  // stays on one and hands them to the card as they are, rather than
+  // regrouping every byte through its cluster buffer. Reads start at the
+  // entry's data, wherever it falls in a sector: SdFat still reads the whole
+  // sectors in between straight into the window, and the partial sector a
+  // read begins with is the one the previous read ended on, in its cache.
+  _winLen = 0;
+  size_t chunk = _winBytes;
+  if (align && chunk >= align) chunk -= chunk % align;
+  uint32_t crc = MZ_CRC32_INIT;
+  while (left > 0) {
+    size_t n = left < chunk ? (size_t)left : chunk;
+    if (!load(data, _win, n)) return false;
+    crc = (uint32_t)mz_crc32(crc, _win, n);
+    if (!sink(_win, n)) return false;
+    data += n;
+    left -= n;
+  }
+  return crc == st.m_crc32;
+}
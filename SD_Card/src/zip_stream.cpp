@@ -0,0 +1,278 @@
+#include "zip_stream.h"
+
+#include <string.h>
+#include "psram.h"
+
+static const uint32_t SIG_LOCAL = 0x04034b50;
+static const uint32_t SIG_CENTRAL = 0x02014b50;
+static const uint32_t SIG_END = 0x06054b50;
+static const uint32_t SIG_DESCRIPTOR = 0x08074b50;
+static const size_t LOCAL_HEADER_SIZE = 30;
+
+static const uint16_t FLAG_ENCRYPTED = 1 << 0;
+static const uint16_t FLAG_DESCRIPTOR = 1 << 3;
+
+static uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t rd32(const uint8_t *p) { return (uint32_t)rd16(p) | ((uint32_t)rd16(p + 2) << 16); }
+static uint64_t rd64(const uint8_t *p) { return (uint64_t)rd32(p) | ((uint64_t)rd32(p + 4) << 32); }
+
+bool safeEntryName(const std::string &name) {
+  if (name.empty() || name[0] == '/' || name[0] == '\\') return false;
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find_first_of("/\\", start);
+    if (end == std::string::npos) end = name.size();
+    if (name.compare(start, end - start, "..") == 0) return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::begin(const Target &target) {
+  end();
+  _inflator = new tinfl_decompressor;
+  _dict = (uint8_t *)psramAlloc(TINFL_LZ_DICT_SIZE);
+  if (!_dict) {
+    end();
+    return false;
+  }
+  _target = target;
+  _state = HEADER;
+  _error = nullptr;
+  _buf.clear();
+  _stats = {};
+  return true;
+}
+
+void ZipStreamExtractor::end() {
+  // An entry cut off mid-way (aborted download) still gets closed
+  if (_open && _target.close) _target.close(false);
+  _open = false;
+  delete _inflator;
+  _inflator = nullptr;
+  psramFree(_dict);
+  _dict = nullptr;
+}
+
+bool ZipStreamExtractor::fail(const char *why) {
+  if (_open && _target.close) _target.close(false);
+  _open = false;
+  _state = FAILED;
+  _error = why;
+  return false;
+}
+
+bool ZipStreamExtractor::gather(const uint8_t *&data, size_t &len, size_t need) {
+  if (_buf.size() < need) {
+    size_t n = need - _buf.size();
+    if (n > len) n = len;
+    _buf.append((const char *)data, n);
+    data += n;
+    len -= n;
+    _stats.inBytes += n;
+  }
+  return _buf.size() >= need;
+}
+
+bool ZipStreamExtractor::feed(const uint8_t *data, size_t len) {
+  if (_state == FAILED) return false;
+  if (!_dict) return fail("not started");
+
+  while (len > 0 && _state != DONE) {
+    switch (_state) {
+      case HEADER: {
+        if (!gather(data, len, 4)) return true;
+        uint32_t sig = rd32((const uint8_t *)_buf.data());
+        if (sig == SIG_CENTRAL || sig == SIG_END) {
+          // Central directory: every entry has been seen, the rest is index
+          _state = DONE;
+          return true;
+        }
+        if (sig != SIG_LOCAL) return fail("bad local header signature");
+        if (!gather(data, len, LOCAL_HEADER_SIZE)) return true;
+        const uint8_t *h = (const uint8_t *)_buf.data();
+        size_t meta = rd16(h + 26) + rd16(h + 28);
+        if (!gather(data, len, LOCAL_HEADER_SIZE + meta)) return true;
+        if (!startEntry()) return false;
+        break;
+      }
+
+      case STORED: {
+        size_t n = len;
+        if (n > _compLeft) n = (size_t)_compLeft;
+        emit(data, n);
+        data += n;
+        len -= n;
+        _compLeft -= n;
+        _stats.inBytes += n;
+        if (_compLeft == 0 && !finishEntry()) return false;
+        break;
+      }
+
+      case DEFLATE: {
+        size_t used = inflateSome(data, len);
+        if (_state == FAILED) return false;
+        data += used;
+        len -= used;
+        _stats.inBytes += used;
+        break;
+      }
+
+      case DESCRIPTOR: {
+        // Optional signature, then crc, compressed and uncompressed size
+        if (!gather(data, len, 4)) return true;
+        size_t sizes = _zip64 ? 16 : 8;
+        bool hasSig = rd32((const uint8_t *)_buf.data()) == SIG_DESCRIPTOR;
+        size_t need = (hasSig ? 8 : 4) + sizes;
+        if (!gather(data, len, need)) return true;
+        _crc = rd32((const uint8_t *)_buf.data() + (hasSig ? 4 : 0));
+        _buf.clear();
+        if (!finishEntry()) return false;
+        break;
+      }
+
+      default:
+        return fail("bad state");
+    }
+  }
+
+  // Entries with nothing to read (empty files, directories) finish here too
+  if (_state == STORED && _compLeft == 0 && !finishEntry()) return false;
+  return true;
+}
+
+bool ZipStreamExtractor::startEntry() {
+  const uint8_t *h = (const uint8_t *)_buf.data();
+  _flags = rd16(h + 6);
+  _method = rd16(h + 8);
+  _crc = rd32(h + 14);
+  uint64_t comp = rd32(h + 18);
+  _uncompSize = rd32(h + 22);
+  uint16_t nameLen = rd16(h + 26);
+  uint16_t extraLen = rd16(h + 28);
+  std::string name(_buf, LOCAL_HEADER_SIZE, nameLen);
+
+  // Zip64 extra field carries the real sizes when the header says 0xFFFFFFFF
+  _zip64 = false;
+  const uint8_t *x = h + LOCAL_HEADER_SIZE + nameLen;
+  const uint8_t *xend = x + extraLen;
+  while (x + 4 <= xend) {
+    uint16_t id = rd16(x);
+    uint16_t sz = rd16(x + 2);
+    const uint8_t *v = x + 4;
+    if (v + sz > xend) break;
+    if (id == 0x0001) {
+      _zip64 = true;
+      const uint8_t *p = v;
+      if (_uncompSize == 0xFFFFFFFF && p + 8 <= v + sz) {
+        _uncompSize = rd64(p);
+        p += 8;
+      }
+      if (comp == 0xFFFFFFFF && p + 8 <= v + sz) comp = rd64(p);
+    }
+    x = v + sz;
+  }
+  _buf.clear();
+
+  if (_flags & FLAG_ENCRYPTED) return fail("encrypted entry");
+  if (_method != 0 && _method != MZ_DEFLATED) return fail("unsupported compression method");
+  if (_method == 0 && (_flags & FLAG_DESCRIPTOR)) return fail("stored entry with data descriptor");
+
+  bool isDir = !name.empty() && (name.back() == '/' || name.back() == '\\');
+  _skip = true;
+  _open = false;
+  _writeOk = true;
+  _outCrc = MZ_CRC32_INIT;
+  _outBytes = 0;
+  _compLeft = (_flags & FLAG_DESCRIPTOR) ? 0 : comp;
+
+  if (!safeEntryName(name)) {
+    _stats.skipped++;
+  } else if (isDir) {
+    name.pop_back();
+    if (!_target.dir || _target.dir(name)) _stats.dirs++;
+  } else if (!_target.open) {
+    _stats.skipped++;
+  } else if (_target.open(name, (_flags & FLAG_DESCRIPTOR) ? 0 : _uncompSize)) {
+    _open = true;
+    _skip = false;
+  } else {
+    // A bundle missing a file must not count as installed
+    return fail("can't create entry");
+  }
+
+  if (_method == MZ_DEFLATED) {
+    tinfl_init(_inflator);
+    _dictOfs = 0;
+    _state = DEFLATE;
+  } else {
+    _state = STORED;
+  }
+  return true;
+}
+
+size_t ZipStreamExtractor::inflateSome(const uint8_t *data, size_t len) {
+  bool bounded = !(_flags & FLAG_DESCRIPTOR);
+  size_t used = 0;
+  for (;;) {
+    size_t inSize = len - used;
+    if (bounded && inSize > _compLeft) inSize = (size_t)_compLeft;
+    // Without a descriptor the size says where the stream ends; with one the
+    // deflate stream's own end block does
+    mz_uint32 flags = (bounded && inSize == _compLeft) ? 0 : TINFL_FLAG_HAS_MORE_INPUT;
+    size_t outSize = TINFL_LZ_DICT_SIZE - _dictOfs;
+    tinfl_status st = tinfl_decompress(_inflator, data + used, &inSize, _dict, _dict + _dictOfs, &outSize, flags);
+    used += inSize;
+    if (bounded) _compLeft -= inSize;
+    if (outSize) {
+      emit(_dict + _dictOfs, outSize);
+      _dictOfs = (_dictOfs + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    if (st == TINFL_STATUS_DONE) {
+      if (!bounded) {
+        _state = DESCRIPTOR;
+        _buf.clear();
+      } else if (_compLeft != 0) {
+        fail("compressed size mismatch");
+      } else {
+        finishEntry();
+      }
+      return used;
+    }
+    if (st < 0) {
+      fail("inflate failed");
+      return used;
+    }
+    if (st == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      if (bounded && _compLeft == 0) fail("truncated deflate stream");
+      if (used == len || _state == FAILED) return used;
+    }
+    // HAS_MORE_OUTPUT: the window wrapped, go round again
+  }
+}
+
+void ZipStreamExtractor::emit(const uint8_t *data, size_t len) {
+  if (!len) return;
+  _outCrc = (uint32_t)mz_crc32(_outCrc, data, len);
+  _outBytes += len;
+  if (_skip || !_writeOk) return;
+  if (!_target.write(data, len)) _writeOk = false;
+  else _stats.outBytes += len;
+}
+
+bool ZipStreamExtractor::finishEntry() {
+  _state = HEADER;
+  _buf.clear();
+  bool sizeOk = (_flags & FLAG_DESCRIPTOR) || _outBytes == _uncompSize;
+  bool ok = _writeOk && sizeOk && _outCrc == _crc;
+  if (_open) {
+    _open = false;
+    if (_target.close) _target.close(ok);
+    if (ok) _stats.files++;
+  }
+  if (_outCrc != _crc) return fail("CRC mismatch");
+  if (!sizeOk) return fail("size mismatch");
+  if (!_writeOk) return fail("write failed");
+  return true;
+}
@@ -0,0 +1,413 @@
+// ZipStreamExtractor and SdbStreamExtractor fed archives built in memory, in
+// pieces of various sizes, into a Target that records what it was given.
+
+#include <unity.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "bundle_format.h"
+#include "sdb_stream.h"
+#include "zip_stream.h"
+
+// --- Target ---
+
+struct Sink {
+  std::map<std::string, std::string> files;  // closed ok
+  std::set<std::string> dirs;
+  std::vector<std::string> opened;
+  std::set<std::string> refuse;  // open() fails for these
+  std::string current;
+  std::string data;
+  uint64_t announced = 0;
+  int closedBad = 0;
+};
+
+static StreamExtractor::Target targetFor(Sink &s) {
+  StreamExtractor::Target t;
+  t.dir = [&s](const std::string &name) {
+    s.dirs.insert(name);
+    return true;
+  };
+  t.open = [&s](const std::string &name, uint64_t size) {
+    if (s.refuse.count(name)) return false;
+    s.opened.push_back(name);
+    s.current = name;
+    s.data.clear();
+    s.announced = size;
+    return true;
+  };
+  t.write = [&s](const uint8_t *data, size_t len) {
+    s.data.append((const char *)data, len);
+    return true;
+  };
+  t.close = [&s](bool ok) {
+    if (ok) s.files[s.current] = s.data;
+    else s.closedBad++;
+  };
+  return t;
+}
+
+// Feed `bytes` in pieces of `piece`; false as soon as the extractor refuses
+static bool feedAll(StreamExtractor &x, const std::string &bytes, size_t piece) {
+  for (size_t i = 0; i < bytes.size(); i += piece) {
+    size_t n = bytes.size() - i < piece ? bytes.size() - i : piece;
+    if (!x.feed((const uint8_t *)bytes.data() + i, n)) return false;
+  }
+  return true;
+}
+
+static uint32_t crcOf(const std::string &s) {
+  return (uint32_t)mz_crc32(MZ_CRC32_INIT, (const uint8_t *)s.data(), s.size());
+}
+
+// --- Zip archives ---
+
+static void put16(std::string &s, uint16_t v) {
+  s += (char)(v & 0xFF);
+  s += (char)(v >> 8);
+}
+static void put32(std::string &s, uint32_t v) {
+  put16(s, (uint16_t)v);
+  put16(s, (uint16_t)(v >> 16));
+}
+
+static const uint16_t ZIP_DESCRIPTOR = 1 << 3;
+
+// Local header + data (+ data descriptor) of one entry. `stored` is the
+// entry's bytes as they appear in the archive.
+static std::string zipEntry(const std::string &name, const std::string &stored, uint16_t method, uint32_t crc,
+                            uint32_t size, uint16_t flags = 0) {
+  bool descriptor = flags & ZIP_DESCRIPTOR;
+  std::string s;
+  put32(s, 0x04034b50);
+  put16(s, 20);
+  put16(s, flags);
+  put16(s, method);
+  put32(s, 0);  // time, date
+  put32(s, descriptor ? 0 : crc);
+  put32(s, descriptor ? 0 : (uint32_t)stored.size());
+  put32(s, descriptor ? 0 : size);
+  put16(s, (uint16_t)name.size());
+  put16(s, 0);
+  s += name;
+  s += stored;
+  if (descriptor) {
+    put32(s, 0x08074b50);
+    put32(s, crc);
+    put32(s, (uint32_t)stored.size());
+    put32(s, size);
+  }
+  return s;
+}
+
+static std::string zipStored(const std::string &name, const std::string &data) {
+  return zipEntry(name, data, 0, crcOf(data), (uint32_t)data.size());
+}
+
+// Start of a central directory: where streaming extraction stops
+static std::string zipEnd() {
+  std::string s;
+  put32(s, 0x02014b50);
+  s += std::string(42, '\0');
+  return s;
+}
+
+// "the quick brown fox jumps over the lazy dog, " x 40, raw deflate
+static const uint8_t FOX_DEFLATED[] = {
+    0x2b, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53,
+    0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28,
+    0x01, 0x4a, 0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x80, 0x79, 0xa3, 0x8a, 0x47,
+    0x15, 0x8f, 0x2a, 0x1e, 0x55, 0x3c, 0xaa, 0x78, 0x54, 0xf1, 0x30, 0x52, 0x0c, 0x00};
+
+static std::string fox() {
+  std::string s;
+  for (int i = 0; i < 40; i++) s += "the quick brown fox jumps over the lazy dog, ";
+  return s;
+}
+
+static std::string foxDeflated() { return std::string((const char *)FOX_DEFLATED, sizeof(FOX_DEFLATED)); }
+
+// --- .sdb bundles ---
+
+struct SdbFile {
+  std::string path;
+  std::string data;
+  bool dir;
+};
+
+// Records in `files` order, payloads `align`ed; `tweak` may edit a record
+// before it is encoded
+static std::string sdbBundle(const std::vector<SdbFile> &files, uint32_t align = SDB_MIN_ALIGN,
+                             void (*tweak)(size_t, SdbRecord &) = nullptr) {
+  SdbHeader h = {};
+  h.version = SDB_VERSION;
+  h.align = align;
+  h.count = (uint32_t)files.size();
+  h.dataStart = sdbAlignUp(SDB_HEADER_SIZE + files.size() * SDB_RECORD_SIZE, align);
+
+  std::string toc, payloads;
+  uint64_t at = h.dataStart;
+  for (size_t i = 0; i < files.size(); i++) {
+    SdbRecord r = {};
+    r.offset = files[i].dir ? 0 : at;
+    r.size = files[i].data.size();
+    r.crc32 = crcOf(files[i].data);
+    r.flags = files[i].dir ? SDB_FLAG_DIR : 0;
+    strncpy(r.path, files[i].path.c_str(), SDB_PATH_MAX - 1);
+    if (!files[i].dir) {
+      payloads.resize((size_t)(at - h.dataStart), '\0');
+      payloads += files[i].data;
+      at = sdbAlignUp(at + r.size, align);
+    }
+    if (tweak) tweak(i, r);
+    uint8_t rec[SDB_RECORD_SIZE];
+    sdbEncodeRecord(r, rec);
+    toc.append((const char *)rec, sizeof(rec));
+  }
+  h.tocCrc = crcOf(toc);
+  h.totalSize = h.dataStart + payloads.size();
+
+  uint8_t head[SDB_HEADER_SIZE];
+  sdbEncodeHeader(h, head);
+  std::string out((const char *)head, sizeof(head));
+  out += toc;
+  out.resize((size_t)h.dataStart, '\0');
+  return out + payloads;
+}
+
+static std::string bytes(size_t n, uint8_t seed) {
+  std::string s(n, '\0');
+  for (size_t i = 0; i < n; i++) s[i] = (char)(seed + i * 13 + i / 251);
+  return s;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// --- Zip ---
+
+static void test_zip_stored_entries_and_dirs() {
+  const std::string a = bytes(3000, 1), b = "small";
+  std::string zip = zipEntry("music/", "", 0, 0, 0) + zipStored("music/a.mp3", a) + zipStored("b.txt", b) +
+                    zipStored("empty", "") + zipEnd();
+
+  const size_t pieces[] = {1, 7, 512, 100000};
+  for (size_t piece : pieces) {
+    Sink sink;
+    ZipStreamExtractor zx;
+    TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+    TEST_ASSERT_TRUE(feedAll(zx, zip, piece));
+    TEST_ASSERT_TRUE(zx.done());
+
+    TEST_ASSERT_EQUAL(3, sink.files.size());
+    TEST_ASSERT_TRUE(sink.files["music/a.mp3"] == a);
+    TEST_ASSERT_TRUE(sink.files["b.txt"] == b);
+    TEST_ASSERT_TRUE(sink.files["empty"].empty());
+    TEST_ASSERT_EQUAL(1, sink.dirs.count("music"));
+    StreamExtractor::Stats st = zx.stats();
+    TEST_ASSERT_EQUAL_UINT32(3, st.files);
+    TEST_ASSERT_EQUAL_UINT32(1, st.dirs);
+    TEST_ASSERT_EQUAL_UINT64(a.size() + b.size(), st.outBytes);
+    TEST_ASSERT_EQUAL(0, sink.closedBad);
+  }
+}
+
+static void test_zip_deflated_entries() {
+  const std::string text = fox();
+  std::string zip = zipEntry("sized.txt", foxDeflated(), MZ_DEFLATED, crcOf(text), (uint32_t)text.size()) +
+                    zipEntry("streamed.txt", foxDeflated(), MZ_DEFLATED, crcOf(text), (uint32_t)text.size(),
+                             ZIP_DESCRIPTOR) +
+                    zipStored("after.txt", "still in sync") + zipEnd();
+
+  const size_t pieces[] = {1, 5, 64, 100000};
+  for (size_t piece : pieces) {
+    Sink sink;
+    ZipStreamExtractor zx;
+    TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+    TEST_ASSERT_TRUE(feedAll(zx, zip, piece));
+    TEST_ASSERT_TRUE(zx.done());
+    TEST_ASSERT_TRUE(sink.files["sized.txt"] == text);
+    TEST_ASSERT_TRUE(sink.files["streamed.txt"] == text);
+    TEST_ASSERT_TRUE(sink.files["after.txt"] == "still in sync");
+  }
+}
+
+static void test_zip_open_failure_fails_the_stream() {
+  std::string zip = zipStored("a.txt", "first") + zipStored("b.txt", "second") + zipStored("c.txt", "third") +
+                    zipEnd();
+  Sink sink;
+  sink.refuse.insert("b.txt");
+  ZipStreamExtractor zx;
+  TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(zx, zip, 9));
+  TEST_ASSERT_FALSE(zx.done());
+  TEST_ASSERT_NOT_NULL(zx.error());
+  TEST_ASSERT_EQUAL_STRING("can't create entry", zx.error());
+  // Not counted as skipped, and nothing after it was opened
+  TEST_ASSERT_EQUAL_UINT32(0, zx.stats().skipped);
+  TEST_ASSERT_EQUAL_UINT32(1, zx.stats().files);
+  TEST_ASSERT_EQUAL(1, sink.opened.size());
+  // Once failed, it stays failed
+  TEST_ASSERT_FALSE(zx.feed((const uint8_t *)"x", 1));
+}
+
+static void test_zip_crc_mismatch_closes_entry_bad() {
+  std::string zip = zipEntry("bad.bin", "payload", 0, crcOf("payload") ^ 1, 7) + zipEnd();
+  Sink sink;
+  ZipStreamExtractor zx;
+  TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(zx, zip, 3));
+  TEST_ASSERT_EQUAL_STRING("CRC mismatch", zx.error());
+  TEST_ASSERT_EQUAL(1, sink.closedBad);
+  TEST_ASSERT_EQUAL(0, sink.files.size());
+}
+
+static void test_zip_cut_off_entry_closed_bad() {
+  std::string zip = zipStored("long.bin", bytes(2000, 7)) + zipEnd();
+  Sink sink;
+  {
+    ZipStreamExtractor zx;
+    TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+    TEST_ASSERT_TRUE(feedAll(zx, zip.substr(0, 1000), 100));
+    TEST_ASSERT_FALSE(zx.done());
+  }
+  TEST_ASSERT_EQUAL(1, sink.closedBad);
+  TEST_ASSERT_EQUAL(0, sink.files.size());
+}
+
+static void test_zip_unsafe_names_skipped() {
+  std::string zip = zipStored("../evil.txt", "x") + zipStored("/abs.txt", "y") + zipStored("ok/../../up", "z") +
+                    zipStored("fine.txt", "w") + zipEnd();
+  Sink sink;
+  ZipStreamExtractor zx;
+  TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+
+  TEST_ASSERT_TRUE(feedAll(zx, zip, 11));
+  TEST_ASSERT_TRUE(zx.done());
+  TEST_ASSERT_EQUAL_UINT32(3, zx.stats().skipped);
+  TEST_ASSERT_EQUAL(1, sink.opened.size());
+  TEST_ASSERT_TRUE(sink.files["fine.txt"] == "w");
+}
+
+static void test_zip_unsupported_method_fails() {
+  std::string zip = zipEntry("x.bz2", "data", 12, crcOf("data"), 4) + zipEnd();
+  Sink sink;
+  ZipStreamExtractor zx;
+  TEST_ASSERT_TRUE(zx.begin(targetFor(sink)));
+  TEST_ASSERT_FALSE(feedAll(zx, zip, 100));
+  TEST_ASSERT_EQUAL(0, sink.opened.size());
+}
+
+// --- .sdb ---
+
+static void test_sdb_files_and_dirs() {
+  const std::string a = bytes(1500, 3), b = bytes(512, 4), c = "tiny";
+  std::string sdb = sdbBundle({{"album", "", true}, {"album/a.mp3", a, false}, {"album/b.mp3", b, false},
+                               {"c.txt", c, false}});
+
+  const size_t pieces[] = {1, 13, 512, 100000};
+  for (size_t piece : pieces) {
+    Sink sink;
+    SdbStreamExtractor sx;
+    TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+    TEST_ASSERT_TRUE(feedAll(sx, sdb, piece));
+    TEST_ASSERT_TRUE(sx.done());
+
+    TEST_ASSERT_EQUAL(1, sink.dirs.count("album"));
+    TEST_ASSERT_EQUAL(3, sink.files.size());
+    TEST_ASSERT_TRUE(sink.files["album/a.mp3"] == a);
+    TEST_ASSERT_TRUE(sink.files["album/b.mp3"] == b);
+    TEST_ASSERT_TRUE(sink.files["c.txt"] == c);
+    // Sizes are known up front
+    TEST_ASSERT_EQUAL_UINT64(c.size(), sink.announced);
+    TEST_ASSERT_EQUAL_UINT32(3, sx.stats().files);
+    TEST_ASSERT_EQUAL_UINT32(1, sx.stats().dirs);
+  }
+}
+
+static void test_sdb_open_failure_fails_the_stream() {
+  std::string sdb = sdbBundle({{"a.bin", bytes(600, 1), false}, {"b.bin", bytes(600, 2), false},
+                               {"c.bin", bytes(600, 3), false}});
+  Sink sink;
+  sink.refuse.insert("b.bin");
+  SdbStreamExtractor sx;
+  TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(sx, sdb, 100));
+  TEST_ASSERT_FALSE(sx.done());
+  TEST_ASSERT_EQUAL_STRING("can't create entry", sx.error());
+  TEST_ASSERT_EQUAL_UINT32(0, sx.stats().skipped);
+  TEST_ASSERT_EQUAL(1, sink.files.size());
+  TEST_ASSERT_EQUAL(1, sink.opened.size());
+}
+
+static void test_sdb_bad_toc_crc_writes_nothing() {
+  std::string sdb = sdbBundle({{"a.bin", bytes(600, 1), false}});
+  sdb[SDB_HEADER_SIZE + 60] ^= 1;  // a byte of the record's path
+  Sink sink;
+  SdbStreamExtractor sx;
+  TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(sx, sdb, 100));
+  TEST_ASSERT_EQUAL_STRING("TOC CRC mismatch", sx.error());
+  TEST_ASSERT_EQUAL(0, sink.opened.size());
+}
+
+static void pastEnd(size_t i, SdbRecord &r) {
+  if (i == 1) r.offset += 1 << 20;
+}
+
+static void test_sdb_payload_past_end_rejected() {
+  std::string sdb = sdbBundle({{"a.bin", bytes(600, 1), false}, {"b.bin", bytes(600, 2), false}},
+                              SDB_MIN_ALIGN, pastEnd);
+  Sink sink;
+  SdbStreamExtractor sx;
+  TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(sx, sdb, 4096));
+  TEST_ASSERT_EQUAL_STRING("payload past end of bundle", sx.error());
+  TEST_ASSERT_EQUAL(0, sink.opened.size());
+}
+
+static void test_sdb_checksum_mismatch_closes_entry_bad() {
+  std::string sdb = sdbBundle({{"a.bin", bytes(700, 1), false}});
+  sdb[sdb.size() - 1] ^= 0x40;
+  Sink sink;
+  SdbStreamExtractor sx;
+  TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+
+  TEST_ASSERT_FALSE(feedAll(sx, sdb, 256));
+  TEST_ASSERT_EQUAL_STRING("checksum mismatch", sx.error());
+  TEST_ASSERT_EQUAL(1, sink.closedBad);
+  TEST_ASSERT_EQUAL(0, sink.files.size());
+}
+
+static void test_sdb_not_a_bundle() {
+  Sink sink;
+  SdbStreamExtractor sx;
+  TEST_ASSERT_TRUE(sx.begin(targetFor(sink)));
+  std::string junk = zipStored("a.txt", "zip, not sdb") + std::string(64, '\0');
+  TEST_ASSERT_FALSE(feedAll(sx, junk, 64));
+  TEST_ASSERT_EQUAL_STRING("not an .sdb bundle", sx.error());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_zip_stored_entries_and_dirs);
+  RUN_TEST(test_zip_deflated_entries);
+  RUN_TEST(test_zip_open_failure_fails_the_stream);
+  RUN_TEST(test_zip_crc_mismatch_closes_entry_bad);
+  RUN_TEST(test_zip_cut_off_entry_closed_bad);
+  RUN_TEST(test_zip_unsafe_names_skipped);
+  RUN_TEST(test_zip_unsupported_method_fails);
+  RUN_TEST(test_sdb_files_and_dirs);
+  RUN_TEST(test_sdb_open_failure_fails_the_stream);
+  RUN_TEST(test_sdb_bad_toc_crc_writes_nothing);
+  RUN_TEST(test_sdb_payload_past_end_rejected);
+  RUN_TEST(test_sdb_checksum_mismatch_closes_entry_bad);
+  RUN_TEST(test_sdb_not_a_bundle);
+  return UNITY_END();
+}
@@ -0,0 +1,193 @@
+// HttpBody decoding over the host WiFiClient stand-in, which hands the reply
+// over in the pieces it was pushed in.
+
+#include <unity.h>
+#include <string>
+#include "http_body.h"
+
+// Everything the body yields until finished()
+static std::string readAll(HttpBody &body) {
+  std::string out;
+  uint8_t buf[7];  // small, so reads end mid-chunk
+  for (int guard = 0; !body.finished() && guard < 100000; guard++) {
+    int n = body.read(buf, sizeof(buf));
+    if (n > 0) out.append((const char *)buf, (size_t)n);
+  }
+  return out;
+}
+
+// `reply` pushed in pieces of `piece` bytes
+static void pushSplit(WiFiClient &client, const std::string &reply, size_t piece) {
+  for (size_t i = 0; i < reply.size(); i += piece) client.push(reply.substr(i, piece));
+}
+
+static const char CHUNKED[] = "4\r\nWiki\r\n5\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\n\r\n";
+static const char DECODED[] = "Wikipedia in\r\n\r\nchunks.";
+
+void setUp() {}
+void tearDown() {}
+
+static void test_chunked_in_one_piece() {
+  WiFiClient client;
+  client.push(CHUNKED);
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  TEST_ASSERT_EQUAL_STRING(DECODED, readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.complete());
+}
+
+static void test_chunked_split_anywhere() {
+  // Every split of the framing: size lines, CRLFs and data cut at each byte
+  for (size_t piece = 1; piece <= 9; piece++) {
+    WiFiClient client;
+    pushSplit(client, CHUNKED, piece);
+    HttpBody body;
+    body.begin(&client, -1, true);
+
+    TEST_ASSERT_EQUAL_STRING(DECODED, readAll(body).c_str());
+    TEST_ASSERT_TRUE(body.complete());
+  }
+}
+
+static void test_chunked_byte_reads() {
+  WiFiClient client;
+  pushSplit(client, CHUNKED, 3);
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  std::string out;
+  while (!body.finished()) {
+    int c = body.read();
+    if (c >= 0) out += (char)c;
+  }
+  TEST_ASSERT_EQUAL_STRING(DECODED, out.c_str());
+  TEST_ASSERT_EQUAL(-1, body.read());
+}
+
+static void test_chunked_extensions_trailer_and_hex_case() {
+  WiFiClient client;
+  client.push("1a;name=value\r\nabcdefghijklmnopqrstuvwxyz\r\nA\r\n0123456789\r\n0\r\nX-Checksum: 1\r\n\r\n");
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  TEST_ASSERT_EQUAL_STRING("abcdefghijklmnopqrstuvwxyz0123456789", readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.complete());
+}
+
+static void test_chunked_stops_at_end_of_body() {
+  // The next reply on the keep-alive connection must be left unread
+  WiFiClient client;
+  client.push(std::string(CHUNKED) + "HTTP/1.1 200 OK\r\n");
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  TEST_ASSERT_EQUAL_STRING(DECODED, readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.complete());
+  TEST_ASSERT_EQUAL(17, client.available());
+}
+
+static void test_chunked_cut_off_is_incomplete() {
+  WiFiClient client;
+  client.push("4\r\nWiki\r\n5\r\nped");
+  client.serverClose();
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  TEST_ASSERT_EQUAL_STRING("Wikiped", readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.finished());
+  TEST_ASSERT_FALSE(body.complete());
+}
+
+static void test_chunked_waits_for_more() {
+  WiFiClient client;
+  client.push("4\r\nWi");
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  uint8_t buf[16];
+  TEST_ASSERT_EQUAL(2, body.read(buf, sizeof(buf)));
+  // Nothing more yet, but the connection is open: not finished
+  TEST_ASSERT_EQUAL(0, body.available());
+  TEST_ASSERT_FALSE(body.finished());
+  client.push("ki\r\n0\r\n\r\n");
+  TEST_ASSERT_EQUAL(2, body.read(buf, sizeof(buf)));
+  TEST_ASSERT_TRUE(body.finished());
+  TEST_ASSERT_TRUE(body.complete());
+}
+
+static void test_content_length_stops_exactly() {
+  WiFiClient client;
+  pushSplit(client, "hello worldNEXT", 4);
+  HttpBody body;
+  body.begin(&client, 11, false);
+
+  TEST_ASSERT_EQUAL_STRING("hello world", readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.complete());
+  TEST_ASSERT_EQUAL('N', client.peek());
+}
+
+static void test_content_length_cut_off_is_incomplete() {
+  WiFiClient client;
+  client.push("hello");
+  client.serverClose();
+  HttpBody body;
+  body.begin(&client, 11, false);
+
+  TEST_ASSERT_EQUAL_STRING("hello", readAll(body).c_str());
+  TEST_ASSERT_FALSE(body.complete());
+}
+
+static void test_no_length_ends_at_close() {
+  WiFiClient client;
+  pushSplit(client, "until the server hangs up", 5);
+  client.serverClose();
+  HttpBody body;
+  body.begin(&client, -1, false);
+
+  TEST_ASSERT_EQUAL_STRING("until the server hangs up", readAll(body).c_str());
+  TEST_ASSERT_TRUE(body.complete());
+}
+
+static void test_empty_bodies() {
+  WiFiClient client;
+  client.push("0\r\n\r\n");
+  HttpBody chunked;
+  chunked.begin(&client, -1, true);
+  TEST_ASSERT_EQUAL_STRING("", readAll(chunked).c_str());
+  TEST_ASSERT_TRUE(chunked.complete());
+
+  HttpBody sized;
+  sized.begin(&client, 0, false);
+  TEST_ASSERT_TRUE(sized.finished());
+  TEST_ASSERT_TRUE(sized.complete());
+}
+
+static void test_skip_drains_rest() {
+  WiFiClient client;
+  pushSplit(client, std::string(CHUNKED) + "NEXT", 6);
+  HttpBody body;
+  body.begin(&client, -1, true);
+
+  uint8_t buf[4];
+  TEST_ASSERT_GREATER_THAN(0, body.read(buf, sizeof(buf)));
+  TEST_ASSERT_TRUE(body.skip(100));
+  TEST_ASSERT_EQUAL('N', client.peek());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_chunked_in_one_piece);
+  RUN_TEST(test_chunked_split_anywhere);
+  RUN_TEST(test_chunked_byte_reads);
+  RUN_TEST(test_chunked_extensions_trailer_and_hex_case);
+  RUN_TEST(test_chunked_stops_at_end_of_body);
+  RUN_TEST(test_chunked_cut_off_is_incomplete);
+  RUN_TEST(test_chunked_waits_for_more);
+  RUN_TEST(test_content_length_stops_exactly);
+  RUN_TEST(test_content_length_cut_off_is_incomplete);
+  RUN_TEST(test_no_length_ends_at_close);
+  RUN_TEST(test_empty_bodies);
+  RUN_TEST(test_skip_drains_rest);
+  return UNITY_END();
+}
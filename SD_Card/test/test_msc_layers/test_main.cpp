@@ -0,0 +1,276 @@
+// SectorCache and WriteCombiner against a RAM card that counts what reaches it.
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+#include "sector_cache.h"
+#include "write_combiner.h"
+
+class RamCard : public BlockDevice {
+ public:
+  explicit RamCard(uint32_t sectors) : data(sectors * BLOCK_SIZE) {
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 31 + i / BLOCK_SIZE);
+  }
+
+  uint32_t sectorCount() override { return (uint32_t)(data.size() / BLOCK_SIZE); }
+  bool readSectors(uint32_t sector, uint8_t *dst, size_t count) override {
+    if ((sector + count) * BLOCK_SIZE > data.size()) return false;
+    reads++;
+    sectorsRead += (uint32_t)count;
+    memcpy(dst, &data[sector * BLOCK_SIZE], count * BLOCK_SIZE);
+    return true;
+  }
+  bool writeSectors(uint32_t sector, const uint8_t *src, size_t count) override {
+    if ((sector + count) * BLOCK_SIZE > data.size()) return false;
+    writes++;
+    sectorsWritten += (uint32_t)count;
+    memcpy(&data[sector * BLOCK_SIZE], src, count * BLOCK_SIZE);
+    return true;
+  }
+  bool sync() override { return true; }
+
+  const uint8_t *sector(uint32_t s) const { return &data[s * BLOCK_SIZE]; }
+
+  std::vector<uint8_t> data;
+  uint32_t reads = 0, sectorsRead = 0;
+  uint32_t writes = 0, sectorsWritten = 0;
+};
+
+static std::vector<uint8_t> pattern(size_t sectors, uint8_t seed) {
+  std::vector<uint8_t> v(sectors * BLOCK_SIZE);
+  for (size_t i = 0; i < v.size(); i++) v[i] = (uint8_t)(seed + i * 7);
+  return v;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// --- SectorCache ---
+
+static void test_cache_miss_then_hit() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_THROUGH, 8));
+  uint8_t a[BLOCK_SIZE], b[BLOCK_SIZE];
+
+  TEST_ASSERT_TRUE(cache.readSectors(5, a, 1));
+  TEST_ASSERT_TRUE(cache.readSectors(5, b, 1));
+  TEST_ASSERT_EQUAL_MEMORY(card.sector(5), a, BLOCK_SIZE);
+  TEST_ASSERT_EQUAL_MEMORY(card.sector(5), b, BLOCK_SIZE);
+  SectorCache::Stats st = cache.stats();
+  TEST_ASSERT_EQUAL_UINT32(1, st.misses);
+  TEST_ASSERT_EQUAL_UINT32(1, st.hits);
+  TEST_ASSERT_EQUAL_UINT32(1, card.sectorsRead);
+}
+
+static void test_cache_long_reads_bypass() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_THROUGH, 4));
+  std::vector<uint8_t> buf(16 * BLOCK_SIZE);
+
+  TEST_ASSERT_TRUE(cache.readSectors(10, buf.data(), 16));
+  TEST_ASSERT_EQUAL_MEMORY(card.sector(10), buf.data(), buf.size());
+  TEST_ASSERT_EQUAL_UINT32(16, cache.stats().bypassSectors);
+  // Nothing was cached: the same sector misses
+  TEST_ASSERT_TRUE(cache.readSectors(12, buf.data(), 1));
+  TEST_ASSERT_EQUAL_UINT32(1, cache.stats().misses);
+}
+
+static void test_cache_write_through_reaches_card() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_THROUGH, 8));
+  std::vector<uint8_t> w = pattern(2, 1);
+  uint8_t r[2 * BLOCK_SIZE];
+
+  TEST_ASSERT_TRUE(cache.writeSectors(3, w.data(), 2));
+  TEST_ASSERT_EQUAL_MEMORY(w.data(), card.sector(3), w.size());
+  TEST_ASSERT_EQUAL(0, cache.dirtyCount());
+  uint32_t before = card.sectorsRead;
+  TEST_ASSERT_TRUE(cache.readSectors(3, r, 2));
+  TEST_ASSERT_EQUAL_MEMORY(w.data(), r, w.size());
+  TEST_ASSERT_EQUAL_UINT32(before, card.sectorsRead);
+}
+
+static void test_cache_write_back_stays_coherent() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_BACK, 8));
+  std::vector<uint8_t> old(card.sector(7), card.sector(7) + BLOCK_SIZE);
+  std::vector<uint8_t> w = pattern(1, 9);
+  uint8_t r[BLOCK_SIZE];
+
+  TEST_ASSERT_TRUE(cache.writeSectors(7, w.data(), 1));
+  TEST_ASSERT_EQUAL(1, cache.dirtyCount());
+  TEST_ASSERT_EQUAL_MEMORY(old.data(), card.sector(7), BLOCK_SIZE);
+  TEST_ASSERT_TRUE(cache.readSectors(7, r, 1));
+  TEST_ASSERT_EQUAL_MEMORY(w.data(), r, BLOCK_SIZE);
+
+  TEST_ASSERT_TRUE(cache.sync());
+  TEST_ASSERT_EQUAL(0, cache.dirtyCount());
+  TEST_ASSERT_EQUAL_MEMORY(w.data(), card.sector(7), BLOCK_SIZE);
+  TEST_ASSERT_EQUAL_UINT32(1, cache.stats().writebacks);
+}
+
+static void test_cache_eviction_writes_back() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(4, SectorCache::WRITE_BACK, 8));
+  std::vector<uint8_t> w = pattern(8, 3);
+
+  // Eight scattered sectors through four slots
+  for (uint32_t i = 0; i < 8; i++) TEST_ASSERT_TRUE(cache.writeSectors(i * 5, &w[i * BLOCK_SIZE], 1));
+  TEST_ASSERT_TRUE(cache.stats().evictions >= 4);
+  TEST_ASSERT_TRUE(cache.dirtyCount() <= 4);
+  TEST_ASSERT_TRUE(cache.sync());
+  for (uint32_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_MEMORY(&w[i * BLOCK_SIZE], card.sector(i * 5), BLOCK_SIZE);
+}
+
+static void test_cache_bypassing_write_replaces_cached_sectors() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_BACK, 4));
+  std::vector<uint8_t> small = pattern(1, 50);
+  std::vector<uint8_t> big = pattern(12, 90);
+  uint8_t r[BLOCK_SIZE];
+
+  // Sector 10 cached clean, sector 12 cached dirty, then one long write over both
+  TEST_ASSERT_TRUE(cache.readSectors(10, r, 1));
+  TEST_ASSERT_TRUE(cache.writeSectors(12, small.data(), 1));
+  TEST_ASSERT_TRUE(cache.writeSectors(8, big.data(), 12));
+
+  TEST_ASSERT_TRUE(cache.readSectors(10, r, 1));
+  TEST_ASSERT_EQUAL_MEMORY(&big[2 * BLOCK_SIZE], r, BLOCK_SIZE);
+  TEST_ASSERT_TRUE(cache.readSectors(12, r, 1));
+  TEST_ASSERT_EQUAL_MEMORY(&big[4 * BLOCK_SIZE], r, BLOCK_SIZE);
+  // The stale dirty copy must not be written over the new data later
+  TEST_ASSERT_TRUE(cache.sync());
+  TEST_ASSERT_EQUAL_MEMORY(big.data(), card.sector(8), big.size());
+}
+
+static void test_cache_invalidate_rereads_card() {
+  RamCard card(64);
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_THROUGH, 8));
+  uint8_t r[BLOCK_SIZE];
+
+  TEST_ASSERT_TRUE(cache.readSectors(20, r, 1));
+  // Changed behind the cache's back
+  std::vector<uint8_t> w = pattern(1, 77);
+  memcpy(&card.data[20 * BLOCK_SIZE], w.data(), BLOCK_SIZE);
+  TEST_ASSERT_TRUE(cache.invalidate());
+  TEST_ASSERT_TRUE(cache.readSectors(20, r, 1));
+  TEST_ASSERT_EQUAL_MEMORY(w.data(), r, BLOCK_SIZE);
+}
+
+// --- WriteCombiner ---
+
+static void test_combiner_partial_sector_read_modify_write() {
+  RamCard card(64);
+  std::vector<uint8_t> before = card.data;
+  WriteCombiner wc(card);
+  TEST_ASSERT_TRUE(wc.begin(16, 250));
+  uint8_t piece[50];
+  memset(piece, 0xAB, sizeof(piece));
+
+  TEST_ASSERT_TRUE(wc.write(2, 100, piece, sizeof(piece)));
+  TEST_ASSERT_EQUAL_UINT32(0, card.writes);
+  // Reads see the pending bytes over the card's
+  uint8_t r[BLOCK_SIZE];
+  TEST_ASSERT_TRUE(wc.readSectors(2, r, 1));
+  TEST_ASSERT_EQUAL_MEMORY(&before[2 * BLOCK_SIZE], r, 100);
+  TEST_ASSERT_EQUAL_MEMORY(piece, r + 100, sizeof(piece));
+  TEST_ASSERT_EQUAL_MEMORY(&before[2 * BLOCK_SIZE + 150], r + 150, BLOCK_SIZE - 150);
+
+  TEST_ASSERT_TRUE(wc.flush());
+  TEST_ASSERT_EQUAL_UINT32(1, card.writes);
+  TEST_ASSERT_EQUAL_UINT32(1, wc.stats().rmwSectors);
+  std::vector<uint8_t> expect = before;
+  memcpy(&expect[2 * BLOCK_SIZE + 100], piece, sizeof(piece));
+  TEST_ASSERT_EQUAL_MEMORY(expect.data(), card.data.data(), expect.size());
+}
+
+static void test_combiner_merges_unaligned_pieces() {
+  RamCard card(64);
+  std::vector<uint8_t> before = card.data;
+  WriteCombiner wc(card);
+  TEST_ASSERT_TRUE(wc.begin(16, 250));
+  std::vector<uint8_t> w = pattern(6, 5);
+
+  // 3000 bytes from byte 10 of sector 4, in three pieces that continue each other
+  const uint32_t start = 4 * BLOCK_SIZE + 10;
+  const uint32_t len[3] = {1000, 1500, 500};
+  uint32_t at = 0;
+  for (uint32_t n : len) {
+    TEST_ASSERT_TRUE(wc.write((start + at) / BLOCK_SIZE, (start + at) % BLOCK_SIZE, &w[at], n));
+    at += n;
+  }
+  TEST_ASSERT_TRUE(wc.sync());
+
+  WriteCombiner::Stats st = wc.stats();
+  TEST_ASSERT_EQUAL_UINT32(3, st.hostWrites);
+  TEST_ASSERT_EQUAL_UINT32(2, st.mergedWrites);
+  TEST_ASSERT_EQUAL_UINT32(1, st.flushes);
+  // Head and tail sectors read once each, not once per piece
+  TEST_ASSERT_EQUAL_UINT32(2, st.rmwSectors);
+  TEST_ASSERT_EQUAL_UINT32(1, card.writes);
+  std::vector<uint8_t> expect = before;
+  memcpy(&expect[start], w.data(), at);
+  TEST_ASSERT_EQUAL_MEMORY(expect.data(), card.data.data(), expect.size());
+}
+
+static void test_combiner_write_elsewhere_flushes_pending() {
+  RamCard card(64);
+  WriteCombiner wc(card);
+  TEST_ASSERT_TRUE(wc.begin(16, 250));
+  std::vector<uint8_t> a = pattern(1, 11), b = pattern(1, 22);
+
+  TEST_ASSERT_TRUE(wc.write(1, 0, a.data(), BLOCK_SIZE));
+  TEST_ASSERT_TRUE(wc.write(40, 0, b.data(), BLOCK_SIZE));
+  TEST_ASSERT_EQUAL_UINT32(1, card.writes);
+  TEST_ASSERT_EQUAL_MEMORY(a.data(), card.sector(1), BLOCK_SIZE);
+  TEST_ASSERT_TRUE(wc.pending());
+  TEST_ASSERT_TRUE(wc.sync());
+  TEST_ASSERT_EQUAL_MEMORY(b.data(), card.sector(40), BLOCK_SIZE);
+  TEST_ASSERT_EQUAL_UINT32(0, wc.stats().rmwSectors);
+}
+
+static void test_combiner_over_write_back_cache() {
+  // The firmware's stack: combiner, then a write-back cache, then the card
+  RamCard card(64);
+  std::vector<uint8_t> before = card.data;
+  SectorCache cache(card);
+  TEST_ASSERT_TRUE(cache.begin(16, SectorCache::WRITE_BACK, 8));
+  WriteCombiner wc(cache);
+  TEST_ASSERT_TRUE(wc.begin(16, 250));
+  uint8_t piece[20];
+  memset(piece, 0x5A, sizeof(piece));
+
+  TEST_ASSERT_TRUE(wc.write(6, 500, piece, sizeof(piece)));  // straddles sectors 6 and 7
+  TEST_ASSERT_TRUE(wc.flush());
+  uint8_t r[2 * BLOCK_SIZE];
+  TEST_ASSERT_TRUE(wc.readSectors(6, r, 2));
+  TEST_ASSERT_EQUAL_MEMORY(piece, r + 500, sizeof(piece));
+  TEST_ASSERT_TRUE(wc.sync());
+  TEST_ASSERT_TRUE(cache.sync());
+  std::vector<uint8_t> expect = before;
+  memcpy(&expect[6 * BLOCK_SIZE + 500], piece, sizeof(piece));
+  TEST_ASSERT_EQUAL_MEMORY(expect.data(), card.data.data(), expect.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_cache_miss_then_hit);
+  RUN_TEST(test_cache_long_reads_bypass);
+  RUN_TEST(test_cache_write_through_reaches_card);
+  RUN_TEST(test_cache_write_back_stays_coherent);
+  RUN_TEST(test_cache_eviction_writes_back);
+  RUN_TEST(test_cache_bypassing_write_replaces_cached_sectors);
+  RUN_TEST(test_cache_invalidate_rereads_card);
+  RUN_TEST(test_combiner_partial_sector_read_modify_write);
+  RUN_TEST(test_combiner_merges_unaligned_pieces);
+  RUN_TEST(test_combiner_write_elsewhere_flushes_pending);
+  RUN_TEST(test_combiner_over_write_back_cache);
+  return UNITY_END();
+}
@@ -0,0 +1,228 @@
+// SyncPlanner decisions against a scratch directory playing the card (the
+// SdFat stand-in), a hand-made SyncState and the FileIndex built from it.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+#include "SdFat.h"
+#include "download_resume.h"
+#include "file_index.h"
+#include "sync_plan.h"
+
+// The planner never touches raw sectors
+class NoCard : public BlockDevice {
+ public:
+  uint32_t sectorCount() override { return 1 << 16; }
+  bool readSectors(uint32_t, uint8_t *, size_t) override { return false; }
+  bool writeSectors(uint32_t, const uint8_t *, size_t) override { return false; }
+  bool sync() override { return true; }
+};
+
+static NoCard g_card;
+static SdFat sd;
+static std::string g_root;
+
+static void putFile(const char *path, size_t size) {
+  sd.mkdir(std::string(path).substr(0, std::string(path).rfind('/')).c_str());
+  File32 f = sd.open(path, O_RDWR | O_CREAT | O_TRUNC);
+  TEST_ASSERT_TRUE(f.isOpen());
+  std::string data(size, 'x');
+  TEST_ASSERT_EQUAL(size, f.write(data.data(), data.size()));
+  f.close();
+}
+
+static ManifestItem item(const char *path, uint32_t size, const char *hash, bool bundle = false) {
+  ManifestItem m;
+  m.path = path;
+  m.size = size;
+  m.hash = hash;
+  m.bundle = bundle;
+  return m;
+}
+
+static SyncState::Entry installed(const char *path, uint32_t size, const char *hash, const char *origin = nullptr) {
+  return SyncState::Entry{path, size, hash, origin ? origin : path};
+}
+
+struct Planned {
+  std::map<std::string, SyncAction::Kind> kinds;  // by path, KEEP not listed
+  std::vector<SyncAction::Kind> order;
+  uint32_t counts[SyncAction::KIND_COUNT];
+  uint64_t downloadBytes;
+  uint32_t unknownSize;
+  uint32_t duplicates;
+};
+
+// Plan `manifest` against `state` and the card as it is now
+static Planned plan(const SyncState &state, const std::vector<ManifestItem> &manifest, bool trashUntracked) {
+  FileIndex index(sd);
+  TEST_ASSERT_TRUE(index.begin());
+  TEST_ASSERT_TRUE(index.check("/"));
+
+  SyncPlanner planner(sd, state, index, trashUntracked);
+  TEST_ASSERT_TRUE(planner.begin());
+  for (const ManifestItem &m : manifest) planner.add(m);
+  SyncPlan p = planner.finish();
+  TEST_ASSERT_TRUE(p.ok());
+
+  Planned out;
+  memcpy(out.counts, p.counts, sizeof(out.counts));
+  out.downloadBytes = p.downloadBytes;
+  out.unknownSize = p.unknownSize;
+  out.duplicates = p.duplicates;
+  for (size_t i = 0; i < p.size(); i++) {
+    SyncAction a;
+    TEST_ASSERT_TRUE(p.get(i, &a));
+    TEST_ASSERT_EQUAL(p.kind(i), a.kind);
+    TEST_ASSERT_EQUAL(0, out.kinds.count(a.item.path));
+    out.kinds[a.item.path] = a.kind;
+    out.order.push_back(a.kind);
+  }
+  p.close();
+  sd.remove(p.spoolPath());
+  return out;
+}
+
+static bool planned(const Planned &p, const char *path, SyncAction::Kind kind) {
+  auto it = p.kinds.find(path);
+  return it != p.kinds.end() && it->second == kind;
+}
+
+void setUp() {
+  char dir[] = "/tmp/sync_plan_XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  g_root = dir;
+  TEST_ASSERT_TRUE(sd.begin(g_root.c_str(), &g_card));
+}
+
+void tearDown() {
+  std::error_code ec;
+  std::filesystem::remove_all(g_root, ec);
+}
+
+static void test_add_update_delete_keep() {
+  putFile("/music/keep.mp3", 100);
+  putFile("/music/changed.mp3", 200);
+  putFile("/music/gone.mp3", 50);
+  SyncState state(sd);
+  state.set(installed("/music/keep.mp3", 100, "k1"));
+  state.set(installed("/music/changed.mp3", 200, "c1"));
+  state.set(installed("/music/gone.mp3", 50, "g1"));
+  state.set(installed("/music/lost.mp3", 10, "l1"));  // installed, since deleted by hand
+
+  Planned p = plan(state,
+                   {item("/music/keep.mp3", 100, "k1"), item("/music/changed.mp3", 200, "c2"),
+                    item("/music/lost.mp3", 10, "l1"), item("/music/new.mp3", 30, "n1")},
+                   false);
+
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::KEEP]);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::ADD]);
+  TEST_ASSERT_EQUAL_UINT32(2, p.counts[SyncAction::UPDATE]);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::DELETE]);
+  TEST_ASSERT_EQUAL(4, p.kinds.size());
+  TEST_ASSERT_TRUE(planned(p, "/music/new.mp3", SyncAction::ADD));
+  TEST_ASSERT_TRUE(planned(p, "/music/changed.mp3", SyncAction::UPDATE));
+  TEST_ASSERT_TRUE(planned(p, "/music/lost.mp3", SyncAction::UPDATE));
+  TEST_ASSERT_TRUE(planned(p, "/music/gone.mp3", SyncAction::DELETE));
+  TEST_ASSERT_EQUAL_UINT64(30 + 200 + 10, p.downloadBytes);
+  // Deletions go first
+  TEST_ASSERT_EQUAL(SyncAction::DELETE, p.order[0]);
+}
+
+static void test_size_change_is_update() {
+  putFile("/a.mp3", 100);
+  SyncState state(sd);
+  state.set(installed("/a.mp3", 100, "h"));
+
+  Planned p = plan(state, {item("/a.mp3", 120, "h")}, false);
+  TEST_ASSERT_TRUE(planned(p, "/a.mp3", SyncAction::UPDATE));
+}
+
+static void test_adopt_untracked_file_of_right_size() {
+  putFile("/right.mp3", 64);
+  putFile("/wrong.mp3", 65);
+  SyncState state(sd);
+
+  Planned p = plan(state, {item("/right.mp3", 64, "r"), item("/wrong.mp3", 64, "w")}, false);
+  TEST_ASSERT_TRUE(planned(p, "/right.mp3", SyncAction::ADOPT));
+  TEST_ASSERT_TRUE(planned(p, "/wrong.mp3", SyncAction::ADD));
+  TEST_ASSERT_EQUAL_UINT64(64, p.downloadBytes);
+}
+
+static void test_bundles_keep_their_members() {
+  putFile("/album/1.mp3", 10);
+  putFile("/album/2.mp3", 10);
+  putFile("/old/x.mp3", 10);
+  SyncState state(sd);
+  state.set(installed("/album.zip", 0, "z1"));
+  state.set(installed("/album/1.mp3", 10, "", "/album.zip"));
+  state.set(installed("/album/2.mp3", 10, "", "/album.zip"));
+  state.set(installed("/old.zip", 0, "o1"));
+  state.set(installed("/old/x.mp3", 10, "", "/old.zip"));
+
+  // Same bundle: everything it installed stays; a dropped bundle takes its files along
+  Planned p = plan(state, {item("/album.zip", 0, "z1", true)}, true);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::KEEP]);
+  TEST_ASSERT_EQUAL_UINT32(2, p.counts[SyncAction::DELETE]);
+  TEST_ASSERT_TRUE(planned(p, "/old.zip", SyncAction::DELETE));
+  TEST_ASSERT_TRUE(planned(p, "/old/x.mp3", SyncAction::DELETE));
+  TEST_ASSERT_EQUAL(0, p.kinds.count("/album/1.mp3"));
+
+  // New bundle version
+  p = plan(state, {item("/album.zip", 0, "z2", true), item("/old.zip", 0, "o1", true)}, false);
+  TEST_ASSERT_TRUE(planned(p, "/album.zip", SyncAction::UPDATE));
+  TEST_ASSERT_EQUAL_UINT32(0, p.counts[SyncAction::DELETE]);
+  TEST_ASSERT_EQUAL_UINT32(1, p.unknownSize);
+}
+
+static void test_duplicate_paths_later_item_wins() {
+  putFile("/keep.mp3", 100);
+  SyncState state(sd);
+  state.set(installed("/keep.mp3", 100, "k1"));
+
+  Planned p = plan(state,
+                   {item("/new.mp3", 10, "a"), item("/keep.mp3", 100, "k1"), item("/new.mp3", 20, "b"),
+                    item("/keep.mp3", 100, "k2"), item("/new.mp3", 30, "c")},
+                   false);
+  TEST_ASSERT_EQUAL_UINT32(3, p.duplicates);
+  TEST_ASSERT_EQUAL_UINT32(0, p.counts[SyncAction::KEEP]);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::ADD]);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::UPDATE]);
+  TEST_ASSERT_EQUAL(2, p.kinds.size());
+  TEST_ASSERT_TRUE(planned(p, "/new.mp3", SyncAction::ADD));
+  TEST_ASSERT_TRUE(planned(p, "/keep.mp3", SyncAction::UPDATE));
+  TEST_ASSERT_EQUAL_UINT64(30 + 100, p.downloadBytes);
+}
+
+static void test_untracked_files_trashed_only_when_asked() {
+  putFile("/stray.mp3", 5);
+  putFile("/.sync_state", 5);
+  putFile("/System Volume Information/IndexerVolumeGuid", 5);
+  putFile("/incoming.mp3.tmp", 5);  // partial download of an item still to fetch
+  std::string sidecar = ResumeSidecar::pathFor(std::string("/incoming.mp3") + DOWNLOAD_TMP_SUFFIX);
+  putFile(sidecar.c_str(), 5);
+  SyncState state(sd);
+
+  Planned p = plan(state, {item("/incoming.mp3", 50, "i")}, false);
+  TEST_ASSERT_EQUAL_UINT32(0, p.counts[SyncAction::DELETE]);
+
+  p = plan(state, {item("/incoming.mp3", 50, "i")}, true);
+  TEST_ASSERT_EQUAL_UINT32(1, p.counts[SyncAction::DELETE]);
+  TEST_ASSERT_TRUE(planned(p, "/stray.mp3", SyncAction::DELETE));
+  TEST_ASSERT_TRUE(planned(p, "/incoming.mp3", SyncAction::ADD));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_add_update_delete_keep);
+  RUN_TEST(test_size_change_is_update);
+  RUN_TEST(test_adopt_untracked_file_of_right_size);
+  RUN_TEST(test_bundles_keep_their_members);
+  RUN_TEST(test_duplicate_paths_later_item_wins);
+  RUN_TEST(test_untracked_files_trashed_only_when_asked);
+  return UNITY_END();
+}
@@ -0,0 +1,357 @@
+// Host tool for .sdb bundles (layout in include/bundle_format.h).
+//
+//   sdbundle pack <dir> <out.sdb> [--align N] [--no-sha]
+//   sdbundle unpack <in.sdb> <dir>
+//   sdbundle list <in.sdb>
+//
+// pack stores every file and directory under <dir>, paths relative to it,
+// payloads aligned to N bytes (default 32768, the cluster size of a
+// typical FAT32/exFAT SD card; 512 is the minimum). Upload the .sdb next to
+// the music and list it in the manifest like a zip bundle.
+//
+// Build (no dependencies besides a C++17 compiler):
+//   g++ -std=c++17 -O2 -Iinclude -o sdbundle tools/sdbundle.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "bundle_format.h"
+
+namespace fs = std::filesystem;
+
+// --- CRC32 (zip polynomial) ---
+
+static uint32_t crcTable[256];
+
+static void crcInit() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crcTable[i] = c;
+  }
+}
+
+static uint32_t crcUpdate(uint32_t crc, const uint8_t *p, size_t n) {
+  crc = ~crc;
+  while (n--) crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+// --- SHA-256 (FIPS 180-4) ---
+
+struct Sha256 {
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  uint64_t total = 0;
+  uint8_t block[64];
+  size_t used = 0;
+
+  static uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void compress(const uint8_t *p) {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+      uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+  }
+
+  void update(const uint8_t *p, size_t n) {
+    total += n;
+    while (n > 0) {
+      size_t c = std::min(n, 64 - used);
+      memcpy(block + used, p, c);
+      used += c;
+      p += c;
+      n -= c;
+      if (used == 64) {
+        compress(block);
+        used = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t out[32]) {
+    uint64_t bits = total * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used != 56) update(&pad, 1);
+    uint8_t len[8];
+    for (int i = 0; i < 8; i++) len[i] = (uint8_t)(bits >> (56 - 8 * i));
+    update(len, 8);
+    for (int i = 0; i < 8; i++) {
+      out[4 * i] = (uint8_t)(h[i] >> 24);
+      out[4 * i + 1] = (uint8_t)(h[i] >> 16);
+      out[4 * i + 2] = (uint8_t)(h[i] >> 8);
+      out[4 * i + 3] = (uint8_t)h[i];
+    }
+  }
+};
+
+static std::string hex(const uint8_t *p, size_t n) {
+  static const char *digits = "0123456789abcdef";
+  std::string s;
+  for (size_t i = 0; i < n; i++) {
+    s += digits[p[i] >> 4];
+    s += digits[p[i] & 15];
+  }
+  return s;
+}
+
+static const size_t IO_CHUNK = 1 << 20;
+
+// --- pack ---
+
+static bool hashFile(const fs::path &p, bool sha, SdbRecord *r) {
+  std::ifstream in(p, std::ios::binary);
+  if (!in) return false;
+  std::vector<uint8_t> buf(IO_CHUNK);
+  Sha256 s;
+  uint32_t crc = 0;
+  uint64_t size = 0;
+  while (in) {
+    in.read((char *)buf.data(), buf.size());
+    size_t n = (size_t)in.gcount();
+    crc = crcUpdate(crc, buf.data(), n);
+    if (sha) s.update(buf.data(), n);
+    size += n;
+  }
+  r->size = size;
+  r->crc32 = crc;
+  if (sha) s.finish(r->sha256);
+  return true;
+}
+
+static int pack(const fs::path &dir, const fs::path &out, uint32_t align, bool sha) {
+  // Sorted, so directories come before what they contain
+  std::vector<fs::path> paths;
+  for (const fs::directory_entry &e : fs::recursive_directory_iterator(dir)) {
+    if (e.is_directory() || e.is_regular_file()) paths.push_back(e.path());
+  }
+  std::sort(paths.begin(), paths.end());
+
+  std::vector<SdbRecord> recs;
+  for (const fs::path &p : paths) {
+    SdbRecord r = {};
+    std::string rel = fs::relative(p, dir).generic_string();
+    if (rel.size() >= SDB_PATH_MAX) {
+      fprintf(stderr, "path too long (max %zu): %s\n", SDB_PATH_MAX - 1, rel.c_str());
+      return 1;
+    }
+    memcpy(r.path, rel.c_str(), rel.size());
+    if (fs::is_directory(p)) {
+      r.flags = SDB_FLAG_DIR;
+    } else {
+      if (!hashFile(p, sha, &r)) {
+        fprintf(stderr, "cannot read %s\n", p.string().c_str());
+        return 1;
+      }
+      if (sha) r.flags |= SDB_FLAG_SHA256;
+    }
+    recs.push_back(r);
+  }
+
+  SdbHeader h = {};
+  h.version = SDB_VERSION;
+  h.align = align;
+  h.count = (uint32_t)recs.size();
+  h.dataStart = sdbAlignUp(SDB_HEADER_SIZE + (uint64_t)recs.size() * SDB_RECORD_SIZE, align);
+  uint64_t at = h.dataStart;
+  for (SdbRecord &r : recs) {
+    if (r.flags & SDB_FLAG_DIR) continue;
+    r.offset = at;
+    at = sdbAlignUp(at + r.size, align);
+  }
+  h.totalSize = at;
+
+  std::vector<uint8_t> toc(recs.size() * SDB_RECORD_SIZE);
+  for (size_t i = 0; i < recs.size(); i++) sdbEncodeRecord(recs[i], toc.data() + i * SDB_RECORD_SIZE);
+  h.tocCrc = crcUpdate(0, toc.data(), toc.size());
+  uint8_t head[SDB_HEADER_SIZE];
+  sdbEncodeHeader(h, head);
+
+  std::ofstream o(out, std::ios::binary | std::ios::trunc);
+  if (!o) {
+    fprintf(stderr, "cannot create %s\n", out.string().c_str());
+    return 1;
+  }
+  o.write((const char *)head, sizeof(head));
+  o.write((const char *)toc.data(), toc.size());
+  uint64_t pos = SDB_HEADER_SIZE + toc.size();
+  std::vector<uint8_t> buf(IO_CHUNK);
+  std::vector<char> zeros(align, 0);
+  for (size_t i = 0; i < recs.size(); i++) {
+    const SdbRecord &r = recs[i];
+    if (r.flags & SDB_FLAG_DIR) continue;
+    o.write(zeros.data(), (std::streamsize)(r.offset - pos));
+    std::ifstream in(paths[i], std::ios::binary);
+    uint64_t copied = 0;
+    while (in) {
+      in.read((char *)buf.data(), buf.size());
+      o.write((const char *)buf.data(), in.gcount());
+      copied += (uint64_t)in.gcount();
+    }
+    if (copied != r.size) {
+      fprintf(stderr, "%s changed while packing\n", paths[i].string().c_str());
+      return 1;
+    }
+    pos = r.offset + r.size;
+  }
+  o.write(zeros.data(), (std::streamsize)(h.totalSize - pos));
+  if (!o) {
+    fprintf(stderr, "write failed: %s\n", out.string().c_str());
+    return 1;
+  }
+  printf("%s: %u entries, %.2f MB, payloads aligned to %u\n", out.string().c_str(), (unsigned)h.count,
+         h.totalSize / (1024.0 * 1024.0), (unsigned)align);
+  return 0;
+}
+
+// --- list / unpack ---
+
+static bool readToc(std::ifstream &in, SdbHeader *h, std::vector<SdbRecord> *recs) {
+  uint8_t head[SDB_HEADER_SIZE];
+  if (!in.read((char *)head, sizeof(head)) || !sdbDecodeHeader(head, h)) {
+    fprintf(stderr, "not an .sdb bundle\n");
+    return false;
+  }
+  std::vector<uint8_t> toc((size_t)h->count * SDB_RECORD_SIZE);
+  if (!in.read((char *)toc.data(), toc.size())) {
+    fprintf(stderr, "truncated TOC\n");
+    return false;
+  }
+  if (crcUpdate(0, toc.data(), toc.size()) != h->tocCrc) {
+    fprintf(stderr, "TOC CRC mismatch\n");
+    return false;
+  }
+  recs->resize(h->count);
+  for (size_t i = 0; i < h->count; i++) sdbDecodeRecord(toc.data() + i * SDB_RECORD_SIZE, &(*recs)[i]);
+  return true;
+}
+
+static int list(const fs::path &file) {
+  std::ifstream in(file, std::ios::binary);
+  SdbHeader h;
+  std::vector<SdbRecord> recs;
+  if (!in || !readToc(in, &h, &recs)) return 1;
+  printf("%u entries, %llu bytes, align %u, data at %llu\n", (unsigned)h.count, (unsigned long long)h.totalSize,
+         (unsigned)h.align, (unsigned long long)h.dataStart);
+  for (const SdbRecord &r : recs) {
+    if (r.flags & SDB_FLAG_DIR) {
+      printf("%12s  %-8s  %s/\n", "dir", "", r.path);
+      continue;
+    }
+    printf("%12llu  %08x  %s  @%llu%s%s\n", (unsigned long long)r.size, (unsigned)r.crc32, r.path,
+           (unsigned long long)r.offset, (r.flags & SDB_FLAG_SHA256) ? "  sha256:" : "",
+           (r.flags & SDB_FLAG_SHA256) ? hex(r.sha256, 32).c_str() : "");
+  }
+  return 0;
+}
+
+// Nothing may land outside the destination
+static bool safePath(const std::string &rel) {
+  if (rel.empty() || rel[0] == '/' || rel[0] == '\\') return false;
+  for (const fs::path &part : fs::path(rel)) {
+    if (part == "..") return false;
+  }
+  return true;
+}
+
+static int unpack(const fs::path &file, const fs::path &dir) {
+  std::ifstream in(file, std::ios::binary);
+  SdbHeader h;
+  std::vector<SdbRecord> recs;
+  if (!in || !readToc(in, &h, &recs)) return 1;
+
+  std::vector<uint8_t> buf(IO_CHUNK);
+  int bad = 0;
+  for (const SdbRecord &r : recs) {
+    std::string rel = r.path;
+    if (!safePath(rel)) {
+      fprintf(stderr, "skipping unsafe path %s\n", r.path);
+      continue;
+    }
+    fs::path dest = dir / fs::path(rel);
+    if (r.flags & SDB_FLAG_DIR) {
+      fs::create_directories(dest);
+      continue;
+    }
+    fs::create_directories(dest.parent_path());
+    std::ofstream o(dest, std::ios::binary | std::ios::trunc);
+    in.seekg((std::streamoff)r.offset);
+    uint64_t left = r.size;
+    uint32_t crc = 0;
+    Sha256 s;
+    while (left > 0 && in) {
+      size_t n = (size_t)std::min<uint64_t>(left, buf.size());
+      in.read((char *)buf.data(), n);
+      n = (size_t)in.gcount();
+      crc = crcUpdate(crc, buf.data(), n);
+      s.update(buf.data(), n);
+      o.write((const char *)buf.data(), n);
+      left -= n;
+    }
+    uint8_t digest[32];
+    s.finish(digest);
+    bool ok = left == 0 && o && crc == r.crc32 &&
+              (!(r.flags & SDB_FLAG_SHA256) || memcmp(digest, r.sha256, 32) == 0);
+    printf("%s %s\n", ok ? "OK    " : "FAILED", rel.c_str());
+    if (!ok) bad++;
+  }
+  return bad ? 1 : 0;
+}
+
+static int usage() {
+  fprintf(stderr,
+          "usage: sdbundle pack <dir> <out.sdb> [--align N] [--no-sha]\n"
+          "       sdbundle unpack <in.sdb> <dir>\n"
+          "       sdbundle list <in.sdb>\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  crcInit();
+  if (argc < 3) return usage();
+  std::string cmd = argv[1];
+  if (cmd == "list") return list(argv[2]);
+  if (cmd == "unpack" && argc == 4) return unpack(argv[2], argv[3]);
+  if (cmd == "pack" && argc >= 4) {
+    uint32_t align = 32768;
+    bool sha = true;
+    for (int i = 4; i < argc; i++) {
+      if (!strcmp(argv[i], "--align") && i + 1 < argc) align = (uint32_t)strtoul(argv[++i], nullptr, 0);
+      else if (!strcmp(argv[i], "--no-sha")) sha = false;
+      else return usage();
+    }
+    if (align < SDB_MIN_ALIGN || (align & (align - 1))) {
+      fprintf(stderr, "--align must be a power of two >= %u\n", (unsigned)SDB_MIN_ALIGN);
+      return 2;
+    }
+    return pack(argv[2], argv[3], align, sha);
+  }
+  return usage();
+}